@@ -26,6 +26,7 @@
 #include <keymaster/key.h>
 #include <keymaster/key_blob_utils/ae.h>
 #include <keymaster/key_factory.h>
+#include <keymaster/key_handle_table.h>
 #include <keymaster/keymaster_context.h>
 #include <keymaster/km_openssl/openssl_err.h>
 #include <keymaster/operation.h>
@@ -58,15 +59,66 @@ keymaster_error_t CheckVersionInfo(const AuthorizationSet& tee_enforced,
     return KM_ERROR_OK;
 }
 
+struct BatchVerifyTasks {
+    const VerificationJob* jobs;
+    OperationPtr* operations;
+    keymaster_error_t* results;
+};
+
+void FinishVerification(void* task_context, size_t index) {
+    BatchVerifyTasks* tasks = reinterpret_cast<BatchVerifyTasks*>(task_context);
+    Operation* operation = tasks->operations[index].get();
+    if (!operation)
+        return;  // BeginVerification failed and its error is already in results.
+
+    const VerificationJob& job = tasks->jobs[index];
+    AuthorizationSet output_params;
+    Buffer output;
+    tasks->results[index] = operation->Finish(job.additional_params, job.message, job.signature,
+                                              &output_params, &output);
+}
+
+struct MigrateKeyBlobsTasks {
+    const KeymasterContext* context;
+    const KeyBlobMigrationJob* jobs;
+    KeyBlobResult* results;
+};
+
+void MigrateKeyBlob(void* task_context, size_t index) {
+    MigrateKeyBlobsTasks* tasks = reinterpret_cast<MigrateKeyBlobsTasks*>(task_context);
+    const KeyBlobMigrationJob& job = tasks->jobs[index];
+    KeyBlobResult* result = &tasks->results[index];
+    result->error =
+        tasks->context->MigrateKeyBlob(job.key_blob, job.additional_params, &result->key_blob);
+}
+
+struct BatchUpgradeKeyTasks {
+    const KeymasterContext* context;
+    const BatchUpgradeKeyRequest* request;
+    KeyBlobResult* results;
+};
+
+void UpgradeKeyBlob(void* task_context, size_t index) {
+    BatchUpgradeKeyTasks* tasks = reinterpret_cast<BatchUpgradeKeyTasks*>(task_context);
+    KeyBlobResult* result = &tasks->results[index];
+    result->error = tasks->context->UpgradeKeyBlob(tasks->request->key_blobs[index],
+                                                   tasks->request->upgrade_params,
+                                                   &result->key_blob);
+}
+
 }  // anonymous namespace
 
-AndroidKeymaster::AndroidKeymaster(KeymasterContext* context, size_t operation_table_size)
-    : context_(context), operation_table_(new(std::nothrow) OperationTable(operation_table_size)) {}
+AndroidKeymaster::AndroidKeymaster(KeymasterContext* context, size_t operation_table_size,
+                                   size_t key_handle_table_size)
+    : context_(context), operation_table_(new(std::nothrow) OperationTable(operation_table_size)),
+      key_handle_table_(new (std::nothrow) KeyHandleTable(key_handle_table_size)) {}
 
 AndroidKeymaster::~AndroidKeymaster() {}
 
 AndroidKeymaster::AndroidKeymaster(AndroidKeymaster&& other)
-    : context_(move(other.context_)), operation_table_(move(other.operation_table_)) {}
+    : context_(move(other.context_)), operation_table_(move(other.operation_table_)),
+      key_handle_table_(move(other.key_handle_table_)),
+      capabilities_(move(other.capabilities_)) {}
 
 // TODO(swillden): Unify support analysis.  Right now, we have per-keytype methods that determine if
 // specific modes, padding, etc. are supported for that key type, and AndroidKeymaster also has
@@ -130,10 +182,38 @@ void GetSupported(const KeymasterContext& context, keymaster_algorithm_t algorit
     response->SetResults(supported, count);
 }
 
+namespace {
+
+/**
+ * Block modes this library offers beyond the ones the keymaster HAL defines, like
+ * KM_MODE_CHACHA20_POLY1305, can only be requested by callers that know about them.  They're never
+ * reported over the HAL.
+ */
+bool IsHalBlockMode(keymaster_block_mode_t block_mode) {
+    switch (block_mode) {
+    case KM_MODE_ECB:
+    case KM_MODE_CBC:
+    case KM_MODE_CTR:
+    case KM_MODE_GCM:
+        return true;
+    }
+    return false;
+}
+
+}  // anonymous namespace
+
 void AndroidKeymaster::SupportedBlockModes(const SupportedBlockModesRequest& request,
                                            SupportedBlockModesResponse* response) {
     GetSupported(*context_, request.algorithm, request.purpose,
                  &OperationFactory::SupportedBlockModes, response);
+    if (response == nullptr || response->error != KM_ERROR_OK)
+        return;
+
+    size_t hal_count = 0;
+    for (size_t i = 0; i < response->results_length; ++i)
+        if (IsHalBlockMode(response->results[i]))
+            response->results[hal_count++] = response->results[i];
+    response->results_length = hal_count;
 }
 
 void AndroidKeymaster::SupportedPaddingModes(const SupportedPaddingModesRequest& request,
@@ -170,6 +250,155 @@ void AndroidKeymaster::SupportedExportFormats(const SupportedExportFormatsReques
     response->SetResults(formats, count);
 }
 
+namespace {
+
+// Every algorithm a context might have a key factory for, whether or not it lists it in
+// GetSupportedAlgorithms.
+const keymaster_algorithm_t kAllAlgorithms[] = {KM_ALGORITHM_RSA, KM_ALGORITHM_EC, KM_ALGORITHM_AES,
+                                                KM_ALGORITHM_TRIPLE_DES, KM_ALGORITHM_HMAC};
+
+// Every purpose the HAL defines.  KM_PURPOSE_AGREE_KEY is this implementation's own and stays out
+// of the matrix, as non-HAL block modes do.
+const keymaster_purpose_t kAllPurposes[] = {
+    KM_PURPOSE_ENCRYPT, KM_PURPOSE_DECRYPT,    KM_PURPOSE_SIGN,
+    KM_PURPOSE_VERIFY,  KM_PURPOSE_DERIVE_KEY, KM_PURPOSE_WRAP,
+};
+
+/**
+ * Lays out a capability matrix as KeymasterCapabilities describes.  With no output array it just
+ * counts, so the matrix can be sized in one pass and written in a second.
+ */
+class CapabilityWriter {
+  public:
+    explicit CapabilityWriter(uint32_t* values) : values_(values), length_(0) {}
+
+    void Append(uint32_t value) {
+        if (values_)
+            values_[length_] = value;
+        ++length_;
+    }
+
+    template <typename T> void AppendList(const T* list, size_t count) {
+        Append(count);
+        for (size_t i = 0; i < count; ++i)
+            Append(list[i]);
+    }
+
+    // Like AppendList, but leaves out the block modes IsHalBlockMode() rejects.
+    void AppendHalBlockModes(const keymaster_block_mode_t* block_modes, size_t count) {
+        size_t count_index = AppendCount();
+        uint32_t hal_count = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (IsHalBlockMode(block_modes[i])) {
+                Append(block_modes[i]);
+                ++hal_count;
+            }
+        }
+        SetCount(count_index, hal_count);
+    }
+
+    // Appends a count to be filled in by SetCount once it's known.
+    size_t AppendCount() {
+        Append(0);
+        return length_ - 1;
+    }
+
+    void SetCount(size_t index, uint32_t count) {
+        if (values_)
+            values_[index] = count;
+    }
+
+    size_t length() const { return length_; }
+
+  private:
+    uint32_t* values_;
+    size_t length_;
+};
+
+bool WriteAlgorithmCapabilities(const KeymasterContext& context, keymaster_algorithm_t algorithm,
+                                CapabilityWriter* writer) {
+    const KeyFactory* key_factory = context.GetKeyFactory(algorithm);
+    if (!key_factory)
+        return false;
+
+    writer->Append(algorithm);
+    size_t count;
+    const keymaster_key_format_t* formats = key_factory->SupportedImportFormats(&count);
+    writer->AppendList(formats, count);
+    formats = key_factory->SupportedExportFormats(&count);
+    writer->AppendList(formats, count);
+
+    size_t purpose_count_index = writer->AppendCount();
+    uint32_t purpose_count = 0;
+    for (auto purpose : kAllPurposes) {
+        const OperationFactory* factory = context.GetOperationFactory(algorithm, purpose);
+        if (!factory)
+            continue;
+        writer->Append(purpose);
+        const keymaster_block_mode_t* block_modes = factory->SupportedBlockModes(&count);
+        writer->AppendHalBlockModes(block_modes, count);
+        const keymaster_padding_t* padding_modes = factory->SupportedPaddingModes(&count);
+        writer->AppendList(padding_modes, count);
+        const keymaster_digest_t* digests = factory->SupportedDigests(&count);
+        writer->AppendList(digests, count);
+        ++purpose_count;
+    }
+    writer->SetCount(purpose_count_index, purpose_count);
+    return true;
+}
+
+void WriteCapabilities(const KeymasterContext& context, CapabilityWriter* writer) {
+    size_t algorithm_count = 0;
+    const keymaster_algorithm_t* algorithms = context.GetSupportedAlgorithms(&algorithm_count);
+    writer->AppendList(algorithms, algorithm_count);
+
+    size_t entry_count_index = writer->AppendCount();
+    uint32_t entry_count = 0;
+    for (auto algorithm : kAllAlgorithms)
+        if (WriteAlgorithmCapabilities(context, algorithm, writer))
+            ++entry_count;
+    // In case the context lists an algorithm the table above doesn't know about.
+    for (size_t i = 0; i < algorithm_count; ++i) {
+        bool known = false;
+        for (auto algorithm : kAllAlgorithms)
+            known = known || algorithm == algorithms[i];
+        if (!known && WriteAlgorithmCapabilities(context, algorithms[i], writer))
+            ++entry_count;
+    }
+    writer->SetCount(entry_count_index, entry_count);
+}
+
+}  // anonymous namespace
+
+keymaster_error_t AndroidKeymaster::BuildCapabilities() {
+    capabilities_.Clear();
+
+    CapabilityWriter counter(nullptr);
+    WriteCapabilities(*context_, &counter);
+    UniquePtr<uint32_t[]> values(new (std::nothrow) uint32_t[counter.length()]);
+    if (!values.get())
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    CapabilityWriter writer(values.get());
+    WriteCapabilities(*context_, &writer);
+    if (!capabilities_.Reinitialize(values.get(), writer.length()))
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    return KM_ERROR_OK;
+}
+
+void AndroidKeymaster::GetCapabilities(const GetCapabilitiesRequest& /* request */,
+                                       GetCapabilitiesResponse* response) {
+    if (response == nullptr)
+        return;
+
+    if (capabilities_.empty()) {
+        response->error = KM_ERROR_UNIMPLEMENTED;
+        return;
+    }
+    // The matrix doesn't change once built, so the response is serialized straight from it.
+    response->shared_capabilities = &capabilities_;
+    response->error = KM_ERROR_OK;
+}
+
 GetHmacSharingParametersResponse AndroidKeymaster::GetHmacSharingParameters() {
     GetHmacSharingParametersResponse response;
     KeymasterEnforcement* policy = context_->enforcement_policy();
@@ -240,17 +469,22 @@ void AndroidKeymaster::GetKeyCharacteristics(const GetKeyCharacteristicsRequest&
     if (response == nullptr)
         return;
 
-    UniquePtr<Key> key;
-    response->error =
-        context_->ParseKeyBlob(KeymasterKeyBlob(request.key_blob), request.additional_params,
-                               &key);
+    KeymasterKeyBlob key_blob(request.key_blob);
+    response->error = context_->ParseKeyBlobAuthorizations(
+        key_blob, request.additional_params, &response->enforced, &response->unenforced);
+    if (response->error == KM_ERROR_UNIMPLEMENTED) {
+        UniquePtr<Key> key;
+        response->error = context_->ParseKeyBlob(key_blob, request.additional_params, &key);
+        if (response->error != KM_ERROR_OK)
+            return;
+
+        // scavenge the key object for the auth lists
+        response->enforced = move(key->hw_enforced());
+        response->unenforced = move(key->sw_enforced());
+    }
     if (response->error != KM_ERROR_OK)
         return;
 
-    // scavenge the key object for the auth lists
-    response->enforced = move(key->hw_enforced());
-    response->unenforced = move(key->sw_enforced());
-
     response->error = CheckVersionInfo(response->enforced, response->unenforced, *context_);
 }
 
@@ -260,38 +494,75 @@ void AndroidKeymaster::BeginOperation(const BeginOperationRequest& request,
         return;
     response->op_handle = 0;
 
-    const KeyFactory* key_factory;
     UniquePtr<Key> key;
-    response->error = LoadKey(request.key_blob, request.additional_params, &key_factory, &key);
+    response->error = LoadKey(request.key_blob, request.additional_params, nullptr, &key);
     if (response->error != KM_ERROR_OK)
         return;
 
+    uint64_t key_id;
+    response->error = CreateKeyId(request.key_blob, &key_id);
+    if (response->error != KM_ERROR_OK)
+        return;
+
+    BeginOperation(request.purpose, move(key), key_id, nullptr /* key_policy */,
+                   request.additional_params, response);
+}
+
+void AndroidKeymaster::BeginOperationWithKeyHandle(
+    const BeginOperationWithKeyHandleRequest& request, BeginOperationResponse* response) {
+    if (response == nullptr)
+        return;
+    response->op_handle = 0;
+
+    UniquePtr<Key> key;
+    uint64_t key_id;
+    const KeyEnforcementPolicy* key_policy;
+    response->error = LoadKeyFromHandle(request.key_handle, &key, &key_id, &key_policy);
+    if (response->error != KM_ERROR_OK)
+        return;
+
+    BeginOperation(request.purpose, move(key), key_id, key_policy, request.additional_params,
+                   response);
+}
+
+void AndroidKeymaster::BeginOperation(keymaster_purpose_t purpose, UniquePtr<Key>&& key,
+                                      uint64_t key_id, const KeyEnforcementPolicy* key_policy,
+                                      const AuthorizationSet& additional_params,
+                                      BeginOperationResponse* response) {
     response->error = KM_ERROR_UNKNOWN_ERROR;
     keymaster_algorithm_t key_algorithm;
     if (!key->authorizations().GetTagValue(TAG_ALGORITHM, &key_algorithm))
         return;
 
     response->error = KM_ERROR_UNSUPPORTED_PURPOSE;
-    OperationFactory* factory = key_factory->GetOperationFactory(request.purpose);
+    OperationFactory* factory = key->key_factory()->GetOperationFactoryForKey(*key, purpose);
     if (!factory) return;
 
     OperationPtr operation(
-        factory->CreateOperation(move(*key), request.additional_params, &response->error));
+        factory->CreateOperation(move(*key), additional_params, &response->error));
     if (operation.get() == nullptr) return;
+    operation->set_task_context(context_.get());
 
     if (context_->enforcement_policy()) {
-        km_id_t key_id;
-        response->error = KM_ERROR_UNKNOWN_ERROR;
-        if (!context_->enforcement_policy()->CreateKeyId(request.key_blob, &key_id)) return;
         operation->set_key_id(key_id);
+        if (key_policy) {
+            if (!operation->mutable_enforcement_policy()->CopyFrom(*key_policy)) {
+                response->error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
+                return;
+            }
+        } else {
+            response->error = KeymasterEnforcement::CompileKeyPolicy(
+                operation->authorizations(), operation->mutable_enforcement_policy());
+            if (response->error != KM_ERROR_OK) return;
+        }
         response->error = context_->enforcement_policy()->AuthorizeOperation(
-            request.purpose, key_id, operation->authorizations(), request.additional_params,
+            purpose, key_id, operation->enforcement_policy(), additional_params,
             0 /* op_handle */, true /* is_begin_operation */);
         if (response->error != KM_ERROR_OK) return;
     }
 
     response->output_params.Clear();
-    response->error = operation->Begin(request.additional_params, &response->output_params);
+    response->error = operation->Begin(additional_params, &response->output_params);
     if (response->error != KM_ERROR_OK)
         return;
 
@@ -311,7 +582,7 @@ void AndroidKeymaster::UpdateOperation(const UpdateOperationRequest& request,
 
     if (context_->enforcement_policy()) {
         response->error = context_->enforcement_policy()->AuthorizeOperation(
-            operation->purpose(), operation->key_id(), operation->authorizations(),
+            operation->purpose(), operation->key_id(), operation->enforcement_policy(),
             request.additional_params, request.op_handle, false /* is_begin_operation */);
         if (response->error != KM_ERROR_OK) {
             operation_table_->Delete(request.op_handle);
@@ -340,7 +611,7 @@ void AndroidKeymaster::FinishOperation(const FinishOperationRequest& request,
 
     if (context_->enforcement_policy()) {
         response->error = context_->enforcement_policy()->AuthorizeOperation(
-            operation->purpose(), operation->key_id(), operation->authorizations(),
+            operation->purpose(), operation->key_id(), operation->enforcement_policy(),
             request.additional_params, request.op_handle, false /* is_begin_operation */);
         if (response->error != KM_ERROR_OK) {
             operation_table_->Delete(request.op_handle);
@@ -353,6 +624,55 @@ void AndroidKeymaster::FinishOperation(const FinishOperationRequest& request,
     operation_table_->Delete(request.op_handle);
 }
 
+void AndroidKeymaster::FinishAndRestartOperation(const FinishAndRestartOperationRequest& request,
+                                                 FinishAndRestartOperationResponse* response) {
+    if (response == nullptr)
+        return;
+    response->op_handle = 0;
+
+    response->error = KM_ERROR_INVALID_OPERATION_HANDLE;
+    Operation* operation = operation_table_->Find(request.op_handle);
+    if (operation == nullptr)
+        return;
+
+    KeymasterEnforcement* policy = context_->enforcement_policy();
+    if (policy) {
+        response->error = policy->AuthorizeOperation(
+            operation->purpose(), operation->key_id(), operation->enforcement_policy(),
+            request.additional_params, request.op_handle, false /* is_begin_operation */);
+        if (response->error != KM_ERROR_OK) {
+            operation_table_->Delete(request.op_handle);
+            return;
+        }
+    }
+
+    response->error = operation->Finish(request.additional_params, request.input, request.signature,
+                                        &response->output_params, &response->output);
+    if (response->error != KM_ERROR_OK) {
+        operation_table_->Delete(request.op_handle);
+        return;
+    }
+
+    // The same checks BeginOperation makes, so a restart can't get around usage limits.
+    response->restart_error = operation->Restart();
+    if (response->restart_error == KM_ERROR_OK && policy)
+        response->restart_error = policy->AuthorizeOperation(
+            operation->purpose(), operation->key_id(), operation->enforcement_policy(),
+            request.restart_params, 0 /* op_handle */, true /* is_begin_operation */);
+    if (response->restart_error == KM_ERROR_OK) {
+        response->restart_output_params.Clear();
+        // Begin() gives the operation its new handle, which is what the table finds it by.
+        response->restart_error =
+            operation->Begin(request.restart_params, &response->restart_output_params);
+    }
+    if (response->restart_error != KM_ERROR_OK) {
+        // Begin() may have replaced the handle already.
+        operation_table_->Delete(operation->operation_handle());
+        return;
+    }
+    response->op_handle = operation->operation_handle();
+}
+
 void AndroidKeymaster::AbortOperation(const AbortOperationRequest& request,
                                       AbortOperationResponse* response) {
     if (!response)
@@ -368,6 +688,93 @@ void AndroidKeymaster::AbortOperation(const AbortOperationRequest& request,
     operation_table_->Delete(request.op_handle);
 }
 
+void AndroidKeymaster::BatchVerify(const BatchVerifyRequest& request,
+                                   BatchVerifyResponse* response) {
+    if (!response)
+        return;
+
+    UniquePtr<OperationPtr[]> operations(new (std::nothrow) OperationPtr[request.num_jobs]);
+    if (!operations.get() || !response->AllocateResults(request.num_jobs)) {
+        response->error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
+        return;
+    }
+
+    // Loading keys and authorizing may touch shared state (the enforcement policy's access
+    // tracking, for example), so only the signature checks are farmed out.
+    for (size_t i = 0; i < request.num_jobs; ++i)
+        response->results[i] = BeginVerification(request.jobs[i], &operations[i]);
+
+    BatchVerifyTasks tasks = {request.jobs, operations.get(), response->results};
+    context_->RunTasks(request.num_jobs, FinishVerification, &tasks);
+    response->error = KM_ERROR_OK;
+}
+
+void AndroidKeymaster::MigrateKeyBlobs(const MigrateKeyBlobsRequest& request,
+                                       MigrateKeyBlobsResponse* response) {
+    if (!response)
+        return;
+
+    if (!response->AllocateResults(request.num_jobs)) {
+        response->error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
+        return;
+    }
+
+    MigrateKeyBlobsTasks tasks = {context_.get(), request.jobs, response->results};
+    context_->RunTasks(request.num_jobs, MigrateKeyBlob, &tasks);
+    response->error = KM_ERROR_OK;
+}
+
+keymaster_error_t AndroidKeymaster::BeginVerification(const VerificationJob& job,
+                                                      OperationPtr* operation) {
+    const KeyFactory* key_factory;
+    UniquePtr<Key> key;
+    keymaster_error_t error = LoadKey(job.key_blob, job.additional_params, &key_factory, &key);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    OperationFactory* factory = key_factory->GetOperationFactoryForKey(*key, KM_PURPOSE_VERIFY);
+    if (!factory)
+        return KM_ERROR_UNSUPPORTED_PURPOSE;
+
+    OperationPtr op(factory->CreateOperation(move(*key), job.additional_params, &error));
+    if (!op.get())
+        return error;
+
+    KeymasterEnforcement* policy = context_->enforcement_policy();
+    if (policy) {
+        km_id_t key_id;
+        if (!policy->CreateKeyId(job.key_blob, &key_id))
+            return KM_ERROR_UNKNOWN_ERROR;
+        op->set_key_id(key_id);
+        error = KeymasterEnforcement::CompileKeyPolicy(op->authorizations(),
+                                                       op->mutable_enforcement_policy());
+        if (error != KM_ERROR_OK)
+            return error;
+        error = policy->AuthorizeOperation(KM_PURPOSE_VERIFY, key_id, op->enforcement_policy(),
+                                           job.additional_params, 0 /* op_handle */,
+                                           true /* is_begin_operation */);
+        if (error != KM_ERROR_OK)
+            return error;
+    }
+
+    AuthorizationSet output_params;
+    error = op->Begin(job.additional_params, &output_params);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    if (policy) {
+        // The check FinishOperation would make before finishing.
+        error = policy->AuthorizeOperation(KM_PURPOSE_VERIFY, op->key_id(),
+                                           op->enforcement_policy(), job.additional_params,
+                                           op->operation_handle(), false /* is_begin_operation */);
+        if (error != KM_ERROR_OK)
+            return error;
+    }
+
+    *operation = move(op);
+    return KM_ERROR_OK;
+}
+
 void AndroidKeymaster::ExportKey(const ExportKeyRequest& request, ExportKeyResponse* response) {
     if (response == nullptr)
         return;
@@ -378,9 +785,29 @@ void AndroidKeymaster::ExportKey(const ExportKeyRequest& request, ExportKeyRespo
     if (response->error != KM_ERROR_OK)
         return;
 
+    ExportKey(*key, request.key_format, response);
+}
+
+void AndroidKeymaster::ExportKeyWithKeyHandle(const ExportKeyWithKeyHandleRequest& request,
+                                              ExportKeyResponse* response) {
+    if (response == nullptr)
+        return;
+
+    // Like ExportKey, this doesn't check the key's version info.
+    UniquePtr<Key> key;
+    uint64_t key_id;
+    response->error = key_handle_table_->LoadKey(request.key_handle, &key, &key_id);
+    if (response->error != KM_ERROR_OK)
+        return;
+
+    ExportKey(*key, request.key_format, response);
+}
+
+void AndroidKeymaster::ExportKey(const Key& key, keymaster_key_format_t key_format,
+                                 ExportKeyResponse* response) {
     UniquePtr<uint8_t[]> out_key;
     size_t size;
-    response->error = key->formatted_key_material(request.key_format, &out_key, &size);
+    response->error = key.formatted_key_material(key_format, &out_key, &size);
     if (response->error == KM_ERROR_OK) {
         response->key_data = out_key.release();
         response->key_data_length = size;
@@ -391,21 +818,37 @@ void AndroidKeymaster::AttestKey(const AttestKeyRequest& request, AttestKeyRespo
     if (!response)
         return;
 
-    const KeyFactory* key_factory;
     UniquePtr<Key> key;
-    response->error = LoadKey(request.key_blob, request.attest_params,
-                              &key_factory, &key);
+    response->error = LoadKey(request.key_blob, request.attest_params, nullptr, &key);
+    if (response->error != KM_ERROR_OK)
+        return;
+
+    AttestKey(key.get(), request.attest_params, response);
+}
+
+void AndroidKeymaster::AttestKeyWithKeyHandle(const AttestKeyWithKeyHandleRequest& request,
+                                              AttestKeyResponse* response) {
+    if (!response)
+        return;
+
+    UniquePtr<Key> key;
+    uint64_t key_id;
+    response->error = LoadKeyFromHandle(request.key_handle, &key, &key_id);
     if (response->error != KM_ERROR_OK)
         return;
 
+    AttestKey(key.get(), request.attest_params, response);
+}
+
+void AndroidKeymaster::AttestKey(Key* key, const AuthorizationSet& attest_params,
+                                 AttestKeyResponse* response) {
     keymaster_blob_t attestation_application_id;
-    if (request.attest_params.GetTagValue(TAG_ATTESTATION_APPLICATION_ID,
-                                          &attestation_application_id)) {
+    if (attest_params.GetTagValue(TAG_ATTESTATION_APPLICATION_ID, &attestation_application_id)) {
         key->sw_enforced().push_back(TAG_ATTESTATION_APPLICATION_ID, attestation_application_id);
     }
 
     CertChainPtr certchain;
-    response->error = context_->GenerateAttestation(*key, request.attest_params, &certchain);
+    response->error = context_->GenerateAttestation(*key, attest_params, &certchain);
     if (response->error == KM_ERROR_OK) {
         response->certificate_chain = *certchain;
         // response->certificate_chain took possession of secondary resources. So we shallowly
@@ -427,6 +870,21 @@ void AndroidKeymaster::UpgradeKey(const UpgradeKeyRequest& request, UpgradeKeyRe
     response->upgraded_key = upgraded_key.release();
 }
 
+void AndroidKeymaster::BatchUpgradeKey(const BatchUpgradeKeyRequest& request,
+                                       BatchUpgradeKeyResponse* response) {
+    if (!response)
+        return;
+
+    if (!response->AllocateResults(request.num_key_blobs)) {
+        response->error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
+        return;
+    }
+
+    BatchUpgradeKeyTasks tasks = {context_.get(), &request, response->results};
+    context_->RunTasks(request.num_key_blobs, UpgradeKeyBlob, &tasks);
+    response->error = KM_ERROR_OK;
+}
+
 void AndroidKeymaster::ImportKey(const ImportKeyRequest& request, ImportKeyResponse* response) {
     if (response == nullptr)
         return;
@@ -451,15 +909,46 @@ void AndroidKeymaster::ImportKey(const ImportKeyRequest& request, ImportKeyRespo
 void AndroidKeymaster::DeleteKey(const DeleteKeyRequest& request, DeleteKeyResponse* response) {
     if (!response)
         return;
+
+    key_handle_table_->DeleteKeyBlob(request.key_blob);
     response->error = context_->DeleteKey(KeymasterKeyBlob(request.key_blob));
 }
 
 void AndroidKeymaster::DeleteAllKeys(const DeleteAllKeysRequest&, DeleteAllKeysResponse* response) {
     if (!response)
         return;
+    key_handle_table_->Clear();
     response->error = context_->DeleteAllKeys();
 }
 
+void AndroidKeymaster::LoadKeyHandle(const LoadKeyHandleRequest& request,
+                                     LoadKeyHandleResponse* response) {
+    if (!response)
+        return;
+    response->key_handle = 0;
+
+    UniquePtr<Key> key;
+    response->error = LoadKey(request.key_blob, request.additional_params, nullptr, &key);
+    if (response->error != KM_ERROR_OK)
+        return;
+
+    uint64_t key_id;
+    response->error = CreateKeyId(request.key_blob, &key_id);
+    if (response->error != KM_ERROR_OK)
+        return;
+
+    response->error = key_handle_table_->Add(move(key), request.key_blob, request.additional_params,
+                                             key_id, &response->key_handle);
+}
+
+void AndroidKeymaster::UnloadKeyHandle(const UnloadKeyHandleRequest& request,
+                                       UnloadKeyHandleResponse* response) {
+    if (!response)
+        return;
+    response->error = key_handle_table_->Delete(request.key_handle) ? KM_ERROR_OK
+                                                                   : KM_ERROR_INVALID_KEY_BLOB;
+}
+
 void AndroidKeymaster::Configure(const ConfigureRequest& request, ConfigureResponse* response) {
     if (!response)
         return;
@@ -482,6 +971,25 @@ keymaster_error_t AndroidKeymaster::LoadKey(const keymaster_key_blob_t& key_blob
     return CheckVersionInfo((*key)->hw_enforced(), (*key)->sw_enforced(), *context_);
 }
 
+keymaster_error_t AndroidKeymaster::LoadKeyFromHandle(uint64_t key_handle, UniquePtr<Key>* key,
+                                                      uint64_t* key_id,
+                                                      const KeyEnforcementPolicy** policy) {
+    keymaster_error_t error = key_handle_table_->LoadKey(key_handle, key, key_id, policy);
+    if (error != KM_ERROR_OK)
+        return error;
+    // The system version may have changed since the key was loaded.
+    return CheckVersionInfo((*key)->hw_enforced(), (*key)->sw_enforced(), *context_);
+}
+
+keymaster_error_t AndroidKeymaster::CreateKeyId(const keymaster_key_blob_t& key_blob,
+                                                uint64_t* key_id) {
+    *key_id = 0;
+    KeymasterEnforcement* policy = context_->enforcement_policy();
+    if (policy && !policy->CreateKeyId(key_blob, key_id))
+        return KM_ERROR_UNKNOWN_ERROR;
+    return KM_ERROR_OK;
+}
+
 void AndroidKeymaster::ImportWrappedKey(const ImportWrappedKeyRequest& request,
                                         ImportWrappedKeyResponse* response) {
     if (!response) return;
@@ -732,4 +732,348 @@ bool VerificationToken::Deserialize(const uint8_t** buf_ptr, const uint8_t* end)
            deserialize_blob(&mac, buf_ptr, end);
 }
 
+void VerificationJob::SetKeyMaterial(const void* key_material, size_t length) {
+    set_key_blob(&key_blob, key_material, length);
+}
+
+size_t VerificationJob::SerializedSize() const {
+    return key_blob_size(key_blob) + additional_params.SerializedSize() + message.SerializedSize() +
+           signature.SerializedSize();
+}
+
+uint8_t* VerificationJob::Serialize(uint8_t* buf, const uint8_t* end) const {
+    buf = serialize_key_blob(key_blob, buf, end);
+    buf = additional_params.Serialize(buf, end);
+    buf = message.Serialize(buf, end);
+    return signature.Serialize(buf, end);
+}
+
+bool VerificationJob::Deserialize(const uint8_t** buf_ptr, const uint8_t* end) {
+    return deserialize_key_blob(&key_blob, buf_ptr, end) &&
+           additional_params.Deserialize(buf_ptr, end) && message.Deserialize(buf_ptr, end) &&
+           signature.Deserialize(buf_ptr, end);
+}
+
+bool BatchVerifyRequest::AllocateJobs(size_t count) {
+    delete[] jobs;
+    num_jobs = 0;
+    jobs = new (std::nothrow) VerificationJob[count];
+    if (!jobs)
+        return false;
+    num_jobs = count;
+    return true;
+}
+
+size_t BatchVerifyRequest::SerializedSize() const {
+    size_t size = sizeof(uint32_t);  // num_jobs
+    for (size_t i = 0; i < num_jobs; ++i)
+        size += jobs[i].SerializedSize();
+    return size;
+}
+
+uint8_t* BatchVerifyRequest::Serialize(uint8_t* buf, const uint8_t* end) const {
+    buf = append_uint32_to_buf(buf, end, num_jobs);
+    for (size_t i = 0; i < num_jobs; ++i)
+        buf = jobs[i].Serialize(buf, end);
+    return buf;
+}
+
+bool BatchVerifyRequest::Deserialize(const uint8_t** buf_ptr, const uint8_t* end) {
+    size_t count;
+    if (!copy_uint32_from_buf(buf_ptr, end, &count))
+        return false;
+    // Every job takes more than one byte, so this rejects absurd counts before allocating.
+    if (count > static_cast<size_t>(end - *buf_ptr) || !AllocateJobs(count))
+        return false;
+    for (size_t i = 0; i < num_jobs; ++i)
+        if (!jobs[i].Deserialize(buf_ptr, end))
+            return false;
+    return true;
+}
+
+bool BatchVerifyResponse::AllocateResults(size_t count) {
+    delete[] results;
+    num_results = 0;
+    results = new (std::nothrow) keymaster_error_t[count];
+    if (!results)
+        return false;
+    num_results = count;
+    for (size_t i = 0; i < num_results; ++i)
+        results[i] = KM_ERROR_UNKNOWN_ERROR;
+    return true;
+}
+
+size_t BatchVerifyResponse::NonErrorSerializedSize() const {
+    return sizeof(uint32_t) + num_results * sizeof(uint32_t);
+}
+
+uint8_t* BatchVerifyResponse::NonErrorSerialize(uint8_t* buf, const uint8_t* end) const {
+    return append_uint32_array_to_buf(buf, end, results, num_results);
+}
+
+bool BatchVerifyResponse::NonErrorDeserialize(const uint8_t** buf_ptr, const uint8_t* end) {
+    delete[] results;
+    results = nullptr;
+    num_results = 0;
+    UniquePtr<keymaster_error_t[]> tmp;
+    size_t count;
+    if (!copy_uint32_array_from_buf(buf_ptr, end, &tmp, &count))
+        return false;
+    results = tmp.release();
+    num_results = count;
+    return true;
+}
+
+void KeyBlobMigrationJob::SetKeyMaterial(const void* key_material, size_t length) {
+    set_key_blob(&key_blob, key_material, length);
+}
+
+size_t KeyBlobMigrationJob::SerializedSize() const {
+    return key_blob_size(key_blob) + additional_params.SerializedSize();
+}
+
+uint8_t* KeyBlobMigrationJob::Serialize(uint8_t* buf, const uint8_t* end) const {
+    buf = serialize_key_blob(key_blob, buf, end);
+    return additional_params.Serialize(buf, end);
+}
+
+bool KeyBlobMigrationJob::Deserialize(const uint8_t** buf_ptr, const uint8_t* end) {
+    return deserialize_key_blob(&key_blob, buf_ptr, end) &&
+           additional_params.Deserialize(buf_ptr, end);
+}
+
+bool MigrateKeyBlobsRequest::AllocateJobs(size_t count) {
+    delete[] jobs;
+    num_jobs = 0;
+    jobs = new (std::nothrow) KeyBlobMigrationJob[count];
+    if (!jobs)
+        return false;
+    num_jobs = count;
+    return true;
+}
+
+size_t MigrateKeyBlobsRequest::SerializedSize() const {
+    size_t size = sizeof(uint32_t);  // num_jobs
+    for (size_t i = 0; i < num_jobs; ++i)
+        size += jobs[i].SerializedSize();
+    return size;
+}
+
+uint8_t* MigrateKeyBlobsRequest::Serialize(uint8_t* buf, const uint8_t* end) const {
+    buf = append_uint32_to_buf(buf, end, num_jobs);
+    for (size_t i = 0; i < num_jobs; ++i)
+        buf = jobs[i].Serialize(buf, end);
+    return buf;
+}
+
+bool MigrateKeyBlobsRequest::Deserialize(const uint8_t** buf_ptr, const uint8_t* end) {
+    size_t count;
+    if (!copy_uint32_from_buf(buf_ptr, end, &count))
+        return false;
+    // Every job takes more than one byte, so this rejects absurd counts before allocating.
+    if (count > static_cast<size_t>(end - *buf_ptr) || !AllocateJobs(count))
+        return false;
+    for (size_t i = 0; i < num_jobs; ++i)
+        if (!jobs[i].Deserialize(buf_ptr, end))
+            return false;
+    return true;
+}
+
+void KeyBlobResult::SetKeyMaterial(const void* key_material, size_t length) {
+    set_key_blob(&key_blob, key_material, length);
+}
+
+size_t KeyBlobResult::SerializedSize() const {
+    return sizeof(uint32_t) /* error */ + key_blob_size(key_blob);
+}
+
+uint8_t* KeyBlobResult::Serialize(uint8_t* buf, const uint8_t* end) const {
+    buf = append_uint32_to_buf(buf, end, error);
+    return serialize_key_blob(key_blob, buf, end);
+}
+
+bool KeyBlobResult::Deserialize(const uint8_t** buf_ptr, const uint8_t* end) {
+    return copy_uint32_from_buf(buf_ptr, end, &error) &&
+           deserialize_key_blob(&key_blob, buf_ptr, end);
+}
+
+bool KeyBlobBatchResponse::AllocateResults(size_t count) {
+    delete[] results;
+    num_results = 0;
+    results = new (std::nothrow) KeyBlobResult[count];
+    if (!results)
+        return false;
+    num_results = count;
+    return true;
+}
+
+size_t KeyBlobBatchResponse::NonErrorSerializedSize() const {
+    size_t size = sizeof(uint32_t);  // num_results
+    for (size_t i = 0; i < num_results; ++i)
+        size += results[i].SerializedSize();
+    return size;
+}
+
+uint8_t* KeyBlobBatchResponse::NonErrorSerialize(uint8_t* buf, const uint8_t* end) const {
+    buf = append_uint32_to_buf(buf, end, num_results);
+    for (size_t i = 0; i < num_results; ++i)
+        buf = results[i].Serialize(buf, end);
+    return buf;
+}
+
+bool KeyBlobBatchResponse::NonErrorDeserialize(const uint8_t** buf_ptr, const uint8_t* end) {
+    size_t count;
+    if (!copy_uint32_from_buf(buf_ptr, end, &count))
+        return false;
+    // Every result takes more than one byte, so this rejects absurd counts before allocating.
+    if (count > static_cast<size_t>(end - *buf_ptr) || !AllocateResults(count))
+        return false;
+    for (size_t i = 0; i < num_results; ++i)
+        if (!results[i].Deserialize(buf_ptr, end))
+            return false;
+    return true;
+}
+
+bool BatchUpgradeKeyRequest::AllocateKeyBlobs(size_t count) {
+    delete[] key_blobs;
+    num_key_blobs = 0;
+    key_blobs = new (std::nothrow) KeymasterKeyBlob[count];
+    if (!key_blobs)
+        return false;
+    num_key_blobs = count;
+    return true;
+}
+
+size_t BatchUpgradeKeyRequest::SerializedSize() const {
+    size_t size = sizeof(uint32_t);  // num_key_blobs
+    for (size_t i = 0; i < num_key_blobs; ++i)
+        size += key_blob_size(key_blobs[i]);
+    return size + upgrade_params.SerializedSize();
+}
+
+uint8_t* BatchUpgradeKeyRequest::Serialize(uint8_t* buf, const uint8_t* end) const {
+    buf = append_uint32_to_buf(buf, end, num_key_blobs);
+    for (size_t i = 0; i < num_key_blobs; ++i)
+        buf = serialize_key_blob(key_blobs[i], buf, end);
+    return upgrade_params.Serialize(buf, end);
+}
+
+bool BatchUpgradeKeyRequest::Deserialize(const uint8_t** buf_ptr, const uint8_t* end) {
+    size_t count;
+    if (!copy_uint32_from_buf(buf_ptr, end, &count))
+        return false;
+    // Every blob takes more than one byte, so this rejects absurd counts before allocating.
+    if (count > static_cast<size_t>(end - *buf_ptr) || !AllocateKeyBlobs(count))
+        return false;
+    for (size_t i = 0; i < num_key_blobs; ++i)
+        if (!deserialize_key_blob(&key_blobs[i], buf_ptr, end))
+            return false;
+    return upgrade_params.Deserialize(buf_ptr, end);
+}
+
+void LoadKeyHandleRequest::SetKeyMaterial(const void* key_material, size_t length) {
+    set_key_blob(&key_blob, key_material, length);
+}
+
+size_t LoadKeyHandleRequest::SerializedSize() const {
+    return key_blob_size(key_blob) + additional_params.SerializedSize();
+}
+
+uint8_t* LoadKeyHandleRequest::Serialize(uint8_t* buf, const uint8_t* end) const {
+    buf = serialize_key_blob(key_blob, buf, end);
+    return additional_params.Serialize(buf, end);
+}
+
+bool LoadKeyHandleRequest::Deserialize(const uint8_t** buf_ptr, const uint8_t* end) {
+    return deserialize_key_blob(&key_blob, buf_ptr, end) &&
+           additional_params.Deserialize(buf_ptr, end);
+}
+
+size_t BeginOperationWithKeyHandleRequest::SerializedSize() const {
+    return sizeof(uint32_t) /* purpose */ + sizeof(uint64_t) /* key_handle */ +
+           additional_params.SerializedSize();
+}
+
+uint8_t* BeginOperationWithKeyHandleRequest::Serialize(uint8_t* buf, const uint8_t* end) const {
+    buf = append_uint32_to_buf(buf, end, purpose);
+    buf = append_uint64_to_buf(buf, end, key_handle);
+    return additional_params.Serialize(buf, end);
+}
+
+bool BeginOperationWithKeyHandleRequest::Deserialize(const uint8_t** buf_ptr,
+                                                     const uint8_t* end) {
+    return copy_uint32_from_buf(buf_ptr, end, &purpose) &&
+           copy_uint64_from_buf(buf_ptr, end, &key_handle) &&
+           additional_params.Deserialize(buf_ptr, end);
+}
+
+size_t AttestKeyWithKeyHandleRequest::SerializedSize() const {
+    return sizeof(uint64_t) /* key_handle */ + attest_params.SerializedSize();
+}
+
+uint8_t* AttestKeyWithKeyHandleRequest::Serialize(uint8_t* buf, const uint8_t* end) const {
+    buf = append_uint64_to_buf(buf, end, key_handle);
+    return attest_params.Serialize(buf, end);
+}
+
+bool AttestKeyWithKeyHandleRequest::Deserialize(const uint8_t** buf_ptr, const uint8_t* end) {
+    return copy_uint64_from_buf(buf_ptr, end, &key_handle) &&
+           attest_params.Deserialize(buf_ptr, end);
+}
+
+size_t FinishAndRestartOperationRequest::SerializedSize() const {
+    return sizeof(op_handle) + input.SerializedSize() + signature.SerializedSize() +
+           additional_params.SerializedSize() + restart_params.SerializedSize();
+}
+
+uint8_t* FinishAndRestartOperationRequest::Serialize(uint8_t* buf, const uint8_t* end) const {
+    buf = append_uint64_to_buf(buf, end, op_handle);
+    buf = input.Serialize(buf, end);
+    buf = signature.Serialize(buf, end);
+    buf = additional_params.Serialize(buf, end);
+    return restart_params.Serialize(buf, end);
+}
+
+bool FinishAndRestartOperationRequest::Deserialize(const uint8_t** buf_ptr, const uint8_t* end) {
+    return copy_uint64_from_buf(buf_ptr, end, &op_handle) && input.Deserialize(buf_ptr, end) &&
+           signature.Deserialize(buf_ptr, end) && additional_params.Deserialize(buf_ptr, end) &&
+           restart_params.Deserialize(buf_ptr, end);
+}
+
+size_t FinishAndRestartOperationResponse::NonErrorSerializedSize() const {
+    return output.SerializedSize() + output_params.SerializedSize() +
+           sizeof(uint32_t) /* restart_error */ + sizeof(op_handle) +
+           restart_output_params.SerializedSize();
+}
+
+uint8_t* FinishAndRestartOperationResponse::NonErrorSerialize(uint8_t* buf,
+                                                              const uint8_t* end) const {
+    buf = output.Serialize(buf, end);
+    buf = output_params.Serialize(buf, end);
+    buf = append_uint32_to_buf(buf, end, restart_error);
+    buf = append_uint64_to_buf(buf, end, op_handle);
+    return restart_output_params.Serialize(buf, end);
+}
+
+bool FinishAndRestartOperationResponse::NonErrorDeserialize(const uint8_t** buf_ptr,
+                                                            const uint8_t* end) {
+    return output.Deserialize(buf_ptr, end) && output_params.Deserialize(buf_ptr, end) &&
+           copy_uint32_from_buf(buf_ptr, end, &restart_error) &&
+           copy_uint64_from_buf(buf_ptr, end, &op_handle) &&
+           restart_output_params.Deserialize(buf_ptr, end);
+}
+
+size_t GetCapabilitiesResponse::NonErrorSerializedSize() const {
+    return matrix().SerializedSize();
+}
+
+uint8_t* GetCapabilitiesResponse::NonErrorSerialize(uint8_t* buf, const uint8_t* end) const {
+    return matrix().Serialize(buf, end);
+}
+
+bool GetCapabilitiesResponse::NonErrorDeserialize(const uint8_t** buf_ptr, const uint8_t* end) {
+    shared_capabilities = nullptr;
+    return capabilities.Deserialize(buf_ptr, end);
+}
+
 }  // namespace keymaster
@@ -496,6 +496,24 @@ bool AuthorizationSet::DeserializeElementsData(const uint8_t** buf_ptr, const ui
     return true;
 }
 
+/* static */
+bool AuthorizationSet::SkipSerialized(const uint8_t** buf_ptr, const uint8_t* end) {
+    if (!skip_size_and_data_in_buf(buf_ptr, end))
+        return false;
+
+    // Same consistency checks as DeserializeElementsData() makes before parsing the elements.
+    uint32_t elements_count;
+    uint32_t elements_size;
+    if (!copy_uint32_from_buf(buf_ptr, end, &elements_count) ||
+        !copy_uint32_from_buf(buf_ptr, end, &elements_size) ||
+        static_cast<ptrdiff_t>(elements_size) > end - *buf_ptr ||
+        elements_count * sizeof(uint32_t) > elements_size)
+        return false;
+
+    *buf_ptr += elements_size;
+    return true;
+}
+
 bool AuthorizationSet::Deserialize(const uint8_t** buf_ptr, const uint8_t* end) {
     FreeData();
 
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <keymaster/key_handle_table.h>
+
+#include <openssl/mem.h>
+#include <openssl/sha.h>
+
+#include <keymaster/key.h>
+#include <keymaster/key_factory.h>
+#include <keymaster/keymaster_enforcement.h>
+#include <keymaster/km_openssl/openssl_utils.h>
+
+#include <keymaster/new>
+
+namespace keymaster {
+
+static_assert(SHA256_DIGEST_LENGTH == 32, "Blob digest size mismatch");
+
+keymaster_error_t KeyHandleTable::Add(UniquePtr<Key>&& key, const keymaster_key_blob_t& key_blob,
+                                      const AuthorizationSet& load_params, uint64_t key_id,
+                                      uint64_t* handle) {
+    if (table_size_ == 0)
+        return KM_ERROR_UNIMPLEMENTED;
+    if (!table_) {
+        table_.reset(new (std::nothrow) Entry[table_size_]);
+        if (!table_)
+            return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    }
+
+    UniquePtr<KeyEnforcementPolicy> policy(new (std::nothrow) KeyEnforcementPolicy);
+    if (!policy)
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    keymaster_error_t error = KeymasterEnforcement::CompileKeyPolicy(key->authorizations(),
+                                                                     policy.get());
+    if (error != KM_ERROR_OK)
+        return error;
+
+    uint64_t new_handle = 0;
+    while (new_handle == 0 || Find(new_handle)) {
+        error = GenerateRandom(reinterpret_cast<uint8_t*>(&new_handle), sizeof(new_handle));
+        if (error != KM_ERROR_OK)
+            return error;
+    }
+
+    // Use a free entry if there is one, otherwise the least recently used.
+    Entry* entry = &table_[0];
+    for (size_t i = 0; i < table_size_ && entry->handle != 0; ++i)
+        if (table_[i].handle == 0 || table_[i].last_use < entry->last_use)
+            entry = &table_[i];
+
+    entry->load_params = load_params;
+    if (entry->load_params.is_valid() != AuthorizationSet::OK) {
+        entry->handle = 0;
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    }
+    entry->handle = new_handle;
+    entry->last_use = ++use_count_;
+    entry->key_id = key_id;
+    DigestBlob(key_blob, entry->blob_digest);
+    entry->key = move(key);
+    entry->policy = move(policy);
+    *handle = new_handle;
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t KeyHandleTable::LoadKey(uint64_t handle, UniquePtr<Key>* key,
+                                          uint64_t* key_id, const KeyEnforcementPolicy** policy) {
+    Entry* entry = Find(handle);
+    if (!entry)
+        return KM_ERROR_INVALID_KEY_BLOB;
+    entry->last_use = ++use_count_;
+
+    const Key& stored = *entry->key;
+    KeymasterKeyBlob key_material(stored.key_material());
+    AuthorizationSet hw_enforced(stored.hw_enforced());
+    AuthorizationSet sw_enforced(stored.sw_enforced());
+    if (!key_material.key_material && stored.key_material().key_material_size)
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    if (hw_enforced.is_valid() != AuthorizationSet::OK ||
+        sw_enforced.is_valid() != AuthorizationSet::OK)
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+
+    *key_id = entry->key_id;
+    if (policy)
+        *policy = entry->policy.get();
+    keymaster_error_t error =
+        stored.key_factory()->LoadKey(move(key_material), entry->load_params, move(hw_enforced),
+                                      move(sw_enforced), key);
+    if (error == KM_ERROR_OK)
+        (*key)->ShareOperationState(entry->key.get());
+    return error;
+}
+
+bool KeyHandleTable::Delete(uint64_t handle) {
+    Entry* entry = Find(handle);
+    if (!entry)
+        return false;
+    *entry = Entry();
+    return true;
+}
+
+void KeyHandleTable::DeleteKeyBlob(const keymaster_key_blob_t& key_blob) {
+    if (!table_)
+        return;
+    uint8_t digest[kBlobDigestSize];
+    DigestBlob(key_blob, digest);
+    for (size_t i = 0; i < table_size_; ++i)
+        if (table_[i].handle != 0 &&
+            CRYPTO_memcmp(table_[i].blob_digest, digest, kBlobDigestSize) == 0)
+            table_[i] = Entry();
+}
+
+void KeyHandleTable::Clear() {
+    table_.reset();
+}
+
+KeyHandleTable::Entry* KeyHandleTable::Find(uint64_t handle) {
+    if (handle == 0 || !table_)
+        return nullptr;
+    for (size_t i = 0; i < table_size_; ++i)
+        if (table_[i].handle == handle)
+            return &table_[i];
+    return nullptr;
+}
+
+void KeyHandleTable::DigestBlob(const keymaster_key_blob_t& key_blob,
+                                uint8_t digest[kBlobDigestSize]) {
+    SHA256(key_blob.key_material, key_blob.key_material_size, digest);
+}
+
+}  // namespace keymaster
@@ -0,0 +1,241 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <keymaster/keymaster_capabilities.h>
+
+#include <string.h>
+
+#include <keymaster/new>
+
+namespace keymaster {
+
+namespace {
+
+// Import and export formats.
+const size_t kAlgorithmListCount = 2;
+// Block modes, padding modes and digests.
+const size_t kPurposeListCount = 3;
+
+bool ReadValue(const uint32_t** pos, const uint32_t* end, uint32_t* value) {
+    if (*pos >= end)
+        return false;
+    *value = *(*pos)++;
+    return true;
+}
+
+// Points |list|, if it's not null, at the list at |*pos| and steps past it.
+bool ReadList(const uint32_t** pos, const uint32_t* end, CapabilityList* list) {
+    uint32_t count;
+    if (!ReadValue(pos, end, &count) || count > static_cast<size_t>(end - *pos))
+        return false;
+    if (list) {
+        list->values = *pos;
+        list->count = count;
+    }
+    *pos += count;
+    return true;
+}
+
+bool SkipLists(const uint32_t** pos, const uint32_t* end, size_t list_count) {
+    for (size_t i = 0; i < list_count; ++i)
+        if (!ReadList(pos, end, nullptr))
+            return false;
+    return true;
+}
+
+// Steps over the rest of an algorithm entry, starting just past the algorithm.
+bool SkipEntry(const uint32_t** pos, const uint32_t* end) {
+    uint32_t purpose_count;
+    if (!SkipLists(pos, end, kAlgorithmListCount) || !ReadValue(pos, end, &purpose_count))
+        return false;
+    for (uint32_t i = 0; i < purpose_count; ++i) {
+        uint32_t purpose;
+        if (!ReadValue(pos, end, &purpose) || !SkipLists(pos, end, kPurposeListCount))
+            return false;
+    }
+    return true;
+}
+
+bool IsWellFormed(const uint32_t* values, size_t values_length) {
+    const uint32_t* pos = values;
+    const uint32_t* end = values + values_length;
+    uint32_t entry_count;
+    if (!values || !ReadList(&pos, end, nullptr) || !ReadValue(&pos, end, &entry_count))
+        return false;
+    for (uint32_t i = 0; i < entry_count; ++i) {
+        uint32_t algorithm;
+        if (!ReadValue(&pos, end, &algorithm) || !SkipEntry(&pos, end))
+            return false;
+    }
+    return pos == end;
+}
+
+}  // anonymous namespace
+
+bool CapabilityList::Contains(uint32_t value) const {
+    for (size_t i = 0; i < count; ++i)
+        if (values[i] == value)
+            return true;
+    return false;
+}
+
+bool KeymasterCapabilities::Reinitialize(const uint32_t* values, size_t values_length) {
+    if (!IsWellFormed(values, values_length)) {
+        Clear();
+        return false;
+    }
+
+    uint32_t* copy = new (std::nothrow) uint32_t[values_length];
+    if (!copy) {
+        Clear();
+        return false;
+    }
+    memcpy(copy, values, values_length * sizeof(*copy));
+    values_.reset(copy);
+    values_length_ = values_length;
+    return true;
+}
+
+void KeymasterCapabilities::Clear() {
+    values_.reset();
+    values_length_ = 0;
+}
+
+keymaster_error_t KeymasterCapabilities::SupportedAlgorithms(CapabilityList* algorithms) const {
+    if (empty())
+        return KM_ERROR_UNKNOWN_ERROR;
+    const uint32_t* pos = values_.get();
+    if (!ReadList(&pos, pos + values_length_, algorithms))
+        return KM_ERROR_UNKNOWN_ERROR;
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t KeymasterCapabilities::SupportedImportFormats(keymaster_algorithm_t algorithm,
+                                                                CapabilityList* formats) const {
+    return FindAlgorithmList(algorithm, 0 /* list_index */, formats);
+}
+
+keymaster_error_t KeymasterCapabilities::SupportedExportFormats(keymaster_algorithm_t algorithm,
+                                                                CapabilityList* formats) const {
+    return FindAlgorithmList(algorithm, 1 /* list_index */, formats);
+}
+
+keymaster_error_t KeymasterCapabilities::SupportedBlockModes(keymaster_algorithm_t algorithm,
+                                                             keymaster_purpose_t purpose,
+                                                             CapabilityList* block_modes) const {
+    return FindPurposeList(algorithm, purpose, 0 /* list_index */, block_modes);
+}
+
+keymaster_error_t
+KeymasterCapabilities::SupportedPaddingModes(keymaster_algorithm_t algorithm,
+                                             keymaster_purpose_t purpose,
+                                             CapabilityList* padding_modes) const {
+    return FindPurposeList(algorithm, purpose, 1 /* list_index */, padding_modes);
+}
+
+keymaster_error_t KeymasterCapabilities::SupportedDigests(keymaster_algorithm_t algorithm,
+                                                          keymaster_purpose_t purpose,
+                                                          CapabilityList* digests) const {
+    return FindPurposeList(algorithm, purpose, 2 /* list_index */, digests);
+}
+
+size_t KeymasterCapabilities::SerializedSize() const {
+    return sizeof(uint32_t) /* values_length_ */ + values_length_ * sizeof(uint32_t);
+}
+
+uint8_t* KeymasterCapabilities::Serialize(uint8_t* buf, const uint8_t* end) const {
+    return append_uint32_array_to_buf(buf, end, values_.get(), values_length_);
+}
+
+bool KeymasterCapabilities::Deserialize(const uint8_t** buf_ptr, const uint8_t* end) {
+    Clear();
+    UniquePtr<uint32_t[]> values;
+    size_t values_length;
+    if (!copy_uint32_array_from_buf(buf_ptr, end, &values, &values_length))
+        return false;
+    if (values_length == 0)
+        return true;
+    if (!IsWellFormed(values.get(), values_length))
+        return false;
+    values_.reset(values.release());
+    values_length_ = values_length;
+    return true;
+}
+
+const uint32_t* KeymasterCapabilities::FindEntry(keymaster_algorithm_t algorithm) const {
+    const uint32_t* pos = values_.get();
+    const uint32_t* end = pos + values_length_;
+    uint32_t entry_count;
+    if (!ReadList(&pos, end, nullptr) || !ReadValue(&pos, end, &entry_count))
+        return nullptr;
+    for (uint32_t i = 0; i < entry_count; ++i) {
+        uint32_t entry_algorithm;
+        if (!ReadValue(&pos, end, &entry_algorithm))
+            return nullptr;
+        if (entry_algorithm == static_cast<uint32_t>(algorithm))
+            return pos;
+        if (!SkipEntry(&pos, end))
+            return nullptr;
+    }
+    return nullptr;
+}
+
+keymaster_error_t KeymasterCapabilities::FindAlgorithmList(keymaster_algorithm_t algorithm,
+                                                           size_t list_index,
+                                                           CapabilityList* list) const {
+    if (empty())
+        return KM_ERROR_UNKNOWN_ERROR;
+    const uint32_t* pos = FindEntry(algorithm);
+    if (!pos)
+        return KM_ERROR_UNSUPPORTED_ALGORITHM;
+
+    const uint32_t* end = values_.get() + values_length_;
+    if (!SkipLists(&pos, end, list_index) || !ReadList(&pos, end, list))
+        return KM_ERROR_UNKNOWN_ERROR;
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t KeymasterCapabilities::FindPurposeList(keymaster_algorithm_t algorithm,
+                                                         keymaster_purpose_t purpose,
+                                                         size_t list_index,
+                                                         CapabilityList* list) const {
+    if (empty())
+        return KM_ERROR_UNKNOWN_ERROR;
+    const uint32_t* pos = FindEntry(algorithm);
+    if (!pos)
+        return KM_ERROR_UNSUPPORTED_ALGORITHM;
+
+    const uint32_t* end = values_.get() + values_length_;
+    uint32_t purpose_count;
+    if (!SkipLists(&pos, end, kAlgorithmListCount) || !ReadValue(&pos, end, &purpose_count))
+        return KM_ERROR_UNKNOWN_ERROR;
+    for (uint32_t i = 0; i < purpose_count; ++i) {
+        uint32_t entry_purpose;
+        if (!ReadValue(&pos, end, &entry_purpose))
+            return KM_ERROR_UNKNOWN_ERROR;
+        if (entry_purpose == static_cast<uint32_t>(purpose)) {
+            if (!SkipLists(&pos, end, list_index) || !ReadList(&pos, end, list))
+                return KM_ERROR_UNKNOWN_ERROR;
+            return KM_ERROR_OK;
+        }
+        if (!SkipLists(&pos, end, kPurposeListCount))
+            return KM_ERROR_UNKNOWN_ERROR;
+    }
+    return KM_ERROR_UNSUPPORTED_PURPOSE;
+}
+
+}  // namespace keymaster
@@ -80,6 +80,10 @@ bool is_public_key_algorithm(const AuthProxy& auth_set) {
 
 static keymaster_error_t authorized_purpose(const keymaster_purpose_t purpose,
                                             const AuthProxy& auth_set) {
+    if (purpose == KM_PURPOSE_AGREE_KEY)
+        return auth_set.Contains(TAG_PURPOSE, purpose) ? KM_ERROR_OK
+                                                       : KM_ERROR_INCOMPATIBLE_PURPOSE;
+
     switch (purpose) {
     case KM_PURPOSE_VERIFY:
     case KM_PURPOSE_ENCRYPT:
@@ -95,6 +99,26 @@ static keymaster_error_t authorized_purpose(const keymaster_purpose_t purpose,
     }
 }
 
+static keymaster_error_t authorized_purpose(const keymaster_purpose_t purpose,
+                                            const KeyEnforcementPolicy& policy) {
+    if (purpose == KM_PURPOSE_AGREE_KEY)
+        return policy.allows_purpose(purpose) ? KM_ERROR_OK : KM_ERROR_INCOMPATIBLE_PURPOSE;
+
+    switch (purpose) {
+    case KM_PURPOSE_VERIFY:
+    case KM_PURPOSE_ENCRYPT:
+    case KM_PURPOSE_SIGN:
+    case KM_PURPOSE_DECRYPT:
+    case KM_PURPOSE_WRAP:
+        if (policy.allows_purpose(purpose))
+            return KM_ERROR_OK;
+        return KM_ERROR_INCOMPATIBLE_PURPOSE;
+
+    default:
+        return KM_ERROR_UNSUPPORTED_PURPOSE;
+    }
+}
+
 inline bool is_origination_purpose(keymaster_purpose_t purpose) {
     return purpose == KM_PURPOSE_ENCRYPT || purpose == KM_PURPOSE_SIGN;
 }
@@ -384,6 +408,223 @@ keymaster_error_t KeymasterEnforcement::AuthorizeBegin(const keymaster_purpose_t
         operation_params.find(KM_TAG_NONCE) != -1)
         return KM_ERROR_CALLER_NONCE_PROHIBITED;
 
+    return RecordKeyAccess(keyid, min_ops_timeout, update_access_count);
+}
+
+keymaster_error_t KeymasterEnforcement::AuthorizeOperation(const keymaster_purpose_t purpose,
+                                                           const km_id_t keyid,
+                                                           const KeyEnforcementPolicy& policy,
+                                                           const AuthorizationSet& operation_params,
+                                                           keymaster_operation_handle_t op_handle,
+                                                           bool is_begin_operation) {
+    /* Public key operations are always authorized. */
+    if (policy.public_key && (purpose == KM_PURPOSE_ENCRYPT || purpose == KM_PURPOSE_VERIFY))
+        return KM_ERROR_OK;
+
+    if (is_begin_operation)
+        return AuthorizeBegin(purpose, keyid, policy, operation_params);
+    else
+        return AuthorizeUpdateOrFinish(policy, operation_params, op_handle);
+}
+
+keymaster_error_t
+KeymasterEnforcement::AuthorizeUpdateOrFinish(const KeyEnforcementPolicy& policy,
+                                              const AuthorizationSet& operation_params,
+                                              keymaster_operation_handle_t op_handle) {
+    // See the AuthProxy version above for why each of these is checked.
+    if (policy.trusted_confirmation_required)
+        return KM_ERROR_NO_USER_CONFIRMATION;
+
+    if (policy.no_auth_required || policy.has_auth_timeout)
+        return KM_ERROR_OK;
+
+    const uint32_t* auth_type_mask = policy.has_user_auth_type ? &policy.user_auth_type : nullptr;
+    for (size_t i = 0; i < policy.user_secure_id_count; ++i)
+        if (AuthTokenMatches(operation_params, policy.user_secure_ids[i], auth_type_mask,
+                             nullptr /* auth_timeout */, op_handle, false /* is_begin_operation */))
+            return KM_ERROR_OK;
+
+    if (policy.has_user_auth_type || policy.user_secure_id_count)
+        return KM_ERROR_KEY_USER_NOT_AUTHENTICATED;
+
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t KeymasterEnforcement::AuthorizeBegin(const keymaster_purpose_t purpose,
+                                                       const km_id_t keyid,
+                                                       const KeyEnforcementPolicy& policy,
+                                                       const AuthorizationSet& operation_params) {
+    keymaster_error_t error = authorized_purpose(purpose, policy);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    if (policy.invalid)
+        return KM_ERROR_INVALID_KEY_BLOB;
+
+    if (policy.has_active_datetime && !activation_date_valid(policy.active_datetime))
+        return KM_ERROR_KEY_NOT_YET_VALID;
+
+    if (policy.has_origination_expire_datetime && is_origination_purpose(purpose) &&
+        expiration_date_passed(policy.origination_expire_datetime))
+        return KM_ERROR_KEY_EXPIRED;
+
+    if (policy.has_usage_expire_datetime && is_usage_purpose(purpose) &&
+        expiration_date_passed(policy.usage_expire_datetime))
+        return KM_ERROR_KEY_EXPIRED;
+
+    if (policy.has_min_seconds_between_ops &&
+        !MinTimeBetweenOpsPassed(policy.min_seconds_between_ops, keyid))
+        return KM_ERROR_KEY_RATE_LIMIT_EXCEEDED;
+
+    if (policy.has_max_uses_per_boot &&
+        !MaxUsesPerBootNotExceeded(keyid, policy.max_uses_per_boot))
+        return KM_ERROR_KEY_MAX_OPS_EXCEEDED;
+
+    // Only timeout-based authentication is checked at begin; the rest is per-operation.
+    if (policy.has_auth_timeout && policy.user_secure_id_count) {
+        const uint32_t* auth_type_mask =
+            policy.has_user_auth_type ? &policy.user_auth_type : nullptr;
+        bool auth_token_matched = false;
+        for (size_t i = 0; i < policy.user_secure_id_count && !auth_token_matched; ++i)
+            auth_token_matched =
+                AuthTokenMatches(operation_params, policy.user_secure_ids[i], auth_type_mask,
+                                 &policy.auth_timeout, 0 /* op_handle */,
+                                 true /* is_begin_operation */);
+        if (!auth_token_matched) {
+            LOG_E("Auth required but no matching auth token found", 0);
+            return KM_ERROR_KEY_USER_NOT_AUTHENTICATED;
+        }
+    }
+
+    if (!policy.caller_nonce && is_origination_purpose(purpose) &&
+        operation_params.find(KM_TAG_NONCE) != -1)
+        return KM_ERROR_CALLER_NONCE_PROHIBITED;
+
+    return RecordKeyAccess(keyid,
+                           policy.has_min_seconds_between_ops ? policy.min_seconds_between_ops
+                                                              : UINT32_MAX,
+                           policy.has_max_uses_per_boot);
+}
+
+template <typename T> static void keep_largest(T value, bool* has_value, T* kept) {
+    if (!*has_value || value > *kept)
+        *kept = value;
+    *has_value = true;
+}
+
+template <typename T> static void keep_smallest(T value, bool* has_value, T* kept) {
+    if (!*has_value || value < *kept)
+        *kept = value;
+    *has_value = true;
+}
+
+keymaster_error_t KeymasterEnforcement::CompileKeyPolicy(const AuthProxy& auth_set,
+                                                         KeyEnforcementPolicy* policy) {
+    policy->Reset();
+    policy->public_key = is_public_key_algorithm(auth_set);
+
+    size_t user_secure_id_count = 0;
+    for (auto& param : auth_set)
+        if (param.tag == KM_TAG_USER_SECURE_ID)
+            ++user_secure_id_count;
+    if (user_secure_id_count) {
+        policy->user_secure_ids.reset(new (std::nothrow) uint64_t[user_secure_id_count]);
+        if (!policy->user_secure_ids.get())
+            return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    }
+
+    for (auto& param : auth_set) {
+        switch (param.tag) {
+        case KM_TAG_PURPOSE:
+            if (param.enumerated < 32)
+                policy->purposes |= 1U << param.enumerated;
+            break;
+
+        case KM_TAG_ACTIVE_DATETIME:
+            keep_largest(param.date_time, &policy->has_active_datetime, &policy->active_datetime);
+            break;
+
+        case KM_TAG_ORIGINATION_EXPIRE_DATETIME:
+            keep_smallest(param.date_time, &policy->has_origination_expire_datetime,
+                          &policy->origination_expire_datetime);
+            break;
+
+        case KM_TAG_USAGE_EXPIRE_DATETIME:
+            keep_smallest(param.date_time, &policy->has_usage_expire_datetime,
+                          &policy->usage_expire_datetime);
+            break;
+
+        case KM_TAG_MIN_SECONDS_BETWEEN_OPS:
+            keep_largest(param.integer, &policy->has_min_seconds_between_ops,
+                         &policy->min_seconds_between_ops);
+            break;
+
+        case KM_TAG_MAX_USES_PER_BOOT:
+            keep_smallest(param.integer, &policy->has_max_uses_per_boot,
+                          &policy->max_uses_per_boot);
+            break;
+
+        case KM_TAG_USER_SECURE_ID:
+            policy->user_secure_ids[policy->user_secure_id_count++] = param.long_integer;
+            break;
+
+        case KM_TAG_USER_AUTH_TYPE:
+            policy->has_user_auth_type = true;
+            policy->user_auth_type = param.integer;
+            break;
+
+        case KM_TAG_AUTH_TIMEOUT:
+            policy->has_auth_timeout = true;
+            policy->auth_timeout = param.integer;
+            break;
+
+        case KM_TAG_NO_AUTH_REQUIRED:
+            policy->no_auth_required = true;
+            break;
+
+        case KM_TAG_TRUSTED_CONFIRMATION_REQUIRED:
+            policy->trusted_confirmation_required = true;
+            break;
+
+        case KM_TAG_CALLER_NONCE:
+            policy->caller_nonce = true;
+            break;
+
+        /* Tags should never be in key auths. */
+        case KM_TAG_INVALID:
+        case KM_TAG_AUTH_TOKEN:
+        case KM_TAG_ROOT_OF_TRUST:
+        case KM_TAG_APPLICATION_DATA:
+        case KM_TAG_ATTESTATION_CHALLENGE:
+        case KM_TAG_ATTESTATION_APPLICATION_ID:
+        case KM_TAG_ATTESTATION_ID_BRAND:
+        case KM_TAG_ATTESTATION_ID_DEVICE:
+        case KM_TAG_ATTESTATION_ID_PRODUCT:
+        case KM_TAG_ATTESTATION_ID_SERIAL:
+        case KM_TAG_ATTESTATION_ID_IMEI:
+        case KM_TAG_ATTESTATION_ID_MEID:
+        case KM_TAG_ATTESTATION_ID_MANUFACTURER:
+        case KM_TAG_ATTESTATION_ID_MODEL:
+        case KM_TAG_BOOTLOADER_ONLY:
+            policy->invalid = true;
+            break;
+
+        /* Everything else is either not enforced here or not enforced at all. */
+        default:
+            break;
+        }
+    }
+
+    // Key has both KM_TAG_USER_SECURE_ID and KM_TAG_NO_AUTH_REQUIRED
+    if (policy->user_secure_id_count && policy->no_auth_required)
+        policy->invalid = true;
+
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t KeymasterEnforcement::RecordKeyAccess(const km_id_t keyid,
+                                                        uint32_t min_ops_timeout,
+                                                        bool update_access_count) {
     if (min_ops_timeout != UINT32_MAX) {
         if (!access_time_map_) {
             LOG_S("Rate-limited keys table not allocated.  Rate-limited keys disabled", 0);
@@ -440,6 +681,36 @@ bool KeymasterEnforcement::AuthTokenMatches(const AuthProxy& auth_set,
     assert(auth_type_index < static_cast<int>(auth_set.size()));
     assert(auth_timeout_index < static_cast<int>(auth_set.size()));
 
+    uint32_t auth_type_mask = 0;
+    bool has_auth_type =
+        auth_type_index >= 0 && auth_type_index < static_cast<int>(auth_set.size());
+    if (has_auth_type) {
+        assert(auth_set[auth_type_index].tag == KM_TAG_USER_AUTH_TYPE);
+        if (auth_set[auth_type_index].tag != KM_TAG_USER_AUTH_TYPE)
+            return false;
+        auth_type_mask = auth_set[auth_type_index].integer;
+    }
+
+    uint32_t auth_timeout = 0;
+    if (auth_timeout_index != -1) {
+        assert(auth_set[auth_timeout_index].tag == KM_TAG_AUTH_TIMEOUT);
+        if (auth_set[auth_timeout_index].tag != KM_TAG_AUTH_TIMEOUT)
+            return false;
+        auth_timeout = auth_set[auth_timeout_index].integer;
+    }
+
+    return AuthTokenMatches(operation_params, user_secure_id,
+                            has_auth_type ? &auth_type_mask : nullptr,
+                            auth_timeout_index != -1 ? &auth_timeout : nullptr, op_handle,
+                            is_begin_operation);
+}
+
+bool KeymasterEnforcement::AuthTokenMatches(const AuthorizationSet& operation_params,
+                                            const uint64_t user_secure_id,
+                                            const uint32_t* auth_type_mask,
+                                            const uint32_t* auth_timeout,
+                                            const keymaster_operation_handle_t op_handle,
+                                            bool is_begin_operation) const {
     keymaster_blob_t auth_token_blob;
     if (!operation_params.GetTagValue(TAG_AUTH_TOKEN, &auth_token_blob)) {
         LOG_E("Authentication required, but auth token not provided", 0);
@@ -465,7 +736,7 @@ bool KeymasterEnforcement::AuthTokenMatches(const AuthProxy& auth_set,
         return false;
     }
 
-    if (auth_timeout_index == -1 && op_handle && op_handle != auth_token.challenge) {
+    if (!auth_timeout && op_handle && op_handle != auth_token.challenge) {
         LOG_E("Auth token has the challenge %llu, need %llu", auth_token.challenge, op_handle);
         return false;
     }
@@ -476,16 +747,12 @@ bool KeymasterEnforcement::AuthTokenMatches(const AuthProxy& auth_set,
         return false;
     }
 
-    if (auth_type_index < 0 || auth_type_index > static_cast<int>(auth_set.size())) {
+    if (!auth_type_mask) {
         LOG_E("Auth required but no auth type found", 0);
         return false;
     }
 
-    assert(auth_set[auth_type_index].tag == KM_TAG_USER_AUTH_TYPE);
-    if (auth_set[auth_type_index].tag != KM_TAG_USER_AUTH_TYPE)
-        return false;
-
-    uint32_t key_auth_type_mask = auth_set[auth_type_index].integer;
+    uint32_t key_auth_type_mask = *auth_type_mask;
     uint32_t token_auth_type = ntoh(auth_token.authenticator_type);
     if ((key_auth_type_mask & token_auth_type) == 0) {
         LOG_E("Key requires match of auth type mask 0%uo, but token contained 0%uo",
@@ -493,12 +760,8 @@ bool KeymasterEnforcement::AuthTokenMatches(const AuthProxy& auth_set,
         return false;
     }
 
-    if (auth_timeout_index != -1 && is_begin_operation) {
-        assert(auth_set[auth_timeout_index].tag == KM_TAG_AUTH_TIMEOUT);
-        if (auth_set[auth_timeout_index].tag != KM_TAG_AUTH_TIMEOUT)
-            return false;
-
-        if (auth_token_timed_out(auth_token, auth_set[auth_timeout_index].integer)) {
+    if (auth_timeout && is_begin_operation) {
+        if (auth_token_timed_out(auth_token, *auth_timeout)) {
             LOG_E("Auth token has timed out", 0);
             return false;
         }
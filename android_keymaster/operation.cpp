@@ -70,6 +70,10 @@ bool OperationFactory::is_public_key_operation() const {
     if (!is_public_key_algorithm(key_type.algorithm))
         return false;
 
+    // Key agreement uses the private key.
+    if (key_type.purpose == KM_PURPOSE_AGREE_KEY)
+        return false;
+
     switch (key_type.purpose) {
     case KM_PURPOSE_VERIFY:
     case KM_PURPOSE_ENCRYPT:
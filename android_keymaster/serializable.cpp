@@ -67,6 +67,21 @@ bool copy_size_and_data_from_buf(const uint8_t** buf_ptr, const uint8_t* end, si
     return copy_from_buf(buf_ptr, end, dest->get(), *size);
 }
 
+bool skip_size_and_data_in_buf(const uint8_t** buf_ptr, const uint8_t* end) {
+    size_t size;
+    if (!copy_uint32_from_buf(buf_ptr, end, &size))
+        return false;
+
+    if (__pval(*buf_ptr) + size < __pval(*buf_ptr))  // Pointer wrap check
+        return false;
+
+    if (*buf_ptr + size > end)
+        return false;
+
+    *buf_ptr += size;
+    return true;
+}
+
 bool Buffer::reserve(size_t size) {
     if (available_write() < size) {
         size_t new_size = buffer_size_ + size - available_write();
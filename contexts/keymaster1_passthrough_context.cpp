@@ -104,15 +104,24 @@ keymaster_error_t Keymaster1PassthroughContext::UpgradeKeyBlob(
         return KM_ERROR_INVALID_ARGUMENT;
     }
 
-    return UpgradeSoftKeyBlob(key, os_version_, os_patchlevel_, upgrade_params, upgraded_key);
+    error = UpgradeSoftKeyBlob(key, os_version_, os_patchlevel_, upgrade_params, upgraded_key);
+    if (error == KM_ERROR_OK)
+        characteristics_cache_.Invalidate(key_to_upgrade);
+    return error;
 }
 
 static keymaster_error_t parseKeymaster1HwBlob(const keymaster1_device_t* device,
+                                               KeyCharacteristicsCache* cache,
                                                const KeymasterKeyBlob& blob,
                                                const AuthorizationSet& additional_params,
                                                KeymasterKeyBlob* key_material,
                                                AuthorizationSet* hw_enforced,
                                                AuthorizationSet* sw_enforced) {
+    if (cache->Lookup(blob, additional_params, hw_enforced, sw_enforced)) {
+        *key_material = blob;
+        return KM_ERROR_OK;
+    }
+
     keymaster_blob_t client_id = {nullptr, 0};
     keymaster_blob_t app_data = {nullptr, 0};
     keymaster_blob_t* client_id_ptr = nullptr;
@@ -134,6 +143,7 @@ static keymaster_error_t parseKeymaster1HwBlob(const keymaster1_device_t* device
 
     hw_enforced->Reinitialize(characteristics->hw_enforced);
     sw_enforced->Reinitialize(characteristics->sw_enforced);
+    cache->Insert(blob, additional_params, *hw_enforced, *sw_enforced);
     *key_material = blob;
     return KM_ERROR_OK;
 }
@@ -156,8 +166,9 @@ keymaster_error_t Keymaster1PassthroughContext::ParseKeyBlob(const KeymasterKeyB
         return error;
 
     if (error == KM_ERROR_INVALID_KEY_BLOB) {
-        error = parseKeymaster1HwBlob(km1_engine_->device(), blob, additional_params,
-                                      &key_material, &hw_enforced, &sw_enforced);
+        error = parseKeymaster1HwBlob(km1_engine_->device(), &characteristics_cache_, blob,
+                                      additional_params, &key_material, &hw_enforced,
+                                      &sw_enforced);
         if (error != KM_ERROR_OK) return error;
     }
 
@@ -174,6 +185,8 @@ keymaster_error_t Keymaster1PassthroughContext::ParseKeyBlob(const KeymasterKeyB
 }
 
 keymaster_error_t Keymaster1PassthroughContext::DeleteKey(const KeymasterKeyBlob& blob) const {
+     characteristics_cache_.Invalidate(blob);
+
      // HACK. Due to a bug with Qualcomm's Keymaster implementation, which causes the device to
      // reboot if we pass it a key blob it doesn't understand, we need to check for software
      // keys.  If it looks like a software key there's nothing to do so we just return.
@@ -197,6 +210,7 @@ keymaster_error_t Keymaster1PassthroughContext::DeleteKey(const KeymasterKeyBlob
 }
 
 keymaster_error_t Keymaster1PassthroughContext::DeleteAllKeys() const {
+    characteristics_cache_.Clear();
     return km1_engine_->DeleteAllKeys();
 }
 
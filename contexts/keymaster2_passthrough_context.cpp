@@ -22,8 +22,10 @@
 
 namespace keymaster {
 
-Keymaster2PassthroughContext::Keymaster2PassthroughContext(keymaster2_device_t* dev)
-        : device_(dev), engine_(KeymasterPassthroughEngine::createInstance(dev)) {
+Keymaster2PassthroughContext::Keymaster2PassthroughContext(keymaster2_device_t* dev,
+                                                           size_t characteristics_cache_size)
+        : device_(dev), engine_(KeymasterPassthroughEngine::createInstance(dev)),
+          characteristics_cache_(characteristics_cache_size) {
 
 }
 
@@ -63,35 +65,42 @@ keymaster_error_t Keymaster2PassthroughContext::UpgradeKeyBlob(
         KeymasterKeyBlob* upgraded_key) const {
     if (!upgraded_key) return KM_ERROR_UNEXPECTED_NULL_POINTER;
     *upgraded_key = {};
-    return device_->upgrade_key(device_, &key_to_upgrade, &upgrade_params, upgraded_key);
+    keymaster_error_t error =
+        device_->upgrade_key(device_, &key_to_upgrade, &upgrade_params, upgraded_key);
+    if (error == KM_ERROR_OK)
+        characteristics_cache_.Invalidate(key_to_upgrade);
+    return error;
 }
 
 keymaster_error_t Keymaster2PassthroughContext::ParseKeyBlob(const KeymasterKeyBlob& blob,
         const AuthorizationSet& additional_params, UniquePtr<Key>* key) const {
-    keymaster_key_characteristics_t characteristics = {};
-    keymaster_blob_t clientId;
-    keymaster_blob_t applicationData;
-    keymaster_blob_t* clientIdPtr = &clientId;
-    keymaster_blob_t* applicationDataPtr = &applicationData;
-    if (!additional_params.GetTagValue(TAG_APPLICATION_ID, clientIdPtr)) {
-        clientIdPtr = nullptr;
-    }
-    if (!additional_params.GetTagValue(TAG_APPLICATION_DATA, applicationDataPtr)) {
-        applicationDataPtr = nullptr;
-    }
+    AuthorizationSet hw_enforced;
+    AuthorizationSet sw_enforced;
+    if (!characteristics_cache_.Lookup(blob, additional_params, &hw_enforced, &sw_enforced)) {
+        keymaster_key_characteristics_t characteristics = {};
+        keymaster_blob_t clientId;
+        keymaster_blob_t applicationData;
+        keymaster_blob_t* clientIdPtr = &clientId;
+        keymaster_blob_t* applicationDataPtr = &applicationData;
+        if (!additional_params.GetTagValue(TAG_APPLICATION_ID, clientIdPtr)) {
+            clientIdPtr = nullptr;
+        }
+        if (!additional_params.GetTagValue(TAG_APPLICATION_DATA, applicationDataPtr)) {
+            applicationDataPtr = nullptr;
+        }
 
-    auto rc = device_->get_key_characteristics(device_, &blob, clientIdPtr, applicationDataPtr,
-                                               &characteristics);
+        auto rc = device_->get_key_characteristics(device_, &blob, clientIdPtr,
+                                                   applicationDataPtr, &characteristics);
 
-    if (rc != KM_ERROR_OK) return rc;
+        if (rc != KM_ERROR_OK) return rc;
 
-    AuthorizationSet hw_enforced;
-    AuthorizationSet sw_enforced;
+        hw_enforced.Reinitialize(characteristics.hw_enforced);
+        sw_enforced.Reinitialize(characteristics.sw_enforced);
 
-    hw_enforced.Reinitialize(characteristics.hw_enforced);
-    sw_enforced.Reinitialize(characteristics.sw_enforced);
+        keymaster_free_characteristics(&characteristics);
 
-    keymaster_free_characteristics(&characteristics);
+        characteristics_cache_.Insert(blob, additional_params, hw_enforced, sw_enforced);
+    }
 
     // GetKeyFactory
     keymaster_algorithm_t algorithm;
@@ -107,10 +116,12 @@ keymaster_error_t Keymaster2PassthroughContext::ParseKeyBlob(const KeymasterKeyB
 }
 
 keymaster_error_t Keymaster2PassthroughContext::DeleteKey(const KeymasterKeyBlob& blob) const {
+    characteristics_cache_.Invalidate(blob);
     return device_->delete_key(device_, &blob);
 }
 
 keymaster_error_t Keymaster2PassthroughContext::DeleteAllKeys() const {
+    characteristics_cache_.Clear();
     return device_->delete_all_keys(device_);
 }
 
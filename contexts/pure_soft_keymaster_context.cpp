@@ -55,10 +55,16 @@ PureSoftKeymasterContext::PureSoftKeymasterContext()
       aes_factory_(new AesKeyFactory(this, this)),
       tdes_factory_(new TripleDesKeyFactory(this, this)),
       hmac_factory_(new HmacKeyFactory(this, this)), os_version_(0), os_patchlevel_(0),
-      soft_keymaster_enforcement_(64, 64) {}
+      soft_keymaster_enforcement_(64, 64) {
+    DrbgRandomSource::InstallForGenerateRandom();
+}
 
 PureSoftKeymasterContext::~PureSoftKeymasterContext() {}
 
+void PureSoftKeymasterContext::set_precompute_ec_signing(bool precompute_signing) {
+    static_cast<EcKeyFactory*>(ec_factory_.get())->set_precompute_signing(precompute_signing);
+}
+
 keymaster_error_t PureSoftKeymasterContext::SetSystemVersion(uint32_t os_version,
                                                          uint32_t os_patchlevel) {
     os_version_ = os_version;
@@ -138,6 +144,43 @@ keymaster_error_t PureSoftKeymasterContext::UpgradeKeyBlob(const KeymasterKeyBlo
 keymaster_error_t PureSoftKeymasterContext::ParseKeyBlob(const KeymasterKeyBlob& blob,
                                                          const AuthorizationSet& additional_params,
                                                          UniquePtr<Key>* key) const {
+    AuthorizationSet hw_enforced;
+    AuthorizationSet sw_enforced;
+    KeymasterKeyBlob key_material;
+    keymaster_error_t error =
+        DeserializeKeyBlob(blob, additional_params, &key_material, &hw_enforced, &sw_enforced);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    // GetKeyFactory
+    keymaster_algorithm_t algorithm;
+    if (!hw_enforced.GetTagValue(TAG_ALGORITHM, &algorithm) &&
+        !sw_enforced.GetTagValue(TAG_ALGORITHM, &algorithm)) {
+        return KM_ERROR_INVALID_ARGUMENT;
+    }
+    auto factory = GetKeyFactory(algorithm);
+    return factory->LoadKey(move(key_material), additional_params, move(hw_enforced),
+                            move(sw_enforced), key);
+}
+
+keymaster_error_t PureSoftKeymasterContext::ParseKeyBlobAuthorizations(
+    const KeymasterKeyBlob& blob, const AuthorizationSet& additional_params,
+    AuthorizationSet* hw_enforced, AuthorizationSet* sw_enforced) const {
+    KeymasterKeyBlob key_material;
+    keymaster_error_t error =
+        DeserializeKeyBlob(blob, additional_params, &key_material, hw_enforced, sw_enforced);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    if (!hw_enforced->Contains(TAG_ALGORITHM) && !sw_enforced->Contains(TAG_ALGORITHM))
+        return KM_ERROR_INVALID_ARGUMENT;
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t PureSoftKeymasterContext::DeserializeKeyBlob(
+    const KeymasterKeyBlob& blob, const AuthorizationSet& additional_params,
+    KeymasterKeyBlob* key_material, AuthorizationSet* hw_enforced,
+    AuthorizationSet* sw_enforced) const {
     // This is a little bit complicated.
     //
     // The SoftKeymasterContext has to handle a lot of different kinds of key blobs.
@@ -160,48 +203,53 @@ keymaster_error_t PureSoftKeymasterContext::ParseKeyBlob(const KeymasterKeyBlob&
     // integrity-assured nor OCB-encrypted and lacks the old software key header is assumed to be
     // keymaster0 hardware.
 
-    AuthorizationSet hw_enforced;
-    AuthorizationSet sw_enforced;
-    KeymasterKeyBlob key_material;
-    keymaster_error_t error;
-
-    auto constructKey = [&, this] () mutable -> keymaster_error_t {
-        // GetKeyFactory
-        if (error != KM_ERROR_OK) return error;
-        keymaster_algorithm_t algorithm;
-        if (!hw_enforced.GetTagValue(TAG_ALGORITHM, &algorithm) &&
-            !sw_enforced.GetTagValue(TAG_ALGORITHM, &algorithm)) {
-            return KM_ERROR_INVALID_ARGUMENT;
-        }
-        auto factory = GetKeyFactory(algorithm);
-        return factory->LoadKey(move(key_material), additional_params, move(hw_enforced),
-                                move(sw_enforced), key);
-    };
-
     AuthorizationSet hidden;
-    error = BuildHiddenAuthorizations(additional_params, &hidden, softwareRootOfTrust);
+    keymaster_error_t error =
+        BuildHiddenAuthorizations(additional_params, &hidden, softwareRootOfTrust);
     if (error != KM_ERROR_OK)
         return error;
 
+    // The header and length fields rule out most formats before any crypto is done, so only the
+    // formats that the blob could actually be in are tried.
+    uint32_t formats = ClassifySoftwareKeyBlob(blob);
+
     // Assume it's an integrity-assured blob (new software-only blob, or new keymaster0-backed
     // blob).
-    error = DeserializeIntegrityAssuredBlob(blob, hidden, &key_material, &hw_enforced, &sw_enforced);
-    if (error != KM_ERROR_INVALID_KEY_BLOB)
-        return constructKey();
+    if (formats & SOFTWARE_BLOB_INTEGRITY_ASSURED) {
+        error =
+            DeserializeIntegrityAssuredBlob(blob, hidden, key_material, hw_enforced, sw_enforced);
+        if (error != KM_ERROR_INVALID_KEY_BLOB)
+            return error;
+    }
 
     // Wasn't an integrity-assured blob.  Maybe it's an OCB-encrypted blob.
-    error = ParseOcbAuthEncryptedBlob(blob, hidden, &key_material, &hw_enforced, &sw_enforced);
-    if (error == KM_ERROR_OK)
-        LOG_D("Parsed an old keymaster1 software key", 0);
-    if (error != KM_ERROR_INVALID_KEY_BLOB)
-        return constructKey();
+    if (formats & SOFTWARE_BLOB_OCB_AUTH_ENCRYPTED) {
+        error = ParseOcbAuthEncryptedBlob(blob, hidden, key_material, hw_enforced, sw_enforced);
+        if (error == KM_ERROR_OK)
+            LOG_D("Parsed an old keymaster1 software key", 0);
+        if (error != KM_ERROR_INVALID_KEY_BLOB)
+            return error;
+    }
 
     // Wasn't an OCB-encrypted blob.  Maybe it's an old softkeymaster blob.
-    error = ParseOldSoftkeymasterBlob(blob, &key_material, &hw_enforced, &sw_enforced);
-    if (error == KM_ERROR_OK)
-        LOG_D("Parsed an old sofkeymaster key", 0);
+    if (formats & SOFTWARE_BLOB_OLD_SOFTKEYMASTER) {
+        error = ParseOldSoftkeymasterBlob(blob, key_material, hw_enforced, sw_enforced);
+        if (error == KM_ERROR_OK)
+            LOG_D("Parsed an old sofkeymaster key", 0);
+        return error;
+    }
+    return KM_ERROR_INVALID_KEY_BLOB;
+}
 
-    return constructKey();
+keymaster_error_t PureSoftKeymasterContext::MigrateKeyBlob(
+    const KeymasterKeyBlob& blob, const AuthorizationSet& additional_params,
+    KeymasterKeyBlob* migrated_blob) const {
+    AuthorizationSet hidden;
+    keymaster_error_t error =
+        BuildHiddenAuthorizations(additional_params, &hidden, softwareRootOfTrust);
+    if (error != KM_ERROR_OK)
+        return error;
+    return MigrateLegacySoftwareKeyBlob(blob, hidden, migrated_blob);
 }
 
 keymaster_error_t PureSoftKeymasterContext::DeleteKey(const KeymasterKeyBlob& /* blob */) const {
@@ -217,6 +265,7 @@ keymaster_error_t PureSoftKeymasterContext::AddRngEntropy(const uint8_t* buf, si
     // XXX TODO according to boringssl openssl/rand.h RAND_add is deprecated and does
     // nothing
     RAND_add(buf, length, 0 /* Don't assume any entropy is added to the pool. */);
+    DrbgRandomSource::AddEntropy(buf, length);
     return KM_ERROR_OK;
 }
 
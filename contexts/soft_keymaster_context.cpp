@@ -28,6 +28,7 @@
 #include <keymaster/km_openssl/aes_key.h>
 #include <keymaster/km_openssl/asymmetric_key.h>
 #include <keymaster/km_openssl/attestation_utils.h>
+#include <keymaster/km_openssl/ec_key_factory.h>
 #include <keymaster/km_openssl/hmac_key.h>
 #include <keymaster/km_openssl/openssl_err.h>
 #include <keymaster/km_openssl/triple_des_key.h>
@@ -57,7 +58,10 @@ SoftKeymasterContext::SoftKeymasterContext(const std::string& root_of_trust)
       aes_factory_(new AesKeyFactory(this, this)),
       tdes_factory_(new TripleDesKeyFactory(this, this)),
       hmac_factory_(new HmacKeyFactory(this, this)), km1_dev_(nullptr),
-      root_of_trust_(string2Blob(root_of_trust)), os_version_(0), os_patchlevel_(0) {}
+      root_of_trust_(string2Blob(root_of_trust)), os_version_(0), os_patchlevel_(0),
+      precompute_ec_signing_(false) {
+    DrbgRandomSource::InstallForGenerateRandom();
+}
 
 SoftKeymasterContext::~SoftKeymasterContext() {}
 
@@ -73,6 +77,7 @@ keymaster_error_t SoftKeymasterContext::SetHardwareDevice(keymaster0_device_t* k
     km0_engine_.reset(new Keymaster0Engine(keymaster0_device));
     rsa_factory_.reset(new RsaKeymaster0KeyFactory(this, km0_engine_.get()));
     ec_factory_.reset(new EcdsaKeymaster0KeyFactory(this, km0_engine_.get()));
+    set_precompute_ec_signing(precompute_ec_signing_);
     // Keep AES and HMAC factories.
 
     return KM_ERROR_OK;
@@ -87,6 +92,7 @@ keymaster_error_t SoftKeymasterContext::SetHardwareDevice(keymaster1_device_t* k
     km1_engine_.reset(new Keymaster1Engine(keymaster1_device));
     rsa_factory_.reset(new RsaKeymaster1KeyFactory(this, km1_engine_.get()));
     ec_factory_.reset(new EcdsaKeymaster1KeyFactory(this, km1_engine_.get()));
+    set_precompute_ec_signing(precompute_ec_signing_);
 
     // Use default HMAC and AES key factories. Higher layers will pass HMAC/AES keys/ops that are
     // supported by the hardware to it and other ones to the software-only factory.
@@ -94,6 +100,12 @@ keymaster_error_t SoftKeymasterContext::SetHardwareDevice(keymaster1_device_t* k
     return KM_ERROR_OK;
 }
 
+void SoftKeymasterContext::set_precompute_ec_signing(bool precompute_signing) {
+    // The keymaster0/1 EC factories are EcKeyFactory subclasses; keys in the device ignore this.
+    precompute_ec_signing_ = precompute_signing;
+    static_cast<EcKeyFactory*>(ec_factory_.get())->set_precompute_signing(precompute_signing);
+}
+
 keymaster_error_t SoftKeymasterContext::SetSystemVersion(uint32_t os_version,
                                                          uint32_t os_patchlevel) {
     os_version_ = os_version;
@@ -237,12 +249,53 @@ keymaster_error_t SoftKeymasterContext::UpgradeKeyBlob(const KeymasterKeyBlob& k
         return KM_ERROR_INVALID_ARGUMENT;
 
     // Handle case 1 and 2
-    return UpgradeSoftKeyBlob(key, os_version_, os_patchlevel_, upgrade_params, upgraded_key);
+    error = UpgradeSoftKeyBlob(key, os_version_, os_patchlevel_, upgrade_params, upgraded_key);
+    if (error == KM_ERROR_OK)
+        km1_characteristics_cache_.Invalidate(key_to_upgrade);
+    return error;
 }
 
 keymaster_error_t SoftKeymasterContext::ParseKeyBlob(const KeymasterKeyBlob& blob,
                                                      const AuthorizationSet& additional_params,
                                                      UniquePtr<Key>* key) const {
+    AuthorizationSet hw_enforced;
+    AuthorizationSet sw_enforced;
+    KeymasterKeyBlob key_material;
+    keymaster_error_t error =
+        DeserializeKeyBlob(blob, additional_params, &key_material, &hw_enforced, &sw_enforced);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    // GetKeyFactory
+    keymaster_algorithm_t algorithm;
+    if (!hw_enforced.GetTagValue(TAG_ALGORITHM, &algorithm) &&
+        !sw_enforced.GetTagValue(TAG_ALGORITHM, &algorithm)) {
+        return KM_ERROR_INVALID_ARGUMENT;
+    }
+    auto factory = GetKeyFactory(algorithm);
+    return factory->LoadKey(move(key_material), additional_params, move(hw_enforced),
+                            move(sw_enforced), key);
+}
+
+keymaster_error_t SoftKeymasterContext::ParseKeyBlobAuthorizations(
+    const KeymasterKeyBlob& blob, const AuthorizationSet& additional_params,
+    AuthorizationSet* hw_enforced, AuthorizationSet* sw_enforced) const {
+    KeymasterKeyBlob key_material;
+    keymaster_error_t error =
+        DeserializeKeyBlob(blob, additional_params, &key_material, hw_enforced, sw_enforced);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    if (!hw_enforced->Contains(TAG_ALGORITHM) && !sw_enforced->Contains(TAG_ALGORITHM))
+        return KM_ERROR_INVALID_ARGUMENT;
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t SoftKeymasterContext::DeserializeKeyBlob(const KeymasterKeyBlob& blob,
+                                                           const AuthorizationSet& additional_params,
+                                                           KeymasterKeyBlob* key_material,
+                                                           AuthorizationSet* hw_enforced,
+                                                           AuthorizationSet* sw_enforced) const {
     // This is a little bit complicated.
     //
     // The SoftKeymasterContext has to handle a lot of different kinds of key blobs.
@@ -275,62 +328,86 @@ keymaster_error_t SoftKeymasterContext::ParseKeyBlob(const KeymasterKeyBlob& blo
     // integrity-assured nor OCB-encrypted and lacks the old software key header is assumed to be
     // keymaster0 hardware.
 
-    AuthorizationSet hw_enforced;
-    AuthorizationSet sw_enforced;
-    KeymasterKeyBlob key_material;
     AuthorizationSet hidden;
-    keymaster_error_t error;
-
-    auto constructKey = [&, this] () mutable -> keymaster_error_t {
-        // GetKeyFactory
-        if (error != KM_ERROR_OK) return error;
-        keymaster_algorithm_t algorithm;
-        if (!hw_enforced.GetTagValue(TAG_ALGORITHM, &algorithm) &&
-            !sw_enforced.GetTagValue(TAG_ALGORITHM, &algorithm)) {
-            return KM_ERROR_INVALID_ARGUMENT;
-        }
-        auto factory = GetKeyFactory(algorithm);
-        return factory->LoadKey(move(key_material), additional_params, move(hw_enforced),
-                                move(sw_enforced), key);
-    };
-
-    error = BuildHiddenAuthorizations(additional_params, &hidden, root_of_trust_);
+    keymaster_error_t error = BuildHiddenAuthorizations(additional_params, &hidden, root_of_trust_);
     if (error != KM_ERROR_OK)
         return error;
 
+    // The header and length fields rule out most formats before any crypto is done, so only the
+    // formats that the blob could actually be in are tried.
+    uint32_t formats = ClassifySoftwareKeyBlob(blob);
+
     // Assume it's an integrity-assured blob (new software-only blob, or new keymaster0-backed
     // blob).
-    error = DeserializeIntegrityAssuredBlob(blob, hidden, &key_material, &hw_enforced, &sw_enforced);
-    if (error != KM_ERROR_INVALID_KEY_BLOB)
-        return constructKey();
+    if (formats & SOFTWARE_BLOB_INTEGRITY_ASSURED) {
+        error =
+            DeserializeIntegrityAssuredBlob(blob, hidden, key_material, hw_enforced, sw_enforced);
+        if (error != KM_ERROR_INVALID_KEY_BLOB)
+            return error;
+    }
 
     // Wasn't an integrity-assured blob.  Maybe it's an OCB-encrypted blob.
-    error = ParseOcbAuthEncryptedBlob(blob, hidden, &key_material, &hw_enforced, &sw_enforced);
-    if (error == KM_ERROR_OK)
-        LOG_D("Parsed an old keymaster1 software key", 0);
-    if (error != KM_ERROR_INVALID_KEY_BLOB)
-        return constructKey();
+    if (formats & SOFTWARE_BLOB_OCB_AUTH_ENCRYPTED) {
+        error = ParseOcbAuthEncryptedBlob(blob, hidden, key_material, hw_enforced, sw_enforced);
+        if (error == KM_ERROR_OK)
+            LOG_D("Parsed an old keymaster1 software key", 0);
+        if (error != KM_ERROR_INVALID_KEY_BLOB)
+            return error;
+    }
 
     // Wasn't an OCB-encrypted blob.  Maybe it's an old softkeymaster blob.
-    error = ParseOldSoftkeymasterBlob(blob, &key_material, &hw_enforced, &sw_enforced);
-    if (error == KM_ERROR_OK)
-        LOG_D("Parsed an old sofkeymaster key", 0);
+    if (formats & SOFTWARE_BLOB_OLD_SOFTKEYMASTER) {
+        error = ParseOldSoftkeymasterBlob(blob, key_material, hw_enforced, sw_enforced);
+        if (error == KM_ERROR_OK)
+            LOG_D("Parsed an old sofkeymaster key", 0);
+        if (error != KM_ERROR_INVALID_KEY_BLOB)
+            return error;
+    }
+
+    if (km1_dev_)
+        return ParseKeymaster1HwBlob(blob, additional_params, key_material, hw_enforced,
+                                     sw_enforced);
+    if (km0_engine_)
+        return ParseKeymaster0HwBlob(blob, key_material, hw_enforced, sw_enforced);
+    return KM_ERROR_INVALID_KEY_BLOB;
+}
+
+keymaster_error_t SoftKeymasterContext::MigrateKeyBlob(const KeymasterKeyBlob& blob,
+                                                       const AuthorizationSet& additional_params,
+                                                       KeymasterKeyBlob* migrated_blob) const {
+    AuthorizationSet hidden;
+    keymaster_error_t error = BuildHiddenAuthorizations(additional_params, &hidden, root_of_trust_);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    error = MigrateLegacySoftwareKeyBlob(blob, hidden, migrated_blob);
     if (error != KM_ERROR_INVALID_KEY_BLOB)
-        return constructKey();
+        return error;
 
+    KeymasterKeyBlob key_material;
+    AuthorizationSet hw_enforced, sw_enforced;
     if (km1_dev_) {
-        error = ParseKeymaster1HwBlob(blob, additional_params, &key_material, &hw_enforced,
-                                      &sw_enforced);
-    } else if (km0_engine_) {
+        // Keymaster1 hardware blobs are already as fast to use as they'll get.  Just make sure the
+        // hardware recognizes this one.
+        return ParseKeymaster1HwBlob(blob, additional_params, &key_material, &hw_enforced,
+                                     &sw_enforced);
+    }
+    if (km0_engine_) {
+        // Raw keymaster0 hardware blobs get wrapped the way newly-generated keymaster0-backed keys
+        // are, so that they carry real authorizations.
         error = ParseKeymaster0HwBlob(blob, &key_material, &hw_enforced, &sw_enforced);
-    } else {
-        return KM_ERROR_INVALID_KEY_BLOB;
+        if (error != KM_ERROR_OK)
+            return error;
+        return SerializeIntegrityAssuredBlob(key_material, hidden, hw_enforced, sw_enforced,
+                                             migrated_blob);
     }
-    return constructKey();
+    return KM_ERROR_INVALID_KEY_BLOB;
 }
 
 keymaster_error_t SoftKeymasterContext::DeleteKey(const KeymasterKeyBlob& blob) const {
     if (km1_engine_) {
+        km1_characteristics_cache_.Invalidate(blob);
+
         // HACK. Due to a bug with Qualcomm's Keymaster implementation, which causes the device to
         // reboot if we pass it a key blob it doesn't understand, we need to check for software
         // keys.  If it looks like a software key there's nothing to do so we just return.
@@ -378,8 +455,10 @@ keymaster_error_t SoftKeymasterContext::DeleteKey(const KeymasterKeyBlob& blob)
 }
 
 keymaster_error_t SoftKeymasterContext::DeleteAllKeys() const {
-    if (km1_engine_)
+    if (km1_engine_) {
+        km1_characteristics_cache_.Clear();
         return km1_engine_->DeleteAllKeys();
+    }
 
     if (km0_engine_ && !km0_engine_->DeleteAllKeys())
         return KM_ERROR_UNKNOWN_ERROR;
@@ -389,15 +468,40 @@ keymaster_error_t SoftKeymasterContext::DeleteAllKeys() const {
 
 keymaster_error_t SoftKeymasterContext::AddRngEntropy(const uint8_t* buf, size_t length) const {
     RAND_add(buf, length, 0 /* Don't assume any entropy is added to the pool. */);
+    DrbgRandomSource::AddEntropy(buf, length);
     return KM_ERROR_OK;
 }
 
+void SoftKeymasterContext::RunTasks(size_t num_tasks,
+                                    void (*task)(void* task_context, size_t index),
+                                    void* task_context) const {
+    // Operations on hardware-backed keys call into the wrapped device, which we can't assume is
+    // safe to call from several threads at once.
+    if (km0_engine_ || km1_dev_) {
+        KeymasterContext::RunTasks(num_tasks, task, task_context);
+        return;
+    }
+    thread_pool_.Run(num_tasks, task, task_context);
+}
+
+size_t SoftKeymasterContext::max_concurrent_tasks() const {
+    // Matches RunTasks.
+    if (km0_engine_ || km1_dev_)
+        return 1;
+    return thread_pool_.num_threads() + 1;
+}
+
 keymaster_error_t SoftKeymasterContext::ParseKeymaster1HwBlob(
     const KeymasterKeyBlob& blob, const AuthorizationSet& additional_params,
     KeymasterKeyBlob* key_material, AuthorizationSet* hw_enforced,
     AuthorizationSet* sw_enforced) const {
     assert(km1_dev_);
 
+    if (km1_characteristics_cache_.Lookup(blob, additional_params, hw_enforced, sw_enforced)) {
+        *key_material = blob;
+        return KM_ERROR_OK;
+    }
+
     keymaster_blob_t client_id = {nullptr, 0};
     keymaster_blob_t app_data = {nullptr, 0};
     keymaster_blob_t* client_id_ptr = nullptr;
@@ -420,6 +524,7 @@ keymaster_error_t SoftKeymasterContext::ParseKeymaster1HwBlob(
 
     hw_enforced->Reinitialize(characteristics->hw_enforced);
     sw_enforced->Reinitialize(characteristics->sw_enforced);
+    km1_characteristics_cache_.Insert(blob, additional_params, *hw_enforced, *sw_enforced);
     *key_material = blob;
     return KM_ERROR_OK;
 }
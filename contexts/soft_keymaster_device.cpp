@@ -42,6 +42,7 @@
 #include <keymaster/contexts/soft_keymaster_context.h>
 #include <keymaster/soft_keymaster_logger.h>
 #include <keymaster/key.h>
+#include <keymaster/legacy_support/keymaster1_digest_table.h>
 
 
 struct keystore_module soft_keymaster1_device_module = {
@@ -79,87 +80,6 @@ namespace keymaster {
 const size_t kMaximumAttestationChallengeLength = 128;
 const size_t kOperationTableSize = 16;
 
-template <typename T> std::vector<T> make_vector(const T* array, size_t len) {
-    return std::vector<T>(array, array + len);
-}
-
-// This helper class implements just enough of the C++ standard collection interface to be able to
-// accept push_back calls, and it does nothing but count them.  It's useful when you want to count
-// insertions but not actually store anything.  It's used in digest_set_is_full below to count the
-// size of a set intersection.
-struct PushbackCounter {
-    struct value_type {
-        // NOLINTNEXTLINE(google-explicit-constructor)
-        template <typename T> value_type(const T&) {}
-    };
-    void push_back(const value_type&) { ++count; }
-    size_t count = 0;
-};
-
-static std::vector<keymaster_digest_t> full_digest_list = {
-    KM_DIGEST_MD5,       KM_DIGEST_SHA1,      KM_DIGEST_SHA_2_224,
-    KM_DIGEST_SHA_2_256, KM_DIGEST_SHA_2_384, KM_DIGEST_SHA_2_512};
-
-template <typename Iter> static bool digest_set_is_full(Iter begin, Iter end) {
-    PushbackCounter counter;
-    std::set_intersection(begin, end, full_digest_list.begin(), full_digest_list.end(),
-                          std::back_inserter(counter));
-    return counter.count == full_digest_list.size();
-}
-
-static keymaster_error_t add_digests(keymaster1_device_t* dev, keymaster_algorithm_t algorithm,
-                                     keymaster_purpose_t purpose,
-                                     SoftKeymasterDevice::DigestMap* map, bool* supports_all) {
-    auto key = std::make_pair(algorithm, purpose);
-
-    keymaster_digest_t* digests;
-    size_t digests_length;
-    keymaster_error_t error =
-        dev->get_supported_digests(dev, algorithm, purpose, &digests, &digests_length);
-    if (error != KM_ERROR_OK) {
-        LOG_E("Error %d getting supported digests from keymaster1 device", error);
-        return error;
-    }
-    std::unique_ptr<keymaster_digest_t, Malloc_Delete> digests_deleter(digests);
-
-    auto digest_vec = make_vector(digests, digests_length);
-    *supports_all = digest_set_is_full(digest_vec.begin(), digest_vec.end());
-    (*map)[key] = std::move(digest_vec);
-    return error;
-}
-
-static keymaster_error_t map_digests(keymaster1_device_t* dev, SoftKeymasterDevice::DigestMap* map,
-                                     bool* supports_all) {
-    map->clear();
-    *supports_all = true;
-
-    keymaster_algorithm_t sig_algorithms[] = {KM_ALGORITHM_RSA, KM_ALGORITHM_EC, KM_ALGORITHM_HMAC};
-    keymaster_purpose_t sig_purposes[] = {KM_PURPOSE_SIGN, KM_PURPOSE_VERIFY};
-    for (auto algorithm : sig_algorithms)
-        for (auto purpose : sig_purposes) {
-            bool alg_purpose_supports_all;
-            keymaster_error_t error =
-                add_digests(dev, algorithm, purpose, map, &alg_purpose_supports_all);
-            if (error != KM_ERROR_OK)
-                return error;
-            *supports_all &= alg_purpose_supports_all;
-        }
-
-    keymaster_algorithm_t crypt_algorithms[] = {KM_ALGORITHM_RSA};
-    keymaster_purpose_t crypt_purposes[] = {KM_PURPOSE_ENCRYPT, KM_PURPOSE_DECRYPT};
-    for (auto algorithm : crypt_algorithms)
-        for (auto purpose : crypt_purposes) {
-            bool alg_purpose_supports_all;
-            keymaster_error_t error =
-                add_digests(dev, algorithm, purpose, map, &alg_purpose_supports_all);
-            if (error != KM_ERROR_OK)
-                return error;
-            *supports_all &= alg_purpose_supports_all;
-        }
-
-    return KM_ERROR_OK;
-}
-
 SoftKeymasterDevice::SoftKeymasterDevice()
     : wrapped_km1_device_(nullptr),
       context_(new SoftKeymasterContext),
@@ -167,6 +87,10 @@ SoftKeymasterDevice::SoftKeymasterDevice()
     LOG_I("Creating device", 0);
     LOG_D("Device address: %p", this);
 
+    keymaster_error_t error = impl_->BuildCapabilities();
+    if (error != KM_ERROR_OK)
+        LOG_E("Error %d building capability matrix", error);
+
     initialize_device_struct(KEYMASTER_SOFTWARE_ONLY | KEYMASTER_BLOBS_ARE_STANDALONE |
                              KEYMASTER_SUPPORTS_EC);
 }
@@ -177,6 +101,10 @@ SoftKeymasterDevice::SoftKeymasterDevice(SoftKeymasterContext* context)
     LOG_I("Creating test device", 0);
     LOG_D("Device address: %p", this);
 
+    keymaster_error_t error = impl_->BuildCapabilities();
+    if (error != KM_ERROR_OK)
+        LOG_E("Error %d building capability matrix", error);
+
     initialize_device_struct(KEYMASTER_SOFTWARE_ONLY | KEYMASTER_BLOBS_ARE_STANDALONE |
                              KEYMASTER_SUPPORTS_EC);
 }
@@ -188,8 +116,12 @@ keymaster_error_t SoftKeymasterDevice::SetHardwareDevice(keymaster0_device_t* ke
     if (!context_)
         return KM_ERROR_UNEXPECTED_NULL_POINTER;
 
-    supports_all_digests_ = false;
+    km1_device_digests_.Clear();
     keymaster_error_t error = context_->SetHardwareDevice(keymaster0_device);
+    if (error != KM_ERROR_OK)
+        return error;
+    // The factories have changed, so the capability matrix must be rebuilt to match.
+    error = impl_->BuildCapabilities();
     if (error != KM_ERROR_OK)
         return error;
 
@@ -216,12 +148,17 @@ keymaster_error_t SoftKeymasterDevice::SetHardwareDevice(keymaster1_device_t* ke
     if (!context_)
         return KM_ERROR_UNEXPECTED_NULL_POINTER;
 
-    keymaster_error_t error =
-        map_digests(keymaster1_device, &km1_device_digests_, &supports_all_digests_);
-    if (error != KM_ERROR_OK)
+    keymaster_error_t error = km1_device_digests_.Initialize(keymaster1_device);
+    if (error != KM_ERROR_OK) {
+        LOG_E("Error %d getting supported digests from keymaster1 device", error);
         return error;
+    }
 
     error = context_->SetHardwareDevice(keymaster1_device);
+    if (error != KM_ERROR_OK)
+        return error;
+    // The factories have changed, so the capability matrix must be rebuilt to match.
+    error = impl_->BuildCapabilities();
     if (error != KM_ERROR_OK)
         return error;
 
@@ -242,22 +179,29 @@ keymaster_error_t SoftKeymasterDevice::SetHardwareDevice(keymaster1_device_t* ke
 }
 
 bool SoftKeymasterDevice::Keymaster1DeviceIsGood() {
-    std::vector<keymaster_digest_t> expected_rsa_digests = {
+    const keymaster_digest_t expected_rsa_digests[] = {
         KM_DIGEST_NONE,      KM_DIGEST_MD5,       KM_DIGEST_SHA1,     KM_DIGEST_SHA_2_224,
         KM_DIGEST_SHA_2_256, KM_DIGEST_SHA_2_384, KM_DIGEST_SHA_2_512};
-    std::vector<keymaster_digest_t> expected_ec_digests = {
+    const keymaster_digest_t expected_ec_digests[] = {
         KM_DIGEST_NONE,      KM_DIGEST_SHA1,      KM_DIGEST_SHA_2_224,
         KM_DIGEST_SHA_2_256, KM_DIGEST_SHA_2_384, KM_DIGEST_SHA_2_512};
 
-    for (auto& entry : km1_device_digests_) {
-        if (entry.first.first == KM_ALGORITHM_RSA)
-            if (!std::is_permutation(entry.second.begin(), entry.second.end(),
-                                     expected_rsa_digests.begin()))
-                return false;
-        if (entry.first.first == KM_ALGORITHM_EC)
-            if (!std::is_permutation(entry.second.begin(), entry.second.end(),
-                                     expected_ec_digests.begin()))
-                return false;
+    uint32_t expected_rsa_mask = 0;
+    for (auto digest : expected_rsa_digests)
+        expected_rsa_mask |= Keymaster1DigestTable::DigestBit(digest);
+    uint32_t expected_ec_mask = 0;
+    for (auto digest : expected_ec_digests)
+        expected_ec_mask |= Keymaster1DigestTable::DigestBit(digest);
+
+    const keymaster_purpose_t purposes[] = {KM_PURPOSE_ENCRYPT, KM_PURPOSE_DECRYPT, KM_PURPOSE_SIGN,
+                                            KM_PURPOSE_VERIFY};
+    for (auto purpose : purposes) {
+        if (km1_device_digests_.covers(KM_ALGORITHM_RSA, purpose) &&
+            km1_device_digests_.digests(KM_ALGORITHM_RSA, purpose) != expected_rsa_mask)
+            return false;
+        if (km1_device_digests_.covers(KM_ALGORITHM_EC, purpose) &&
+            km1_device_digests_.digests(KM_ALGORITHM_EC, purpose) != expected_ec_mask)
+            return false;
     }
     return true;
 }
@@ -384,6 +328,39 @@ bool FindTagValue(const keymaster_key_param_set_t& params,
     return false;
 }
 
+// Copies |list| into a malloced array, which is how the keymaster1 get_supported_* calls return
+// their results.
+template <typename T>
+keymaster_error_t CopyCapabilityList(const CapabilityList& list, T** values,
+                                     size_t* values_length) {
+    *values_length = list.count;
+    *values = reinterpret_cast<T*>(malloc(list.count * sizeof(**values)));
+    if (!*values)
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    for (size_t i = 0; i < list.count; ++i)
+        (*values)[i] = static_cast<T>(list.values[i]);
+    return KM_ERROR_OK;
+}
+
+// Answers a get_supported_* call with AndroidKeymaster's per-query |query| method rather than the
+// capability matrix, for when the matrix couldn't be built.
+template <typename Request, typename Response, typename T>
+keymaster_error_t QuerySupported(AndroidKeymaster* impl,
+                                 void (AndroidKeymaster::*query)(const Request&, Response*),
+                                 const Request& request, T** values, size_t* values_length) {
+    Response response;
+    (impl->*query)(request, &response);
+    if (response.error != KM_ERROR_OK)
+        return response.error;
+
+    *values_length = response.results_length;
+    *values = reinterpret_cast<T*>(malloc(*values_length * sizeof(**values)));
+    if (!*values)
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    std::copy(response.results, response.results + response.results_length, *values);
+    return KM_ERROR_OK;
+}
+
 }  // unnamed namespaced
 
 /* static */
@@ -420,22 +397,21 @@ keymaster_error_t SoftKeymasterDevice::get_supported_algorithms(const keymaster1
     if (km1_dev)
         return km1_dev->get_supported_algorithms(km1_dev, algorithms, algorithms_length);
 
-    SupportedAlgorithmsRequest request;
-    SupportedAlgorithmsResponse response;
-    convert_device(dev)->impl_->SupportedAlgorithms(request, &response);
-    if (response.error != KM_ERROR_OK) {
-        LOG_E("get_supported_algorithms failed with %d", response.error);
-
-        return response.error;
+    AndroidKeymaster* impl = convert_device(dev)->impl_.get();
+    keymaster_error_t error;
+    if (impl->capabilities().empty()) {
+        SupportedAlgorithmsRequest request;
+        error = QuerySupported(impl, &AndroidKeymaster::SupportedAlgorithms, request, algorithms,
+                               algorithms_length);
+    } else {
+        CapabilityList supported;
+        error = impl->capabilities().SupportedAlgorithms(&supported);
+        if (error == KM_ERROR_OK)
+            error = CopyCapabilityList(supported, algorithms, algorithms_length);
     }
-
-    *algorithms_length = response.results_length;
-    *algorithms =
-        reinterpret_cast<keymaster_algorithm_t*>(malloc(*algorithms_length * sizeof(**algorithms)));
-    if (!*algorithms)
-        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
-    std::copy(response.results, response.results + response.results_length, *algorithms);
-    return KM_ERROR_OK;
+    if (error != KM_ERROR_OK)
+        LOG_E("get_supported_algorithms failed with %d", error);
+    return error;
 }
 
 /* static */
@@ -454,24 +430,23 @@ keymaster_error_t SoftKeymasterDevice::get_supported_block_modes(const keymaster
     if (km1_dev)
         return km1_dev->get_supported_block_modes(km1_dev, algorithm, purpose, modes, modes_length);
 
-    SupportedBlockModesRequest request;
-    request.algorithm = algorithm;
-    request.purpose = purpose;
-    SupportedBlockModesResponse response;
-    convert_device(dev)->impl_->SupportedBlockModes(request, &response);
-
-    if (response.error != KM_ERROR_OK) {
-        LOG_E("get_supported_block_modes failed with %d", response.error);
-
-        return response.error;
+    AndroidKeymaster* impl = convert_device(dev)->impl_.get();
+    keymaster_error_t error;
+    if (impl->capabilities().empty()) {
+        SupportedBlockModesRequest request;
+        request.algorithm = algorithm;
+        request.purpose = purpose;
+        error = QuerySupported(impl, &AndroidKeymaster::SupportedBlockModes, request, modes,
+                               modes_length);
+    } else {
+        CapabilityList supported;
+        error = impl->capabilities().SupportedBlockModes(algorithm, purpose, &supported);
+        if (error == KM_ERROR_OK)
+            error = CopyCapabilityList(supported, modes, modes_length);
     }
-
-    *modes_length = response.results_length;
-    *modes = reinterpret_cast<keymaster_block_mode_t*>(malloc(*modes_length * sizeof(**modes)));
-    if (!*modes)
-        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
-    std::copy(response.results, response.results + response.results_length, *modes);
-    return KM_ERROR_OK;
+    if (error != KM_ERROR_OK)
+        LOG_E("get_supported_block_modes failed with %d", error);
+    return error;
 }
 
 /* static */
@@ -491,23 +466,23 @@ keymaster_error_t SoftKeymasterDevice::get_supported_padding_modes(const keymast
         return km1_dev->get_supported_padding_modes(km1_dev, algorithm, purpose, modes,
                                                     modes_length);
 
-    SupportedPaddingModesRequest request;
-    request.algorithm = algorithm;
-    request.purpose = purpose;
-    SupportedPaddingModesResponse response;
-    convert_device(dev)->impl_->SupportedPaddingModes(request, &response);
-
-    if (response.error != KM_ERROR_OK) {
-        LOG_E("get_supported_padding_modes failed with %d", response.error);
-        return response.error;
+    AndroidKeymaster* impl = convert_device(dev)->impl_.get();
+    keymaster_error_t error;
+    if (impl->capabilities().empty()) {
+        SupportedPaddingModesRequest request;
+        request.algorithm = algorithm;
+        request.purpose = purpose;
+        error = QuerySupported(impl, &AndroidKeymaster::SupportedPaddingModes, request, modes,
+                               modes_length);
+    } else {
+        CapabilityList supported;
+        error = impl->capabilities().SupportedPaddingModes(algorithm, purpose, &supported);
+        if (error == KM_ERROR_OK)
+            error = CopyCapabilityList(supported, modes, modes_length);
     }
-
-    *modes_length = response.results_length;
-    *modes = reinterpret_cast<keymaster_padding_t*>(malloc(*modes_length * sizeof(**modes)));
-    if (!*modes)
-        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
-    std::copy(response.results, response.results + response.results_length, *modes);
-    return KM_ERROR_OK;
+    if (error != KM_ERROR_OK)
+        LOG_E("get_supported_padding_modes failed with %d", error);
+    return error;
 }
 
 /* static */
@@ -526,23 +501,23 @@ keymaster_error_t SoftKeymasterDevice::get_supported_digests(const keymaster1_de
     if (km1_dev)
         return km1_dev->get_supported_digests(km1_dev, algorithm, purpose, digests, digests_length);
 
-    SupportedDigestsRequest request;
-    request.algorithm = algorithm;
-    request.purpose = purpose;
-    SupportedDigestsResponse response;
-    convert_device(dev)->impl_->SupportedDigests(request, &response);
-
-    if (response.error != KM_ERROR_OK) {
-        LOG_E("get_supported_digests failed with %d", response.error);
-        return response.error;
+    AndroidKeymaster* impl = convert_device(dev)->impl_.get();
+    keymaster_error_t error;
+    if (impl->capabilities().empty()) {
+        SupportedDigestsRequest request;
+        request.algorithm = algorithm;
+        request.purpose = purpose;
+        error = QuerySupported(impl, &AndroidKeymaster::SupportedDigests, request, digests,
+                               digests_length);
+    } else {
+        CapabilityList supported;
+        error = impl->capabilities().SupportedDigests(algorithm, purpose, &supported);
+        if (error == KM_ERROR_OK)
+            error = CopyCapabilityList(supported, digests, digests_length);
     }
-
-    *digests_length = response.results_length;
-    *digests = reinterpret_cast<keymaster_digest_t*>(malloc(*digests_length * sizeof(**digests)));
-    if (!*digests)
-        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
-    std::copy(response.results, response.results + response.results_length, *digests);
-    return KM_ERROR_OK;
+    if (error != KM_ERROR_OK)
+        LOG_E("get_supported_digests failed with %d", error);
+    return error;
 }
 
 /* static */
@@ -559,23 +534,22 @@ keymaster_error_t SoftKeymasterDevice::get_supported_import_formats(
     if (km1_dev)
         return km1_dev->get_supported_import_formats(km1_dev, algorithm, formats, formats_length);
 
-    SupportedImportFormatsRequest request;
-    request.algorithm = algorithm;
-    SupportedImportFormatsResponse response;
-    convert_device(dev)->impl_->SupportedImportFormats(request, &response);
-
-    if (response.error != KM_ERROR_OK) {
-        LOG_E("get_supported_import_formats failed with %d", response.error);
-        return response.error;
+    AndroidKeymaster* impl = convert_device(dev)->impl_.get();
+    keymaster_error_t error;
+    if (impl->capabilities().empty()) {
+        SupportedImportFormatsRequest request;
+        request.algorithm = algorithm;
+        error = QuerySupported(impl, &AndroidKeymaster::SupportedImportFormats, request, formats,
+                               formats_length);
+    } else {
+        CapabilityList supported;
+        error = impl->capabilities().SupportedImportFormats(algorithm, &supported);
+        if (error == KM_ERROR_OK)
+            error = CopyCapabilityList(supported, formats, formats_length);
     }
-
-    *formats_length = response.results_length;
-    *formats =
-        reinterpret_cast<keymaster_key_format_t*>(malloc(*formats_length * sizeof(**formats)));
-    if (!*formats)
-        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
-    std::copy(response.results, response.results + response.results_length, *formats);
-    return KM_ERROR_OK;
+    if (error != KM_ERROR_OK)
+        LOG_E("get_supported_import_formats failed with %d", error);
+    return error;
 }
 
 /* static */
@@ -592,23 +566,22 @@ keymaster_error_t SoftKeymasterDevice::get_supported_export_formats(
     if (km1_dev)
         return km1_dev->get_supported_export_formats(km1_dev, algorithm, formats, formats_length);
 
-    SupportedExportFormatsRequest request;
-    request.algorithm = algorithm;
-    SupportedExportFormatsResponse response;
-    convert_device(dev)->impl_->SupportedExportFormats(request, &response);
-
-    if (response.error != KM_ERROR_OK) {
-        LOG_E("get_supported_export_formats failed with %d", response.error);
-        return response.error;
+    AndroidKeymaster* impl = convert_device(dev)->impl_.get();
+    keymaster_error_t error;
+    if (impl->capabilities().empty()) {
+        SupportedExportFormatsRequest request;
+        request.algorithm = algorithm;
+        error = QuerySupported(impl, &AndroidKeymaster::SupportedExportFormats, request, formats,
+                               formats_length);
+    } else {
+        CapabilityList supported;
+        error = impl->capabilities().SupportedExportFormats(algorithm, &supported);
+        if (error == KM_ERROR_OK)
+            error = CopyCapabilityList(supported, formats, formats_length);
     }
-
-    *formats_length = response.results_length;
-    *formats =
-        reinterpret_cast<keymaster_key_format_t*>(malloc(*formats_length * sizeof(**formats)));
-    if (!*formats)
-        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
-    std::copy(response.results, response.results + *formats_length, *formats);
-    return KM_ERROR_OK;
+    if (error != KM_ERROR_OK)
+        LOG_E("get_supported_export_formats failed with %d", error);
+    return error;
 }
 
 /* static */
@@ -660,35 +633,25 @@ keymaster_error_t SoftKeymasterDevice::add_rng_entropy(const keymaster2_device_t
     return add_rng_entropy(&sk_dev->km1_device_, data, data_length);
 }
 
-template <typename Collection, typename Value> bool contains(const Collection& c, const Value& v) {
-    return std::find(c.begin(), c.end(), v) != c.end();
-}
-
 bool SoftKeymasterDevice::FindUnsupportedDigest(keymaster_algorithm_t algorithm,
                                                 keymaster_purpose_t purpose,
-                                                const AuthorizationSet& params,
+                                                uint32_t requested_digests,
                                                 keymaster_digest_t* unsupported) const {
     assert(wrapped_km1_device_);
 
-    auto supported_digests = km1_device_digests_.find(std::make_pair(algorithm, purpose));
-    if (supported_digests == km1_device_digests_.end())
-        // Invalid algorith/purpose pair (e.g. EC encrypt).  Let the error be handled by HW module.
+    // Invalid algorithm/purpose pairs (e.g. EC encrypt) have no unsupported digests.  Let the
+    // error be handled by HW module.
+    if (!km1_device_digests_.FindUnsupported(algorithm, purpose, requested_digests, unsupported))
         return false;
 
-    for (auto& entry : params)
-        if (entry.tag == TAG_DIGEST)
-            if (!contains(supported_digests->second, entry.enumerated)) {
-                LOG_I("Digest %d requested but not supported by module %s", entry.enumerated,
-                      wrapped_km1_device_->common.module->name);
-                *unsupported = static_cast<keymaster_digest_t>(entry.enumerated);
-                return true;
-            }
-    return false;
+    LOG_I("Digest %d requested but not supported by module %s", *unsupported,
+          wrapped_km1_device_->common.module->name);
+    return true;
 }
 
 bool SoftKeymasterDevice::RequiresSoftwareDigesting(keymaster_algorithm_t algorithm,
                                                     keymaster_purpose_t purpose,
-                                                    const AuthorizationSet& params) const {
+                                                    uint32_t requested_digests) const {
     assert(wrapped_km1_device_);
     if (!wrapped_km1_device_)
         return true;
@@ -705,7 +668,7 @@ bool SoftKeymasterDevice::RequiresSoftwareDigesting(keymaster_algorithm_t algori
     }
 
     keymaster_digest_t unsupported;
-    if (!FindUnsupportedDigest(algorithm, purpose, params, &unsupported)) {
+    if (!FindUnsupportedDigest(algorithm, purpose, requested_digests, &unsupported)) {
         LOG_D("Requested digest(s) supported for algorithm %d and purpose %d", algorithm, purpose);
         return false;
     }
@@ -725,10 +688,11 @@ bool SoftKeymasterDevice::KeyRequiresSoftwareDigesting(
         return false;
     }
 
+    uint32_t requested_digests = Keymaster1DigestTable::RequestedDigests(key_description);
     for (auto& entry : key_description)
         if (entry.tag == TAG_PURPOSE) {
             keymaster_purpose_t purpose = static_cast<keymaster_purpose_t>(entry.enumerated);
-            if (RequiresSoftwareDigesting(algorithm, purpose, key_description))
+            if (RequiresSoftwareDigesting(algorithm, purpose, requested_digests))
                 return true;
         }
 
@@ -1224,18 +1188,19 @@ keymaster_error_t SoftKeymasterDevice::begin(const keymaster1_device_t* dev,
             return KM_ERROR_INVALID_KEY_BLOB;
         }
 
+        uint32_t requested_digests = Keymaster1DigestTable::RequestedDigests(in_params_set);
         if (algorithm == KM_ALGORITHM_HMAC) {
             // Because HMAC keys can have only one digest, in_params_set doesn't contain it.  We
-            // need to get the digest from the key and add it to in_params_set.
+            // need to get the digest from the key and add it to the requested digests.
             keymaster_digest_t digest;
             if (!akmKey->hw_enforced().GetTagValue(TAG_DIGEST, &digest) &&
                 !akmKey->sw_enforced().GetTagValue(TAG_DIGEST, &digest)) {
                 return KM_ERROR_INVALID_KEY_BLOB;
             }
-            in_params_set.push_back(TAG_DIGEST, digest);
+            requested_digests |= Keymaster1DigestTable::DigestBit(digest);
         }
 
-        if (!skdev->RequiresSoftwareDigesting(algorithm, purpose, in_params_set)) {
+        if (!skdev->RequiresSoftwareDigesting(algorithm, purpose, requested_digests)) {
             LOG_D("Operation supported by %s, passing through to keymaster1 module",
                   km1_dev->common.module->name);
             return km1_dev->begin(km1_dev, purpose, key, in_params, out_params, operation_handle);
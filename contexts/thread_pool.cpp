@@ -0,0 +1,115 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <keymaster/contexts/thread_pool.h>
+
+#include <algorithm>
+#include <atomic>
+
+namespace keymaster {
+
+struct ThreadPool::Batch {
+    void (*task)(void* task_context, size_t index);
+    void* task_context;
+    size_t num_tasks;
+    std::atomic<size_t> next_task;
+    size_t active_threads;  // Guarded by mutex_.
+};
+
+ThreadPool::ThreadPool(size_t num_threads) : num_threads_(num_threads) {
+    if (num_threads_ == 0) {
+        unsigned hardware_threads = std::thread::hardware_concurrency();
+        num_threads_ = hardware_threads > 1 ? hardware_threads - 1 : 0;
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_available_.notify_all();
+    for (auto& thread : threads_)
+        thread.join();
+}
+
+void ThreadPool::Run(size_t num_tasks, void (*task)(void* task_context, size_t index),
+                     void* task_context) {
+    if (num_tasks < 2 || num_threads_ == 0) {
+        for (size_t i = 0; i < num_tasks; ++i)
+            task(task_context, i);
+        return;
+    }
+
+    Batch batch;
+    batch.task = task;
+    batch.task_context = task_context;
+    batch.num_tasks = num_tasks;
+    batch.next_task = 0;
+    batch.active_threads = 1;  // This thread.
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        StartThreads();
+        batches_.push_back(&batch);
+    }
+    work_available_.notify_all();
+
+    WorkOn(&batch);
+
+    // Every task has been claimed, but workers may still be running theirs, and |batch| lives on
+    // this stack frame.
+    std::unique_lock<std::mutex> lock(mutex_);
+    batch_finished_.wait(lock, [&batch] { return batch.active_threads == 0; });
+}
+
+void ThreadPool::StartThreads() {
+    if (!threads_.empty())
+        return;
+    threads_.reserve(num_threads_);
+    for (size_t i = 0; i < num_threads_; ++i)
+        threads_.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+// The caller must have counted itself in batch->active_threads.
+void ThreadPool::WorkOn(Batch* batch) {
+    size_t index;
+    while ((index = batch->next_task.fetch_add(1)) < batch->num_tasks)
+        batch->task(batch->task_context, index);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto pos = std::find(batches_.begin(), batches_.end(), batch);
+    if (pos != batches_.end())
+        batches_.erase(pos);
+    if (--batch->active_threads == 0)
+        batch_finished_.notify_all();
+}
+
+void ThreadPool::WorkerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        work_available_.wait(lock, [this] { return stopping_ || !batches_.empty(); });
+        if (stopping_)
+            return;
+
+        Batch* batch = batches_.front();
+        ++batch->active_threads;
+        lock.unlock();
+        WorkOn(batch);
+        lock.lock();
+    }
+}
+
+}  // namespace keymaster
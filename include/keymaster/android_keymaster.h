@@ -24,7 +24,10 @@ namespace keymaster {
 
 class Key;
 class KeyFactory;
+struct KeyEnforcementPolicy;
+class KeyHandleTable;
 class KeymasterContext;
+class Operation;
 class OperationTable;
 
 /**
@@ -47,7 +50,10 @@ class OperationTable;
  */
 class AndroidKeymaster {
   public:
-    AndroidKeymaster(KeymasterContext* context, size_t operation_table_size);
+    static const size_t kDefaultKeyHandleTableSize = 16;
+
+    AndroidKeymaster(KeymasterContext* context, size_t operation_table_size,
+                     size_t key_handle_table_size = kDefaultKeyHandleTableSize);
     virtual ~AndroidKeymaster();
     AndroidKeymaster(AndroidKeymaster&&);
 
@@ -87,15 +93,98 @@ class AndroidKeymaster {
     void FinishOperation(const FinishOperationRequest& request, FinishOperationResponse* response);
     void AbortOperation(const AbortOperationRequest& request, AbortOperationResponse* response);
 
+    /**
+     * Finishes an operation and, if that succeeds, begins it again in place, so that a caller
+     * MACing or signing many messages with the same parameters doesn't re-create the operation
+     * each time.  The restart is authorized as a new begin would be, and gets a new handle.
+     * Operations that don't support Operation::Restart() are just finished.
+     */
+    void FinishAndRestartOperation(const FinishAndRestartOperationRequest& request,
+                                   FinishAndRestartOperationResponse* response);
+
+    /**
+     * Checks each job's signature as a complete begin/finish VERIFY operation would, but without
+     * any of the operations touching the operation table.  Keys are loaded and authorized in job
+     * order on the calling thread; the signature checks themselves are handed to
+     * KeymasterContext::RunTasks, so they run in parallel if the context supports it.
+     */
+    void BatchVerify(const BatchVerifyRequest& request, BatchVerifyResponse* response);
+
+    /**
+     * Rewrites each job's key blob in the context's current blob format, if it's in a legacy one
+     * (see KeymasterContext::MigrateKeyBlob).  Blobs are independent of one another, so the whole
+     * batch is handed to KeymasterContext::RunTasks.
+     */
+    void MigrateKeyBlobs(const MigrateKeyBlobsRequest& request, MigrateKeyBlobsResponse* response);
+
+    /**
+     * Upgrades every blob in the request as UpgradeKey would, reporting the outcome per blob.  The
+     * upgrades go through KeymasterContext::RunTasks, so they run in parallel if the context
+     * supports it.
+     */
+    void BatchUpgradeKey(const BatchUpgradeKeyRequest& request, BatchUpgradeKeyResponse* response);
+
+    /**
+     * Parses a key blob once and keeps the key, so that the *WithKeyHandle methods below can use
+     * it without the blob being sent and parsed again.  At most |key_handle_table_size| keys are
+     * kept; loading another evicts the least recently used.
+     */
+    void LoadKeyHandle(const LoadKeyHandleRequest& request, LoadKeyHandleResponse* response);
+    void UnloadKeyHandle(const UnloadKeyHandleRequest& request, UnloadKeyHandleResponse* response);
+    void BeginOperationWithKeyHandle(const BeginOperationWithKeyHandleRequest& request,
+                                     BeginOperationResponse* response);
+    void ExportKeyWithKeyHandle(const ExportKeyWithKeyHandleRequest& request,
+                                ExportKeyResponse* response);
+    void AttestKeyWithKeyHandle(const AttestKeyWithKeyHandleRequest& request,
+                                AttestKeyResponse* response);
+
+    /**
+     * Returns the whole capability matrix, everything the Supported* methods above can report, in
+     * one response.  The response refers to the matrix rather than holding a copy, so it must not
+     * outlive this AndroidKeymaster.  Returns KM_ERROR_UNIMPLEMENTED if BuildCapabilities hasn't
+     * been called.
+     */
+    void GetCapabilities(const GetCapabilitiesRequest& request, GetCapabilitiesResponse* response);
+
+    /**
+     * Builds the capability matrix from the context's factories.  The matrix isn't built on
+     * demand, so that it never changes while requests are being served: call this once the
+     * context's factories are final and before any request that reads it, and not concurrently
+     * with one.  Contexts whose factories can't answer these queries, such as the keymaster1
+     * passthrough ones, simply never build it.
+     */
+    keymaster_error_t BuildCapabilities();
+
+    /**
+     * Returns the capability matrix GetCapabilities reports.  It's empty if it hasn't been built.
+     */
+    const KeymasterCapabilities& capabilities() const { return capabilities_; }
+
     bool has_operation(keymaster_operation_handle_t op_handle) const;
 
   private:
     keymaster_error_t LoadKey(const keymaster_key_blob_t& key_blob,
                               const AuthorizationSet& additional_params,
                               const KeyFactory** factory, UniquePtr<Key>* key);
+    keymaster_error_t LoadKeyFromHandle(uint64_t key_handle, UniquePtr<Key>* key,
+                                        uint64_t* key_id,
+                                        const KeyEnforcementPolicy** policy = nullptr);
+    keymaster_error_t CreateKeyId(const keymaster_key_blob_t& key_blob, uint64_t* key_id);
+    // |key_policy| is the key's compiled enforcement policy, or null to compile it here.
+    void BeginOperation(keymaster_purpose_t purpose, UniquePtr<Key>&& key, uint64_t key_id,
+                        const KeyEnforcementPolicy* key_policy,
+                        const AuthorizationSet& additional_params,
+                        BeginOperationResponse* response);
+    void ExportKey(const Key& key, keymaster_key_format_t key_format,
+                   ExportKeyResponse* response);
+    void AttestKey(Key* key, const AuthorizationSet& attest_params, AttestKeyResponse* response);
+    keymaster_error_t BeginVerification(const VerificationJob& job,
+                                        UniquePtr<Operation>* operation);
 
     UniquePtr<KeymasterContext> context_;
     UniquePtr<OperationTable> operation_table_;
+    UniquePtr<KeyHandleTable> key_handle_table_;
+    KeymasterCapabilities capabilities_;
 };
 
 }  // namespace keymaster
@@ -24,6 +24,7 @@
 
 #include <keymaster/android_keymaster_utils.h>
 #include <keymaster/authorization_set.h>
+#include <keymaster/keymaster_capabilities.h>
 
 namespace keymaster {
 
@@ -55,6 +56,16 @@ enum AndroidKeymasterCommand : uint32_t {
     DELETE_ALL_KEYS = 23,
     DESTROY_ATTESTATION_IDS = 24,
     IMPORT_WRAPPED_KEY = 25,
+    BATCH_VERIFY = 26,
+    MIGRATE_KEY_BLOBS = 27,
+    BATCH_UPGRADE_KEY = 28,
+    LOAD_KEY_HANDLE = 29,
+    UNLOAD_KEY_HANDLE = 30,
+    BEGIN_OPERATION_WITH_KEY_HANDLE = 31,
+    EXPORT_KEY_WITH_KEY_HANDLE = 32,
+    ATTEST_KEY_WITH_KEY_HANDLE = 33,
+    FINISH_AND_RESTART_OPERATION = 34,
+    GET_CAPABILITIES = 35,
 };
 
 /**
@@ -903,6 +914,355 @@ struct VerifyAuthorizationResponse : public KeymasterResponse {
     VerificationToken token;
 };
 
+/**
+ * One (key, message, signature) triple for BatchVerifyRequest.  |additional_params| plays the same
+ * role as in BeginOperationRequest: it selects the digest and padding and carries
+ * APPLICATION_ID/APPLICATION_DATA.
+ */
+struct VerificationJob : public Serializable {
+    void SetKeyMaterial(const void* key_material, size_t length);
+    void SetKeyMaterial(const keymaster_key_blob_t& blob) {
+        SetKeyMaterial(blob.key_material, blob.key_material_size);
+    }
+
+    size_t SerializedSize() const override;
+    uint8_t* Serialize(uint8_t* buf, const uint8_t* end) const override;
+    bool Deserialize(const uint8_t** buf_ptr, const uint8_t* end) override;
+
+    KeymasterKeyBlob key_blob;
+    AuthorizationSet additional_params;
+    Buffer message;
+    Buffer signature;
+};
+
+struct BatchVerifyRequest : public KeymasterMessage {
+    explicit BatchVerifyRequest(int32_t ver = MAX_MESSAGE_VERSION)
+        : KeymasterMessage(ver), jobs(nullptr), num_jobs(0) {}
+    ~BatchVerifyRequest() { delete[] jobs; }
+
+    bool AllocateJobs(size_t count);
+
+    size_t SerializedSize() const override;
+    uint8_t* Serialize(uint8_t* buf, const uint8_t* end) const override;
+    bool Deserialize(const uint8_t** buf_ptr, const uint8_t* end) override;
+
+    VerificationJob* jobs;
+    size_t num_jobs;
+};
+
+/**
+ * |error| reports whether the batch as a whole could be processed.  When it's KM_ERROR_OK,
+ * |results| holds one entry per job, in request order: KM_ERROR_OK if the signature verified,
+ * KM_ERROR_VERIFICATION_FAILED if it didn't, or whatever error prevented the job from being run.
+ */
+struct BatchVerifyResponse : public KeymasterResponse {
+    explicit BatchVerifyResponse(int32_t ver = MAX_MESSAGE_VERSION)
+        : KeymasterResponse(ver), results(nullptr), num_results(0) {}
+    ~BatchVerifyResponse() { delete[] results; }
+
+    bool AllocateResults(size_t count);
+
+    size_t NonErrorSerializedSize() const override;
+    uint8_t* NonErrorSerialize(uint8_t* buf, const uint8_t* end) const override;
+    bool NonErrorDeserialize(const uint8_t** buf_ptr, const uint8_t* end) override;
+
+    keymaster_error_t* results;
+    size_t num_results;
+};
+
+/**
+ * One key blob to be migrated by MigrateKeyBlobsRequest.  |additional_params| carries the
+ * APPLICATION_ID/APPLICATION_DATA the blob is bound to.
+ */
+struct KeyBlobMigrationJob : public Serializable {
+    void SetKeyMaterial(const void* key_material, size_t length);
+    void SetKeyMaterial(const keymaster_key_blob_t& blob) {
+        SetKeyMaterial(blob.key_material, blob.key_material_size);
+    }
+
+    size_t SerializedSize() const override;
+    uint8_t* Serialize(uint8_t* buf, const uint8_t* end) const override;
+    bool Deserialize(const uint8_t** buf_ptr, const uint8_t* end) override;
+
+    KeymasterKeyBlob key_blob;
+    AuthorizationSet additional_params;
+};
+
+struct MigrateKeyBlobsRequest : public KeymasterMessage {
+    explicit MigrateKeyBlobsRequest(int32_t ver = MAX_MESSAGE_VERSION)
+        : KeymasterMessage(ver), jobs(nullptr), num_jobs(0) {}
+    ~MigrateKeyBlobsRequest() { delete[] jobs; }
+
+    bool AllocateJobs(size_t count);
+
+    size_t SerializedSize() const override;
+    uint8_t* Serialize(uint8_t* buf, const uint8_t* end) const override;
+    bool Deserialize(const uint8_t** buf_ptr, const uint8_t* end) override;
+
+    KeyBlobMigrationJob* jobs;
+    size_t num_jobs;
+};
+
+/**
+ * The outcome for one blob in a batch request that rewrites key blobs.  |key_blob| is only
+ * meaningful when |error| is KM_ERROR_OK.
+ */
+struct KeyBlobResult : public Serializable {
+    void SetKeyMaterial(const void* key_material, size_t length);
+    void SetKeyMaterial(const keymaster_key_blob_t& blob) {
+        SetKeyMaterial(blob.key_material, blob.key_material_size);
+    }
+
+    size_t SerializedSize() const override;
+    uint8_t* Serialize(uint8_t* buf, const uint8_t* end) const override;
+    bool Deserialize(const uint8_t** buf_ptr, const uint8_t* end) override;
+
+    keymaster_error_t error = KM_ERROR_UNKNOWN_ERROR;
+    KeymasterKeyBlob key_blob;
+};
+
+/**
+ * Response to a batch request that rewrites key blobs.  |error| reports whether the batch as a
+ * whole could be processed.  When it's KM_ERROR_OK, |results| holds one entry per blob, in request
+ * order.  An entry with KM_ERROR_OK and an empty |key_blob| means the blob needed no rewriting and
+ * should be kept as it is.
+ */
+struct KeyBlobBatchResponse : public KeymasterResponse {
+    explicit KeyBlobBatchResponse(int32_t ver)
+        : KeymasterResponse(ver), results(nullptr), num_results(0) {}
+    ~KeyBlobBatchResponse() { delete[] results; }
+
+    bool AllocateResults(size_t count);
+
+    size_t NonErrorSerializedSize() const override;
+    uint8_t* NonErrorSerialize(uint8_t* buf, const uint8_t* end) const override;
+    bool NonErrorDeserialize(const uint8_t** buf_ptr, const uint8_t* end) override;
+
+    KeyBlobResult* results;
+    size_t num_results;
+};
+
+struct MigrateKeyBlobsResponse : public KeyBlobBatchResponse {
+    explicit MigrateKeyBlobsResponse(int32_t ver = MAX_MESSAGE_VERSION)
+        : KeyBlobBatchResponse(ver) {}
+};
+
+/**
+ * Upgrades every blob in |key_blobs| as UpgradeKeyRequest would, with the same |upgrade_params|
+ * for all of them.  That's the common case after an OS update, when every key belonging to an app
+ * needs upgrading at once.
+ */
+struct BatchUpgradeKeyRequest : public KeymasterMessage {
+    explicit BatchUpgradeKeyRequest(int32_t ver = MAX_MESSAGE_VERSION)
+        : KeymasterMessage(ver), key_blobs(nullptr), num_key_blobs(0) {}
+    ~BatchUpgradeKeyRequest() { delete[] key_blobs; }
+
+    bool AllocateKeyBlobs(size_t count);
+
+    size_t SerializedSize() const override;
+    uint8_t* Serialize(uint8_t* buf, const uint8_t* end) const override;
+    bool Deserialize(const uint8_t** buf_ptr, const uint8_t* end) override;
+
+    KeymasterKeyBlob* key_blobs;
+    size_t num_key_blobs;
+    AuthorizationSet upgrade_params;
+};
+
+struct BatchUpgradeKeyResponse : public KeyBlobBatchResponse {
+    explicit BatchUpgradeKeyResponse(int32_t ver = MAX_MESSAGE_VERSION)
+        : KeyBlobBatchResponse(ver) {}
+};
+
+/**
+ * Parses |key_blob| once and keeps the result inside the keymaster, returning a short handle that
+ * the *WithKeyHandle requests below accept in place of the blob.  |additional_params| carries the
+ * APPLICATION_ID/APPLICATION_DATA the blob is bound to; they're remembered along with the key.
+ */
+struct LoadKeyHandleRequest : public KeymasterMessage {
+    explicit LoadKeyHandleRequest(int32_t ver = MAX_MESSAGE_VERSION) : KeymasterMessage(ver) {}
+
+    void SetKeyMaterial(const void* key_material, size_t length);
+    void SetKeyMaterial(const keymaster_key_blob_t& blob) {
+        SetKeyMaterial(blob.key_material, blob.key_material_size);
+    }
+
+    size_t SerializedSize() const override;
+    uint8_t* Serialize(uint8_t* buf, const uint8_t* end) const override;
+    bool Deserialize(const uint8_t** buf_ptr, const uint8_t* end) override;
+
+    KeymasterKeyBlob key_blob;
+    AuthorizationSet additional_params;
+};
+
+/**
+ * Handles are never zero.  A handle stops working when it's unloaded, when the keymaster evicts
+ * it to make room for another, or when its key is deleted; requests using it then fail with
+ * KM_ERROR_INVALID_KEY_BLOB and the client should load the blob again.
+ */
+struct LoadKeyHandleResponse : public KeymasterResponse {
+    explicit LoadKeyHandleResponse(int32_t ver = MAX_MESSAGE_VERSION)
+        : KeymasterResponse(ver), key_handle(0) {}
+
+    size_t NonErrorSerializedSize() const override { return sizeof(uint64_t); }
+    uint8_t* NonErrorSerialize(uint8_t* buf, const uint8_t* end) const override {
+        return append_uint64_to_buf(buf, end, key_handle);
+    }
+    bool NonErrorDeserialize(const uint8_t** buf_ptr, const uint8_t* end) override {
+        return copy_uint64_from_buf(buf_ptr, end, &key_handle);
+    }
+
+    uint64_t key_handle;
+};
+
+struct UnloadKeyHandleRequest : public KeymasterMessage {
+    explicit UnloadKeyHandleRequest(int32_t ver = MAX_MESSAGE_VERSION)
+        : KeymasterMessage(ver), key_handle(0) {}
+
+    size_t SerializedSize() const override { return sizeof(uint64_t); }
+    uint8_t* Serialize(uint8_t* buf, const uint8_t* end) const override {
+        return append_uint64_to_buf(buf, end, key_handle);
+    }
+    bool Deserialize(const uint8_t** buf_ptr, const uint8_t* end) override {
+        return copy_uint64_from_buf(buf_ptr, end, &key_handle);
+    }
+
+    uint64_t key_handle;
+};
+
+struct UnloadKeyHandleResponse : public KeymasterResponse {
+    explicit UnloadKeyHandleResponse(int32_t ver = MAX_MESSAGE_VERSION) : KeymasterResponse(ver) {}
+
+    size_t NonErrorSerializedSize() const override { return 0; }
+    uint8_t* NonErrorSerialize(uint8_t* buf, const uint8_t*) const override { return buf; }
+    bool NonErrorDeserialize(const uint8_t**, const uint8_t*) override { return true; }
+};
+
+/**
+ * BeginOperationRequest with a key handle in place of the key blob.  The response is a
+ * BeginOperationResponse.
+ */
+struct BeginOperationWithKeyHandleRequest : public KeymasterMessage {
+    explicit BeginOperationWithKeyHandleRequest(int32_t ver = MAX_MESSAGE_VERSION)
+        : KeymasterMessage(ver), key_handle(0) {}
+
+    size_t SerializedSize() const override;
+    uint8_t* Serialize(uint8_t* buf, const uint8_t* end) const override;
+    bool Deserialize(const uint8_t** buf_ptr, const uint8_t* end) override;
+
+    keymaster_purpose_t purpose;
+    uint64_t key_handle;
+    AuthorizationSet additional_params;
+};
+
+/**
+ * ExportKeyRequest with a key handle in place of the key blob.  No additional params are needed,
+ * since the handle is already bound to the application.  The response is an ExportKeyResponse.
+ */
+struct ExportKeyWithKeyHandleRequest : public KeymasterMessage {
+    explicit ExportKeyWithKeyHandleRequest(int32_t ver = MAX_MESSAGE_VERSION)
+        : KeymasterMessage(ver), key_handle(0) {}
+
+    size_t SerializedSize() const override { return sizeof(uint64_t) + sizeof(uint32_t); }
+    uint8_t* Serialize(uint8_t* buf, const uint8_t* end) const override {
+        buf = append_uint64_to_buf(buf, end, key_handle);
+        return append_uint32_to_buf(buf, end, key_format);
+    }
+    bool Deserialize(const uint8_t** buf_ptr, const uint8_t* end) override {
+        return copy_uint64_from_buf(buf_ptr, end, &key_handle) &&
+               copy_uint32_from_buf(buf_ptr, end, &key_format);
+    }
+
+    uint64_t key_handle;
+    keymaster_key_format_t key_format;
+};
+
+/**
+ * AttestKeyRequest with a key handle in place of the key blob.  The response is an
+ * AttestKeyResponse.
+ */
+struct AttestKeyWithKeyHandleRequest : public KeymasterMessage {
+    explicit AttestKeyWithKeyHandleRequest(int32_t ver = MAX_MESSAGE_VERSION)
+        : KeymasterMessage(ver), key_handle(0) {}
+
+    size_t SerializedSize() const override;
+    uint8_t* Serialize(uint8_t* buf, const uint8_t* end) const override;
+    bool Deserialize(const uint8_t** buf_ptr, const uint8_t* end) override;
+
+    uint64_t key_handle;
+    AuthorizationSet attest_params;
+};
+
+/**
+ * Finishes an operation as FinishOperationRequest does, then, if that succeeded, begins it again
+ * with the same key and parameters.  |restart_params| play the part of the begin params, so they
+ * can carry a new nonce.
+ */
+struct FinishAndRestartOperationRequest : public KeymasterMessage {
+    explicit FinishAndRestartOperationRequest(int32_t ver = MAX_MESSAGE_VERSION)
+        : KeymasterMessage(ver), op_handle(0) {}
+
+    size_t SerializedSize() const override;
+    uint8_t* Serialize(uint8_t* buf, const uint8_t* end) const override;
+    bool Deserialize(const uint8_t** buf_ptr, const uint8_t* end) override;
+
+    keymaster_operation_handle_t op_handle;
+    Buffer input;
+    Buffer signature;
+    AuthorizationSet additional_params;
+    AuthorizationSet restart_params;
+};
+
+/**
+ * |error|, |output| and |output_params| are the result of the finish.  If the operation couldn't
+ * be restarted, |restart_error| says why and |op_handle| is zero; otherwise |op_handle| is the
+ * handle of the restarted operation and |restart_output_params| are its begin output params.
+ */
+struct FinishAndRestartOperationResponse : public KeymasterResponse {
+    explicit FinishAndRestartOperationResponse(int32_t ver = MAX_MESSAGE_VERSION)
+        : KeymasterResponse(ver), restart_error(KM_ERROR_OK), op_handle(0) {}
+
+    size_t NonErrorSerializedSize() const override;
+    uint8_t* NonErrorSerialize(uint8_t* buf, const uint8_t* end) const override;
+    bool NonErrorDeserialize(const uint8_t** buf_ptr, const uint8_t* end) override;
+
+    Buffer output;
+    AuthorizationSet output_params;
+    keymaster_error_t restart_error;
+    keymaster_operation_handle_t op_handle;
+    AuthorizationSet restart_output_params;
+};
+
+struct GetCapabilitiesRequest : public KeymasterMessage {
+    explicit GetCapabilitiesRequest(int32_t ver = MAX_MESSAGE_VERSION) : KeymasterMessage(ver) {}
+
+    size_t SerializedSize() const override { return 0; }
+    uint8_t* Serialize(uint8_t* buf, const uint8_t*) const override { return buf; }
+    bool Deserialize(const uint8_t**, const uint8_t*) override { return true; };
+};
+
+/**
+ * Carries the whole capability matrix, which answers every GET_SUPPORTED_* query in one round
+ * trip.  See KeymasterCapabilities for the layout.
+ */
+struct GetCapabilitiesResponse : public KeymasterResponse {
+    explicit GetCapabilitiesResponse(int32_t ver = MAX_MESSAGE_VERSION)
+        : KeymasterResponse(ver), shared_capabilities(nullptr) {}
+
+    size_t NonErrorSerializedSize() const override;
+    uint8_t* NonErrorSerialize(uint8_t* buf, const uint8_t* end) const override;
+    bool NonErrorDeserialize(const uint8_t** buf_ptr, const uint8_t* end) override;
+
+    // The matrix to send, or the one received.
+    const KeymasterCapabilities& matrix() const {
+        return shared_capabilities ? *shared_capabilities : capabilities;
+    }
+
+    // AndroidKeymaster points this at its own matrix, which outlives the response, rather than
+    // copying it into |capabilities|.  Deserializing always fills |capabilities|.
+    const KeymasterCapabilities* shared_capabilities;
+    KeymasterCapabilities capabilities;
+};
+
 }  // namespace keymaster
 
 #endif  // SYSTEM_KEYMASTER_ANDROID_KEYMASTER_MESSAGES_H_
@@ -42,6 +42,13 @@ class AsymmetricKeyFactory : public KeyFactory {
 
     virtual const keymaster_key_format_t* SupportedImportFormats(size_t* format_count) const override;
     virtual const keymaster_key_format_t* SupportedExportFormats(size_t* format_count) const override;
+
+  protected:
+    /**
+     * Returns the EVP type of |key|'s key material.  Factories whose keys aren't all of
+     * evp_key_type() override this.
+     */
+    virtual int key_material_type(const AsymmetricKey& /* key */) const { return evp_key_type(); }
 };
 
 }  // namespace keymaster
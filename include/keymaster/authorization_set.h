@@ -439,6 +439,13 @@ class AuthorizationSet : public Serializable, public keymaster_key_param_set_t {
 
     size_t SerializedSizeOfElements() const;
 
+    /**
+     * Steps *buf_ptr over a serialized AuthorizationSet, checking only that its length fields are
+     * consistent with each other and with \p end.  Returns false if Deserialize() would certainly
+     * fail; true doesn't guarantee that it would succeed.  Nothing is allocated.
+     */
+    static bool SkipSerialized(const uint8_t** buf_ptr, const uint8_t* end);
+
   private:
     void FreeData();
     void MoveFrom(AuthorizationSet& set);
@@ -521,6 +528,8 @@ class AuthorizationSetBuilder {
     AuthorizationSetBuilder& RsaSigningKey(uint32_t key_size, uint64_t public_exponent);
     AuthorizationSetBuilder& RsaEncryptionKey(uint32_t key_size, uint64_t public_exponent);
     AuthorizationSetBuilder& EcdsaSigningKey(uint32_t key_size);
+    AuthorizationSetBuilder& Ed25519SigningKey();
+    AuthorizationSetBuilder& X25519AgreementKey();
     AuthorizationSetBuilder& AesEncryptionKey(uint32_t key_size);
     AuthorizationSetBuilder& TripleDesEncryptionKey(uint32_t key_size);
 
@@ -600,6 +609,19 @@ inline AuthorizationSetBuilder& AuthorizationSetBuilder::EcdsaSigningKey(uint32_
     return SigningKey();
 }
 
+inline AuthorizationSetBuilder& AuthorizationSetBuilder::Ed25519SigningKey() {
+    Authorization(TAG_ALGORITHM, KM_ALGORITHM_EC);
+    Authorization(TAG_EC_CURVE, KM_EC_CURVE_CURVE_25519);
+    Digest(KM_DIGEST_NONE);
+    return SigningKey();
+}
+
+inline AuthorizationSetBuilder& AuthorizationSetBuilder::X25519AgreementKey() {
+    Authorization(TAG_ALGORITHM, KM_ALGORITHM_EC);
+    Authorization(TAG_EC_CURVE, KM_EC_CURVE_CURVE_25519);
+    return Authorization(TAG_PURPOSE, KM_PURPOSE_AGREE_KEY);
+}
+
 inline AuthorizationSetBuilder& AuthorizationSetBuilder::AesEncryptionKey(uint32_t key_size) {
     AesKey(key_size);
     return EncryptionKey();
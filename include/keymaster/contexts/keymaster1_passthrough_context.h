@@ -26,6 +26,7 @@
 #include <keymaster/attestation_record.h>
 #include <keymaster/keymaster_context.h>
 #include <keymaster/km_openssl/software_random_source.h>
+#include <keymaster/legacy_support/key_characteristics_cache.h>
 #include <keymaster/legacy_support/keymaster1_engine.h>
 #include <keymaster/legacy_support/keymaster_passthrough_engine.h>
 #include <keymaster/legacy_support/keymaster_passthrough_key.h>
@@ -126,6 +127,7 @@ class Keymaster1PassthroughContext : public KeymasterContext,
     mutable std::unordered_map<keymaster_algorithm_t, UniquePtr<KeyFactory>> factories_;
     UniquePtr<KeymasterPassthroughEngine> pt_engine_;
     UniquePtr<Keymaster1Engine> km1_engine_;
+    mutable KeyCharacteristicsCache characteristics_cache_;
 
     uint32_t os_version_;
     uint32_t os_patchlevel_;
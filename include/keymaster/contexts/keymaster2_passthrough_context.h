@@ -24,6 +24,7 @@
 #include <hardware/keymaster_defs.h>
 
 #include <keymaster/keymaster_context.h>
+#include <keymaster/legacy_support/key_characteristics_cache.h>
 #include <keymaster/legacy_support/keymaster_passthrough_engine.h>
 #include <keymaster/legacy_support/keymaster_passthrough_key.h>
 
@@ -31,7 +32,14 @@ namespace keymaster {
 
 class Keymaster2PassthroughContext : public KeymasterContext {
   public:
-    explicit Keymaster2PassthroughContext(keymaster2_device_t* dev);
+    /**
+     * Key characteristics returned by |dev| are cached for up to |characteristics_cache_size| key
+     * blobs, so repeated operations on the same key don't each need a get_key_characteristics
+     * round trip.  Zero disables the cache.
+     */
+    explicit Keymaster2PassthroughContext(
+        keymaster2_device_t* dev,
+        size_t characteristics_cache_size = KeyCharacteristicsCache::kDefaultMaxEntries);
 
     /**
      * Sets the system version as reported by the system *itself*.  This is used to verify that the
@@ -113,6 +121,7 @@ class Keymaster2PassthroughContext : public KeymasterContext {
     mutable std::unordered_map<keymaster_algorithm_t, UniquePtr<KeymasterPassthroughKeyFactory>>
         factories_;
     UniquePtr<KeymasterPassthroughEngine> engine_;
+    mutable KeyCharacteristicsCache characteristics_cache_;
     uint32_t os_version_;
     uint32_t os_patchlevel_;
 };
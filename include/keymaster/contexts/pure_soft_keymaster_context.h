@@ -23,7 +23,8 @@
 
 #include <keymaster/keymaster_context.h>
 #include <keymaster/attestation_record.h>
-#include <keymaster/km_openssl/software_random_source.h>
+#include <keymaster/contexts/thread_pool.h>
+#include <keymaster/km_openssl/drbg_random_source.h>
 #include <keymaster/km_openssl/soft_keymaster_enforcement.h>
 #include <keymaster/soft_key_factory.h>
 #include <keymaster/random_source.h>
@@ -41,11 +42,17 @@ class Key;
 class PureSoftKeymasterContext: public KeymasterContext,
         protected SoftwareKeyBlobMaker,
         AttestationRecordContext,
-        SoftwareRandomSource {
+        DrbgRandomSource {
   public:
     explicit PureSoftKeymasterContext();
     ~PureSoftKeymasterContext() override;
 
+    /**
+     * Enables signing precomputation for software EC keys held behind key handles (see
+     * EcKeyFactory::set_precompute_signing).  Off by default.
+     */
+    void set_precompute_ec_signing(bool precompute_signing);
+
     /*********************************************************************************************
      * Implement KeymasterContext
      */
@@ -62,9 +69,21 @@ class PureSoftKeymasterContext: public KeymasterContext,
     keymaster_error_t ParseKeyBlob(const KeymasterKeyBlob& blob,
                                    const AuthorizationSet& additional_params,
                                    UniquePtr<Key>* key) const override;
+    keymaster_error_t ParseKeyBlobAuthorizations(const KeymasterKeyBlob& blob,
+                                                 const AuthorizationSet& additional_params,
+                                                 AuthorizationSet* hw_enforced,
+                                                 AuthorizationSet* sw_enforced) const override;
+    keymaster_error_t MigrateKeyBlob(const KeymasterKeyBlob& blob,
+                                     const AuthorizationSet& additional_params,
+                                     KeymasterKeyBlob* migrated_blob) const override;
     keymaster_error_t DeleteKey(const KeymasterKeyBlob& blob) const override;
     keymaster_error_t DeleteAllKeys() const override;
     keymaster_error_t AddRngEntropy(const uint8_t* buf, size_t length) const override;
+    void RunTasks(size_t num_tasks, void (*task)(void* task_context, size_t index),
+                  void* task_context) const override {
+        thread_pool_.Run(num_tasks, task, task_context);
+    }
+    size_t max_concurrent_tasks() const override { return thread_pool_.num_threads() + 1; }
 
     keymaster_error_t GenerateAttestation(const Key& key,
                                           const AuthorizationSet& attest_params,
@@ -91,6 +110,16 @@ class PureSoftKeymasterContext: public KeymasterContext,
               KeymasterKeyBlob* wrapped_key_material) const override;
 
   protected:
+    /**
+     * Identifies the kind of software blob and extracts its key material and authorizations, after
+     * integrity checking.  Shared by ParseKeyBlob and ParseKeyBlobAuthorizations.
+     */
+    keymaster_error_t DeserializeKeyBlob(const KeymasterKeyBlob& blob,
+                                         const AuthorizationSet& additional_params,
+                                         KeymasterKeyBlob* key_material,
+                                         AuthorizationSet* hw_enforced,
+                                         AuthorizationSet* sw_enforced) const;
+
     std::unique_ptr<KeyFactory> rsa_factory_;
     std::unique_ptr<KeyFactory> ec_factory_;
     std::unique_ptr<KeyFactory> aes_factory_;
@@ -99,6 +128,7 @@ class PureSoftKeymasterContext: public KeymasterContext,
     uint32_t os_version_;
     uint32_t os_patchlevel_;
     SoftKeymasterEnforcement soft_keymaster_enforcement_;
+    mutable ThreadPool thread_pool_;
 };
 
 }  // namespace keymaster
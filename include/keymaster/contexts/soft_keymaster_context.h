@@ -26,8 +26,10 @@
 #include <hardware/keymaster1.h>
 
 #include <keymaster/attestation_record.h>
+#include <keymaster/contexts/thread_pool.h>
 #include <keymaster/keymaster_context.h>
-#include <keymaster/km_openssl/software_random_source.h>
+#include <keymaster/km_openssl/drbg_random_source.h>
+#include <keymaster/legacy_support/key_characteristics_cache.h>
 #include <keymaster/soft_key_factory.h>
 #include <keymaster/random_source.h>
 
@@ -41,7 +43,7 @@ class Key;
 /**
  * SoftKeymasterContext provides the context for a non-secure implementation of AndroidKeymaster.
  */
-class SoftKeymasterContext: public KeymasterContext, SoftwareKeyBlobMaker, SoftwareRandomSource,
+class SoftKeymasterContext: public KeymasterContext, SoftwareKeyBlobMaker, DrbgRandomSource,
         AttestationRecordContext {
   public:
     explicit SoftKeymasterContext(const std::string& root_of_trust = "SW");
@@ -60,6 +62,13 @@ class SoftKeymasterContext: public KeymasterContext, SoftwareKeyBlobMaker, Softw
      */
     keymaster_error_t SetHardwareDevice(keymaster1_device_t* keymaster1_device);
 
+    /**
+     * Enables signing precomputation for software EC keys held behind key handles (see
+     * EcKeyFactory::set_precompute_signing).  Off by default.  The setting survives a later
+     * SetHardwareDevice call, but keys that live in the hardware device are never precomputed.
+     */
+    void set_precompute_ec_signing(bool precompute_signing);
+
     /*********************************************************************************************
      * Implement KeymasterContext
      */
@@ -76,9 +85,19 @@ class SoftKeymasterContext: public KeymasterContext, SoftwareKeyBlobMaker, Softw
     keymaster_error_t ParseKeyBlob(const KeymasterKeyBlob& blob,
                                    const AuthorizationSet& additional_params,
                                    UniquePtr<Key>* key) const override;
+    keymaster_error_t ParseKeyBlobAuthorizations(const KeymasterKeyBlob& blob,
+                                                 const AuthorizationSet& additional_params,
+                                                 AuthorizationSet* hw_enforced,
+                                                 AuthorizationSet* sw_enforced) const override;
+    keymaster_error_t MigrateKeyBlob(const KeymasterKeyBlob& blob,
+                                     const AuthorizationSet& additional_params,
+                                     KeymasterKeyBlob* migrated_blob) const override;
     keymaster_error_t DeleteKey(const KeymasterKeyBlob& blob) const override;
     keymaster_error_t DeleteAllKeys() const override;
     keymaster_error_t AddRngEntropy(const uint8_t* buf, size_t length) const override;
+    void RunTasks(size_t num_tasks, void (*task)(void* task_context, size_t index),
+                  void* task_context) const override;
+    size_t max_concurrent_tasks() const override;
 
     keymaster_error_t GenerateAttestation(const Key& key,
                                           const AuthorizationSet& attest_params,
@@ -105,6 +124,16 @@ class SoftKeymasterContext: public KeymasterContext, SoftwareKeyBlobMaker, Softw
     /*********************************************************************************************/
 
   private:
+    /**
+     * Identifies the kind of blob (see the list in the implementation) and extracts its key
+     * material and authorizations, after integrity checking.  Shared by ParseKeyBlob and
+     * ParseKeyBlobAuthorizations.
+     */
+    keymaster_error_t DeserializeKeyBlob(const KeymasterKeyBlob& blob,
+                                         const AuthorizationSet& additional_params,
+                                         KeymasterKeyBlob* key_material,
+                                         AuthorizationSet* hw_enforced,
+                                         AuthorizationSet* sw_enforced) const;
     keymaster_error_t ParseKeymaster1HwBlob(const KeymasterKeyBlob& blob,
                                             const AuthorizationSet& additional_params,
                                             KeymasterKeyBlob* key_material,
@@ -126,6 +155,9 @@ class SoftKeymasterContext: public KeymasterContext, SoftwareKeyBlobMaker, Softw
     const KeymasterBlob root_of_trust_;
     uint32_t os_version_;
     uint32_t os_patchlevel_;
+    bool precompute_ec_signing_;
+    mutable ThreadPool thread_pool_;
+    mutable KeyCharacteristicsCache km1_characteristics_cache_;
 };
 
 }  // namespace keymaster
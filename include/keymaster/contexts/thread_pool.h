@@ -0,0 +1,75 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_THREAD_POOL_H_
+#define SYSTEM_KEYMASTER_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace keymaster {
+
+/**
+ * ThreadPool implements KeymasterContext::RunTasks for the software contexts.
+ *
+ * Worker threads are started on the first Run that has more than one task, so contexts that never
+ * run a batch don't pay for them.  The calling thread works through the batch alongside the
+ * workers, and several threads may call Run at once; their batches share the workers.
+ *
+ * Uses the C++ standard library, so it isn't part of libkeymaster_portable.
+ */
+class ThreadPool {
+  public:
+    /**
+     * |num_threads| of zero means one fewer than the number of hardware threads, leaving one for
+     * the caller.
+     */
+    explicit ThreadPool(size_t num_threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    void operator=(const ThreadPool&) = delete;
+
+    void Run(size_t num_tasks, void (*task)(void* task_context, size_t index), void* task_context);
+
+    /**
+     * The number of worker threads, not counting the caller of Run.
+     */
+    size_t num_threads() const { return num_threads_; }
+
+  private:
+    struct Batch;
+
+    void StartThreads();
+    void WorkOn(Batch* batch);
+    void WorkerLoop();
+
+    size_t num_threads_;
+
+    std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable batch_finished_;
+    std::deque<Batch*> batches_;
+    std::vector<std::thread> threads_;
+    bool stopping_ = false;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_THREAD_POOL_H_
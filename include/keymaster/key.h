@@ -60,6 +60,15 @@ class Key {
     const KeyFactory* key_factory() const { return key_factory_; }
     const KeyFactory*& key_factory() { return key_factory_; }
 
+    /**
+     * Makes this key share whatever operation setup state |source| keeps, creating it in |source|
+     * first if need be.  |source| must have the same key material and factory.  This is for keys
+     * that are rebuilt for every use from one long-lived key (see KeyHandleTable), so that work
+     * which depends only on the key material is done once rather than per operation.  Keys that
+     * keep no such state ignore the call.
+     */
+    virtual void ShareOperationState(Key* /* source */) {}
+
   protected:
     Key(AuthorizationSet&& hw_enforced, AuthorizationSet&& sw_enforced,
         const KeyFactory* key_factory)
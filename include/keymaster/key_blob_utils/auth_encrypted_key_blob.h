@@ -32,6 +32,13 @@ keymaster_error_t SerializeAuthEncryptedBlob(const KeymasterKeyBlob& encrypted_k
                                              const Buffer& nonce, const Buffer& tag,
                                              KeymasterKeyBlob* key_blob);
 
+/**
+ * Returns true if |key_blob| has the layout of a versioned or unversioned auth-encrypted blob,
+ * judging only by its header and length fields.  False means DeserializeAuthEncryptedBlob() would
+ * reject it.
+ */
+bool LooksLikeAuthEncryptedBlob(const KeymasterKeyBlob& key_blob);
+
 keymaster_error_t DeserializeAuthEncryptedBlob(const KeymasterKeyBlob& key_blob,
                                                KeymasterKeyBlob* encrypted_key_material,
                                                AuthorizationSet* hw_enforced,
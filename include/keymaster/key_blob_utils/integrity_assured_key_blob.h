@@ -17,6 +17,8 @@
 #ifndef SYSTEM_KEYMASTER_INTEGRITY_ASSURED_KEY_BLOB_
 #define SYSTEM_KEYMASTER_INTEGRITY_ASSURED_KEY_BLOB_
 
+#include <stdint.h>
+
 #include <hardware/keymaster_defs.h>
 
 namespace keymaster {
@@ -26,11 +28,35 @@ class Buffer;
 template<typename BlobType> struct TKeymasterBlob;
 typedef TKeymasterBlob<keymaster_key_blob_t> KeymasterKeyBlob;
 
-keymaster_error_t SerializeIntegrityAssuredBlob(const KeymasterKeyBlob& key_material,
-                                                const AuthorizationSet& hidden,
-                                                const AuthorizationSet& hw_enforced,
-                                                const AuthorizationSet& sw_enforced,
-                                                KeymasterKeyBlob* key_blob);
+/**
+ * Integrity-assured blob layouts, identified by the blob's first byte.  Both end with a truncated
+ * HMAC over the rest of the blob and the hidden authorizations.
+ *
+ * V0 stores the key material and the two authorization sets in their usual serialized form, with
+ * fixed-width fields throughout and blob data collected into a separate indirect data area.
+ *
+ * COMPACT stores lengths, counts and values as varints, codes each tag as the difference from
+ * the previous one and keeps blob data inline with its entry, so blobs are smaller and parse in a
+ * single pass.  New blobs use it; V0 blobs are still accepted.
+ */
+enum IntegrityAssuredBlobVersion : uint8_t {
+    INTEGRITY_ASSURED_BLOB_V0 = 0,
+    INTEGRITY_ASSURED_BLOB_COMPACT = 1,
+};
+
+keymaster_error_t
+SerializeIntegrityAssuredBlob(const KeymasterKeyBlob& key_material, const AuthorizationSet& hidden,
+                              const AuthorizationSet& hw_enforced,
+                              const AuthorizationSet& sw_enforced, KeymasterKeyBlob* key_blob,
+                              IntegrityAssuredBlobVersion version = INTEGRITY_ASSURED_BLOB_COMPACT);
+
+/**
+ * Returns true if |key_blob| has the layout of an integrity-assured blob, judging only by its
+ * version byte and length fields.  No HMAC is computed, so a true result says nothing about
+ * whether the blob is genuine, but a false one means DeserializeIntegrityAssuredBlob() would
+ * reject it.
+ */
+bool LooksLikeIntegrityAssuredBlob(const KeymasterKeyBlob& key_blob);
 
 keymaster_error_t DeserializeIntegrityAssuredBlob(const KeymasterKeyBlob& key_blob,
                                                   const AuthorizationSet& hidden,
@@ -50,6 +50,34 @@ keymaster_error_t ParseOcbAuthEncryptedBlob(const KeymasterKeyBlob& blob,
                                             AuthorizationSet* hw_enforced,
                                             AuthorizationSet* sw_enforced);
 
+/**
+ * Software key blob formats, as bits in the mask returned by ClassifySoftwareKeyBlob().
+ */
+enum SoftwareKeyBlobFormat : uint32_t {
+    SOFTWARE_BLOB_INTEGRITY_ASSURED = 1 << 0,
+    SOFTWARE_BLOB_OCB_AUTH_ENCRYPTED = 1 << 1,
+    SOFTWARE_BLOB_OLD_SOFTKEYMASTER = 1 << 2,
+};
+
+/**
+ * Returns the mask of software blob formats that |blob| could be in, judging only by its header
+ * and length fields, without any crypto or allocation.  A format that isn't in the mask would fail
+ * to parse, so it needn't be tried.  Real blobs almost always match exactly one format; zero means
+ * the blob is a hardware blob or garbage.
+ */
+uint32_t ClassifySoftwareKeyBlob(const KeymasterKeyBlob& blob);
+
+/**
+ * Re-emits an OCB-encrypted keymaster1 software blob, an old softkeymaster blob or a V0
+ * integrity-assured blob as a compact integrity-assured blob with the same key material and
+ * authorizations, so that later parses take the fast path.  If |blob| is already a valid compact
+ * blob, returns KM_ERROR_OK and leaves |migrated_blob| empty.  Returns KM_ERROR_INVALID_KEY_BLOB
+ * if |blob| isn't a software blob in any format, or doesn't match |hidden|.
+ */
+keymaster_error_t MigrateLegacySoftwareKeyBlob(const KeymasterKeyBlob& blob,
+                                               const AuthorizationSet& hidden,
+                                               KeymasterKeyBlob* migrated_blob);
+
 keymaster_error_t SetKeyBlobAuthorizations(const AuthorizationSet& key_description,
                                            keymaster_key_origin_t origin, uint32_t os_version,
                                            uint32_t os_patchlevel, AuthorizationSet* hw_enforced,
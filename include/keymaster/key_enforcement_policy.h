@@ -0,0 +1,151 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef SYSTEM_KEYMASTER_KEY_ENFORCEMENT_POLICY_H_
+#define SYSTEM_KEYMASTER_KEY_ENFORCEMENT_POLICY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <hardware/keymaster_defs.h>
+
+#include <keymaster/UniquePtr.h>
+#include <keymaster/new>
+
+namespace keymaster {
+
+/**
+ * A key's authorizations, reduced to the values KeymasterEnforcement checks when it authorizes an
+ * operation on the key.  KeymasterEnforcement::CompileKeyPolicy builds one when a key is loaded:
+ * from its blob when an operation begins with the blob, or once per handle when the key is added to
+ * a KeyHandleTable, whose operations then get copies.  Authorizing begin, update and finish reads
+ * these fields instead of walking the whole authorization list each time.
+ *
+ * Where a key carries several values of a tag that sets a limit, only the most restrictive one is
+ * kept, since that's the only one that can fail.
+ */
+struct KeyEnforcementPolicy {
+    KeyEnforcementPolicy() { Reset(); }
+
+    KeyEnforcementPolicy(const KeyEnforcementPolicy&) = delete;
+    void operator=(const KeyEnforcementPolicy&) = delete;
+
+    void Reset() {
+        public_key = false;
+        purposes = 0;
+        invalid = false;
+        has_active_datetime = false;
+        active_datetime = 0;
+        has_origination_expire_datetime = false;
+        origination_expire_datetime = 0;
+        has_usage_expire_datetime = false;
+        usage_expire_datetime = 0;
+        has_min_seconds_between_ops = false;
+        min_seconds_between_ops = 0;
+        has_max_uses_per_boot = false;
+        max_uses_per_boot = 0;
+        user_secure_ids.reset();
+        user_secure_id_count = 0;
+        has_user_auth_type = false;
+        user_auth_type = 0;
+        has_auth_timeout = false;
+        auth_timeout = 0;
+        no_auth_required = false;
+        caller_nonce = false;
+        trusted_confirmation_required = false;
+    }
+
+    /**
+     * Makes this a copy of |other|.  Returns false, leaving this unchanged, if the copy of the
+     * secure IDs can't be allocated.
+     */
+    bool CopyFrom(const KeyEnforcementPolicy& other) {
+        UniquePtr<uint64_t[]> ids;
+        if (other.user_secure_id_count) {
+            ids.reset(new (std::nothrow) uint64_t[other.user_secure_id_count]);
+            if (!ids.get())
+                return false;
+            memcpy(ids.get(), other.user_secure_ids.get(),
+                   other.user_secure_id_count * sizeof(uint64_t));
+        }
+        public_key = other.public_key;
+        purposes = other.purposes;
+        invalid = other.invalid;
+        has_active_datetime = other.has_active_datetime;
+        active_datetime = other.active_datetime;
+        has_origination_expire_datetime = other.has_origination_expire_datetime;
+        origination_expire_datetime = other.origination_expire_datetime;
+        has_usage_expire_datetime = other.has_usage_expire_datetime;
+        usage_expire_datetime = other.usage_expire_datetime;
+        has_min_seconds_between_ops = other.has_min_seconds_between_ops;
+        min_seconds_between_ops = other.min_seconds_between_ops;
+        has_max_uses_per_boot = other.has_max_uses_per_boot;
+        max_uses_per_boot = other.max_uses_per_boot;
+        user_secure_ids.reset(ids.release());
+        user_secure_id_count = other.user_secure_id_count;
+        has_user_auth_type = other.has_user_auth_type;
+        user_auth_type = other.user_auth_type;
+        has_auth_timeout = other.has_auth_timeout;
+        auth_timeout = other.auth_timeout;
+        no_auth_required = other.no_auth_required;
+        caller_nonce = other.caller_nonce;
+        trusted_confirmation_required = other.trusted_confirmation_required;
+        return true;
+    }
+
+    bool allows_purpose(keymaster_purpose_t purpose) const {
+        return purpose < 32 && (purposes & (1U << purpose)) != 0;
+    }
+
+    // An RSA or EC key, whose public half may be used without restriction.
+    bool public_key;
+    // Bit (1 << purpose) is set for each KM_TAG_PURPOSE.
+    uint32_t purposes;
+    // The key has authorizations that no valid key blob can have.
+    bool invalid;
+
+    // The latest activation date, the earliest expiration dates, the longest interval between
+    // operations and the smallest use count.
+    bool has_active_datetime;
+    uint64_t active_datetime;
+    bool has_origination_expire_datetime;
+    uint64_t origination_expire_datetime;
+    bool has_usage_expire_datetime;
+    uint64_t usage_expire_datetime;
+    bool has_min_seconds_between_ops;
+    uint32_t min_seconds_between_ops;
+    bool has_max_uses_per_boot;
+    uint32_t max_uses_per_boot;
+
+    // User authentication.  Of several KM_TAG_USER_AUTH_TYPE or KM_TAG_AUTH_TIMEOUT values, the
+    // last one counts.
+    UniquePtr<uint64_t[]> user_secure_ids;
+    size_t user_secure_id_count;
+    bool has_user_auth_type;
+    uint32_t user_auth_type;
+    bool has_auth_timeout;
+    uint32_t auth_timeout;
+    bool no_auth_required;
+    bool trusted_confirmation_required;
+
+    bool caller_nonce;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_KEY_ENFORCEMENT_POLICY_H_
@@ -56,6 +56,16 @@ class KeyFactory {
 
     virtual OperationFactory* GetOperationFactory(keymaster_purpose_t purpose) const = 0;
 
+    /**
+     * Returns the factory for |purpose| operations with |key|.  Factories whose keys need different
+     * operations depending on their authorizations override this; by default it's just
+     * GetOperationFactory(purpose).
+     */
+    virtual OperationFactory* GetOperationFactoryForKey(const Key& /* key */,
+                                                        keymaster_purpose_t purpose) const {
+        return GetOperationFactory(purpose);
+    }
+
     // Informational methods.
     virtual const keymaster_key_format_t* SupportedImportFormats(size_t* format_count) const = 0;
     virtual const keymaster_key_format_t* SupportedExportFormats(size_t* format_count) const = 0;
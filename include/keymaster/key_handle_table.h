@@ -0,0 +1,98 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_KEY_HANDLE_TABLE_H_
+#define SYSTEM_KEYMASTER_KEY_HANDLE_TABLE_H_
+
+#include <stdint.h>
+
+#include <hardware/keymaster_defs.h>
+
+#include <keymaster/UniquePtr.h>
+#include <keymaster/android_keymaster_utils.h>
+#include <keymaster/authorization_set.h>
+#include <keymaster/key_enforcement_policy.h>
+
+namespace keymaster {
+
+class Key;
+class KeyFactory;
+
+/**
+ * KeyHandleTable holds keys that have already been parsed from their blobs, under random 64-bit
+ * handles, so that AndroidKeymaster can use them repeatedly without receiving and parsing the blob
+ * each time.  It holds at most |table_size| keys and evicts the least recently used one when full.
+ *
+ * Operations take ownership of the Key they're created from, so the table keeps each parsed key
+ * and the params it was loaded with, and on every use rebuilds a new Key from copies of its pieces
+ * with KeyFactory::LoadKey.  That skips the blob's integrity check or decryption and the
+ * enforcement key ID computation, which are what parsing a blob costs.  Rebuilt keys share the
+ * stored key's operation setup state (see Key::ShareOperationState), and the key's
+ * KeyEnforcementPolicy is compiled when it's added, so both are done once per handle too.
+ */
+class KeyHandleTable {
+  public:
+    explicit KeyHandleTable(size_t table_size) : table_size_(table_size), use_count_(0) {}
+
+    /**
+     * Takes |key|, which was parsed from |key_blob|, and stores it with
+     * |load_params|, |key_id| and its compiled enforcement policy, returning the new handle in
+     * |handle|.  A table of size zero returns KM_ERROR_UNIMPLEMENTED.
+     */
+    keymaster_error_t Add(UniquePtr<Key>&& key, const keymaster_key_blob_t& key_blob,
+                          const AuthorizationSet& load_params, uint64_t key_id, uint64_t* handle);
+
+    /**
+     * Builds a new Key for |handle| and marks it most recently used.  Returns
+     * KM_ERROR_INVALID_KEY_BLOB if there's no such handle.  If |policy| isn't null it's pointed at
+     * the key's compiled enforcement policy, which stays valid until the table is next changed.
+     */
+    keymaster_error_t LoadKey(uint64_t handle, UniquePtr<Key>* key, uint64_t* key_id,
+                              const KeyEnforcementPolicy** policy = nullptr);
+
+    bool Delete(uint64_t handle);
+
+    /**
+     * Deletes every handle that was loaded from |key_blob|.
+     */
+    void DeleteKeyBlob(const keymaster_key_blob_t& key_blob);
+
+    void Clear();
+
+  private:
+    static const size_t kBlobDigestSize = 32;
+
+    struct Entry {
+        uint64_t handle = 0;  // Zero means the entry is free.
+        uint64_t last_use = 0;
+        uint64_t key_id = 0;
+        uint8_t blob_digest[kBlobDigestSize] = {};
+        UniquePtr<Key> key;
+        AuthorizationSet load_params;
+        UniquePtr<KeyEnforcementPolicy> policy;
+    };
+
+    Entry* Find(uint64_t handle);
+    static void DigestBlob(const keymaster_key_blob_t& key_blob, uint8_t digest[kBlobDigestSize]);
+
+    UniquePtr<Entry[]> table_;
+    size_t table_size_;
+    uint64_t use_count_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_KEY_HANDLE_TABLE_H_
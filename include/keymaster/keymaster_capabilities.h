@@ -0,0 +1,122 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef SYSTEM_KEYMASTER_KEYMASTER_CAPABILITIES_H_
+#define SYSTEM_KEYMASTER_KEYMASTER_CAPABILITIES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hardware/keymaster_defs.h>
+
+#include <keymaster/UniquePtr.h>
+#include <keymaster/serializable.h>
+
+namespace keymaster {
+
+/**
+ * One list of enum values from a KeymasterCapabilities.  It points into the capabilities it came
+ * from, so it's only good for as long as they are.
+ */
+struct CapabilityList {
+    CapabilityList() : values(nullptr), count(0) {}
+
+    bool Contains(uint32_t value) const;
+
+    const uint32_t* values;
+    size_t count;
+};
+
+/**
+ * KeymasterCapabilities holds everything the AndroidKeymaster Supported* queries can report, as one
+ * flat array of uint32_t, so that it can be built once and then handed out or sent over the wire
+ * without any further factory lookups or allocations per query.  The array holds:
+ *
+ *     algorithms               the list SupportedAlgorithms reports
+ *     entry_count
+ *     entry_count times:
+ *         algorithm
+ *         import_formats
+ *         export_formats
+ *         purpose_count
+ *         purpose_count times:
+ *             purpose
+ *             block_modes
+ *             padding_modes
+ *             digests
+ *
+ * where each list is a count followed by that many values.  There is an entry for every algorithm
+ * that has a key factory, which may be more than the algorithms list names, and in it one for every
+ * purpose that has an operation factory.
+ */
+class KeymasterCapabilities : public Serializable {
+  public:
+    KeymasterCapabilities() : values_length_(0) {}
+
+    /**
+     * Copies |values| and checks that they're laid out as described above.  If they're not, or the
+     * copy can't be allocated, returns false and leaves the capabilities empty.
+     */
+    bool Reinitialize(const uint32_t* values, size_t values_length);
+    bool Reinitialize(const KeymasterCapabilities& other) {
+        return Reinitialize(other.values_.get(), other.values_length_);
+    }
+    void Clear();
+
+    bool empty() const { return values_length_ == 0; }
+    const uint32_t* values() const { return values_.get(); }
+    size_t values_length() const { return values_length_; }
+
+    /**
+     * These report what the AndroidKeymaster Supported* method of the same name would, including
+     * KM_ERROR_UNSUPPORTED_ALGORITHM and KM_ERROR_UNSUPPORTED_PURPOSE, but without allocating.
+     * Empty capabilities make them all fail with KM_ERROR_UNKNOWN_ERROR.
+     */
+    keymaster_error_t SupportedAlgorithms(CapabilityList* algorithms) const;
+    keymaster_error_t SupportedImportFormats(keymaster_algorithm_t algorithm,
+                                             CapabilityList* formats) const;
+    keymaster_error_t SupportedExportFormats(keymaster_algorithm_t algorithm,
+                                             CapabilityList* formats) const;
+    keymaster_error_t SupportedBlockModes(keymaster_algorithm_t algorithm,
+                                          keymaster_purpose_t purpose,
+                                          CapabilityList* block_modes) const;
+    keymaster_error_t SupportedPaddingModes(keymaster_algorithm_t algorithm,
+                                            keymaster_purpose_t purpose,
+                                            CapabilityList* padding_modes) const;
+    keymaster_error_t SupportedDigests(keymaster_algorithm_t algorithm,
+                                       keymaster_purpose_t purpose,
+                                       CapabilityList* digests) const;
+
+    size_t SerializedSize() const override;
+    uint8_t* Serialize(uint8_t* buf, const uint8_t* end) const override;
+    bool Deserialize(const uint8_t** buf_ptr, const uint8_t* end) override;
+
+  private:
+    // Returns the entry for |algorithm|, pointing just past the algorithm, or nullptr.
+    const uint32_t* FindEntry(keymaster_algorithm_t algorithm) const;
+    keymaster_error_t FindAlgorithmList(keymaster_algorithm_t algorithm, size_t list_index,
+                                        CapabilityList* list) const;
+    keymaster_error_t FindPurposeList(keymaster_algorithm_t algorithm, keymaster_purpose_t purpose,
+                                      size_t list_index, CapabilityList* list) const;
+
+    UniquePtr<uint32_t[]> values_;
+    size_t values_length_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_KEYMASTER_CAPABILITIES_H_
@@ -107,6 +107,37 @@ class KeymasterContext {
                                            const AuthorizationSet& additional_params,
                                            UniquePtr<Key>* key) const = 0;
 
+    /**
+     * ParseKeyBlobAuthorizations does the same integrity checking and decryption as ParseKeyBlob,
+     * but returns only the authorization sets.  It doesn't construct a Key, so implementations can
+     * skip decoding the key material, which for asymmetric keys is most of the cost.
+     *
+     * Contexts that don't implement it return KM_ERROR_UNIMPLEMENTED, and callers fall back to
+     * ParseKeyBlob.
+     */
+    virtual keymaster_error_t
+    ParseKeyBlobAuthorizations(const KeymasterKeyBlob& /* blob */,
+                               const AuthorizationSet& /* additional_params */,
+                               AuthorizationSet* /* hw_enforced */,
+                               AuthorizationSet* /* sw_enforced */) const {
+        return KM_ERROR_UNIMPLEMENTED;
+    }
+
+    /**
+     * MigrateKeyBlob re-emits a blob in a legacy format as a blob in the context's current format,
+     * with the same key material and authorizations, so that later ParseKeyBlob calls don't have
+     * to fall back through the legacy parsers.  If |blob| is already in the current format (or is
+     * a hardware blob that has no other form), returns KM_ERROR_OK and leaves |migrated_blob|
+     * empty.  Unlike UpgradeKeyBlob, the OS version and patch level are left alone.
+     *
+     * Contexts that have no legacy formats to migrate from return KM_ERROR_UNIMPLEMENTED.
+     */
+    virtual keymaster_error_t MigrateKeyBlob(const KeymasterKeyBlob& /* blob */,
+                                             const AuthorizationSet& /* additional_params */,
+                                             KeymasterKeyBlob* /* migrated_blob */) const {
+        return KM_ERROR_UNIMPLEMENTED;
+    }
+
     /**
      * Take whatever environment-specific action is appropriate (if any) to delete the specified
      * key.
@@ -144,6 +175,23 @@ class KeymasterContext {
               AuthorizationSet* wrapped_key_params, keymaster_key_format_t* wrapped_key_format,
               KeymasterKeyBlob* wrapped_key_material) const = 0;
 
+    /**
+     * Calls |task|(|task_context|, i) for each i in [0, |num_tasks|) and returns once all of the
+     * calls have completed.  The calls must be independent of one another, so contexts with threads
+     * to spare may make them concurrently.  The default makes them in order on the calling thread.
+     */
+    virtual void RunTasks(size_t num_tasks, void (*task)(void* task_context, size_t index),
+                          void* task_context) const {
+        for (size_t i = 0; i < num_tasks; ++i)
+            task(task_context, i);
+    }
+
+    /**
+     * Returns how many of the calls RunTasks makes may run at once.  Callers that would split work
+     * into tasks only to spread it across threads can skip the split when this is one.
+     */
+    virtual size_t max_concurrent_tasks() const { return 1; }
+
   private:
     // Uncopyable.
     KeymasterContext(const KeymasterContext&);
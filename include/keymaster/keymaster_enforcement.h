@@ -21,6 +21,7 @@
 
 #include <keymaster/android_keymaster_messages.h>
 #include <keymaster/authorization_set.h>
+#include <keymaster/key_enforcement_policy.h>
 
 namespace keymaster {
 
@@ -89,6 +90,38 @@ class KeymasterEnforcement {
         return AuthorizeUpdateOrFinish(auth_set, operation_params, op_handle);
     }
 
+    /**
+     * Reduces a key's authorizations to the KeyEnforcementPolicy that the overloads below check.
+     * Key authorizations don't change, so this is done once per key rather than on every call:
+     * when a blob is loaded to begin an operation, or when a key is added to a KeyHandleTable.
+     */
+    static keymaster_error_t CompileKeyPolicy(const AuthProxy& auth_set,
+                                              KeyEnforcementPolicy* policy);
+
+    /**
+     * As above, but checks a policy compiled by CompileKeyPolicy, so the key's authorizations
+     * aren't walked again.  The result is the same, except that when a key fails more than one
+     * check the error reported may differ.
+     */
+    keymaster_error_t AuthorizeOperation(const keymaster_purpose_t purpose, const km_id_t keyid,
+                                         const KeyEnforcementPolicy& policy,
+                                         const AuthorizationSet& operation_params,
+                                         keymaster_operation_handle_t op_handle,
+                                         bool is_begin_operation);
+    keymaster_error_t AuthorizeBegin(const keymaster_purpose_t purpose, const km_id_t keyid,
+                                     const KeyEnforcementPolicy& policy,
+                                     const AuthorizationSet& operation_params);
+    keymaster_error_t AuthorizeUpdate(const KeyEnforcementPolicy& policy,
+                                      const AuthorizationSet& operation_params,
+                                      keymaster_operation_handle_t op_handle) {
+        return AuthorizeUpdateOrFinish(policy, operation_params, op_handle);
+    }
+    keymaster_error_t AuthorizeFinish(const KeyEnforcementPolicy& policy,
+                                      const AuthorizationSet& operation_params,
+                                      keymaster_operation_handle_t op_handle) {
+        return AuthorizeUpdateOrFinish(policy, operation_params, op_handle);
+    }
+
     //
     // Methods that must be implemented by subclasses
     //
@@ -183,6 +216,11 @@ class KeymasterEnforcement {
     keymaster_error_t AuthorizeUpdateOrFinish(const AuthProxy& auth_set,
                                               const AuthorizationSet& operation_params,
                                               keymaster_operation_handle_t op_handle);
+    keymaster_error_t AuthorizeUpdateOrFinish(const KeyEnforcementPolicy& policy,
+                                              const AuthorizationSet& operation_params,
+                                              keymaster_operation_handle_t op_handle);
+    keymaster_error_t RecordKeyAccess(const km_id_t keyid, uint32_t min_ops_timeout,
+                                      bool update_access_count);
 
     bool MinTimeBetweenOpsPassed(uint32_t min_time_between, const km_id_t keyid);
     bool MaxUsesPerBootNotExceeded(const km_id_t keyid, uint32_t max_uses);
@@ -191,6 +229,11 @@ class KeymasterEnforcement {
                           const int auth_timeout_index,
                           const keymaster_operation_handle_t op_handle,
                           bool is_begin_operation) const;
+    // |auth_type_mask| and |auth_timeout| are null if the key has no such authorization.
+    bool AuthTokenMatches(const AuthorizationSet& operation_params, const uint64_t user_secure_id,
+                          const uint32_t* auth_type_mask, const uint32_t* auth_timeout,
+                          const keymaster_operation_handle_t op_handle,
+                          bool is_begin_operation) const;
 
     AccessTimeMap* access_time_map_;
     AccessCountMap* access_count_map_;
@@ -60,6 +60,12 @@ namespace keymaster {
 static const keymaster_tag_t KM_TAG_DIGEST_OLD = static_cast<keymaster_tag_t>(KM_ENUM | 5);
 static const keymaster_tag_t KM_TAG_PADDING_OLD = static_cast<keymaster_tag_t>(KM_ENUM | 7);
 
+// Curve25519 keys, which the keymaster HAL doesn't define.  They're EC keys on this curve: Ed25519
+// keys if their purposes are signing and verification, and X25519 keys if their purpose is key
+// agreement.  Both values are the next free ones after the HAL's own.
+static const keymaster_ec_curve_t KM_EC_CURVE_CURVE_25519 = static_cast<keymaster_ec_curve_t>(4);
+static const keymaster_purpose_t KM_PURPOSE_AGREE_KEY = static_cast<keymaster_purpose_t>(6);
+
 // Until we have C++11, fake std::static_assert.
 template <bool b> struct StaticAssert {};
 template <> struct StaticAssert<true> {
@@ -26,6 +26,18 @@ namespace keymaster {
 const size_t kMinGcmTagLength = 12 * 8;
 const size_t kMaxGcmTagLength = 16 * 8;
 
+/**
+ * ChaCha20-Poly1305 (RFC 8439), for devices whose cores lack AES instructions.  It isn't a block
+ * cipher mode, and the keymaster HAL doesn't define it; it's offered as a block mode of 256-bit AES
+ * keys, whose key material serves as the ChaCha20 key, so that it can share the AES-GCM handling
+ * of nonces, associated data and tags.  Such keys can't have any other block mode.  The value is
+ * well clear of the HAL's modes, and AndroidKeymaster never reports it over the HAL.  Only
+ * available when built against BoringSSL.
+ */
+const keymaster_block_mode_t KM_MODE_CHACHA20_POLY1305 =
+    static_cast<keymaster_block_mode_t>(0x1000);
+const size_t kChaCha20Poly1305TagLength = 16 * 8;
+
 class AesKeyFactory : public SymmetricKeyFactory {
   public:
     explicit AesKeyFactory(const SoftwareKeyBlobMaker* blob_maker,
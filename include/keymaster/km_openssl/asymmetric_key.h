@@ -34,8 +34,58 @@ class AsymmetricKey : public Key {
                                              UniquePtr<uint8_t[]>* material,
                                              size_t* size) const override;
 
-    virtual bool InternalToEvp(EVP_PKEY* pkey) const = 0;
+    /**
+     * Copies the key into |pkey|, first decoding the key material if LoadKey deferred it.
+     */
+    bool InternalToEvp(EVP_PKEY* pkey) const {
+        return DecodeAndCopy(false /* public_only */, pkey);
+    }
+
+    /**
+     * Like InternalToEvp(), but if the key material hasn't been decoded yet only its public
+     * components are.  That skips the private key consistency checks of a full decode, and is all
+     * that verification, encryption and export need.
+     */
+    bool PublicKeyToEvp(EVP_PKEY* pkey) const {
+        return DecodeAndCopy(true /* public_only */, pkey);
+    }
+
+    /**
+     * Returns a new EVP_PKEY holding at least the key's public components, decoded the way
+     * PublicKeyToEvp() decodes them, or nullptr on failure.  Caller takes ownership.  Export and
+     * attestation use this, since not every kind of key can be copied into an existing EVP_PKEY.
+     */
+    virtual EVP_PKEY* NewPublicEvpKey() const;
+
     virtual bool EvpToInternal(const EVP_PKEY* pkey) = 0;
+
+    /**
+     * Decodes only the public components of key_material(), a private key of |evp_key_type| in
+     * the form d2i_PrivateKey() accepts, leaving the rest undecoded until the key is first used
+     * for a private key operation.  Returns false if the key material can't be decoded.
+     */
+    bool DeferDecoding(int evp_key_type);
+
+  protected:
+    /**
+     * Copies whatever the subclass currently holds into |pkey|, without decoding anything.
+     */
+    virtual bool CopyInternalToEvp(EVP_PKEY* pkey) const = 0;
+
+    /**
+     * Decodes deferred key material into the subclass, via EvpToInternal().  With |public_only|,
+     * key material that hasn't been decoded at all gets only its public components decoded.  Not
+     * thread-safe: a key belongs to the one operation it was loaded for, so decoding is too.
+     */
+    bool DecodeKeyMaterial(bool public_only) const;
+
+  private:
+    enum DecodeState { NOT_DECODED, PUBLIC_DECODED, FULLY_DECODED };
+
+    bool DecodeAndCopy(bool public_only, EVP_PKEY* pkey) const;
+
+    int evp_key_type_ = EVP_PKEY_NONE;
+    mutable DecodeState decoded_ = FULLY_DECODED;
 };
 
 }  // namespace keymaster
@@ -17,10 +17,36 @@
 #ifndef SYSTEM_KEYMASTER_CKDF_H_
 #define SYSTEM_KEYMASTER_CKDF_H_
 
+#include <openssl/cmac.h>
+
 #include <keymaster/android_keymaster_utils.h>
+#include <keymaster/km_openssl/openssl_utils.h>
 
 namespace keymaster {
 
+DEFINE_OPENSSL_OBJECT_POINTER(CMAC_CTX)
+
+/**
+ * Keyed implementation of CKDF, aka AES-CMAC KDF, from NIST SP 800-108.  The AES key schedule and
+ * CMAC subkeys are computed once, in Init, so repeated derivations under the same key only pay for
+ * the CMAC blocks themselves.
+ */
+class Ckdf {
+  public:
+    keymaster_error_t Init(const KeymasterKeyBlob& key);
+
+    /**
+     * Derives output->key_material_size bytes into |output|.  Uses 32-bit i and L, and prefixes
+     * with i.  The context is the concatenation of |context_chunks|.
+     */
+    keymaster_error_t GenerateKey(const KeymasterBlob& label,
+                                  const keymaster_blob_t* context_chunks, size_t num_chunks,
+                                  KeymasterKeyBlob* output);
+
+  private:
+    CMAC_CTX_Ptr ctx_;
+};
+
 /**
  * Implementation of CKDF, aka AES-CMAC KDF, from NIST SP 800-108.  Uses 32-bit i and L, and
  * prefixes with i.  This version takes the context in an array of keymaster_blob_ts.
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef SYSTEM_KEYMASTER_CURVE25519_KEY_H_
+#define SYSTEM_KEYMASTER_CURVE25519_KEY_H_
+
+#include <keymaster/km_openssl/asymmetric_key.h>
+#include <keymaster/km_openssl/openssl_utils.h>
+
+namespace keymaster {
+
+/**
+ * An EC key on KM_EC_CURVE_CURVE_25519: an Ed25519 signing key, or an X25519 key agreement key.
+ *
+ * Unlike EC_KEY and RSA, Curve25519 keys can't be copied into an EVP_PKEY that already exists, so
+ * the decoded EVP_PKEY itself is kept and handed out, through evp_key() and NewPublicEvpKey().  It
+ * is never modified once decoded, so the operations created from the key share it.
+ */
+class Curve25519Key : public AsymmetricKey {
+  public:
+    Curve25519Key(AuthorizationSet&& hw_enforced, AuthorizationSet&& sw_enforced,
+                  const KeyFactory* key_factory)
+        : AsymmetricKey(move(hw_enforced), move(sw_enforced), key_factory) {}
+    virtual ~Curve25519Key() {}
+
+    bool EvpToInternal(const EVP_PKEY* pkey) override;
+    EVP_PKEY* NewPublicEvpKey() const override;
+
+    /**
+     * Returns a new reference to the fully decoded key, or nullptr on failure.  Caller takes
+     * ownership of the reference.
+     */
+    EVP_PKEY* evp_key() const;
+
+  protected:
+    // Always fails; see the class comment.
+    bool CopyInternalToEvp(EVP_PKEY* /* pkey */) const override { return false; }
+
+  private:
+    static EVP_PKEY* NewReference(EVP_PKEY* pkey);
+
+    EVP_PKEY_Ptr pkey_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_CURVE25519_KEY_H_
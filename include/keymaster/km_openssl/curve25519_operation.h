@@ -0,0 +1,142 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef SYSTEM_KEYMASTER_CURVE25519_OPERATION_H_
+#define SYSTEM_KEYMASTER_CURVE25519_OPERATION_H_
+
+#include <openssl/evp.h>
+
+#include <keymaster/UniquePtr.h>
+
+#include <keymaster/key.h>
+#include <keymaster/operation.h>
+
+namespace keymaster {
+
+/**
+ * Base for Ed25519 and X25519 operations.  Neither can work incrementally: Ed25519 hashes the
+ * message twice, and X25519 needs the whole peer key, so Update just collects the input for Finish.
+ */
+class Curve25519Operation : public Operation {
+  public:
+    // Ed25519 isn't meant for bulk data; this bounds the memory an operation can hold.
+    static const size_t kMaxMessageSize = 16 * 1024;
+
+    Curve25519Operation(keymaster_purpose_t purpose, AuthorizationSet&& hw_enforced,
+                        AuthorizationSet&& sw_enforced, EVP_PKEY* key)
+        : Operation(purpose, move(hw_enforced), move(sw_enforced)), key_(key) {}
+    ~Curve25519Operation();
+
+    keymaster_error_t Begin(const AuthorizationSet& input_params,
+                            AuthorizationSet* output_params) override;
+    keymaster_error_t Update(const AuthorizationSet& additional_params, const Buffer& input,
+                             AuthorizationSet* output_params, Buffer* output,
+                             size_t* input_consumed) override;
+    keymaster_error_t Abort() override { return KM_ERROR_OK; }
+
+  protected:
+    EVP_PKEY* key_;
+    Buffer data_;
+};
+
+class Ed25519SignOperation : public Curve25519Operation {
+  public:
+    Ed25519SignOperation(AuthorizationSet&& hw_enforced, AuthorizationSet&& sw_enforced,
+                         EVP_PKEY* key)
+        : Curve25519Operation(KM_PURPOSE_SIGN, move(hw_enforced), move(sw_enforced), key) {}
+    keymaster_error_t Finish(const AuthorizationSet& additional_params, const Buffer& input,
+                             const Buffer& signature, AuthorizationSet* output_params,
+                             Buffer* output) override;
+};
+
+class Ed25519VerifyOperation : public Curve25519Operation {
+  public:
+    Ed25519VerifyOperation(AuthorizationSet&& hw_enforced, AuthorizationSet&& sw_enforced,
+                           EVP_PKEY* key)
+        : Curve25519Operation(KM_PURPOSE_VERIFY, move(hw_enforced), move(sw_enforced), key) {}
+    keymaster_error_t Finish(const AuthorizationSet& additional_params, const Buffer& input,
+                             const Buffer& signature, AuthorizationSet* output_params,
+                             Buffer* output) override;
+};
+
+/**
+ * Computes the X25519 shared secret with the peer whose public key, a DER-encoded
+ * SubjectPublicKeyInfo like the one ExportKey returns, is the operation's input.  The output is
+ * the raw 32-byte shared secret, which callers should pass through a KDF before use.
+ */
+class X25519AgreeOperation : public Curve25519Operation {
+  public:
+    X25519AgreeOperation(AuthorizationSet&& hw_enforced, AuthorizationSet&& sw_enforced,
+                         EVP_PKEY* key)
+        : Curve25519Operation(KM_PURPOSE_AGREE_KEY, move(hw_enforced), move(sw_enforced), key) {}
+    keymaster_error_t Finish(const AuthorizationSet& additional_params, const Buffer& input,
+                             const Buffer& signature, AuthorizationSet* output_params,
+                             Buffer* output) override;
+};
+
+class Curve25519OperationFactory : public OperationFactory {
+  private:
+    KeyType registry_key() const override { return KeyType(KM_ALGORITHM_EC, purpose()); }
+    OperationPtr CreateOperation(Key&& key, const AuthorizationSet& begin_params,
+                                 keymaster_error_t* error) const override;
+
+    virtual keymaster_purpose_t purpose() const = 0;
+    // The EVP type of the keys this factory's operations use.
+    virtual int evp_key_type() const = 0;
+    virtual Operation* InstantiateOperation(AuthorizationSet&& hw_enforced,
+                                            AuthorizationSet&& sw_enforced,
+                                            EVP_PKEY* key) const = 0;
+};
+
+class Ed25519OperationFactory : public Curve25519OperationFactory {
+  private:
+    const keymaster_digest_t* SupportedDigests(size_t* digest_count) const override;
+    int evp_key_type() const override { return EVP_PKEY_ED25519; }
+};
+
+class Ed25519SignOperationFactory : public Ed25519OperationFactory {
+  private:
+    keymaster_purpose_t purpose() const override { return KM_PURPOSE_SIGN; }
+    Operation* InstantiateOperation(AuthorizationSet&& hw_enforced, AuthorizationSet&& sw_enforced,
+                                    EVP_PKEY* key) const override {
+        return new (std::nothrow) Ed25519SignOperation(move(hw_enforced), move(sw_enforced), key);
+    }
+};
+
+class Ed25519VerifyOperationFactory : public Ed25519OperationFactory {
+  private:
+    keymaster_purpose_t purpose() const override { return KM_PURPOSE_VERIFY; }
+    Operation* InstantiateOperation(AuthorizationSet&& hw_enforced, AuthorizationSet&& sw_enforced,
+                                    EVP_PKEY* key) const override {
+        return new (std::nothrow)
+            Ed25519VerifyOperation(move(hw_enforced), move(sw_enforced), key);
+    }
+};
+
+class X25519AgreeOperationFactory : public Curve25519OperationFactory {
+  private:
+    keymaster_purpose_t purpose() const override { return KM_PURPOSE_AGREE_KEY; }
+    int evp_key_type() const override { return EVP_PKEY_X25519; }
+    Operation* InstantiateOperation(AuthorizationSet&& hw_enforced, AuthorizationSet&& sw_enforced,
+                                    EVP_PKEY* key) const override {
+        return new (std::nothrow) X25519AgreeOperation(move(hw_enforced), move(sw_enforced), key);
+    }
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_CURVE25519_OPERATION_H_
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_DRBG_RANDOM_SOURCE_H_
+#define SYSTEM_KEYMASTER_DRBG_RANDOM_SOURCE_H_
+
+#include <keymaster/random_source.h>
+
+namespace keymaster {
+
+/**
+ * DrbgRandomSource serves random bytes from a per-thread AES-256-CTR generator, rather than calling
+ * RAND_bytes for every request, so that the small draws made for operation handles, IVs and
+ * symmetric keys don't each pay for RAND_bytes' locking and reseed checks.
+ *
+ * Each thread's generator is seeded from RAND_bytes when the thread first uses it, and reseeded
+ * after every kReseedInterval bytes of output, after any AddEntropy call, and in the child after
+ * fork().  Output is generated
+ * kBufferSize bytes at a time and handed out from the buffer, which is wiped as it's consumed; the
+ * generator is rekeyed from its own output after each refill, so earlier output can't be recovered
+ * from its state.  Requests bigger than the buffer bypass it.
+ *
+ * All of the state is per-thread or process-wide, so any DrbgRandomSource is as good as another.
+ *
+ * Uses the C++ standard library, so unlike most of km_openssl it isn't part of
+ * libkeymaster_portable.
+ */
+class DrbgRandomSource : public RandomSource {
+  public:
+    static const size_t kBufferSize = 512;
+    static const size_t kReseedInterval = 1 << 20;
+
+    keymaster_error_t GenerateRandom(uint8_t* buffer, size_t length) const override;
+
+    /**
+     * Mixes \p length bytes of \p data into the seed of every thread's generator, and makes each
+     * of them reseed before producing any more output.
+     */
+    static void AddEntropy(const uint8_t* data, size_t length);
+
+    /**
+     * Makes GenerateRandom() in openssl_utils.h, which supplies operation handles and IVs, draw
+     * from DrbgRandomSource.
+     */
+    static void InstallForGenerateRandom();
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_DRBG_RANDOM_SOURCE_H_
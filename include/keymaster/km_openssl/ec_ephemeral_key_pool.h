@@ -0,0 +1,81 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_EC_EPHEMERAL_KEY_POOL_H_
+#define SYSTEM_KEYMASTER_EC_EPHEMERAL_KEY_POOL_H_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <keymaster/km_openssl/nist_curve_key_exchange.h>
+
+namespace keymaster {
+
+/**
+ * EcEphemeralKeyPool keeps a stock of pre-generated ephemeral key pairs for each NIST curve, so
+ * that an EciesKem::Encrypt costs one ECDH instead of a key generation plus an ECDH.
+ *
+ * A curve is stocked only after its first TakeKeyExchange call.  From then on a background thread
+ * tops it back up to |keys_per_curve| whenever keys are taken.  TakeKeyExchange never waits for the
+ * background thread: if the stock is empty it generates a key inline, exactly as
+ * NistCurveKeyExchange::GenerateKeyExchange would.  Each key is handed out once.
+ *
+ * Passing |background_refill| = false leaves topping up to explicit Refill calls, which makes
+ * the stock level deterministic for tests.
+ *
+ * Uses the C++ standard library, so unlike most of km_openssl it isn't part of
+ * libkeymaster_portable.
+ */
+class EcEphemeralKeyPool : public NistCurveKeyExchangeSource {
+  public:
+    explicit EcEphemeralKeyPool(size_t keys_per_curve, bool background_refill = true);
+    ~EcEphemeralKeyPool() override;
+
+    NistCurveKeyExchange* TakeKeyExchange(keymaster_ec_curve_t curve) override;
+
+    /**
+     * Returns the number of keys currently stocked for |curve|.
+     */
+    size_t available(keymaster_ec_curve_t curve) const;
+
+    /**
+     * Tops the stock for |curve| up to |keys_per_curve| on the calling thread, and marks the curve
+     * as stocked.  Returns false if a key could not be generated.
+     */
+    bool Refill(keymaster_ec_curve_t curve);
+
+  private:
+    static const size_t kNumCurves = KM_EC_CURVE_P_521 + 1;
+
+    void RefillLoop();
+    bool FindCurveToRefill(size_t* curve_index) const;
+
+    const size_t keys_per_curve_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable refill_needed_;
+    std::vector<std::unique_ptr<NistCurveKeyExchange>> keys_[kNumCurves];
+    bool stocked_[kNumCurves] = {};
+    bool stopping_ = false;
+    std::thread refill_thread_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_EC_EPHEMERAL_KEY_POOL_H_
@@ -33,18 +33,54 @@ class EcKey : public AsymmetricKey {
         : AsymmetricKey(move(hw_enforced), move(sw_enforced), key_factory) {}
     virtual ~EcKey() {}
 
-    bool InternalToEvp(EVP_PKEY* pkey) const override;
     bool EvpToInternal(const EVP_PKEY* pkey) override;
 
-    EC_KEY* key() const { return ec_key_.get(); }
+    EC_KEY* key() const {
+        DecodeKeyMaterial(false /* public_only */);
+        return ec_key_.get();
+    }
+
+    /**
+     * Prepares this key for repeated signing.  The key material is decoded and checked, on OpenSSL
+     * fixed-base multiples of the curve generator are attached to the key, and an EVP_PKEY
+     * wrapping it is built once, to be shared by every operation created from the key afterwards.
+     * ShareOperationState() calls this on the key behind a key handle when the key opted in.
+     */
+    keymaster_error_t PrecomputeSigningState();
+
+    /**
+     * Returns the EVP_PKEY built by PrecomputeSigningState(), or nullptr if it hasn't been called.
+     * The caller does not take ownership.
+     */
+    EVP_PKEY* precomputed_pkey() const { return precomputed_pkey_.get(); }
+
+    /**
+     * Opts this key in to PrecomputeSigningState() through ShareOperationState(), that is, when it
+     * is the long-lived key behind a key handle.  EcKeyFactory sets this on the keys it creates
+     * when signing precomputation is enabled on the factory.
+     */
+    void set_precompute_signing(bool precompute_signing) {
+        precompute_signing_ = precompute_signing;
+    }
+
+    /**
+     * If this key opted in to signing precomputation and may sign, runs PrecomputeSigningState()
+     * on |source| and shares the result, so that each key rebuilt from a handle starts operations
+     * from the same prepared EVP_PKEY without decoding its key material again.
+     */
+    void ShareOperationState(Key* source) override;
 
   protected:
+    bool CopyInternalToEvp(EVP_PKEY* pkey) const override;
+
     EcKey(EC_KEY* ec_key, AuthorizationSet&& hw_enforced, AuthorizationSet&& sw_enforced,
           const KeyFactory* key_factory)
         : AsymmetricKey(move(hw_enforced), move(sw_enforced), key_factory), ec_key_(ec_key) {}
 
   private:
     EC_KEY_Ptr ec_key_;
+    EVP_PKEY_Ptr precomputed_pkey_;
+    bool precompute_signing_ = false;
 };
 
 }  // namespace keymaster
@@ -26,6 +26,11 @@
 
 namespace keymaster {
 
+/**
+ * Creates and loads EC keys.  Besides the NIST curves, keys on KM_EC_CURVE_CURVE_25519 are
+ * supported, as Ed25519 signing keys or, if their purpose is KM_PURPOSE_AGREE_KEY, X25519 key
+ * agreement keys; those are loaded as Curve25519Key, and get their own operation factories.
+ */
 class EcKeyFactory : public AsymmetricKeyFactory, public SoftKeyFactoryMixin {
   public:
     explicit EcKeyFactory(const SoftwareKeyBlobMaker* blob_maker) :
@@ -54,13 +59,35 @@ class EcKeyFactory : public AsymmetricKeyFactory, public SoftKeyFactoryMixin {
                                                  uint32_t* key_size) const;
 
     OperationFactory* GetOperationFactory(keymaster_purpose_t purpose) const override;
+    OperationFactory* GetOperationFactoryForKey(const Key& key,
+                                                keymaster_purpose_t purpose) const override;
+
+    /**
+     * Enables signing precomputation (see EcKey::PrecomputeSigningState) for the EC keys this
+     * factory creates, which takes effect for keys held behind a key handle.  Off by default,
+     * since each handle then keeps a decoded key and its EVP_PKEY in memory.
+     */
+    void set_precompute_signing(bool precompute_signing) {
+        precompute_signing_ = precompute_signing;
+    }
 
   protected:
-    static EC_GROUP* ChooseGroup(size_t key_size_bits);
-    static EC_GROUP* ChooseGroup(keymaster_ec_curve_t ec_curve);
+    int key_material_type(const AsymmetricKey& key) const override;
+
+    // The returned groups are shared; see ec_get_shared_group().
+    static const EC_GROUP* ChooseGroup(size_t key_size_bits);
+    static const EC_GROUP* ChooseGroup(keymaster_ec_curve_t ec_curve);
 
     static keymaster_error_t GetCurveAndSize(const AuthorizationSet& key_description,
                                              keymaster_ec_curve_t* curve, uint32_t* key_size_bits);
+
+  private:
+    static keymaster_error_t
+    UpdateCurve25519ImportKeyDescription(const AuthorizationSet& key_description, int evp_key_type,
+                                         AuthorizationSet* updated_description,
+                                         uint32_t* key_size_bits);
+
+    bool precompute_signing_ = false;
 };
 
 }  // namespace keymaster
@@ -26,6 +26,7 @@
 
 #include "hkdf.h"
 #include "key_exchange.h"
+#include "nist_curve_key_exchange.h"
 
 namespace keymaster {
 
@@ -38,6 +39,13 @@ class EciesKem : public Kem {
     virtual ~EciesKem() override {}
     EciesKem(const AuthorizationSet& kem_description, keymaster_error_t* error);
 
+    /**
+     * Creates an EciesKem that takes its ephemeral keys from |ephemeral_keys|, which must outlive
+     * it, rather than generating one in each Encrypt call.
+     */
+    EciesKem(const AuthorizationSet& kem_description, NistCurveKeyExchangeSource* ephemeral_keys,
+             keymaster_error_t* error);
+
     /* Kem interface. */
     bool Encrypt(const Buffer& peer_public_value, Buffer* output_clear_key,
                  Buffer* output_encrypted_key) override;
@@ -50,6 +58,7 @@ class EciesKem : public Kem {
 
   private:
     UniquePtr<KeyExchange> key_exchange_;
+    NistCurveKeyExchangeSource* ephemeral_keys_;
     UniquePtr<Rfc5869Sha256Kdf> kdf_;
     bool single_hash_mode_;
     uint32_t key_bytes_to_generate_;
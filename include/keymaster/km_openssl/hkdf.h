@@ -19,6 +19,7 @@
 
 #include "kdf.h"
 
+#include <keymaster/km_openssl/hmac.h>
 #include <keymaster/serializable.h>
 
 #include <keymaster/UniquePtr.h>
@@ -28,6 +29,10 @@ namespace keymaster {
 /**
  * Rfc5869Sha256Kdf implements the key derivation function specified in RFC 5869 (using SHA256) and
  * outputs key material, as needed by ECIES. See https://tools.ietf.org/html/rfc5869 for details.
+ *
+ * The Extract step runs once, in Init, and the resulting pseudo-random key is kept as a keyed HMAC
+ * state.  Each GenerateKey call only performs the Expand step, so deriving several keys with
+ * different |info| values from the same secret is cheap.
  */
 class Rfc5869Sha256Kdf : public Kdf {
   public:
@@ -37,12 +42,14 @@ class Rfc5869Sha256Kdf : public Kdf {
                     salt.available_read());
     }
 
-    bool Init(const uint8_t* secret, size_t secret_len, const uint8_t* salt, size_t salt_len) {
-        return Kdf::Init(KM_DIGEST_SHA_2_256, secret, secret_len, salt, salt_len);
-    }
+    bool Init(const uint8_t* secret, size_t secret_len, const uint8_t* salt, size_t salt_len);
 
     bool GenerateKey(const uint8_t* info, size_t info_len, uint8_t* output,
                      size_t output_len) override;
+
+  private:
+    // HMAC keyed with the pseudo-random key produced by the Extract step.
+    HmacSha256 expand_hmac_;
 };
 
 }  // namespace keymaster
@@ -17,6 +17,10 @@
 #ifndef SYSTEM_KEYMASTER_HMAC_H_
 #define SYSTEM_KEYMASTER_HMAC_H_
 
+#include <openssl/hmac.h>
+
+#include <hardware/keymaster_defs.h>
+
 #include <keymaster/serializable.h>
 
 namespace keymaster {
@@ -24,13 +28,19 @@ namespace keymaster {
 // Only HMAC-SHA256 is supported.
 class HmacSha256 {
   public:
-    HmacSha256(){};
+    HmacSha256();
+    ~HmacSha256();
+
+    // Not copyable; ctx_ holds keyed state.
+    HmacSha256(const HmacSha256&) = delete;
+    void operator=(const HmacSha256&) = delete;
 
     // DigestLength returns the length, in bytes, of the resulting digest.
     size_t DigestLength() const;
 
-    // Initializes this instance using |key|. Call Init only once. It returns
-    // false on the second of later calls.
+    // Initializes this instance using |key|. The keyed inner and outer hash
+    // states are computed here, once, and reused by every subsequent Sign or
+    // Verify call.
     bool Init(const uint8_t* key, size_t key_length);
     bool Init(const Buffer& key);
 
@@ -40,6 +50,11 @@ class HmacSha256 {
     bool Sign(const Buffer& data, uint8_t* digest, size_t digest_len) const;
     bool Sign(const uint8_t* data, size_t data_len, uint8_t* digest, size_t digest_len) const;
 
+    // Sign calculates the HMAC of the concatenation of |data_chunks|, without
+    // requiring the caller to materialize the concatenation.
+    bool Sign(const keymaster_blob_t* data_chunks, size_t num_chunks, uint8_t* digest,
+              size_t digest_len) const;
+
     // Verify returns true if |digest| is a valid HMAC of |data| using the key
     // supplied to Init. |digest| must be exactly |DigestLength()| bytes long.
     // Use of this method is strongly recommended over using Sign() with a manual
@@ -51,8 +66,8 @@ class HmacSha256 {
                 size_t digest_len) const;
 
   private:
-    UniquePtr<uint8_t[]> key_;
-    size_t key_len_;
+    HMAC_CTX ctx_;
+    bool initialized_;
 };
 
 }  // namespace keymaster
@@ -19,6 +19,8 @@
 
 #include <keymaster/km_openssl/kdf.h>
 
+#include <openssl/evp.h>
+
 #include <hardware/keymaster_defs.h>
 
 #include <keymaster/serializable.h>
@@ -29,14 +31,15 @@ namespace keymaster {
 /**
  * A light implementation of ISO18033KDF as defined by ISO-18033-2 (www.shoup.net/iso/std6.pdf) and
  * its slightly different variant ANSI-X9-42.
+ *
+ * The digest state after absorbing the secret is computed once, in Init, and cloned for each
+ * output block.
  */
 class Iso18033Kdf : public Kdf {
   public:
-    ~Iso18033Kdf() {}
+    ~Iso18033Kdf();
 
-    bool Init(keymaster_digest_t digest_type, const uint8_t* secret, size_t secret_len) {
-        return Kdf::Init(digest_type, secret, secret_len, nullptr /* salt */, 0 /* salt_len */);
-    }
+    bool Init(keymaster_digest_t digest_type, const uint8_t* secret, size_t secret_len);
 
     /**
      * Generates ISO18033's derived key, as defined in ISO-18033-2 and ANSI-X9-42. In ISO 18033-2,
@@ -56,10 +59,11 @@ class Iso18033Kdf : public Kdf {
                      size_t output_len) override;
 
   protected:
-    explicit Iso18033Kdf(uint32_t start_counter) : start_counter_(start_counter) {}
+    explicit Iso18033Kdf(uint32_t start_counter);
 
   private:
     uint32_t start_counter_;
+    EVP_MD_CTX secret_ctx_;  // Digest state after hashing the secret.
 };
 
 }  // namespace keymaster
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_KEYED_CONTEXT_TEMPLATES_H_
+#define SYSTEM_KEYMASTER_KEYED_CONTEXT_TEMPLATES_H_
+
+#include <stdint.h>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include <hardware/keymaster_defs.h>
+
+#include <keymaster/UniquePtr.h>
+#include <keymaster/android_keymaster_utils.h>
+
+namespace keymaster {
+
+/**
+ * KeyedContextTemplates holds cipher and HMAC contexts that are already keyed with one symmetric
+ * key, for operations to copy rather than key their own.  Keying a context is most of the cost of
+ * beginning a short operation (the AES key schedule, plus the GHASH table for GCM, or hashing the
+ * padded HMAC key), while copying one is little more than a memcpy.
+ *
+ * A context is created the first time it's asked for, for each block mode and direction, and kept
+ * until the templates are released.  Templates are reference counted so that every key built from
+ * the same key material can share one set, and are safe to use from several threads at once.
+ */
+class KeyedContextTemplates {
+  public:
+    /**
+     * Returns a new, empty set of templates with one reference, or nullptr if allocation fails.
+     */
+    static KeyedContextTemplates* New();
+
+    void AddRef();
+    void Release();
+
+    /**
+     * Returns a context keyed with |key| for |cipher|, which must be the cipher for |block_mode|,
+     * in the direction given by |encrypt|.  It has no IV and default padding.  Returns nullptr if
+     * the context can't be created.
+     */
+    const EVP_CIPHER_CTX* CipherContext(const EVP_CIPHER* cipher, keymaster_block_mode_t block_mode,
+                                        bool encrypt, const KeymasterKeyBlob& key);
+
+    /**
+     * Returns an HMAC context keyed with |key| for |md|, or nullptr if it can't be created.  An
+     * HMAC key has only one digest, so only one HMAC context is kept; asking for another digest
+     * returns nullptr.
+     */
+    const HMAC_CTX* HmacContext(const EVP_MD* md, const KeymasterKeyBlob& key);
+
+  private:
+    // Two directions for each of ECB, CBC, CTR and GCM.
+    static const size_t kCipherSlots = 8;
+
+    KeyedContextTemplates() {}
+    ~KeyedContextTemplates();
+
+    struct HmacTemplate {
+        explicit HmacTemplate(const EVP_MD* digest) : md(digest) { HMAC_CTX_init(&ctx); }
+        ~HmacTemplate() { HMAC_CTX_cleanup(&ctx); }
+
+        HMAC_CTX ctx;
+        const EVP_MD* const md;
+    };
+
+    static int CipherSlot(keymaster_block_mode_t block_mode, bool encrypt);
+
+    EVP_CIPHER_CTX* cipher_ctxs_[kCipherSlots] = {};
+    HmacTemplate* hmac_ = nullptr;
+    uint32_t ref_count_ = 1;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_KEYED_CONTEXT_TEMPLATES_H_
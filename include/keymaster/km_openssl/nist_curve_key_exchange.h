@@ -67,6 +67,22 @@ class NistCurveKeyExchange : public KeyExchange {
     size_t shared_secret_len_;
 };
 
+/**
+ * NistCurveKeyExchangeSource supplies ephemeral key exchanges, for callers that want to obtain
+ * their ephemeral keys from somewhere other than an inline NistCurveKeyExchange::GenerateKeyExchange
+ * call, e.g. from a pool generated ahead of time.
+ */
+class NistCurveKeyExchangeSource {
+  public:
+    virtual ~NistCurveKeyExchangeSource() {}
+
+    /**
+     * Returns a key exchange on |curve| that has not been returned before, or nullptr on failure.
+     * Caller takes ownership.
+     */
+    virtual NistCurveKeyExchange* TakeKeyExchange(keymaster_ec_curve_t curve) = 0;
+};
+
 }  // namespace keymaster
 
 #endif  // SYSTEM_KEYMASTER_NIST_CURVE_KEY_EXCHANGE_H_
@@ -32,6 +32,7 @@ namespace keymaster {
 
 template<typename BlobType> struct TKeymasterBlob;
 typedef TKeymasterBlob<keymaster_key_blob_t> KeymasterKeyBlob;
+class RandomSource;
 
 class EvpMdCtxCleaner {
   public:
@@ -61,6 +62,7 @@ DEFINE_OPENSSL_OBJECT_POINTER(EC_KEY)
 DEFINE_OPENSSL_OBJECT_POINTER(EC_POINT)
 DEFINE_OPENSSL_OBJECT_POINTER(ENGINE)
 DEFINE_OPENSSL_OBJECT_POINTER(EVP_PKEY)
+DEFINE_OPENSSL_OBJECT_POINTER(EVP_PKEY_CTX)
 DEFINE_OPENSSL_OBJECT_POINTER(PKCS8_PRIV_KEY_INFO)
 DEFINE_OPENSSL_OBJECT_POINTER(RSA)
 DEFINE_OPENSSL_OBJECT_POINTER(X509)
@@ -71,8 +73,45 @@ typedef OpenSslObjectDeleter<BIGNUM, BN_free> BIGNUM_Delete;
 typedef UniquePtr<BIGNUM, BIGNUM_Delete> BIGNUM_Ptr;
 
 keymaster_error_t ec_get_group_size(const EC_GROUP* group, size_t* key_size_bits);
+
+/**
+ * Returns true for the EVP types of Curve25519 keys, Ed25519 and X25519, which keymaster handles as
+ * KM_ALGORITHM_EC keys on KM_EC_CURVE_CURVE_25519.
+ */
+inline bool is_curve25519_evp_type(int evp_key_type) {
+    return evp_key_type == EVP_PKEY_ED25519 || evp_key_type == EVP_PKEY_X25519;
+}
 EC_GROUP* ec_get_group(keymaster_ec_curve_t curve);
 
+/**
+ * Returns a process-wide EC_GROUP for |curve|, with the generator multiples precomputed, or nullptr
+ * if |curve| isn't a supported NIST curve.  The group is created on first use and never freed;
+ * callers must not free or modify it.  EC_KEY_set_group() may be used to attach it to keys.
+ */
+const EC_GROUP* ec_get_shared_group(keymaster_ec_curve_t curve);
+
+/**
+ * Returns the object published in |*slot|, first creating it with |create| and publishing it if the
+ * slot is still empty, or nullptr if |create| fails.  Published objects are never freed.
+ *
+ * Publication is lock-free, since this must also work where no mutex is available.  If two threads
+ * race, the loser destroys its object with Delete_T and uses the winner's.
+ */
+template <typename T, typename Delete_T, typename Create_T>
+T* publish_once(T** slot, Create_T create) {
+    T* published = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (published)
+        return published;
+
+    UniquePtr<T, Delete_T> created(create());
+    if (!created.get())
+        return nullptr;
+    if (__atomic_compare_exchange_n(slot, &published, created.get(), false /* weak */,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return created.release();
+    return published;
+}
+
 /**
  * Many OpenSSL APIs take ownership of an argument on success but don't free the argument on
  * failure. This means we need to tell our scoped pointers when we've transferred ownership, without
@@ -98,6 +137,13 @@ size_t ec_group_size_bits(EC_KEY* ec_key);
 
 keymaster_error_t GenerateRandom(uint8_t* buf, size_t length);
 
+/**
+ * Makes GenerateRandom draw from |random_source| instead of calling RAND_bytes directly, or
+ * restores RAND_bytes if |random_source| is null.  |random_source| must remain valid, and safe to
+ * call from any thread, until it's replaced.
+ */
+void SetGenerateRandomSource(const RandomSource* random_source);
+
 }  // namespace keymaster
 
 #endif  // SYSTEM_KEYMASTER_OPENSSL_UTILS_H_
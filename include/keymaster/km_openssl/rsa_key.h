@@ -29,7 +29,6 @@ class RsaKey : public AsymmetricKey {
            const KeyFactory* key_factory)
         : AsymmetricKey(move(hw_enforced), move(sw_enforced), key_factory) {}
 
-    bool InternalToEvp(EVP_PKEY* pkey) const override;
     bool EvpToInternal(const EVP_PKEY* pkey) override;
 
     bool SupportedMode(keymaster_purpose_t purpose, keymaster_padding_t padding);
@@ -39,9 +38,14 @@ class RsaKey : public AsymmetricKey {
         void operator()(RSA* p) { RSA_free(p); }
     };
 
-    RSA* key() const { return rsa_key_.get(); }
+    RSA* key() const {
+        DecodeKeyMaterial(false /* public_only */);
+        return rsa_key_.get();
+    }
 
   protected:
+    bool CopyInternalToEvp(EVP_PKEY* pkey) const override;
+
     RsaKey(RSA* rsa, AuthorizationSet&& hw_enforced, AuthorizationSet&& sw_enforced,
            const KeyFactory* key_factory)
         : AsymmetricKey(move(hw_enforced), move(sw_enforced), key_factory), rsa_key_(rsa) {}
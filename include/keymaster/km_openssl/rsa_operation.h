@@ -78,6 +78,8 @@ class RsaDigestingOperation : public RsaOperation {
                           keymaster_padding_t padding, EVP_PKEY* key);
     ~RsaDigestingOperation();
 
+    keymaster_error_t Restart() override;
+
   protected:
     int GetOpensslPadding(keymaster_error_t* error) override;
     bool require_digest() const override { return padding_ == KM_PAD_RSA_PSS; }
@@ -194,7 +196,7 @@ class RsaOperationFactory : public OperationFactory {
     const keymaster_digest_t* SupportedDigests(size_t* digest_count) const override;
 
   protected:
-    static EVP_PKEY* GetRsaKey(Key&& key, keymaster_error_t* error);
+    static EVP_PKEY* GetRsaKey(Key&& key, bool public_only, keymaster_error_t* error);
     virtual RsaOperation* CreateRsaOperation(Key&& key, const AuthorizationSet& begin_params,
                                              keymaster_error_t* error) const;
 
@@ -22,6 +22,7 @@
 #include <keymaster/soft_key_factory.h>
 
 #include <keymaster/key.h>
+#include <keymaster/km_openssl/keyed_context_templates.h>
 
 namespace keymaster {
 
@@ -75,10 +76,21 @@ class SymmetricKey : public Key {
         return KM_ERROR_UNSUPPORTED_KEY_FORMAT;
     }
 
+    void ShareOperationState(Key* source) override;
+
+    /**
+     * Returns the keyed contexts this key shares with others built from the same key material, or
+     * nullptr if it isn't sharing any.  Operations copy these rather than keying their own.
+     */
+    KeyedContextTemplates* context_templates() const { return context_templates_; }
+
   protected:
     SymmetricKey(KeymasterKeyBlob&& key_material, AuthorizationSet&& hw_enforced,
                  AuthorizationSet&& sw_enforced,
                  const KeyFactory* key_factory);
+
+  private:
+    KeyedContextTemplates* context_templates_ = nullptr;
 };
 
 }  // namespace keymaster
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_KEY_CHARACTERISTICS_CACHE_H_
+#define SYSTEM_KEYMASTER_KEY_CHARACTERISTICS_CACHE_H_
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <hardware/keymaster_defs.h>
+
+#include <keymaster/authorization_set.h>
+
+namespace keymaster {
+
+/**
+ * KeyCharacteristicsCache remembers the authorization lists a wrapped hardware device returned from
+ * get_key_characteristics, so that parsing the same hardware key blob again doesn't need another
+ * round trip into secure hardware.
+ *
+ * Entries are keyed by a SHA-256 digest of the key blob together with the APPLICATION_ID and
+ * APPLICATION_DATA that were supplied, so a lookup only hits if the caller presents the same
+ * application binding the device already accepted.  The cache holds at most |max_entries| entries
+ * and evicts the least recently used one when full; a cache with zero entries caches nothing.
+ *
+ * Contexts must call Invalidate() when a blob is deleted or upgraded, and Clear() when all keys are
+ * deleted.
+ */
+class KeyCharacteristicsCache {
+  public:
+    static const size_t kDefaultMaxEntries = 64;
+
+    explicit KeyCharacteristicsCache(size_t max_entries = kDefaultMaxEntries);
+
+    KeyCharacteristicsCache(const KeyCharacteristicsCache&) = delete;
+    void operator=(const KeyCharacteristicsCache&) = delete;
+
+    /**
+     * Copies the cached authorizations for |blob| into |hw_enforced| and |sw_enforced|.  Returns
+     * false if there is no entry (or the copy couldn't be made), in which case the outputs are
+     * unspecified and the caller should ask the device.
+     */
+    bool Lookup(const keymaster_key_blob_t& blob, const AuthorizationSet& additional_params,
+                AuthorizationSet* hw_enforced, AuthorizationSet* sw_enforced);
+
+    void Insert(const keymaster_key_blob_t& blob, const AuthorizationSet& additional_params,
+                const AuthorizationSet& hw_enforced, const AuthorizationSet& sw_enforced);
+
+    /**
+     * Drops every entry for |blob|, whatever application binding it was cached under.
+     */
+    void Invalidate(const keymaster_key_blob_t& blob);
+
+    void Clear();
+
+    size_t size() const;
+
+  private:
+    struct Entry {
+        Entry(const std::string& blob_digest, const std::string& cache_key,
+              const AuthorizationSet& hw_enforced, const AuthorizationSet& sw_enforced)
+            : blob_digest(blob_digest), cache_key(cache_key), hw_enforced(hw_enforced),
+              sw_enforced(sw_enforced) {}
+
+        std::string blob_digest;
+        std::string cache_key;
+        AuthorizationSet hw_enforced;
+        AuthorizationSet sw_enforced;
+    };
+    typedef std::list<Entry> EntryList;
+
+    static std::string BlobDigest(const keymaster_key_blob_t& blob);
+    static std::string CacheKey(const std::string& blob_digest,
+                                const AuthorizationSet& additional_params);
+
+    const size_t max_entries_;
+    mutable std::mutex mutex_;
+    EntryList entries_;  // Most recently used first.
+    std::unordered_map<std::string, EntryList::iterator> index_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_KEY_CHARACTERISTICS_CACHE_H_
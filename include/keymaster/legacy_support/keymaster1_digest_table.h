@@ -0,0 +1,108 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef SYSTEM_KEYMASTER_KEYMASTER1_DIGEST_TABLE_H_
+#define SYSTEM_KEYMASTER_KEYMASTER1_DIGEST_TABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hardware/keymaster1.h>
+#include <hardware/keymaster_defs.h>
+
+namespace keymaster {
+
+/**
+ * Keymaster1DigestTable records which digests a wrapped keymaster1 device supports for each
+ * algorithm and purpose that takes a digest, as one bit per digest.  It's filled from the device's
+ * get_supported_digests once, when the device is wrapped, so deciding whether a key or operation
+ * needs software digesting takes a few bit tests rather than a search per requested digest.
+ */
+class Keymaster1DigestTable {
+  public:
+    Keymaster1DigestTable() { Clear(); }
+
+    /**
+     * Asks |dev| for its digests for RSA, EC and HMAC signing and verification and for RSA
+     * encryption and decryption.  If the device returns an error the table is left empty.
+     */
+    keymaster_error_t Initialize(const keymaster1_device_t* dev);
+
+    void Clear();
+
+    /**
+     * Returns true if the device was asked about |algorithm| and |purpose|.  Other pairs (e.g. EC
+     * encryption) are invalid, and are left for the device to reject.
+     */
+    bool covers(keymaster_algorithm_t algorithm, keymaster_purpose_t purpose) const;
+
+    /**
+     * Returns the digests the device supports for |algorithm| and |purpose|, with DigestBit(digest)
+     * set for each.
+     */
+    uint32_t digests(keymaster_algorithm_t algorithm, keymaster_purpose_t purpose) const;
+
+    /**
+     * Returns true if, for every pair it covers, the device supports MD5, SHA1 and all of the SHA-2
+     * digests.
+     */
+    bool supports_all() const { return supports_all_; }
+
+    /**
+     * Returns true if |requested_digests| has a digest the device doesn't support for |algorithm|
+     * and |purpose|, and places the lowest such digest in |unsupported|.  Pairs the table doesn't
+     * cover have no unsupported digests.
+     */
+    bool FindUnsupported(keymaster_algorithm_t algorithm, keymaster_purpose_t purpose,
+                         uint32_t requested_digests, keymaster_digest_t* unsupported) const;
+
+    /**
+     * The bit for |digest| in the masks above.  Values too large for a bit of their own share the
+     * top bit, which no device digest sets, so they always count as unsupported.
+     */
+    static uint32_t DigestBit(uint32_t digest) {
+        return digest < kUnknownDigest ? 1U << digest : 1U << kUnknownDigest;
+    }
+
+    /**
+     * Returns the mask of the KM_TAG_DIGEST values in |params|, which may be an AuthorizationSet or
+     * an AuthProxy.
+     */
+    template <typename Params> static uint32_t RequestedDigests(const Params& params) {
+        uint32_t requested = 0;
+        for (auto& entry : params)
+            if (entry.tag == KM_TAG_DIGEST)
+                requested |= DigestBit(entry.enumerated);
+        return requested;
+    }
+
+  private:
+    static const uint32_t kUnknownDigest = 31;
+    static const size_t kAlgorithmCount = 3;  // RSA, EC and HMAC.
+    static const size_t kPurposeCount = 4;    // Encrypt, decrypt, sign and verify.
+
+    // Returns false if the pair has no slot in the table.
+    static bool index(keymaster_algorithm_t algorithm, keymaster_purpose_t purpose, size_t* i);
+
+    uint32_t digests_[kAlgorithmCount * kPurposeCount];
+    uint32_t covered_;  // Bit i is set if digests_[i] was filled from the device.
+    bool supports_all_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_KEYMASTER1_DIGEST_TABLE_H_
@@ -18,9 +18,6 @@
 #ifndef LEGACY_SUPPORT_KEYMASTER1_LEGACY_SUPPORT_H_
 #define LEGACY_SUPPORT_KEYMASTER1_LEGACY_SUPPORT_H_
 
-#include <map>
-#include <vector>
-
 #include <hardware/keymaster_defs.h>
 #include <hardware/keymaster1.h>
 
@@ -32,6 +29,7 @@
 #include "ec_keymaster1_key.h"
 #include "keymaster_passthrough_engine.h"
 #include "keymaster_passthrough_key.h"
+#include "keymaster1_digest_table.h"
 #include "keymaster1_engine.h"
 #include "rsa_keymaster1_key.h"
 
@@ -39,9 +37,6 @@ namespace keymaster {
 
 class Keymaster1LegacySupport {
 public:
-    typedef std::pair<keymaster_algorithm_t, keymaster_purpose_t> AlgPurposePair;
-    typedef std::map<AlgPurposePair, std::vector<keymaster_digest_t>> DigestMap;
-
     // NOLINTNEXTLINE(google-explicit-constructor)
     Keymaster1LegacySupport(const keymaster1_device_t* dev);
 
@@ -50,8 +45,7 @@ public:
                                    const AuthProxy& key_description) const;
 
 private:
-    DigestMap device_digests_;
-    bool supports_all_;
+    Keymaster1DigestTable device_digests_;
 
 };
 
@@ -24,12 +24,14 @@
 #include <hardware/keymaster_defs.h>
 #include <keymaster/android_keymaster_utils.h>
 #include <keymaster/authorization_set.h>
+#include <keymaster/key_enforcement_policy.h>
 #include <keymaster/logger.h>
 
 namespace keymaster {
 
 class AuthorizationSet;
 class Key;
+class KeymasterContext;
 class Operation;
 using OperationPtr = UniquePtr<Operation>;
 
@@ -104,6 +106,21 @@ class Operation {
 
     AuthProxy authorizations() const { return AuthProxy(hw_enforced_, sw_enforced_); }
 
+    /**
+     * authorizations(), compiled for KeymasterEnforcement.  AndroidKeymaster compiles it once,
+     * before authorizing Begin, and checks it for the rest of the operation's life.
+     */
+    KeyEnforcementPolicy* mutable_enforcement_policy() { return &enforcement_policy_; }
+    const KeyEnforcementPolicy& enforcement_policy() const { return enforcement_policy_; }
+
+    /**
+     * Lets the operation split large inputs into pieces that |context|->RunTasks processes in
+     * parallel.  AndroidKeymaster sets it before Begin; operations that don't split their work
+     * ignore it.
+     */
+    void set_task_context(const KeymasterContext* context) { task_context_ = context; }
+    const KeymasterContext* task_context() const { return task_context_; }
+
     virtual keymaster_error_t Begin(const AuthorizationSet& input_params,
                                     AuthorizationSet* output_params) = 0;
     virtual keymaster_error_t Update(const AuthorizationSet& input_params, const Buffer& input,
@@ -114,6 +131,14 @@ class Operation {
                                      Buffer* output) = 0;
     virtual keymaster_error_t Abort() = 0;
 
+    /**
+     * Prepares a successfully finished operation to be begun again, with the same key and
+     * parameters, without being re-created.  Begin() must be called before the operation is used,
+     * and it assigns a new operation handle.  Operations that can't be reused this way return
+     * KM_ERROR_UNIMPLEMENTED.
+     */
+    virtual keymaster_error_t Restart() { return KM_ERROR_UNIMPLEMENTED; }
+
   protected:
     // Helper function for implementing Finish() methods that need to call Update() to process
     // input, but don't expect any output.
@@ -125,6 +150,8 @@ class Operation {
     AuthorizationSet hw_enforced_;
     AuthorizationSet sw_enforced_;
     uint64_t key_id_;
+    KeyEnforcementPolicy enforcement_policy_;
+    const KeymasterContext* task_context_ = nullptr;
 };
 
 }  // namespace keymaster
@@ -152,6 +152,11 @@ bool copy_from_buf(const uint8_t** buf_ptr, const uint8_t* end, void* dest, size
 bool copy_size_and_data_from_buf(const uint8_t** buf_ptr, const uint8_t* end, size_t* size,
                                  UniquePtr<uint8_t[]>* dest);
 
+/**
+ * Like copy_size_and_data_from_buf(), but just steps over the data rather than copying it.
+ */
+bool skip_size_and_data_in_buf(const uint8_t** buf_ptr, const uint8_t* end);
+
 /**
  * Copies a value convertible from uint32_t from \p *buf_ptr.  Returns false if there are less than
  * four bytes remaining in \p *buf_ptr.  Advances \p *buf_ptr to the next byte to be read.
@@ -18,7 +18,6 @@
 #define SYSTEM_KEYMASTER_SOFT_KEYMASTER_DEVICE_H_
 
 #include <cstdlib>
-#include <map>
 #include <vector>
 
 #include <hardware/keymaster0.h>
@@ -27,6 +26,7 @@
 
 #include <keymaster/android_keymaster.h>
 #include <keymaster/contexts/soft_keymaster_context.h>
+#include <keymaster/legacy_support/keymaster1_digest_table.h>
 #include <keymaster/UniquePtr.h>
 
 namespace keymaster {
@@ -79,18 +79,15 @@ class SoftKeymasterDevice {
 
     bool configured() const { return configured_; }
 
-    bool supports_all_digests() { return supports_all_digests_; }
-
-    typedef std::pair<keymaster_algorithm_t, keymaster_purpose_t> AlgPurposePair;
-    typedef std::map<AlgPurposePair, std::vector<keymaster_digest_t>> DigestMap;
+    bool supports_all_digests() { return km1_device_digests_.supports_all(); }
 
   private:
     void initialize_device_struct(uint32_t flags);
+    // |requested_digests| is a Keymaster1DigestTable digest mask.
     bool FindUnsupportedDigest(keymaster_algorithm_t algorithm, keymaster_purpose_t purpose,
-                               const AuthorizationSet& params,
-                               keymaster_digest_t* unsupported) const;
+                               uint32_t requested_digests, keymaster_digest_t* unsupported) const;
     bool RequiresSoftwareDigesting(keymaster_algorithm_t algorithm, keymaster_purpose_t purpose,
-                                   const AuthorizationSet& params) const;
+                                   uint32_t requested_digests) const;
     bool KeyRequiresSoftwareDigesting(const AuthorizationSet& key_description) const;
 
     static void StoreDefaultNewKeyParams(keymaster_algorithm_t algorithm,
@@ -240,13 +237,12 @@ class SoftKeymasterDevice {
     keymaster2_device_t km2_device_;
 
     keymaster1_device_t* wrapped_km1_device_;
-    DigestMap km1_device_digests_;
+    Keymaster1DigestTable km1_device_digests_;
     SoftKeymasterContext* context_;
     UniquePtr<AndroidKeymaster> impl_;
     std::string module_name_;
     hw_module_t updated_module_;
     bool configured_;
-    bool supports_all_digests_;
 };
 
 }  // namespace keymaster
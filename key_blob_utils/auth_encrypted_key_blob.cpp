@@ -79,6 +79,43 @@ static keymaster_error_t DeserializeUnversionedBlob(const KeymasterKeyBlob& key_
     return KM_ERROR_OK;
 }
 
+static bool SkipFixedSizeField(const uint8_t** buf_ptr, const uint8_t* end, size_t size) {
+    if (end - *buf_ptr < static_cast<ptrdiff_t>(size))
+        return false;
+    *buf_ptr += size;
+    return true;
+}
+
+static bool SkipSizedField(const uint8_t** buf_ptr, const uint8_t* end, size_t expected_size) {
+    uint32_t size;
+    return copy_uint32_from_buf(buf_ptr, end, &size) && size == expected_size &&
+           SkipFixedSizeField(buf_ptr, end, size);
+}
+
+bool LooksLikeAuthEncryptedBlob(const KeymasterKeyBlob& key_blob) {
+    if (!key_blob.key_material || key_blob.key_material_size == 0)
+        return false;
+
+    const uint8_t* end = key_blob.key_material + key_blob.key_material_size;
+
+    const uint8_t* p = key_blob.key_material;
+    if (*p++ == CURRENT_BLOB_VERSION &&               //
+        SkipSizedField(&p, end, OCB_NONCE_LENGTH) &&  //
+        skip_size_and_data_in_buf(&p, end) &&         //
+        SkipSizedField(&p, end, OCB_TAG_LENGTH) &&    //
+        AuthorizationSet::SkipSerialized(&p, end) &&  //
+        AuthorizationSet::SkipSerialized(&p, end))
+        return true;
+
+    // Unversioned blobs have no version byte, and no length fields for the nonce and tag.
+    p = key_blob.key_material;
+    return SkipFixedSizeField(&p, end, OCB_NONCE_LENGTH) &&  //
+           skip_size_and_data_in_buf(&p, end) &&             //
+           SkipFixedSizeField(&p, end, OCB_TAG_LENGTH) &&    //
+           AuthorizationSet::SkipSerialized(&p, end) &&      //
+           AuthorizationSet::SkipSerialized(&p, end);
+}
+
 keymaster_error_t DeserializeAuthEncryptedBlob(const KeymasterKeyBlob& key_blob,
                                                KeymasterKeyBlob* encrypted_key_material,
                                                AuthorizationSet* hw_enforced,
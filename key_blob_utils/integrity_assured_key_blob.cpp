@@ -16,89 +16,376 @@
 
 #include <keymaster/key_blob_utils/integrity_assured_key_blob.h>
 
-#include <assert.h>
-
-#include <openssl/hmac.h>
 #include <openssl/mem.h>
 
 #include <keymaster/android_keymaster_utils.h>
 #include <keymaster/authorization_set.h>
+#include <keymaster/km_openssl/hmac.h>
 #include <keymaster/km_openssl/openssl_err.h>
+#include <keymaster/km_openssl/openssl_utils.h>
 #include <keymaster/new>
 
 
 namespace keymaster {
 
-static const uint8_t BLOB_VERSION = 0;
 static const size_t HMAC_SIZE = 8;
 static const char HMAC_KEY[] = "IntegrityAssuredBlob0";
 
-inline size_t min(size_t a, size_t b) {
-    if (a < b)
-        return a;
-    return b;
-}
+// Serialized hidden sets are normally just a root of trust and an application ID, so they fit
+// on the stack.
+static const size_t kHiddenStackBufferSize = 256;
 
-class HmacCleanup {
-  public:
-    explicit HmacCleanup(HMAC_CTX* ctx) : ctx_(ctx) {}
-    ~HmacCleanup() { HMAC_CTX_cleanup(ctx_); }
+static HmacSha256* shared_hmac = nullptr;
 
-  private:
-    HMAC_CTX* ctx_;
-};
+/**
+ * Returns the process-wide HMAC-SHA256 instance keyed with HMAC_KEY, creating it on first use.
+ * Keying computes the inner and outer hash states; each ComputeHmac call then starts from a copy
+ * of them instead.
+ */
+static const HmacSha256* GetSharedHmac() {
+    return publish_once<HmacSha256, DefaultDelete<HmacSha256>>(&shared_hmac, []() -> HmacSha256* {
+        UniquePtr<HmacSha256> hmac(new (std::nothrow) HmacSha256);
+        if (!hmac.get() ||
+            !hmac->Init(reinterpret_cast<const uint8_t*>(HMAC_KEY), sizeof(HMAC_KEY)))
+            return nullptr;
+        return hmac.release();
+    });
+}
 
 static keymaster_error_t ComputeHmac(const uint8_t* serialized_data, size_t serialized_data_size,
                                      const AuthorizationSet& hidden, uint8_t hmac[HMAC_SIZE]) {
+    const HmacSha256* keyed_hmac = GetSharedHmac();
+    if (!keyed_hmac)
+        return TranslateLastOpenSslError();
+
+    uint8_t hidden_stack_buffer[kHiddenStackBufferSize];
+    UniquePtr<uint8_t[]> hidden_heap_buffer;
+    uint8_t* hidden_bytes = hidden_stack_buffer;
     size_t hidden_bytes_size = hidden.SerializedSize();
-    UniquePtr<uint8_t[]> hidden_bytes(new (std::nothrow) uint8_t[hidden_bytes_size]);
-    if (!hidden_bytes.get())
-        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
-    hidden.Serialize(hidden_bytes.get(), hidden_bytes.get() + hidden_bytes_size);
+    if (hidden_bytes_size > sizeof(hidden_stack_buffer)) {
+        hidden_heap_buffer.reset(new (std::nothrow) uint8_t[hidden_bytes_size]);
+        if (!hidden_heap_buffer.get())
+            return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+        hidden_bytes = hidden_heap_buffer.get();
+    }
+    hidden.Serialize(hidden_bytes, hidden_bytes + hidden_bytes_size);
 
-    HMAC_CTX ctx;
-    HMAC_CTX_init(&ctx);
-    const EVP_MD* md = EVP_sha256();
-    if (!HMAC_Init_ex(&ctx, HMAC_KEY, sizeof(HMAC_KEY), md, nullptr /* engine */))
+    const keymaster_blob_t chunks[] = {
+        {serialized_data, serialized_data_size},
+        {hidden_bytes, hidden_bytes_size},
+    };
+    bool signed_ok = keyed_hmac->Sign(chunks, array_length(chunks), hmac, HMAC_SIZE);
+    memset_s(hidden_bytes, 0, hidden_bytes_size);
+    if (!signed_ok)
         return TranslateLastOpenSslError();
-    HmacCleanup cleanup(&ctx);
 
-    uint8_t tmp[EVP_MAX_MD_SIZE];
-    unsigned tmp_len;
-    if (!HMAC_Update(&ctx, serialized_data, serialized_data_size) ||
-        !HMAC_Update(&ctx, hidden_bytes.get(), hidden_bytes_size) ||  //
-        !HMAC_Final(&ctx, tmp, &tmp_len))
-        return TranslateLastOpenSslError();
+    return KM_ERROR_OK;
+}
 
-    assert(tmp_len >= HMAC_SIZE);
-    memcpy(hmac, tmp, min(HMAC_SIZE, tmp_len));
+/*
+ * The compact layout.  Varints are little-endian base 128, as in protocol buffers.  The key
+ * material is a varint length followed by the bytes.  Each authorization set is a varint entry
+ * count followed by the entries, in set order.  An entry starts with its tag, rotated so the type
+ * bits are at the bottom (which keeps related tags of different types numerically close) and
+ * written as the zigzag-coded difference from the previous entry's rotated tag.  Sets are mostly
+ * built in tag order, so that's usually a single byte.  The value follows: a varint for integer,
+ * enum and date types, one byte for bools, and a varint length followed by the data itself for
+ * bytes and bignums.
+ */
 
-    return KM_ERROR_OK;
+// Keeps sets of typical size off the heap while parsing.
+static const size_t kCompactSetStackEntries = 24;
+
+static size_t varint_size(uint64_t value) {
+    size_t size = 1;
+    for (; value >= 0x80; value >>= 7)
+        ++size;
+    return size;
+}
+
+static uint8_t* append_varint_to_buf(uint8_t* buf, const uint8_t* end, uint64_t value) {
+    for (; value >= 0x80; value >>= 7, ++buf)
+        if (buf < end)
+            *buf = static_cast<uint8_t>(value | 0x80);
+    if (buf < end)
+        *buf = static_cast<uint8_t>(value);
+    return buf + 1;
+}
+
+static bool copy_varint_from_buf(const uint8_t** buf_ptr, const uint8_t* end, uint64_t* value) {
+    uint64_t result = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (*buf_ptr >= end)
+            return false;
+        uint8_t byte = *(*buf_ptr)++;
+        if (shift == 63 && byte > 1)
+            return false;  // Overflows 64 bits.
+        result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool copy_varint32_from_buf(const uint8_t** buf_ptr, const uint8_t* end, uint32_t* value) {
+    uint64_t result;
+    if (!copy_varint_from_buf(buf_ptr, end, &result) || result > UINT32_MAX)
+        return false;
+    *value = static_cast<uint32_t>(result);
+    return true;
+}
+
+static uint32_t rotate_tag(keymaster_tag_t tag) {
+    return (keymaster_tag_mask_type(tag) << 4) | (keymaster_tag_get_type(tag) >> 28);
+}
+
+static keymaster_tag_t unrotate_tag(uint32_t rotated_tag) {
+    return static_cast<keymaster_tag_t>((rotated_tag >> 4) | (rotated_tag << 28));
+}
+
+static uint64_t zigzag_encode(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+static int64_t zigzag_decode(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+static size_t compact_value_size(const keymaster_key_param_t& param) {
+    switch (keymaster_tag_get_type(param.tag)) {
+    case KM_INVALID:
+        return 0;
+    case KM_ENUM:
+    case KM_ENUM_REP:
+        return varint_size(param.enumerated);
+    case KM_UINT:
+    case KM_UINT_REP:
+        return varint_size(param.integer);
+    case KM_ULONG:
+    case KM_ULONG_REP:
+        return varint_size(param.long_integer);
+    case KM_DATE:
+        return varint_size(param.date_time);
+    case KM_BOOL:
+        return 1;
+    case KM_BIGNUM:
+    case KM_BYTES:
+        return varint_size(param.blob.data_length) + param.blob.data_length;
+    }
+    return 0;
+}
+
+static uint8_t* serialize_compact_value(const keymaster_key_param_t& param, uint8_t* buf,
+                                        const uint8_t* end) {
+    switch (keymaster_tag_get_type(param.tag)) {
+    case KM_INVALID:
+        break;
+    case KM_ENUM:
+    case KM_ENUM_REP:
+        return append_varint_to_buf(buf, end, param.enumerated);
+    case KM_UINT:
+    case KM_UINT_REP:
+        return append_varint_to_buf(buf, end, param.integer);
+    case KM_ULONG:
+    case KM_ULONG_REP:
+        return append_varint_to_buf(buf, end, param.long_integer);
+    case KM_DATE:
+        return append_varint_to_buf(buf, end, param.date_time);
+    case KM_BOOL:
+        if (buf < end)
+            *buf = static_cast<uint8_t>(param.boolean);
+        return buf + 1;
+    case KM_BIGNUM:
+    case KM_BYTES:
+        buf = append_varint_to_buf(buf, end, param.blob.data_length);
+        return append_to_buf(buf, end, param.blob.data, param.blob.data_length);
+    }
+    return buf;
+}
+
+/**
+ * Parses a value into |param|, whose tag must already be set.  Blob values point into the buffer.
+ */
+static bool parse_compact_value(const uint8_t** buf_ptr, const uint8_t* end,
+                                keymaster_key_param_t* param) {
+    switch (keymaster_tag_get_type(param->tag)) {
+    case KM_INVALID:
+        return false;
+    case KM_ENUM:
+    case KM_ENUM_REP:
+        return copy_varint32_from_buf(buf_ptr, end, &param->enumerated);
+    case KM_UINT:
+    case KM_UINT_REP:
+        return copy_varint32_from_buf(buf_ptr, end, &param->integer);
+    case KM_ULONG:
+    case KM_ULONG_REP:
+        return copy_varint_from_buf(buf_ptr, end, &param->long_integer);
+    case KM_DATE:
+        return copy_varint_from_buf(buf_ptr, end, &param->date_time);
+    case KM_BOOL:
+        // As in the AuthorizationSet layout, only 0 and 1 are accepted.
+        if (*buf_ptr >= end || **buf_ptr > 1)
+            return false;
+        param->boolean = *(*buf_ptr)++;
+        return true;
+    case KM_BIGNUM:
+    case KM_BYTES: {
+        uint64_t length;
+        if (!copy_varint_from_buf(buf_ptr, end, &length) ||
+            length > static_cast<uint64_t>(end - *buf_ptr))
+            return false;
+        param->blob.data = *buf_ptr;
+        param->blob.data_length = length;
+        *buf_ptr += length;
+        return true;
+    }
+    }
+    return false;
+}
+
+static size_t compact_set_size(const AuthorizationSet& set) {
+    size_t size = varint_size(set.size());
+    uint32_t previous_tag = 0;
+    for (const keymaster_key_param_t& param : set) {
+        uint32_t tag = rotate_tag(param.tag);
+        size += varint_size(zigzag_encode(static_cast<int64_t>(tag) - previous_tag)) +
+                compact_value_size(param);
+        previous_tag = tag;
+    }
+    return size;
+}
+
+static uint8_t* serialize_compact_set(const AuthorizationSet& set, uint8_t* buf,
+                                      const uint8_t* end) {
+    buf = append_varint_to_buf(buf, end, set.size());
+    uint32_t previous_tag = 0;
+    for (const keymaster_key_param_t& param : set) {
+        uint32_t tag = rotate_tag(param.tag);
+        buf = append_varint_to_buf(buf, end,
+                                   zigzag_encode(static_cast<int64_t>(tag) - previous_tag));
+        buf = serialize_compact_value(param, buf, end);
+        previous_tag = tag;
+    }
+    return buf;
+}
+
+/**
+ * Parses a compact set in one pass.  If |set| is null the entries are checked but not kept.
+ */
+static bool parse_compact_set(const uint8_t** buf_ptr, const uint8_t* end, AuthorizationSet* set) {
+    uint64_t count;
+    // Every entry takes at least one byte.
+    if (!copy_varint_from_buf(buf_ptr, end, &count) ||
+        count > static_cast<uint64_t>(end - *buf_ptr))
+        return false;
+
+    keymaster_key_param_t stack_params[kCompactSetStackEntries];
+    UniquePtr<keymaster_key_param_t[]> heap_params;
+    keymaster_key_param_t* params = stack_params;
+    if (set && count > kCompactSetStackEntries) {
+        heap_params.reset(new (std::nothrow) keymaster_key_param_t[count]);
+        if (!heap_params.get())
+            return false;
+        params = heap_params.get();
+    }
+
+    uint32_t previous_tag = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t encoded_delta;
+        if (!copy_varint_from_buf(buf_ptr, end, &encoded_delta))
+            return false;
+        int64_t delta = zigzag_decode(encoded_delta);
+        if (delta < -static_cast<int64_t>(previous_tag) ||
+            delta > static_cast<int64_t>(UINT32_MAX - previous_tag))
+            return false;
+        previous_tag = static_cast<uint32_t>(previous_tag + delta);
+
+        keymaster_key_param_t param;
+        param.tag = unrotate_tag(previous_tag);
+        if (!parse_compact_value(buf_ptr, end, &param))
+            return false;
+        if (set)
+            params[i] = param;
+    }
+
+    return !set || set->Reinitialize(params, count);
 }
 
 keymaster_error_t SerializeIntegrityAssuredBlob(const KeymasterKeyBlob& key_material,
                                                 const AuthorizationSet& hidden,
                                                 const AuthorizationSet& hw_enforced,
                                                 const AuthorizationSet& sw_enforced,
-                                                KeymasterKeyBlob* key_blob) {
-    size_t size = 1 /* version */ +                //
-                  key_material.SerializedSize() +  //
-                  hw_enforced.SerializedSize() +   //
-                  sw_enforced.SerializedSize() +   //
-                  HMAC_SIZE;
+                                                KeymasterKeyBlob* key_blob,
+                                                IntegrityAssuredBlobVersion version) {
+    size_t size;
+    switch (version) {
+    case INTEGRITY_ASSURED_BLOB_V0:
+        size = 1 /* version */ +                //
+               key_material.SerializedSize() +  //
+               hw_enforced.SerializedSize() +   //
+               sw_enforced.SerializedSize() +   //
+               HMAC_SIZE;
+        break;
+    case INTEGRITY_ASSURED_BLOB_COMPACT:
+        size = 1 /* version */ +                               //
+               varint_size(key_material.key_material_size) +  //
+               key_material.key_material_size +               //
+               compact_set_size(hw_enforced) +                //
+               compact_set_size(sw_enforced) +                //
+               HMAC_SIZE;
+        break;
+    default:
+        return KM_ERROR_INVALID_ARGUMENT;
+    }
 
     if (!key_blob->Reset(size))
         return KM_ERROR_MEMORY_ALLOCATION_FAILED;
 
     uint8_t* p = key_blob->writable_data();
-    *p++ = BLOB_VERSION;
-    p = key_material.Serialize(p, key_blob->end());
-    p = hw_enforced.Serialize(p, key_blob->end());
-    p = sw_enforced.Serialize(p, key_blob->end());
+    *p++ = version;
+    if (version == INTEGRITY_ASSURED_BLOB_V0) {
+        p = key_material.Serialize(p, key_blob->end());
+        p = hw_enforced.Serialize(p, key_blob->end());
+        p = sw_enforced.Serialize(p, key_blob->end());
+    } else {
+        p = append_varint_to_buf(p, key_blob->end(), key_material.key_material_size);
+        p = append_to_buf(p, key_blob->end(), key_material.key_material,
+                          key_material.key_material_size);
+        p = serialize_compact_set(hw_enforced, p, key_blob->end());
+        p = serialize_compact_set(sw_enforced, p, key_blob->end());
+    }
 
     return ComputeHmac(key_blob->key_material, p - key_blob->key_material, hidden, p);
 }
 
+bool LooksLikeIntegrityAssuredBlob(const KeymasterKeyBlob& key_blob) {
+    if (key_blob.key_material_size < 1 /* version */ + HMAC_SIZE)
+        return false;
+
+    const uint8_t* p = key_blob.begin();
+    const uint8_t* end = key_blob.end() - HMAC_SIZE;
+    switch (*p++) {
+    case INTEGRITY_ASSURED_BLOB_V0:
+        return skip_size_and_data_in_buf(&p, end) &&         //
+               AuthorizationSet::SkipSerialized(&p, end) &&  //
+               AuthorizationSet::SkipSerialized(&p, end);
+    case INTEGRITY_ASSURED_BLOB_COMPACT: {
+        uint64_t key_material_size;
+        if (!copy_varint_from_buf(&p, end, &key_material_size) ||
+            key_material_size > static_cast<uint64_t>(end - p))
+            return false;
+        p += key_material_size;
+        return parse_compact_set(&p, end, nullptr /* set */) &&  //
+               parse_compact_set(&p, end, nullptr /* set */) &&  //
+               p == end;
+    }
+    default:
+        return false;
+    }
+}
+
 keymaster_error_t DeserializeIntegrityAssuredBlob(const KeymasterKeyBlob& key_blob,
                                                   const AuthorizationSet& hidden,
                                                   KeymasterKeyBlob* key_material,
@@ -130,19 +417,36 @@ keymaster_error_t DeserializeIntegrityAssuredBlob_NoHmacCheck(const KeymasterKey
     const uint8_t* p = key_blob.begin();
     const uint8_t* end = key_blob.end() - HMAC_SIZE;
 
-    if (p > end)
+    if (p >= end)
         return KM_ERROR_INVALID_KEY_BLOB;
 
-    if (*p != BLOB_VERSION)
-        return KM_ERROR_INVALID_KEY_BLOB;
-    ++p;
+    switch (*p++) {
+    case INTEGRITY_ASSURED_BLOB_V0:
+        if (!key_material->Deserialize(&p, end) ||  //
+            !hw_enforced->Deserialize(&p, end) ||   //
+            !sw_enforced->Deserialize(&p, end))
+            return KM_ERROR_INVALID_KEY_BLOB;
+        return KM_ERROR_OK;
 
-    if (!key_material->Deserialize(&p, end) ||  //
-        !hw_enforced->Deserialize(&p, end) ||   //
-        !sw_enforced->Deserialize(&p, end))
-        return KM_ERROR_INVALID_KEY_BLOB;
+    case INTEGRITY_ASSURED_BLOB_COMPACT: {
+        uint64_t key_material_size;
+        if (!copy_varint_from_buf(&p, end, &key_material_size) ||
+            key_material_size > static_cast<uint64_t>(end - p))
+            return KM_ERROR_INVALID_KEY_BLOB;
+        if (!key_material->Reset(key_material_size))
+            return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+        memcpy(key_material->writable_data(), p, key_material_size);
+        p += key_material_size;
+        if (!parse_compact_set(&p, end, hw_enforced) ||  //
+            !parse_compact_set(&p, end, sw_enforced) ||  //
+            p != end)
+            return KM_ERROR_INVALID_KEY_BLOB;
+        return KM_ERROR_OK;
+    }
 
-    return KM_ERROR_OK;
+    default:
+        return KM_ERROR_INVALID_KEY_BLOB;
+    }
 }
 
 }  // namespace keymaster;
@@ -259,6 +259,48 @@ keymaster_error_t ParseOcbAuthEncryptedBlob(const KeymasterKeyBlob& blob,
                          nonce, tag, key_material);
 }
 
+uint32_t ClassifySoftwareKeyBlob(const KeymasterKeyBlob& blob) {
+    uint32_t formats = 0;
+    if (LooksLikeIntegrityAssuredBlob(blob))
+        formats |= SOFTWARE_BLOB_INTEGRITY_ASSURED;
+    if (LooksLikeAuthEncryptedBlob(blob))
+        formats |= SOFTWARE_BLOB_OCB_AUTH_ENCRYPTED;
+    if (blob.key_material_size >= sizeof(SOFT_KEY_MAGIC) &&
+        memcmp(blob.key_material, SOFT_KEY_MAGIC, sizeof(SOFT_KEY_MAGIC)) == 0)
+        formats |= SOFTWARE_BLOB_OLD_SOFTKEYMASTER;
+    return formats;
+}
+
+keymaster_error_t MigrateLegacySoftwareKeyBlob(const KeymasterKeyBlob& blob,
+                                               const AuthorizationSet& hidden,
+                                               KeymasterKeyBlob* migrated_blob) {
+    migrated_blob->Clear();
+    uint32_t formats = ClassifySoftwareKeyBlob(blob);
+
+    KeymasterKeyBlob key_material;
+    AuthorizationSet hw_enforced, sw_enforced;
+    keymaster_error_t error = KM_ERROR_INVALID_KEY_BLOB;
+    if (formats & SOFTWARE_BLOB_INTEGRITY_ASSURED) {
+        error = DeserializeIntegrityAssuredBlob(blob, hidden, &key_material, &hw_enforced,
+                                                &sw_enforced);
+        // Already in the current format; there's nothing to migrate.
+        if (error == KM_ERROR_OK && blob.key_material[0] == INTEGRITY_ASSURED_BLOB_COMPACT)
+            return KM_ERROR_OK;
+        if (error != KM_ERROR_OK && error != KM_ERROR_INVALID_KEY_BLOB)
+            return error;
+    }
+
+    if (error == KM_ERROR_INVALID_KEY_BLOB && (formats & SOFTWARE_BLOB_OCB_AUTH_ENCRYPTED))
+        error = ParseOcbAuthEncryptedBlob(blob, hidden, &key_material, &hw_enforced, &sw_enforced);
+    if (error == KM_ERROR_INVALID_KEY_BLOB && (formats & SOFTWARE_BLOB_OLD_SOFTKEYMASTER))
+        error = ParseOldSoftkeymasterBlob(blob, &key_material, &hw_enforced, &sw_enforced);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    return SerializeIntegrityAssuredBlob(key_material, hidden, hw_enforced, sw_enforced,
+                                         migrated_blob);
+}
+
 keymaster_error_t SetKeyBlobAuthorizations(const AuthorizationSet& key_description,
                                            keymaster_key_origin_t origin, uint32_t os_version,
                                            uint32_t os_patchlevel, AuthorizationSet* hw_enforced,
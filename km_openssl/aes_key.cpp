@@ -69,8 +69,38 @@ keymaster_error_t AesKeyFactory::LoadKey(KeymasterKeyBlob&& key_material,
     return error;
 }
 
+static keymaster_error_t
+validate_chacha20_poly1305_key_params(const AuthorizationSet& key_description) {
+#if defined(OPENSSL_IS_BORINGSSL)
+    // The key material is a ChaCha20 key, so it mustn't also be usable as an AES key.
+    for (auto& entry : key_description) {
+        if (entry.tag == KM_TAG_BLOCK_MODE && entry.enumerated != KM_MODE_CHACHA20_POLY1305) {
+            LOG_E("ChaCha20-Poly1305 can't be combined with other block modes", 0);
+            return KM_ERROR_INCOMPATIBLE_BLOCK_MODE;
+        }
+    }
+
+    uint32_t key_size_bits;
+    if (key_description.GetTagValue(TAG_KEY_SIZE, &key_size_bits) && key_size_bits != 256) {
+        LOG_E("ChaCha20-Poly1305 requires a 256-bit key", 0);
+        return KM_ERROR_UNSUPPORTED_KEY_SIZE;
+    }
+    return KM_ERROR_OK;
+#else
+    (void)key_description;
+    LOG_E("ChaCha20-Poly1305 requires BoringSSL", 0);
+    return KM_ERROR_UNSUPPORTED_BLOCK_MODE;
+#endif
+}
+
 keymaster_error_t AesKeyFactory::validate_algorithm_specific_new_key_params(
     const AuthorizationSet& key_description) const {
+    if (key_description.Contains(TAG_BLOCK_MODE, KM_MODE_CHACHA20_POLY1305)) {
+        keymaster_error_t error = validate_chacha20_poly1305_key_params(key_description);
+        if (error != KM_ERROR_OK)
+            return error;
+    }
+
     if (key_description.Contains(TAG_BLOCK_MODE, KM_MODE_GCM)) {
         uint32_t min_tag_length;
         if (!key_description.GetTagValue(TAG_MIN_MAC_LENGTH, &min_tag_length))
@@ -82,7 +112,7 @@ keymaster_error_t AesKeyFactory::validate_algorithm_specific_new_key_params(
         if (min_tag_length < kMinGcmTagLength || min_tag_length > kMaxGcmTagLength)
             return KM_ERROR_UNSUPPORTED_MIN_MAC_LENGTH;
     } else {
-        // Not GCM
+        // Not GCM.  ChaCha20-Poly1305 tags are always full length.
         if (key_description.find(TAG_MIN_MAC_LENGTH) != -1) {
             LOG_W("KM_TAG_MIN_MAC_LENGTH found for non AES-GCM key", 0);
             return KM_ERROR_INVALID_TAG;
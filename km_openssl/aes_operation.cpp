@@ -16,10 +16,17 @@
 
 #include "aes_operation.h"
 
+#include <keymaster/km_openssl/aes_key.h>
+
 namespace keymaster {
 
-static const keymaster_block_mode_t supported_block_modes[] = {KM_MODE_ECB, KM_MODE_CBC,
-                                                               KM_MODE_CTR, KM_MODE_GCM};
+static const keymaster_block_mode_t supported_block_modes[] = {
+    KM_MODE_ECB, KM_MODE_CBC, KM_MODE_CTR, KM_MODE_GCM,
+#if defined(OPENSSL_IS_BORINGSSL)
+    // ChaCha20Poly1305 needs BoringSSL's CRYPTO_chacha_20 and CRYPTO_poly1305_*.
+    KM_MODE_CHACHA20_POLY1305,
+#endif
+};
 
 const keymaster_block_mode_t*
 AesEvpCipherDescription::SupportedBlockModes(size_t* block_mode_count) const {
@@ -82,6 +89,8 @@ const EVP_CIPHER* AesEvpCipherDescription::GetCipherInstance(size_t key_size,
         break;
 
     default:
+        // Including KM_MODE_CHACHA20_POLY1305, which isn't an EVP cipher; BlockCipherEvpOperation
+        // uses ChaCha20Poly1305 instead.
         *error = KM_ERROR_UNSUPPORTED_BLOCK_MODE;
         break;
     }
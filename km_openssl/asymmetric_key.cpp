@@ -19,6 +19,9 @@
 #include <keymaster/new>
 
 #include <openssl/asn1.h>
+#include <openssl/ec.h>
+#include <openssl/err.h>
+#include <openssl/rsa.h>
 #include <openssl/stack.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
@@ -30,8 +33,188 @@
 #include <keymaster/km_openssl/openssl_utils.h>
 
 
+#if defined(OPENSSL_IS_BORINGSSL)
+#include <openssl/bn.h>
+#include <openssl/bytestring.h>
+#include <openssl/ec_key.h>
+#endif
+
 namespace keymaster {
 
+#if defined(OPENSSL_IS_BORINGSSL)
+
+static EVP_PKEY* ParseRsaPublicComponents(CBS* private_key) {
+    // RSAPrivateKey ::= SEQUENCE { version INTEGER, modulus INTEGER, publicExponent INTEGER, ... }
+    CBS rsa_private_key;
+    uint64_t version;
+    if (!CBS_get_asn1(private_key, &rsa_private_key, CBS_ASN1_SEQUENCE) ||
+        !CBS_get_asn1_uint64(&rsa_private_key, &version))
+        return nullptr;
+
+    RSA_Ptr rsa(RSA_new());
+    if (!rsa.get())
+        return nullptr;
+    rsa->n = BN_new();
+    rsa->e = BN_new();
+    if (!rsa->n || !rsa->e || !BN_parse_asn1_unsigned(&rsa_private_key, rsa->n) ||
+        !BN_parse_asn1_unsigned(&rsa_private_key, rsa->e))
+        return nullptr;
+
+    EVP_PKEY_Ptr pkey(EVP_PKEY_new());
+    if (!pkey.get() || !EVP_PKEY_set1_RSA(pkey.get(), rsa.get()))
+        return nullptr;
+    return pkey.release();
+}
+
+/**
+ * |algorithm| holds the rest of a PKCS#8 AlgorithmIdentifier, or is null for a bare ECPrivateKey,
+ * whose curve then has to come from its own parameters field.
+ */
+static EVP_PKEY* ParseEcPublicComponents(CBS* algorithm, CBS* private_key) {
+    EC_GROUP_Ptr group;
+    if (algorithm) {
+        // The curve comes from the AlgorithmIdentifier parameters, following the algorithm OID.
+        CBS oid;
+        if (!CBS_get_asn1(algorithm, &oid, CBS_ASN1_OBJECT))
+            return nullptr;
+        group.reset(EC_KEY_parse_parameters(algorithm));
+    }
+
+    // ECPrivateKey ::= SEQUENCE { version INTEGER, privateKey OCTET STRING,
+    //                             parameters [0] OPTIONAL, publicKey [1] BIT STRING OPTIONAL }
+    // Without the optional public key, the caller has to fall back to a full parse.
+    static const unsigned kParametersTag = CBS_ASN1_CONTEXT_SPECIFIC | CBS_ASN1_CONSTRUCTED | 0;
+    static const unsigned kPublicKeyTag = CBS_ASN1_CONTEXT_SPECIFIC | CBS_ASN1_CONSTRUCTED | 1;
+    CBS ec_private_key, private_scalar, parameters, public_key, public_key_bits;
+    int has_parameters;
+    uint64_t version;
+    uint8_t padding;
+    if (!CBS_get_asn1(private_key, &ec_private_key, CBS_ASN1_SEQUENCE) ||
+        !CBS_get_asn1_uint64(&ec_private_key, &version) ||
+        !CBS_get_asn1(&ec_private_key, &private_scalar, CBS_ASN1_OCTETSTRING) ||
+        !CBS_get_optional_asn1(&ec_private_key, &parameters, &has_parameters, kParametersTag))
+        return nullptr;
+    if (!group.get() && has_parameters)
+        group.reset(EC_KEY_parse_parameters(&parameters));
+    if (!group.get() || !CBS_get_asn1(&ec_private_key, &public_key, kPublicKeyTag) ||
+        !CBS_get_asn1(&public_key, &public_key_bits, CBS_ASN1_BITSTRING) ||
+        !CBS_get_u8(&public_key_bits, &padding) || padding != 0)
+        return nullptr;
+
+    EC_KEY_Ptr ec_key(EC_KEY_new());
+    EC_POINT_Ptr point(EC_POINT_new(group.get()));
+    if (!ec_key.get() || !point.get() || !EC_KEY_set_group(ec_key.get(), group.get()) ||
+        !EC_POINT_oct2point(group.get(), point.get(), CBS_data(&public_key_bits),
+                            CBS_len(&public_key_bits), nullptr /* ctx */) ||
+        !EC_KEY_set_public_key(ec_key.get(), point.get()))
+        return nullptr;
+
+    EVP_PKEY_Ptr pkey(EVP_PKEY_new());
+    if (!pkey.get() || !EVP_PKEY_set1_EC_KEY(pkey.get(), ec_key.get()))
+        return nullptr;
+    return pkey.release();
+}
+
+static EVP_PKEY* ParsePkcs8PublicComponents(int evp_key_type, CBS cbs) {
+    // PrivateKeyInfo ::= SEQUENCE { version INTEGER, privateKeyAlgorithm AlgorithmIdentifier,
+    //                               privateKey OCTET STRING, ... }
+    CBS private_key_info, algorithm, private_key;
+    uint64_t version;
+    if (!CBS_get_asn1(&cbs, &private_key_info, CBS_ASN1_SEQUENCE) ||
+        !CBS_get_asn1_uint64(&private_key_info, &version) || version != 0 ||
+        !CBS_get_asn1(&private_key_info, &algorithm, CBS_ASN1_SEQUENCE) ||
+        !CBS_get_asn1(&private_key_info, &private_key, CBS_ASN1_OCTETSTRING))
+        return nullptr;
+
+    switch (evp_key_type) {
+    case EVP_PKEY_RSA:
+        return ParseRsaPublicComponents(&private_key);
+    case EVP_PKEY_EC:
+        return ParseEcPublicComponents(&algorithm, &private_key);
+    default:
+        return nullptr;
+    }
+}
+
+/**
+ * Extracts just the public key from private key material, without decoding or validating the
+ * private components.  EvpKeyToKeyMaterial() writes RSA and EC keys as a bare RSAPrivateKey or
+ * ECPrivateKey, but d2i_PrivateKey() also accepts them wrapped in a PKCS#8 PrivateKeyInfo, so both
+ * are handled.  Returns nullptr if the material can't be handled this way, in which case the
+ * caller should decode the whole thing.
+ */
+static EVP_PKEY* ParsePublicComponents(int evp_key_type, const uint8_t* data, size_t data_length) {
+    CBS cbs;
+    CBS_init(&cbs, data, data_length);
+
+    CBS private_key = cbs;
+    EVP_PKEY_Ptr pkey;
+    switch (evp_key_type) {
+    case EVP_PKEY_RSA:
+        pkey.reset(ParseRsaPublicComponents(&private_key));
+        break;
+    case EVP_PKEY_EC:
+        pkey.reset(ParseEcPublicComponents(nullptr /* algorithm */, &private_key));
+        break;
+    default:
+        return nullptr;
+    }
+    if (pkey.get())
+        return pkey.release();
+    return ParsePkcs8PublicComponents(evp_key_type, cbs);
+}
+
+#else  // OPENSSL_IS_BORINGSSL
+
+static EVP_PKEY* ParsePublicComponents(int /* evp_key_type */, const uint8_t* /* data */,
+                                       size_t /* data_length */) {
+    return nullptr;
+}
+
+#endif  // OPENSSL_IS_BORINGSSL
+
+bool AsymmetricKey::DeferDecoding(int evp_key_type) {
+    evp_key_type_ = evp_key_type;
+    decoded_ = NOT_DECODED;
+    return DecodeKeyMaterial(true /* public_only */);
+}
+
+bool AsymmetricKey::DecodeAndCopy(bool public_only, EVP_PKEY* pkey) const {
+    return DecodeKeyMaterial(public_only) && CopyInternalToEvp(pkey);
+}
+
+bool AsymmetricKey::DecodeKeyMaterial(bool public_only) const {
+    if (decoded_ == FULLY_DECODED || (public_only && decoded_ == PUBLIC_DECODED))
+        return true;
+
+    EVP_PKEY_Ptr pkey;
+    if (public_only)
+        pkey.reset(ParsePublicComponents(evp_key_type_, key_material().key_material,
+                                         key_material().key_material_size));
+    if (!pkey.get()) {
+        ERR_clear_error();
+        public_only = false;
+        const uint8_t* tmp = key_material().key_material;
+        pkey.reset(d2i_PrivateKey(evp_key_type_, nullptr /* pkey */, &tmp,
+                                  key_material().key_material_size));
+        if (!pkey.get())
+            return false;
+    }
+
+    // Decoding fills in the subclass's cached form of key_material(); the key itself is unchanged.
+    if (!const_cast<AsymmetricKey*>(this)->EvpToInternal(pkey.get()))
+        return false;
+    decoded_ = public_only ? PUBLIC_DECODED : FULLY_DECODED;
+    return true;
+}
+
+EVP_PKEY* AsymmetricKey::NewPublicEvpKey() const {
+    EVP_PKEY_Ptr pkey(EVP_PKEY_new());
+    if (!pkey.get() || !PublicKeyToEvp(pkey.get()))
+        return nullptr;
+    return pkey.release();
+}
+
 keymaster_error_t AsymmetricKey::formatted_key_material(keymaster_key_format_t format,
                                                         UniquePtr<uint8_t[]>* material,
                                                         size_t* size) const {
@@ -41,8 +224,8 @@ keymaster_error_t AsymmetricKey::formatted_key_material(keymaster_key_format_t f
     if (material == nullptr || size == nullptr)
         return KM_ERROR_OUTPUT_PARAMETER_NULL;
 
-    EVP_PKEY_Ptr pkey(EVP_PKEY_new());
-    if (!InternalToEvp(pkey.get()))
+    EVP_PKEY_Ptr pkey(NewPublicEvpKey());
+    if (!pkey.get())
         return TranslateLastOpenSslError();
 
     int key_data_length = i2d_PUBKEY(pkey.get(), nullptr);
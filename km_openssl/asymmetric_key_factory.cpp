@@ -48,22 +48,14 @@ keymaster_error_t AsymmetricKeyFactory::LoadKey(KeymasterKeyBlob&& key_material,
     if (error != KM_ERROR_OK)
         return error;
 
-    const uint8_t* tmp = key_material.key_material;
+    // Only the public components of the key material are decoded here, which is enough to reject
+    // corrupt key material at load.  The full decode, and the private key checks that come with
+    // it, waits until an operation actually needs the private key.
     asym_key->key_material() = move(key_material);
-
-    EVP_PKEY* pkey =
-        d2i_PrivateKey(evp_key_type(), nullptr /* pkey */, &tmp,
-                       asym_key->key_material().key_material_size);
-    if (!pkey)
-        return TranslateLastOpenSslError();
-    UniquePtr<EVP_PKEY, EVP_PKEY_Delete> pkey_deleter(pkey);
-
-    if (!asym_key->EvpToInternal(pkey))
-        error = TranslateLastOpenSslError();
-    else
-        key->reset(asym_key.release());
-
-    return error;
+    if (!asym_key->DeferDecoding(key_material_type(*asym_key)))
+        return KM_ERROR_INVALID_KEY_BLOB;
+    key->reset(asym_key.release());
+    return KM_ERROR_OK;
 }
 
 }  // namespace keymaster
@@ -36,6 +36,7 @@ namespace {
 constexpr int kDigitalSignatureKeyUsageBit = 0;
 constexpr int kKeyEnciphermentKeyUsageBit = 2;
 constexpr int kDataEnciphermentKeyUsageBit = 3;
+constexpr int kKeyAgreementKeyUsageBit = 4;
 constexpr int kMaxKeyUsageBit = 8;
 
 template <typename T> T && min(T && a, T && b) {
@@ -228,6 +229,13 @@ keymaster_error_t add_key_usage_extension(const AuthorizationSet& tee_enforced,
         }
     }
 
+    if (tee_enforced.Contains(TAG_PURPOSE, KM_PURPOSE_AGREE_KEY) ||
+        sw_enforced.Contains(TAG_PURPOSE, KM_PURPOSE_AGREE_KEY)) {
+        if (!ASN1_BIT_STRING_set_bit(key_usage.get(), kKeyAgreementKeyUsageBit, 1)) {
+            return TranslateLastOpenSslError();
+        }
+    }
+
     // Convert to octets
     int len = i2d_ASN1_BIT_STRING(key_usage.get(), nullptr);
     if (len < 0) {
@@ -310,8 +318,8 @@ keymaster_error_t generate_attestation(const AsymmetricKey& key,
          !key.hw_enforced().GetTagValue(TAG_ALGORITHM, &sign_algorithm)))
         return KM_ERROR_UNKNOWN_ERROR;
 
-    EVP_PKEY_Ptr pkey(EVP_PKEY_new());
-    if (!key.InternalToEvp(pkey.get()))
+    EVP_PKEY_Ptr pkey(key.NewPublicEvpKey());
+    if (!pkey.get())
         return TranslateLastOpenSslError();
 
     X509_Ptr certificate(X509_new());
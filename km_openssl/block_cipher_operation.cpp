@@ -24,19 +24,24 @@
 
 #include <openssl/aes.h>
 #include <openssl/err.h>
-#include <openssl/rand.h>
+#include <openssl/mem.h>
 
+#include <keymaster/keymaster_context.h>
 #include <keymaster/logger.h>
 
 #include <keymaster/km_openssl/aes_key.h>
 #include <keymaster/km_openssl/openssl_err.h>
 #include <keymaster/km_openssl/openssl_utils.h>
+#include <keymaster/km_openssl/symmetric_key.h>
 
 namespace keymaster {
 
 static const size_t GCM_NONCE_SIZE = 12;
 
 inline bool allows_padding(keymaster_block_mode_t block_mode) {
+    // Not a HAL enumerator, so it can't be a case label.
+    if (block_mode == KM_MODE_CHACHA20_POLY1305) return false;
+
     switch (block_mode) {
     case KM_MODE_CTR:
     case KM_MODE_GCM:
@@ -49,6 +54,11 @@ inline bool allows_padding(keymaster_block_mode_t block_mode) {
     return false;
 }
 
+// Authenticated modes take associated data and a tag, and a 12-byte nonce.
+inline bool is_aead_mode(keymaster_block_mode_t block_mode) {
+    return block_mode == KM_MODE_GCM || block_mode == KM_MODE_CHACHA20_POLY1305;
+}
+
 static keymaster_error_t GetAndValidateGcmTagLength(const AuthorizationSet& begin_params,
                                                     const AuthProxy& key_params,
                                                     size_t* tag_length) {
@@ -76,6 +86,19 @@ static keymaster_error_t GetAndValidateGcmTagLength(const AuthorizationSet& begi
     return KM_ERROR_OK;
 }
 
+static keymaster_error_t
+GetAndValidateChaCha20Poly1305TagLength(const AuthorizationSet& begin_params, size_t* tag_length) {
+    // Poly1305 tags aren't truncated, so KM_TAG_MAC_LENGTH is optional.
+    uint32_t tag_length_bits;
+    if (begin_params.GetTagValue(TAG_MAC_LENGTH, &tag_length_bits) &&
+        tag_length_bits != kChaCha20Poly1305TagLength) {
+        return KM_ERROR_UNSUPPORTED_MAC_LENGTH;
+    }
+
+    *tag_length = kChaCha20Poly1305TagLength / 8;
+    return KM_ERROR_OK;
+}
+
 OperationPtr BlockCipherOperationFactory::CreateOperation(Key&& key,
                                                           const AuthorizationSet& begin_params,
                                                           keymaster_error_t* error) const {
@@ -101,6 +124,11 @@ OperationPtr BlockCipherOperationFactory::CreateOperation(Key&& key,
         if (*error != KM_ERROR_OK) {
             return nullptr;
         }
+    } else if (block_mode == KM_MODE_CHACHA20_POLY1305) {
+        *error = GetAndValidateChaCha20Poly1305TagLength(begin_params, &tag_length);
+        if (*error != KM_ERROR_OK) {
+            return nullptr;
+        }
     }
 
     keymaster_padding_t padding;
@@ -147,9 +175,26 @@ BlockCipherEvpOperation::BlockCipherEvpOperation(keymaster_purpose_t purpose,
                                                  size_t tag_length, Key&& key,
                                                  const EvpCipherDescription& cipher_description)
     : Operation(purpose, key.hw_enforced_move(), key.sw_enforced_move()), block_mode_(block_mode),
-      caller_iv_(caller_iv), tag_length_(tag_length), data_started_(false), padding_(padding),
+      caller_iv_(caller_iv), tag_length_(tag_length), data_started_(false), data_length_(0),
+      padding_(padding),
       key_(key.key_material_move()), cipher_description_(cipher_description) {
     EVP_CIPHER_CTX_init(&ctx_);
+
+    // Block cipher keys are all SymmetricKeys.  If this one shares keyed contexts, start from a
+    // copy of one, so Begin needn't key ctx_.
+    KeyedContextTemplates* templates = static_cast<SymmetricKey&>(key).context_templates();
+    if (!templates) return;
+    keymaster_error_t error;
+    const EVP_CIPHER* cipher =
+        cipher_description_.GetCipherInstance(key_.key_material_size, block_mode_, &error);
+    const EVP_CIPHER_CTX* keyed_ctx =
+        cipher ? templates->CipherContext(cipher, block_mode_, purpose == KM_PURPOSE_ENCRYPT, key_)
+               : nullptr;
+    if (keyed_ctx && !EVP_CIPHER_CTX_copy(&ctx_, keyed_ctx)) {
+        // Leave ctx_ empty, so Begin keys it the usual way.
+        EVP_CIPHER_CTX_cleanup(&ctx_);
+        EVP_CIPHER_CTX_init(&ctx_);
+    }
 }
 
 BlockCipherEvpOperation::~BlockCipherEvpOperation() {
@@ -162,7 +207,13 @@ keymaster_error_t BlockCipherEvpOperation::Begin(const AuthorizationSet& /* inpu
                              (size_t)sizeof(operation_handle_));
     if (rc != KM_ERROR_OK) return rc;
 
-    return InitializeCipher(move(key_));
+    // ctx_ is already keyed if it was copied from the key's contexts, or if the operation was
+    // restarted.
+    if (!EVP_CIPHER_CTX_cipher(&ctx_)) {
+        keymaster_error_t error = InitializeCipher(key_);
+        if (error != KM_ERROR_OK) return error;
+    }
+    return StartCipher();
 }
 
 keymaster_error_t BlockCipherEvpOperation::Update(const AuthorizationSet& additional_params,
@@ -170,7 +221,7 @@ keymaster_error_t BlockCipherEvpOperation::Update(const AuthorizationSet& additi
                                                   AuthorizationSet* /* output_params */,
                                                   Buffer* output, size_t* input_consumed) {
     keymaster_error_t error;
-    if (block_mode_ == KM_MODE_GCM && !HandleAad(additional_params, input, &error)) return error;
+    if (tag_length_ > 0 && !HandleAad(additional_params, input, &error)) return error;
     if (!InternalUpdate(input.peek_read(), input.available_read(), output, &error)) return error;
     *input_consumed = input.available_read();
 
@@ -190,10 +241,13 @@ keymaster_error_t BlockCipherEvpOperation::Finish(const AuthorizationSet& additi
     if (!UpdateForFinish(additional_params, input, output_params, output, &error)) return error;
     if (!output->reserve(block_size_bytes())) return KM_ERROR_MEMORY_ALLOCATION_FAILED;
 
-    if (block_mode_ == KM_MODE_GCM && aad_block_buf_len_ > 0 && !ProcessBufferedAadBlock(&error)) {
+    if (tag_length_ > 0 && aad_block_buf_len_ > 0 && !ProcessBufferedAadBlock(&error)) {
         return error;
     }
 
+    // ParallelGcm and ChaCha20Poly1305 buffer nothing; the subclasses take care of their tags.
+    if (tag_outside_ctx()) return KM_ERROR_OK;
+
     int output_written = -1;
     if (!EVP_CipherFinal_ex(&ctx_, output->peek_write(), &output_written)) {
         if (tag_length_ > 0) return KM_ERROR_VERIFICATION_FAILED;
@@ -208,6 +262,8 @@ keymaster_error_t BlockCipherEvpOperation::Finish(const AuthorizationSet& additi
 }
 
 bool BlockCipherEvpOperation::need_iv() const {
+    if (block_mode_ == KM_MODE_CHACHA20_POLY1305) return true;
+
     switch (block_mode_) {
     case KM_MODE_CBC:
     case KM_MODE_CTR:
@@ -222,16 +278,48 @@ bool BlockCipherEvpOperation::need_iv() const {
     }
 }
 
-keymaster_error_t BlockCipherEvpOperation::InitializeCipher(KeymasterKeyBlob key) {
+keymaster_error_t BlockCipherEvpOperation::InitializeCipher(const KeymasterKeyBlob& key) {
+    // ChaCha20Poly1305 needs the nonce as well as the key, so StartCipher sets it up.
+    if (block_mode_ == KM_MODE_CHACHA20_POLY1305) return KM_ERROR_OK;
+
     keymaster_error_t error;
     const EVP_CIPHER* cipher =
         cipher_description_.GetCipherInstance(key.key_material_size, block_mode_, &error);
     if (error) return error;
 
-    if (!EVP_CipherInit_ex(&ctx_, cipher, nullptr /* engine */, key.key_material, iv_.data,
+    if (!EVP_CipherInit_ex(&ctx_, cipher, nullptr /* engine */, key.key_material, nullptr /* iv */,
                            evp_encrypt_mode())) {
         return TranslateLastOpenSslError();
     }
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t BlockCipherEvpOperation::StartCipher() {
+    if (block_mode_ == KM_MODE_CHACHA20_POLY1305) {
+        if (!chacha20_poly1305_) chacha20_poly1305_.reset(new (std::nothrow) ChaCha20Poly1305);
+        if (!chacha20_poly1305_) return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+        keymaster_error_t error = chacha20_poly1305_->Init(key_, iv_.data);
+        if (error != KM_ERROR_OK) return error;
+    } else {
+        keymaster_error_t error = StartEvpCipher();
+        if (error != KM_ERROR_OK) return error;
+    }
+
+    if (tag_length_ > 0) {
+        if (!aad_block_buf_) aad_block_buf_.reset(new (std::nothrow) uint8_t[block_size_bytes()]);
+        if (!aad_block_buf_) return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+        aad_block_buf_len_ = 0;
+    }
+
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t BlockCipherEvpOperation::StartEvpCipher() {
+    // With no cipher or key, EVP_CipherInit_ex keeps the ones already in the context.
+    if (!EVP_CipherInit_ex(&ctx_, nullptr /* cipher */, nullptr /* engine */, nullptr /* key */,
+                           iv_.data, evp_encrypt_mode())) {
+        return TranslateLastOpenSslError();
+    }
 
     switch (padding_) {
     case KM_PAD_NONE:
@@ -243,13 +331,6 @@ keymaster_error_t BlockCipherEvpOperation::InitializeCipher(KeymasterKeyBlob key
     default:
         return KM_ERROR_UNSUPPORTED_PADDING_MODE;
     }
-
-    if (block_mode_ == KM_MODE_GCM) {
-        aad_block_buf_.reset(new (std::nothrow) uint8_t[block_size_bytes()]);
-        if (!aad_block_buf_) return KM_ERROR_MEMORY_ALLOCATION_FAILED;
-        aad_block_buf_len_ = 0;
-    }
-
     return KM_ERROR_OK;
 }
 
@@ -260,14 +341,14 @@ keymaster_error_t BlockCipherEvpOperation::GetIv(const AuthorizationSet& input_p
         return KM_ERROR_INVALID_ARGUMENT;
     }
 
-    if (block_mode_ != KM_MODE_GCM && iv_blob.data_length != block_size_bytes()) {
+    if (!is_aead_mode(block_mode_) && iv_blob.data_length != block_size_bytes()) {
         LOG_E("Expected %d-byte IV for operation, but got %d bytes", block_size_bytes(),
               iv_blob.data_length);
         return KM_ERROR_INVALID_NONCE;
     }
 
-    if (block_mode_ == KM_MODE_GCM && iv_blob.data_length != GCM_NONCE_SIZE) {
-        LOG_E("Expected %d-byte nonce for GCM operation, but got %d bytes", GCM_NONCE_SIZE,
+    if (is_aead_mode(block_mode_) && iv_blob.data_length != GCM_NONCE_SIZE) {
+        LOG_E("Expected %d-byte nonce for AEAD operation, but got %d bytes", GCM_NONCE_SIZE,
               iv_blob.data_length);
         return KM_ERROR_INVALID_NONCE;
     }
@@ -323,6 +404,12 @@ bool BlockCipherEvpOperation::HandleAad(const AuthorizationSet& input_params, co
 }
 
 bool BlockCipherEvpOperation::ProcessBufferedAadBlock(keymaster_error_t* error) {
+    if (chacha20_poly1305_) {
+        chacha20_poly1305_->AddAad(aad_block_buf_.get(), aad_block_buf_len_);
+        aad_block_buf_len_ = 0;
+        return true;
+    }
+    if (!RecordAad(aad_block_buf_.get(), aad_block_buf_len_, error)) return false;
     int output_written;
     if (EVP_CipherUpdate(&ctx_, nullptr /* out */, &output_written, aad_block_buf_.get(),
                          aad_block_buf_len_)) {
@@ -335,6 +422,11 @@ bool BlockCipherEvpOperation::ProcessBufferedAadBlock(keymaster_error_t* error)
 
 bool BlockCipherEvpOperation::ProcessAadBlocks(const uint8_t* data, size_t blocks,
                                                keymaster_error_t* error) {
+    if (chacha20_poly1305_) {
+        chacha20_poly1305_->AddAad(data, blocks * block_size_bytes());
+        return true;
+    }
+    if (!RecordAad(data, blocks * block_size_bytes(), error)) return false;
     int output_written;
     if (EVP_CipherUpdate(&ctx_, nullptr /* out */, &output_written, data,
                          blocks * block_size_bytes())) {
@@ -344,6 +436,18 @@ bool BlockCipherEvpOperation::ProcessAadBlocks(const uint8_t* data, size_t block
     return false;
 }
 
+bool BlockCipherEvpOperation::RecordAad(const uint8_t* data, size_t length,
+                                        keymaster_error_t* error) {
+    if (block_mode_ != KM_MODE_GCM || !task_context() ||
+        task_context()->max_concurrent_tasks() < 2)
+        return true;
+    if (!aad_.reserve(length) || !aad_.write(data, length)) {
+        *error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
+        return false;
+    }
+    return true;
+}
+
 inline size_t min(size_t a, size_t b) {
     return (a < b) ? a : b;
 }
@@ -368,12 +472,74 @@ bool BlockCipherEvpOperation::InternalUpdate(const uint8_t* input, size_t input_
         return false;
     }
 
-    int output_written = -1;
-    if (!EVP_CipherUpdate(&ctx_, output->peek_write(), &output_written, input, input_length)) {
-        *error = TranslateLastOpenSslError();
+    // Large CTR and GCM inputs can be split into runs and processed in parallel, if the context
+    // has threads to spare.  A GCM operation can only switch before its first data, since ctx_
+    // won't give up its tag state.
+    if (block_mode_ == KM_MODE_GCM && !parallel_gcm_ && data_length_ == 0 &&
+        ParallelCtr::Worthwhile(task_context(), input_length)) {
+        *error = StartParallelGcm();
+        if (*error != KM_ERROR_OK) return false;
+    }
+
+    if (parallel_gcm_) {
+        *error = parallel_gcm_->Crypt(input, input_length, output->peek_write(), task_context(),
+                                      purpose() == KM_PURPOSE_ENCRYPT);
+    } else if (chacha20_poly1305_) {
+        *error = chacha20_poly1305_->Crypt(input, input_length, output->peek_write(),
+                                           purpose() == KM_PURPOSE_ENCRYPT);
+    } else if (block_mode_ == KM_MODE_CTR &&
+               ParallelCtr::Worthwhile(task_context(), input_length)) {
+        const EVP_CIPHER* cipher =
+            cipher_description_.GetCipherInstance(key_.key_material_size, block_mode_, error);
+        if (*error != KM_ERROR_OK) return false;
+        ParallelCtr ctr;
+        ctr.Init(cipher, key_, iv_.data);
+        *error = ctr.Crypt(&ctx_, data_length_, input, input_length, output->peek_write(),
+                           task_context(), nullptr /* hasher */, false /* hash_output */);
+    } else {
+        int output_written = -1;
+        if (!EVP_CipherUpdate(&ctx_, output->peek_write(), &output_written, input,
+                              input_length)) {
+            *error = TranslateLastOpenSslError();
+            return false;
+        }
+        data_length_ += input_length;
+        // Once data has started without going parallel, the associated data isn't needed.
+        aad_.Clear();
+        return output->advance_write(output_written);
+    }
+
+    if (*error != KM_ERROR_OK) return false;
+    data_length_ += input_length;
+    if (!output->advance_write(input_length)) {
+        *error = KM_ERROR_UNKNOWN_ERROR;
         return false;
     }
-    return output->advance_write(output_written);
+    return true;
+}
+
+keymaster_error_t BlockCipherEvpOperation::StartParallelGcm() {
+    keymaster_error_t error;
+    const size_t key_size = key_.key_material_size;
+    const EVP_CIPHER* gcm_cipher =
+        cipher_description_.GetCipherInstance(key_size, KM_MODE_GCM, &error);
+    if (error != KM_ERROR_OK) return error;
+    const EVP_CIPHER* ecb_cipher =
+        cipher_description_.GetCipherInstance(key_size, KM_MODE_ECB, &error);
+    if (error != KM_ERROR_OK) return error;
+    const EVP_CIPHER* ctr_cipher =
+        cipher_description_.GetCipherInstance(key_size, KM_MODE_CTR, &error);
+    if (error != KM_ERROR_OK) return error;
+
+    UniquePtr<ParallelGcm> parallel_gcm(new (std::nothrow) ParallelGcm);
+    if (!parallel_gcm) return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    error = parallel_gcm->Init(gcm_cipher, ecb_cipher, ctr_cipher, key_, iv_.data,
+                               aad_.peek_read(), aad_.available_read());
+    if (error != KM_ERROR_OK) return error;
+
+    aad_.Clear();
+    parallel_gcm_.reset(parallel_gcm.release());
+    return KM_ERROR_OK;
 }
 
 bool BlockCipherEvpOperation::UpdateForFinish(const AuthorizationSet& additional_params,
@@ -429,8 +595,15 @@ keymaster_error_t BlockCipherEvpEncryptOperation::Finish(const AuthorizationSet&
     if (tag_length_ > 0) {
         if (!output->reserve(tag_length_)) return KM_ERROR_MEMORY_ALLOCATION_FAILED;
 
-        if (!EVP_CIPHER_CTX_ctrl(&ctx_, EVP_CTRL_GCM_GET_TAG, tag_length_, output->peek_write()))
+        if (tag_outside_ctx()) {
+            uint8_t tag[kMaxTagSize];
+            error = ComputeTag(tag);
+            if (error != KM_ERROR_OK) return error;
+            memcpy(output->peek_write(), tag, tag_length_);
+        } else if (!EVP_CIPHER_CTX_ctrl(&ctx_, EVP_CTRL_GCM_GET_TAG, tag_length_,
+                                        output->peek_write())) {
             return TranslateLastOpenSslError();
+        }
         if (!output->advance_write(tag_length_)) return KM_ERROR_UNKNOWN_ERROR;
     }
 
@@ -438,10 +611,9 @@ keymaster_error_t BlockCipherEvpEncryptOperation::Finish(const AuthorizationSet&
 }
 
 keymaster_error_t BlockCipherEvpEncryptOperation::GenerateIv() {
-    iv_.Reset((block_mode_ == KM_MODE_GCM) ? GCM_NONCE_SIZE : block_size_bytes());
+    iv_.Reset(is_aead_mode(block_mode_) ? GCM_NONCE_SIZE : block_size_bytes());
     if (!iv_.data) return KM_ERROR_MEMORY_ALLOCATION_FAILED;
-    if (RAND_bytes(iv_.writable_data(), iv_.data_length) != 1) return TranslateLastOpenSslError();
-    return KM_ERROR_OK;
+    return GenerateRandom(iv_.writable_data(), iv_.data_length);
 }
 
 keymaster_error_t BlockCipherEvpDecryptOperation::Begin(const AuthorizationSet& input_params,
@@ -470,7 +642,7 @@ keymaster_error_t BlockCipherEvpDecryptOperation::Update(const AuthorizationSet&
     *input_consumed = input.available_read();
 
     keymaster_error_t error;
-    if (block_mode_ == KM_MODE_GCM) {
+    if (tag_length_ > 0) {
         if (!HandleAad(additional_params, input, &error)) return error;
         return ProcessAllButTagLengthBytes(input, output);
     }
@@ -534,6 +706,12 @@ keymaster_error_t BlockCipherEvpDecryptOperation::Finish(const AuthorizationSet&
 
     if (tag_buf_len_ < tag_length_) {
         return KM_ERROR_INVALID_INPUT_LENGTH;
+    } else if (tag_outside_ctx()) {
+        uint8_t tag[kMaxTagSize];
+        error = ComputeTag(tag);
+        if (error != KM_ERROR_OK) return error;
+        if (CRYPTO_memcmp(tag, tag_buf_.get(), tag_length_) != 0)
+            return KM_ERROR_VERIFICATION_FAILED;
     } else if (tag_length_ > 0 &&
                !EVP_CIPHER_CTX_ctrl(&ctx_, EVP_CTRL_GCM_SET_TAG, tag_length_, tag_buf_.get())) {
         return TranslateLastOpenSslError();
@@ -545,8 +723,32 @@ keymaster_error_t BlockCipherEvpDecryptOperation::Finish(const AuthorizationSet&
                                            output);
 }
 
+keymaster_error_t BlockCipherEvpOperation::ComputeTag(uint8_t* tag) {
+    if (parallel_gcm_) {
+        parallel_gcm_->Tag(tag);
+        return KM_ERROR_OK;
+    }
+
+    // Decryption checks the tag before Finish processes any associated data still buffered, which
+    // there can be if there was no data.
+    assert(chacha20_poly1305_);
+    keymaster_error_t error;
+    if (aad_block_buf_len_ > 0 && !ProcessBufferedAadBlock(&error)) return error;
+    chacha20_poly1305_->Tag(tag);
+    return KM_ERROR_OK;
+}
+
 keymaster_error_t BlockCipherEvpOperation::Abort() {
     return KM_ERROR_OK;
 }
 
+keymaster_error_t BlockCipherEvpOperation::Restart() {
+    aad_block_buf_len_ = 0;
+    data_started_ = false;
+    data_length_ = 0;
+    aad_.Clear();
+    parallel_gcm_.reset();
+    return KM_ERROR_OK;
+}
+
 }  // namespace keymaster
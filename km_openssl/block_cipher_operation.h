@@ -21,6 +21,9 @@
 
 #include <keymaster/operation.h>
 
+#include "chacha20_poly1305.h"
+#include "parallel_cipher.h"
+
 namespace keymaster {
 
 /**
@@ -82,12 +85,20 @@ class BlockCipherEvpOperation : public Operation {
                              const Buffer& signature, AuthorizationSet* output_params,
                              Buffer* output) override;
     keymaster_error_t Abort() override;
+    keymaster_error_t Restart() override;
 
   protected:
+    // The longest tag computed outside of ctx_.
+    static const size_t kMaxTagSize = 16;
+
     virtual int evp_encrypt_mode() = 0;
 
     bool need_iv() const;
-    keymaster_error_t InitializeCipher(KeymasterKeyBlob key);
+    keymaster_error_t InitializeCipher(const KeymasterKeyBlob& key);
+    keymaster_error_t StartCipher();
+    keymaster_error_t StartEvpCipher();
+    keymaster_error_t StartParallelGcm();
+    bool RecordAad(const uint8_t* data, size_t length, keymaster_error_t* error);
     keymaster_error_t GetIv(const AuthorizationSet& input_params);
     bool HandleAad(const AuthorizationSet& input_params, const Buffer& input,
                    keymaster_error_t* error);
@@ -100,16 +111,30 @@ class BlockCipherEvpOperation : public Operation {
                          AuthorizationSet* output_params, Buffer* output, keymaster_error_t* error);
     size_t block_size_bytes() const { return cipher_description_.block_size_bytes(); }
 
+    // True if the data and tag are handled by parallel_gcm_ or chacha20_poly1305_ rather than ctx_.
+    bool tag_outside_ctx() const { return parallel_gcm_ || chacha20_poly1305_; }
+    // Writes the tag of such an operation, kMaxTagSize bytes, to |tag|.
+    keymaster_error_t ComputeTag(uint8_t* tag);
+
     const keymaster_block_mode_t block_mode_;
     EVP_CIPHER_CTX ctx_;
     KeymasterBlob iv_;
     const bool caller_iv_;
     const size_t tag_length_;
 
+    // Set once a GCM operation has taken the parallel path (see InternalUpdate).  From then on it
+    // produces the data and the tag, and ctx_ is unused.
+    UniquePtr<ParallelGcm> parallel_gcm_;
+    // Set for KM_MODE_CHACHA20_POLY1305 operations, which don't use ctx_ at all.
+    UniquePtr<ChaCha20Poly1305> chacha20_poly1305_;
+
   private:
     UniquePtr<uint8_t[]> aad_block_buf_;
     size_t aad_block_buf_len_;
     bool data_started_;
+    uint64_t data_length_;
+    // A GCM operation that might go parallel keeps its associated data, for ParallelGcm.
+    Buffer aad_;
     const keymaster_padding_t padding_;
     KeymasterKeyBlob key_;
     const EvpCipherDescription& cipher_description_;
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "chacha20_poly1305.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(OPENSSL_IS_BORINGSSL)
+#include <openssl/chacha.h>
+#endif
+
+namespace keymaster {
+
+#if defined(OPENSSL_IS_BORINGSSL)
+
+static const size_t kChaChaBlockSize = 64;
+
+// The block counter is 32 bits, and block zero goes to the Poly1305 key.
+static const uint64_t kMaxDataLength = ((1ULL << 32) - 1) * kChaChaBlockSize;
+
+static const uint8_t kZeros[16] = {};
+
+static void StoreLittleEndian64(uint64_t value, uint8_t* bytes) {
+    for (size_t i = 0; i < 8; ++i)
+        bytes[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+// Poly1305 input is padded with zeros to 16 bytes after the associated data and after the data.
+static void PadTo16(poly1305_state* state, uint64_t length) {
+    if (length % 16)
+        CRYPTO_poly1305_update(state, kZeros, 16 - length % 16);
+}
+
+ChaCha20Poly1305::~ChaCha20Poly1305() {
+    memset_s(&poly1305_, 0, sizeof(poly1305_));
+    memset_s(keystream_, 0, sizeof(keystream_));
+}
+
+keymaster_error_t ChaCha20Poly1305::Init(const KeymasterKeyBlob& key, const uint8_t* nonce) {
+    if (key.key_material_size != kKeySize) return KM_ERROR_UNSUPPORTED_KEY_SIZE;
+    key_ = key.key_material;
+    memcpy(nonce_, nonce, sizeof(nonce_));
+
+    // The first 32 bytes of keystream block zero are the one-time Poly1305 key.
+    uint8_t poly1305_key[kChaChaBlockSize] = {};
+    CRYPTO_chacha_20(poly1305_key, poly1305_key, sizeof(poly1305_key), key_, nonce_,
+                     0 /* counter */);
+    CRYPTO_poly1305_init(&poly1305_, poly1305_key);
+    memset_s(poly1305_key, 0, sizeof(poly1305_key));
+
+    counter_ = 1;
+    keystream_used_ = sizeof(keystream_);
+    data_started_ = false;
+    aad_length_ = 0;
+    data_length_ = 0;
+    return KM_ERROR_OK;
+}
+
+void ChaCha20Poly1305::AddAad(const uint8_t* aad, size_t length) {
+    assert(!data_started_);
+    CRYPTO_poly1305_update(&poly1305_, aad, length);
+    aad_length_ += length;
+}
+
+keymaster_error_t ChaCha20Poly1305::Crypt(const uint8_t* input, size_t length, uint8_t* output,
+                                          bool encrypt) {
+    if (length > kMaxDataLength - data_length_) return KM_ERROR_INVALID_INPUT_LENGTH;
+    StartData();
+
+    // Authenticate ciphertext before decrypting it, in case |output| overwrites |input|.
+    if (!encrypt) CRYPTO_poly1305_update(&poly1305_, input, length);
+    XorKeystream(input, length, output);
+    if (encrypt) CRYPTO_poly1305_update(&poly1305_, output, length);
+    data_length_ += length;
+    return KM_ERROR_OK;
+}
+
+void ChaCha20Poly1305::Tag(uint8_t* tag) {
+    StartData();
+    PadTo16(&poly1305_, data_length_);
+
+    uint8_t lengths[16];
+    StoreLittleEndian64(aad_length_, lengths);
+    StoreLittleEndian64(data_length_, lengths + 8);
+    CRYPTO_poly1305_update(&poly1305_, lengths, sizeof(lengths));
+    CRYPTO_poly1305_finish(&poly1305_, tag);
+}
+
+void ChaCha20Poly1305::StartData() {
+    if (data_started_) return;
+    PadTo16(&poly1305_, aad_length_);
+    data_started_ = true;
+}
+
+void ChaCha20Poly1305::XorKeystream(const uint8_t* input, size_t length, uint8_t* output) {
+    // Finish the current keystream block.
+    for (; length && keystream_used_ < sizeof(keystream_); --length)
+        *output++ = *input++ ^ keystream_[keystream_used_++];
+
+    // Whole blocks go straight through CRYPTO_chacha_20.
+    size_t whole_blocks = length / kChaChaBlockSize;
+    if (whole_blocks) {
+        CRYPTO_chacha_20(output, input, whole_blocks * kChaChaBlockSize, key_, nonce_, counter_);
+        counter_ += whole_blocks;
+        input += whole_blocks * kChaChaBlockSize;
+        output += whole_blocks * kChaChaBlockSize;
+        length -= whole_blocks * kChaChaBlockSize;
+    }
+
+    // Keep the rest of the last block's keystream for the next call.
+    if (length) {
+        memset(keystream_, 0, sizeof(keystream_));
+        CRYPTO_chacha_20(keystream_, keystream_, sizeof(keystream_), key_, nonce_, counter_++);
+        for (keystream_used_ = 0; keystream_used_ < length; ++keystream_used_)
+            output[keystream_used_] = input[keystream_used_] ^ keystream_[keystream_used_];
+    }
+}
+
+#else  // OPENSSL_IS_BORINGSSL
+
+// AesEvpCipherDescription doesn't offer the mode here, so operations never get past Init().
+
+ChaCha20Poly1305::~ChaCha20Poly1305() {}
+
+keymaster_error_t ChaCha20Poly1305::Init(const KeymasterKeyBlob& /* key */,
+                                         const uint8_t* /* nonce */) {
+    return KM_ERROR_UNSUPPORTED_BLOCK_MODE;
+}
+
+void ChaCha20Poly1305::AddAad(const uint8_t* /* aad */, size_t /* length */) {}
+
+keymaster_error_t ChaCha20Poly1305::Crypt(const uint8_t* /* input */, size_t /* length */,
+                                          uint8_t* /* output */, bool /* encrypt */) {
+    return KM_ERROR_UNSUPPORTED_BLOCK_MODE;
+}
+
+void ChaCha20Poly1305::Tag(uint8_t* tag) {
+    memset(tag, 0, kTagSize);
+}
+
+#endif  // OPENSSL_IS_BORINGSSL
+
+}  // namespace keymaster
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef SYSTEM_KEYMASTER_CHACHA20_POLY1305_H_
+#define SYSTEM_KEYMASTER_CHACHA20_POLY1305_H_
+
+#include <stdint.h>
+
+#include <openssl/crypto.h>
+#if defined(OPENSSL_IS_BORINGSSL)
+#include <openssl/poly1305.h>
+#endif
+
+#include <hardware/keymaster_defs.h>
+
+#include <keymaster/android_keymaster_utils.h>
+
+namespace keymaster {
+
+/**
+ * ChaCha20Poly1305 is the AEAD construction of RFC 8439, fed in pieces the way
+ * BlockCipherEvpOperation feeds an EVP GCM context: all of the associated data first, then the
+ * data.  BoringSSL only offers it as a one-shot EVP_AEAD, so this streams CRYPTO_chacha_20 and
+ * CRYPTO_poly1305_* instead.  Other libraries have neither, so there Init() always fails with
+ * KM_ERROR_UNSUPPORTED_BLOCK_MODE.
+ */
+class ChaCha20Poly1305 {
+  public:
+    static const size_t kKeySize = 32;
+    static const size_t kNonceSize = 12;
+    static const size_t kTagSize = 16;
+
+    ChaCha20Poly1305() {}
+    ~ChaCha20Poly1305();
+
+    ChaCha20Poly1305(const ChaCha20Poly1305&) = delete;
+    void operator=(const ChaCha20Poly1305&) = delete;
+
+    /**
+     * Starts a message with |nonce|, discarding any earlier state.  |key| must outlive the
+     * ChaCha20Poly1305.
+     */
+    keymaster_error_t Init(const KeymasterKeyBlob& key, const uint8_t* nonce);
+
+    /**
+     * Authenticates associated data.  Must not be called once data has been passed to Crypt.
+     */
+    void AddAad(const uint8_t* aad, size_t length);
+
+    /**
+     * Encrypts or decrypts |length| bytes from |input| to |output|, which may be the same.
+     */
+    keymaster_error_t Crypt(const uint8_t* input, size_t length, uint8_t* output, bool encrypt);
+
+    /**
+     * Writes the kTagSize-byte tag over everything processed to |tag|.  Nothing more may be
+     * processed.
+     */
+    void Tag(uint8_t* tag);
+
+  private:
+    void StartData();
+    void XorKeystream(const uint8_t* input, size_t length, uint8_t* output);
+
+    const uint8_t* key_ = nullptr;
+    uint8_t nonce_[kNonceSize];
+#if defined(OPENSSL_IS_BORINGSSL)
+    poly1305_state poly1305_;
+#endif
+    uint32_t counter_ = 0;       // Of the next keystream block to generate.
+    uint8_t keystream_[64];      // The current keystream block...
+    size_t keystream_used_ = 0;  // ...of which this much is spent.
+    bool data_started_ = false;
+    uint64_t aad_length_ = 0;
+    uint64_t data_length_ = 0;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_CHACHA20_POLY1305_H_
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <keymaster/km_openssl/curve25519_key.h>
+
+namespace keymaster {
+
+bool Curve25519Key::EvpToInternal(const EVP_PKEY* pkey) {
+    if (!is_curve25519_evp_type(EVP_PKEY_id(pkey)))
+        return false;
+    pkey_.reset(NewReference(const_cast<EVP_PKEY*>(pkey)));
+    return pkey_.get() != nullptr;
+}
+
+EVP_PKEY* Curve25519Key::NewPublicEvpKey() const {
+    // Curve25519 private keys hold their public key, so there's no cheaper public-only decode.
+    if (!DecodeKeyMaterial(true /* public_only */))
+        return nullptr;
+    return NewReference(pkey_.get());
+}
+
+EVP_PKEY* Curve25519Key::evp_key() const {
+    if (!DecodeKeyMaterial(false /* public_only */))
+        return nullptr;
+    return NewReference(pkey_.get());
+}
+
+/* static */
+EVP_PKEY* Curve25519Key::NewReference(EVP_PKEY* pkey) {
+    if (!pkey || !EVP_PKEY_up_ref(pkey))
+        return nullptr;
+    return pkey;
+}
+
+}  // namespace keymaster
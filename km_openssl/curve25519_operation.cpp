@@ -0,0 +1,180 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <keymaster/km_openssl/curve25519_operation.h>
+
+#include <openssl/x509.h>
+
+#include <keymaster/km_openssl/curve25519_key.h>
+#include <keymaster/km_openssl/openssl_err.h>
+#include <keymaster/km_openssl/openssl_utils.h>
+
+namespace keymaster {
+
+// Ed25519 hashes the message itself.
+static const keymaster_digest_t ed25519_supported_digests[] = {KM_DIGEST_NONE};
+
+OperationPtr Curve25519OperationFactory::CreateOperation(Key&& key,
+                                                         const AuthorizationSet& begin_params,
+                                                         keymaster_error_t* error) const {
+    const Curve25519Key& curve25519_key = static_cast<Curve25519Key&>(key);
+
+    // Verification only needs the public key.
+    EVP_PKEY_Ptr pkey(purpose() == KM_PURPOSE_VERIFY ? curve25519_key.NewPublicEvpKey()
+                                                     : curve25519_key.evp_key());
+    if (!pkey.get()) {
+        *error = KM_ERROR_INVALID_KEY_BLOB;
+        return nullptr;
+    }
+
+    // Ed25519 keys can't agree, and X25519 keys can't sign.
+    if (EVP_PKEY_id(pkey.get()) != evp_key_type()) {
+        *error = KM_ERROR_INCOMPATIBLE_PURPOSE;
+        return nullptr;
+    }
+
+    if (evp_key_type() == EVP_PKEY_ED25519) {
+        keymaster_digest_t digest;
+        if (!GetAndValidateDigest(begin_params, key, &digest, error)) return nullptr;
+    }
+
+    *error = KM_ERROR_OK;
+    auto op = OperationPtr(
+        InstantiateOperation(key.hw_enforced_move(), key.sw_enforced_move(), pkey.release()));
+    if (!op) *error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    return op;
+}
+
+const keymaster_digest_t* Ed25519OperationFactory::SupportedDigests(size_t* digest_count) const {
+    *digest_count = array_length(ed25519_supported_digests);
+    return ed25519_supported_digests;
+}
+
+Curve25519Operation::~Curve25519Operation() {
+    if (key_ != nullptr)
+        EVP_PKEY_free(key_);
+}
+
+keymaster_error_t Curve25519Operation::Begin(const AuthorizationSet& /* input_params */,
+                                             AuthorizationSet* /* output_params */) {
+    return GenerateRandom(reinterpret_cast<uint8_t*>(&operation_handle_),
+                          (size_t)sizeof(operation_handle_));
+}
+
+keymaster_error_t Curve25519Operation::Update(const AuthorizationSet& /* additional_params */,
+                                              const Buffer& input,
+                                              AuthorizationSet* /* output_params */,
+                                              Buffer* /* output */, size_t* input_consumed) {
+    size_t input_length = input.available_read();
+    if (input_length > kMaxMessageSize - data_.available_read())
+        return KM_ERROR_INVALID_INPUT_LENGTH;
+
+    // Grow geometrically, so that many small updates don't copy the data over and over.
+    if (data_.available_write() < input_length &&
+        !data_.reserve(input_length > data_.buffer_size() ? input_length : data_.buffer_size()))
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    if (!data_.write(input.peek_read(), input_length))
+        return KM_ERROR_UNKNOWN_ERROR;
+
+    *input_consumed = input_length;
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t Ed25519SignOperation::Finish(const AuthorizationSet& additional_params,
+                                               const Buffer& input, const Buffer& /* signature */,
+                                               AuthorizationSet* /* output_params */,
+                                               Buffer* output) {
+    if (!output)
+        return KM_ERROR_OUTPUT_PARAMETER_NULL;
+
+    keymaster_error_t error = UpdateForFinish(additional_params, input);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    EVP_MD_CTX ctx;
+    EVP_MD_CTX_init(&ctx);
+    EvpMdCtxCleaner ctx_cleaner(&ctx);
+    size_t siglen;
+    if (EVP_DigestSignInit(&ctx, nullptr /* pctx */, nullptr /* type */, nullptr /* engine */,
+                           key_) != 1 ||
+        EVP_DigestSign(&ctx, nullptr /* signature */, &siglen, data_.peek_read(),
+                       data_.available_read()) != 1)
+        return TranslateLastOpenSslError();
+    if (!output->Reinitialize(siglen))
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    if (EVP_DigestSign(&ctx, output->peek_write(), &siglen, data_.peek_read(),
+                       data_.available_read()) != 1)
+        return TranslateLastOpenSslError();
+    if (!output->advance_write(siglen))
+        return KM_ERROR_UNKNOWN_ERROR;
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t Ed25519VerifyOperation::Finish(const AuthorizationSet& additional_params,
+                                                 const Buffer& input, const Buffer& signature,
+                                                 AuthorizationSet* /* output_params */,
+                                                 Buffer* /* output */) {
+    keymaster_error_t error = UpdateForFinish(additional_params, input);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    EVP_MD_CTX ctx;
+    EVP_MD_CTX_init(&ctx);
+    EvpMdCtxCleaner ctx_cleaner(&ctx);
+    if (EVP_DigestVerifyInit(&ctx, nullptr /* pctx */, nullptr /* type */, nullptr /* engine */,
+                             key_) != 1)
+        return TranslateLastOpenSslError();
+    if (EVP_DigestVerify(&ctx, signature.peek_read(), signature.available_read(),
+                         data_.peek_read(), data_.available_read()) != 1)
+        return KM_ERROR_VERIFICATION_FAILED;
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t X25519AgreeOperation::Finish(const AuthorizationSet& additional_params,
+                                               const Buffer& input, const Buffer& /* signature */,
+                                               AuthorizationSet* /* output_params */,
+                                               Buffer* output) {
+    if (!output)
+        return KM_ERROR_OUTPUT_PARAMETER_NULL;
+
+    keymaster_error_t error = UpdateForFinish(additional_params, input);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    const uint8_t* peer_key_data = data_.peek_read();
+    EVP_PKEY_Ptr peer_key(d2i_PUBKEY(nullptr, &peer_key_data, data_.available_read()));
+    if (!peer_key.get() || EVP_PKEY_id(peer_key.get()) != EVP_PKEY_X25519 ||
+        peer_key_data != data_.peek_read() + data_.available_read())
+        return KM_ERROR_INVALID_ARGUMENT;
+
+    EVP_PKEY_CTX_Ptr ctx(EVP_PKEY_CTX_new(key_, nullptr /* engine */));
+    size_t secret_length;
+    if (!ctx.get() || EVP_PKEY_derive_init(ctx.get()) != 1 ||
+        EVP_PKEY_derive_set_peer(ctx.get(), peer_key.get()) != 1 ||
+        EVP_PKEY_derive(ctx.get(), nullptr /* key */, &secret_length) != 1)
+        return TranslateLastOpenSslError();
+    if (!output->Reinitialize(secret_length))
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    // Fails for small-order peer points, which would make the shared secret all zeros.
+    if (EVP_PKEY_derive(ctx.get(), output->peek_write(), &secret_length) != 1)
+        return KM_ERROR_INVALID_ARGUMENT;
+    if (!output->advance_write(secret_length))
+        return KM_ERROR_UNKNOWN_ERROR;
+    return KM_ERROR_OK;
+}
+
+}  // namespace keymaster
@@ -0,0 +1,202 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <keymaster/km_openssl/drbg_random_source.h>
+
+#include <pthread.h>
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#include <keymaster/android_keymaster_utils.h>
+#include <keymaster/km_openssl/openssl_utils.h>
+
+namespace keymaster {
+
+namespace {
+
+const size_t kSeedSize = 32 /* AES-256 key */ + 16 /* initial counter */;
+
+struct EntropyPool;
+EntropyPool& entropy_pool();
+
+// AddEntropy input, folded into a running digest.  |generation| changes with every addition, and
+// in the child after every fork(), so each thread can tell without locking whether it has to
+// reseed.  Without the fork check, parent and child would hand out the same buffered output.
+struct EntropyPool {
+    EntropyPool() { pthread_atfork(LockForFork, UnlockAfterFork, UnlockInChild); }
+
+    // The pool mutex is held across fork(), so the child never inherits it locked by a thread
+    // that no longer exists.
+    static void LockForFork() { entropy_pool().mutex.lock(); }
+    static void UnlockAfterFork() { entropy_pool().mutex.unlock(); }
+    static void UnlockInChild() {
+        entropy_pool().generation.fetch_add(1, std::memory_order_release);
+        entropy_pool().mutex.unlock();
+    }
+
+    std::mutex mutex;
+    uint8_t digest[SHA256_DIGEST_LENGTH] = {};
+    std::atomic<uint64_t> generation{0};
+};
+
+EntropyPool& entropy_pool() {
+    static EntropyPool pool;
+    return pool;
+}
+
+class ThreadDrbg {
+  public:
+    ThreadDrbg() { EVP_CIPHER_CTX_init(&ctx_); }
+    ~ThreadDrbg() {
+        EVP_CIPHER_CTX_cleanup(&ctx_);
+        memset_s(buffer_, 0, sizeof(buffer_));
+    }
+
+    bool Generate(uint8_t* output, size_t length);
+
+  private:
+    bool NeedsReseed();
+    bool Reseed();
+    bool Keystream(uint8_t* output, size_t length);
+    bool Rekey();
+    bool Refill();
+
+    EVP_CIPHER_CTX ctx_;
+    uint8_t buffer_[DrbgRandomSource::kBufferSize];
+    size_t buffer_used_ = sizeof(buffer_);
+    size_t output_since_reseed_ = 0;
+    uint64_t seen_generation_ = 0;
+    bool seeded_ = false;
+};
+
+bool ThreadDrbg::NeedsReseed() {
+    return !seeded_ || output_since_reseed_ >= DrbgRandomSource::kReseedInterval ||
+           entropy_pool().generation.load(std::memory_order_acquire) != seen_generation_;
+}
+
+bool ThreadDrbg::Reseed() {
+    uint8_t seed[kSeedSize];
+    if (RAND_bytes(seed, sizeof(seed)) != 1)
+        return false;
+    {
+        EntropyPool& pool = entropy_pool();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        for (size_t i = 0; i < sizeof(pool.digest); ++i)
+            seed[i] ^= pool.digest[i];
+        seen_generation_ = pool.generation.load(std::memory_order_relaxed);
+    }
+
+    bool result = EVP_EncryptInit_ex(&ctx_, EVP_aes_256_ctr(), nullptr /* engine */, seed,
+                                     seed + 32) == 1;
+    memset_s(seed, 0, sizeof(seed));
+    if (!result)
+        return false;
+
+    // Anything buffered came from the old seed.
+    memset_s(buffer_, 0, sizeof(buffer_));
+    buffer_used_ = sizeof(buffer_);
+    output_since_reseed_ = 0;
+    seeded_ = true;
+    return true;
+}
+
+bool ThreadDrbg::Keystream(uint8_t* output, size_t length) {
+    memset(output, 0, length);
+    while (length > 0) {
+        // EVP_EncryptUpdate takes an int length.
+        int chunk = static_cast<int>(length < (1U << 30) ? length : (1U << 30));
+        int written;
+        if (EVP_EncryptUpdate(&ctx_, output, &written, output, chunk) != 1 || written != chunk)
+            return false;
+        output += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+bool ThreadDrbg::Rekey() {
+    uint8_t seed[kSeedSize];
+    bool result = Keystream(seed, sizeof(seed)) &&
+                  EVP_EncryptInit_ex(&ctx_, nullptr /* cipher */, nullptr /* engine */, seed,
+                                     seed + 32) == 1;
+    memset_s(seed, 0, sizeof(seed));
+    return result;
+}
+
+bool ThreadDrbg::Refill() {
+    if (!Keystream(buffer_, sizeof(buffer_)) || !Rekey())
+        return false;
+    buffer_used_ = 0;
+    return true;
+}
+
+bool ThreadDrbg::Generate(uint8_t* output, size_t length) {
+    if (NeedsReseed() && !Reseed())
+        return false;
+
+    output_since_reseed_ += length;
+    if (length > sizeof(buffer_))
+        return Keystream(output, length) && Rekey();
+
+    while (length > 0) {
+        if (buffer_used_ == sizeof(buffer_) && !Refill())
+            return false;
+        size_t to_copy = sizeof(buffer_) - buffer_used_;
+        if (to_copy > length)
+            to_copy = length;
+        memcpy(output, buffer_ + buffer_used_, to_copy);
+        memset_s(buffer_ + buffer_used_, 0, to_copy);
+        buffer_used_ += to_copy;
+        output += to_copy;
+        length -= to_copy;
+    }
+    return true;
+}
+
+thread_local ThreadDrbg thread_drbg;
+
+DrbgRandomSource shared_drbg_random_source;
+
+}  // anonymous namespace
+
+keymaster_error_t DrbgRandomSource::GenerateRandom(uint8_t* buffer, size_t length) const {
+    if (!thread_drbg.Generate(buffer, length))
+        return KM_ERROR_UNKNOWN_ERROR;
+    return KM_ERROR_OK;
+}
+
+void DrbgRandomSource::AddEntropy(const uint8_t* data, size_t length) {
+    EntropyPool& pool = entropy_pool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, pool.digest, sizeof(pool.digest));
+    SHA256_Update(&ctx, data, length);
+    SHA256_Final(pool.digest, &ctx);
+    pool.generation.fetch_add(1, std::memory_order_release);
+}
+
+void DrbgRandomSource::InstallForGenerateRandom() {
+    SetGenerateRandomSource(&shared_drbg_random_source);
+}
+
+}  // namespace keymaster
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <keymaster/km_openssl/ec_ephemeral_key_pool.h>
+
+#include <keymaster/logger.h>
+
+namespace keymaster {
+
+EcEphemeralKeyPool::EcEphemeralKeyPool(size_t keys_per_curve, bool background_refill)
+    : keys_per_curve_(keys_per_curve) {
+    for (auto& keys : keys_)
+        keys.reserve(keys_per_curve_);
+    if (background_refill) refill_thread_ = std::thread(&EcEphemeralKeyPool::RefillLoop, this);
+}
+
+EcEphemeralKeyPool::~EcEphemeralKeyPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    refill_needed_.notify_one();
+    if (refill_thread_.joinable()) refill_thread_.join();
+}
+
+NistCurveKeyExchange* EcEphemeralKeyPool::TakeKeyExchange(keymaster_ec_curve_t curve) {
+    if (static_cast<size_t>(curve) >= kNumCurves) {
+        LOG_E("Not a NIST curve: %d", curve);
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stocked_[curve] = true;
+        auto& keys = keys_[curve];
+        if (!keys.empty()) {
+            NistCurveKeyExchange* key = keys.back().release();
+            keys.pop_back();
+            refill_needed_.notify_one();
+            return key;
+        }
+    }
+
+    // Pool ran dry; don't make the caller wait behind the refill thread.
+    refill_needed_.notify_one();
+    return NistCurveKeyExchange::GenerateKeyExchange(curve);
+}
+
+size_t EcEphemeralKeyPool::available(keymaster_ec_curve_t curve) const {
+    if (static_cast<size_t>(curve) >= kNumCurves) return 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    return keys_[curve].size();
+}
+
+bool EcEphemeralKeyPool::Refill(keymaster_ec_curve_t curve) {
+    if (static_cast<size_t>(curve) >= kNumCurves) {
+        LOG_E("Not a NIST curve: %d", curve);
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    stocked_[curve] = true;
+    while (keys_[curve].size() < keys_per_curve_) {
+        lock.unlock();
+        std::unique_ptr<NistCurveKeyExchange> key(NistCurveKeyExchange::GenerateKeyExchange(curve));
+        lock.lock();
+        if (!key) return false;
+        if (keys_[curve].size() < keys_per_curve_) keys_[curve].push_back(std::move(key));
+    }
+    return true;
+}
+
+bool EcEphemeralKeyPool::FindCurveToRefill(size_t* curve_index) const {
+    for (size_t i = 0; i < kNumCurves; ++i) {
+        if (stocked_[i] && keys_[i].size() < keys_per_curve_) {
+            *curve_index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void EcEphemeralKeyPool::RefillLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        size_t curve_index;
+        if (!FindCurveToRefill(&curve_index)) {
+            refill_needed_.wait(lock);
+            continue;
+        }
+
+        // Generate without holding the lock, so takers aren't blocked behind a scalar multiply.
+        lock.unlock();
+        std::unique_ptr<NistCurveKeyExchange> key(NistCurveKeyExchange::GenerateKeyExchange(
+            static_cast<keymaster_ec_curve_t>(curve_index)));
+        lock.lock();
+
+        if (!key) {
+            // Don't spin on a persistent failure; try again on the next take.
+            LOG_E("Failed to generate ephemeral key for curve %zu", curve_index);
+            stocked_[curve_index] = false;
+            continue;
+        }
+        if (keys_[curve_index].size() < keys_per_curve_)
+            keys_[curve_index].push_back(std::move(key));
+    }
+}
+
+}  // namespace keymaster
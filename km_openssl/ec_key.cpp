@@ -16,6 +16,8 @@
 
 #include <keymaster/km_openssl/ec_key.h>
 
+#include <keymaster/km_openssl/openssl_err.h>
+
 #if defined(OPENSSL_IS_BORINGSSL)
 typedef size_t openssl_size_t;
 #else
@@ -25,12 +27,49 @@ typedef int openssl_size_t;
 namespace keymaster {
 
 bool EcKey::EvpToInternal(const EVP_PKEY* pkey) {
+    precomputed_pkey_.reset();
     ec_key_.reset(EVP_PKEY_get1_EC_KEY(const_cast<EVP_PKEY*>(pkey)));
     return ec_key_.get() != nullptr;
 }
 
-bool EcKey::InternalToEvp(EVP_PKEY* pkey) const {
-    return EVP_PKEY_set1_EC_KEY(pkey, ec_key_.get()) == 1;
+keymaster_error_t EcKey::PrecomputeSigningState() {
+    if (!key())
+        return KM_ERROR_UNEXPECTED_NULL_POINTER;
+    if (precomputed_pkey_.get())
+        return KM_ERROR_OK;
+
+#if !defined(OPENSSL_IS_BORINGSSL)
+    // OpenSSL keeps the generator table in the key's own copy of the group.
+    if (!EC_KEY_precompute_mult(ec_key_.get(), nullptr /* ctx */))
+        return TranslateLastOpenSslError();
+#endif
+    // BoringSSL's built-in NIST groups already carry static generator tables, which every key on
+    // the curve shares, so there is nothing more to compute per key.
+
+    EVP_PKEY_Ptr pkey(EVP_PKEY_new());
+    if (!pkey.get())
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    if (!InternalToEvp(pkey.get()))
+        return TranslateLastOpenSslError();
+
+    precomputed_pkey_.reset(pkey.release());
+    return KM_ERROR_OK;
+}
+
+void EcKey::ShareOperationState(Key* source) {
+    if (!precompute_signing_ || !authorizations().Contains(TAG_PURPOSE, KM_PURPOSE_SIGN))
+        return;
+
+    // |source| was built by the same factory from the same key material, so it's an EcKey too.
+    EcKey* ec_source = static_cast<EcKey*>(source);
+    if (ec_source->PrecomputeSigningState() != KM_ERROR_OK)
+        return;
+    EVP_PKEY_up_ref(ec_source->precomputed_pkey());
+    precomputed_pkey_.reset(ec_source->precomputed_pkey());
+}
+
+bool EcKey::CopyInternalToEvp(EVP_PKEY* pkey) const {
+    return ec_key_.get() && EVP_PKEY_set1_EC_KEY(pkey, ec_key_.get()) == 1;
 }
 
 }  // namespace keymaster
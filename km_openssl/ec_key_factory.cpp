@@ -18,9 +18,12 @@
 
 #include <openssl/evp.h>
 
+#include <keymaster/km_openssl/curve25519_key.h>
+#include <keymaster/km_openssl/curve25519_operation.h>
 #include <keymaster/km_openssl/ec_key.h>
 #include <keymaster/km_openssl/ecdsa_operation.h>
 #include <keymaster/km_openssl/openssl_err.h>
+#include <keymaster/km_openssl/openssl_utils.h>
 
 #include <keymaster/operation.h>
 
@@ -28,6 +31,40 @@ namespace keymaster {
 
 static EcdsaSignOperationFactory sign_factory;
 static EcdsaVerifyOperationFactory verify_factory;
+static Ed25519SignOperationFactory ed25519_sign_factory;
+static Ed25519VerifyOperationFactory ed25519_verify_factory;
+static X25519AgreeOperationFactory x25519_agree_factory;
+
+static bool is_curve25519_key(const AuthProxy& authorizations) {
+    return authorizations.Contains(TAG_EC_CURVE, KM_EC_CURVE_CURVE_25519);
+}
+
+/**
+ * Curve25519 keys are either for signing or for key agreement; the purposes decide which.
+ */
+static keymaster_error_t GetCurve25519KeyType(const AuthorizationSet& authorizations,
+                                              int* evp_key_type) {
+    bool agree = authorizations.Contains(TAG_PURPOSE, KM_PURPOSE_AGREE_KEY);
+    bool sign = authorizations.Contains(TAG_PURPOSE, KM_PURPOSE_SIGN) ||
+                authorizations.Contains(TAG_PURPOSE, KM_PURPOSE_VERIFY);
+    if (agree == sign) {
+        LOG_E("%s", "Curve25519 keys must be either signing or key agreement keys");
+        return KM_ERROR_INCOMPATIBLE_PURPOSE;
+    }
+    *evp_key_type = agree ? EVP_PKEY_X25519 : EVP_PKEY_ED25519;
+    return KM_ERROR_OK;
+}
+
+static keymaster_error_t GenerateCurve25519KeyMaterial(int evp_key_type,
+                                                       KeymasterKeyBlob* key_material) {
+    EVP_PKEY_CTX_Ptr ctx(EVP_PKEY_CTX_new_id(evp_key_type, nullptr /* engine */));
+    EVP_PKEY* raw_pkey = nullptr;
+    if (!ctx.get() || EVP_PKEY_keygen_init(ctx.get()) != 1 ||
+        EVP_PKEY_keygen(ctx.get(), &raw_pkey) != 1)
+        return TranslateLastOpenSslError();
+    EVP_PKEY_Ptr pkey(raw_pkey);
+    return EvpKeyToKeyMaterial(pkey.get(), key_material);
+}
 
 OperationFactory* EcKeyFactory::GetOperationFactory(keymaster_purpose_t purpose) const {
     switch (purpose) {
@@ -40,6 +77,32 @@ OperationFactory* EcKeyFactory::GetOperationFactory(keymaster_purpose_t purpose)
     }
 }
 
+OperationFactory* EcKeyFactory::GetOperationFactoryForKey(const Key& key,
+                                                          keymaster_purpose_t purpose) const {
+    if (!is_curve25519_key(key.authorizations())) {
+        if (purpose == KM_PURPOSE_AGREE_KEY)
+            return nullptr;
+        return GetOperationFactory(purpose);
+    }
+
+    // Curve25519Key doesn't hold an EC_KEY, so it never gets ECDSA operations.  Creating the
+    // operation checks that the key is of the right kind for the purpose.
+    if (purpose == KM_PURPOSE_SIGN)
+        return &ed25519_sign_factory;
+    if (purpose == KM_PURPOSE_VERIFY)
+        return &ed25519_verify_factory;
+    if (purpose == KM_PURPOSE_AGREE_KEY)
+        return &x25519_agree_factory;
+    return nullptr;
+}
+
+int EcKeyFactory::key_material_type(const AsymmetricKey& key) const {
+    if (!is_curve25519_key(key.authorizations()))
+        return evp_key_type();
+    return key.authorizations().Contains(TAG_PURPOSE, KM_PURPOSE_AGREE_KEY) ? EVP_PKEY_X25519
+                                                                            : EVP_PKEY_ED25519;
+}
+
 /* static */
 keymaster_error_t EcKeyFactory::GetCurveAndSize(const AuthorizationSet& key_description,
                                                 keymaster_ec_curve_t* curve,
@@ -91,23 +154,30 @@ keymaster_error_t EcKeyFactory::GenerateKey(const AuthorizationSet& key_descript
         authorizations.push_back(TAG_EC_CURVE, ec_curve);
     }
 
+    if (ec_curve == KM_EC_CURVE_CURVE_25519) {
+        int evp_key_type;
+        KeymasterKeyBlob key_material;
+        error = GetCurve25519KeyType(authorizations, &evp_key_type);
+        if (error == KM_ERROR_OK)
+            error = GenerateCurve25519KeyMaterial(evp_key_type, &key_material);
+        if (error != KM_ERROR_OK)
+            return error;
+        return blob_maker_.CreateKeyBlob(authorizations, KM_ORIGIN_GENERATED, key_material,
+                                         key_blob, hw_enforced, sw_enforced);
+    }
+
     UniquePtr<EC_KEY, EC_KEY_Delete> ec_key(EC_KEY_new());
     UniquePtr<EVP_PKEY, EVP_PKEY_Delete> pkey(EVP_PKEY_new());
     if (ec_key.get() == nullptr || pkey.get() == nullptr)
         return KM_ERROR_MEMORY_ALLOCATION_FAILED;
 
-    UniquePtr<EC_GROUP, EC_GROUP_Delete> group(ChooseGroup(ec_curve));
-    if (group.get() == nullptr) {
+    const EC_GROUP* group = ChooseGroup(ec_curve);
+    if (group == nullptr) {
         LOG_E("Unable to get EC group for curve %d", ec_curve);
         return KM_ERROR_UNSUPPORTED_KEY_SIZE;
     }
 
-#if !defined(OPENSSL_IS_BORINGSSL)
-    EC_GROUP_set_point_conversion_form(group.get(), POINT_CONVERSION_UNCOMPRESSED);
-    EC_GROUP_set_asn1_flag(group.get(), OPENSSL_EC_NAMED_CURVE);
-#endif
-
-    if (EC_KEY_set_group(ec_key.get(), group.get()) != 1 ||
+    if (EC_KEY_set_group(ec_key.get(), group) != 1 ||
         EC_KEY_generate_key(ec_key.get()) != 1 || EC_KEY_check_key(ec_key.get()) < 0) {
         return TranslateLastOpenSslError();
     }
@@ -158,6 +228,10 @@ keymaster_error_t EcKeyFactory::UpdateImportKeyDescription(const AuthorizationSe
     if (error != KM_ERROR_OK)
         return error;
 
+    if (is_curve25519_evp_type(EVP_PKEY_id(pkey.get())))
+        return UpdateCurve25519ImportKeyDescription(key_description, EVP_PKEY_id(pkey.get()),
+                                                    updated_description, key_size_bits);
+
     UniquePtr<EC_KEY, EC_KEY_Delete> ec_key(EVP_PKEY_get1_EC_KEY(pkey.get()));
     if (!ec_key.get())
         return TranslateLastOpenSslError();
@@ -198,51 +272,75 @@ keymaster_error_t EcKeyFactory::UpdateImportKeyDescription(const AuthorizationSe
 }
 
 /* static */
-EC_GROUP* EcKeyFactory::ChooseGroup(size_t key_size_bits) {
+const EC_GROUP* EcKeyFactory::ChooseGroup(size_t key_size_bits) {
     switch (key_size_bits) {
     case 224:
-        return EC_GROUP_new_by_curve_name(NID_secp224r1);
-        break;
+        return ec_get_shared_group(KM_EC_CURVE_P_224);
     case 256:
-        return EC_GROUP_new_by_curve_name(NID_X9_62_prime256v1);
-        break;
+        return ec_get_shared_group(KM_EC_CURVE_P_256);
     case 384:
-        return EC_GROUP_new_by_curve_name(NID_secp384r1);
-        break;
+        return ec_get_shared_group(KM_EC_CURVE_P_384);
     case 521:
-        return EC_GROUP_new_by_curve_name(NID_secp521r1);
-        break;
+        return ec_get_shared_group(KM_EC_CURVE_P_521);
     default:
         return nullptr;
-        break;
     }
 }
 
 /* static */
-EC_GROUP* EcKeyFactory::ChooseGroup(keymaster_ec_curve_t ec_curve) {
-    switch (ec_curve) {
-    case KM_EC_CURVE_P_224:
-        return EC_GROUP_new_by_curve_name(NID_secp224r1);
-        break;
-    case KM_EC_CURVE_P_256:
-        return EC_GROUP_new_by_curve_name(NID_X9_62_prime256v1);
-        break;
-    case KM_EC_CURVE_P_384:
-        return EC_GROUP_new_by_curve_name(NID_secp384r1);
-        break;
-    case KM_EC_CURVE_P_521:
-        return EC_GROUP_new_by_curve_name(NID_secp521r1);
-        break;
-    default:
-        return nullptr;
-        break;
+const EC_GROUP* EcKeyFactory::ChooseGroup(keymaster_ec_curve_t ec_curve) {
+    return ec_get_shared_group(ec_curve);
+}
+
+/* static */
+keymaster_error_t EcKeyFactory::UpdateCurve25519ImportKeyDescription(
+    const AuthorizationSet& key_description, int evp_key_type,
+    AuthorizationSet* updated_description, uint32_t* key_size_bits) {
+    updated_description->Reinitialize(key_description);
+
+    *key_size_bits = 256;
+    uint32_t key_size;
+    if (!updated_description->GetTagValue(TAG_KEY_SIZE, &key_size)) {
+        updated_description->push_back(TAG_KEY_SIZE, *key_size_bits);
+    } else if (key_size != *key_size_bits) {
+        return KM_ERROR_IMPORT_PARAMETER_MISMATCH;
+    }
+
+    keymaster_ec_curve_t curve;
+    if (!updated_description->GetTagValue(TAG_EC_CURVE, &curve)) {
+        updated_description->push_back(TAG_EC_CURVE, KM_EC_CURVE_CURVE_25519);
+    } else if (curve != KM_EC_CURVE_CURVE_25519) {
+        return KM_ERROR_IMPORT_PARAMETER_MISMATCH;
+    }
+
+    int expected_evp_key_type;
+    keymaster_error_t error = GetCurve25519KeyType(*updated_description, &expected_evp_key_type);
+    if (error != KM_ERROR_OK)
+        return error;
+    if (expected_evp_key_type != evp_key_type)
+        return KM_ERROR_INCOMPATIBLE_PURPOSE;
+
+    keymaster_algorithm_t algorithm = KM_ALGORITHM_EC;
+    if (!updated_description->GetTagValue(TAG_ALGORITHM, &algorithm)) {
+        updated_description->push_back(TAG_ALGORITHM, KM_ALGORITHM_EC);
+    } else if (algorithm != KM_ALGORITHM_EC) {
+        return KM_ERROR_IMPORT_PARAMETER_MISMATCH;
     }
+
+    return KM_ERROR_OK;
 }
 
 keymaster_error_t EcKeyFactory::CreateEmptyKey(AuthorizationSet&& hw_enforced,
                                                AuthorizationSet&& sw_enforced,
                                                UniquePtr<AsymmetricKey>* key) const {
-    key->reset(new (std::nothrow) EcKey(move(hw_enforced), move(sw_enforced), this));
+    if (is_curve25519_key(AuthProxy(hw_enforced, sw_enforced)))
+        key->reset(new (std::nothrow) Curve25519Key(move(hw_enforced), move(sw_enforced), this));
+    else {
+        EcKey* ec_key = new (std::nothrow) EcKey(move(hw_enforced), move(sw_enforced), this);
+        if (ec_key)
+            ec_key->set_precompute_signing(precompute_signing_);
+        key->reset(ec_key);
+    }
     if (!(*key)) return KM_ERROR_MEMORY_ALLOCATION_FAILED;
     return KM_ERROR_OK;
 }
@@ -32,10 +32,20 @@ OperationPtr EcdsaOperationFactory::CreateOperation(Key&& key, const Authorizati
                                                     keymaster_error_t* error) const {
     const EcKey& ecdsa_key = static_cast<EcKey&>(key);
 
-    UniquePtr<EVP_PKEY, EVP_PKEY_Delete> pkey(EVP_PKEY_new());
-    if (!ecdsa_key.InternalToEvp(pkey.get())) {
-        *error = KM_ERROR_UNKNOWN_ERROR;
-        return nullptr;
+    UniquePtr<EVP_PKEY, EVP_PKEY_Delete> pkey;
+    if (ecdsa_key.precomputed_pkey()) {
+        // Share the key's prepared EVP_PKEY rather than building a new one.
+        pkey.reset(ecdsa_key.precomputed_pkey());
+        EVP_PKEY_up_ref(pkey.get());
+    } else {
+        // Verification only needs the public key.
+        pkey.reset(EVP_PKEY_new());
+        bool converted = purpose() == KM_PURPOSE_VERIFY ? ecdsa_key.PublicKeyToEvp(pkey.get())
+                                                        : ecdsa_key.InternalToEvp(pkey.get());
+        if (!converted) {
+            *error = KM_ERROR_INVALID_KEY_BLOB;
+            return nullptr;
+        }
     }
 
     keymaster_digest_t digest;
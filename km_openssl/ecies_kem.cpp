@@ -21,7 +21,12 @@
 
 namespace keymaster {
 
-EciesKem::EciesKem(const AuthorizationSet& kem_description, keymaster_error_t* error) {
+EciesKem::EciesKem(const AuthorizationSet& kem_description, keymaster_error_t* error)
+    : EciesKem(kem_description, nullptr /* ephemeral_keys */, error) {}
+
+EciesKem::EciesKem(const AuthorizationSet& kem_description,
+                   NistCurveKeyExchangeSource* ephemeral_keys, keymaster_error_t* error)
+    : ephemeral_keys_(ephemeral_keys) {
     const AuthorizationSet& authorizations(kem_description);
 
     if (!authorizations.GetTagValue(TAG_EC_CURVE, &curve_)) {
@@ -82,7 +87,10 @@ bool EciesKem::Encrypt(const Buffer& peer_public_value, Buffer* output_clear_key
 bool EciesKem::Encrypt(const uint8_t* peer_public_value, size_t peer_public_value_len,
                        Buffer* output_clear_key, Buffer* output_encrypted_key) {
 
-    key_exchange_.reset(NistCurveKeyExchange::GenerateKeyExchange(curve_));
+    if (ephemeral_keys_)
+        key_exchange_.reset(ephemeral_keys_->TakeKeyExchange(curve_));
+    else
+        key_exchange_.reset(NistCurveKeyExchange::GenerateKeyExchange(curve_));
     if (!key_exchange_.get()) {
         return false;
     }
@@ -16,16 +16,20 @@
 
 #include <keymaster/km_openssl/hkdf.h>
 
+#include <openssl/sha.h>
+
 #include <keymaster/android_keymaster_utils.h>
 #include <keymaster/km_openssl/hmac.h>
 #include <keymaster/new>
 
 namespace keymaster {
 
-bool Rfc5869Sha256Kdf::GenerateKey(const uint8_t* info, size_t info_len, uint8_t* output,
-                                   size_t output_len) {
-    if (!is_initialized_ || output == nullptr)
+bool Rfc5869Sha256Kdf::Init(const uint8_t* secret, size_t secret_len, const uint8_t* salt,
+                            size_t salt_len) {
+    if (!Kdf::Init(KM_DIGEST_SHA_2_256, secret, secret_len, salt, salt_len))
         return false;
+    is_initialized_ = false;
+
     /**
      * Step 1. Extract: PRK = HMAC-SHA256(actual_salt, secret)
      * https://tools.ietf.org/html/rfc5869#section-2.2
@@ -35,22 +39,26 @@ bool Rfc5869Sha256Kdf::GenerateKey(const uint8_t* info, size_t info_len, uint8_t
     if (salt_.get() != nullptr && salt_len_ > 0) {
         result = prk_hmac.Init(salt_.get(), salt_len_);
     } else {
-        UniquePtr<uint8_t[]> zeros(new(std::nothrow) uint8_t[digest_size_]);
-        if (zeros.get() == nullptr)
-            return false;
         /* If salt is not given, digest size of zeros are used. */
-        memset(zeros.get(), 0, digest_size_);
-        result = prk_hmac.Init(zeros.get(), digest_size_);
+        uint8_t zeros[SHA256_DIGEST_LENGTH] = {};
+        result = prk_hmac.Init(zeros, digest_size_);
     }
-    if (!result)
+    if (!result || digest_size_ != prk_hmac.DigestLength())
         return false;
 
-    UniquePtr<uint8_t[]> pseudo_random_key(new(std::nothrow) uint8_t[digest_size_]);
-    if (pseudo_random_key.get() == nullptr || digest_size_ != prk_hmac.DigestLength())
+    uint8_t pseudo_random_key[SHA256_DIGEST_LENGTH];
+    Eraser prk_eraser(pseudo_random_key);
+    if (!prk_hmac.Sign(secret_key_.get(), secret_key_len_, pseudo_random_key, digest_size_) ||
+        !expand_hmac_.Init(pseudo_random_key, digest_size_))
         return false;
-    result =
-        prk_hmac.Sign(secret_key_.get(), secret_key_len_, pseudo_random_key.get(), digest_size_);
-    if (!result)
+
+    is_initialized_ = true;
+    return true;
+}
+
+bool Rfc5869Sha256Kdf::GenerateKey(const uint8_t* info, size_t info_len, uint8_t* output,
+                                   size_t output_len) {
+    if (!is_initialized_ || output == nullptr)
         return false;
 
     /**
@@ -61,32 +69,22 @@ bool Rfc5869Sha256Kdf::GenerateKey(const uint8_t* info, size_t info_len, uint8_t
     if (num_blocks >= 256u)
         return false;
 
-    UniquePtr<uint8_t[]> buf(new(std::nothrow) uint8_t[digest_size_ + info_len + 1]);
-    UniquePtr<uint8_t[]> digest(new(std::nothrow) uint8_t[digest_size_]);
-    if (buf.get() == nullptr || digest.get() == nullptr)
-        return false;
-    HmacSha256 hmac;
-    result = hmac.Init(pseudo_random_key.get(), digest_size_);
-    if (!result)
-        return false;
-
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    Eraser digest_eraser(digest);
     for (size_t i = 0; i < num_blocks; i++) {
-        size_t block_input_len = 0;
-        if (i != 0) {
-            memcpy(buf.get(), digest.get(), digest_size_);
-            block_input_len = digest_size_;
-        }
-        if (info != nullptr && info_len > 0)
-            memcpy(buf.get() + block_input_len, info, info_len);
-        block_input_len += info_len;
-        *(buf.get() + block_input_len++) = static_cast<uint8_t>(i + 1);
-        result = hmac.Sign(buf.get(), block_input_len, digest.get(), digest_size_);
-        if (!result)
+        // T(i) = HMAC-SHA256(PRK, T(i - 1) || info || i), with T(0) empty.
+        uint8_t counter = static_cast<uint8_t>(i + 1);
+        keymaster_blob_t block_input[] = {
+            {digest, i == 0 ? 0 : digest_size_},
+            {info, info != nullptr ? info_len : 0},
+            {&counter, sizeof(counter)},
+        };
+        if (!expand_hmac_.Sign(block_input, array_length(block_input), digest, digest_size_))
             return false;
         size_t block_output_len = digest_size_ < output_len - i * digest_size_
                                       ? digest_size_
                                       : output_len - i * digest_size_;
-        memcpy(output + i * digest_size_, digest.get(), block_output_len);
+        memcpy(output + i * digest_size_, digest, block_output_len);
     }
     return true;
 }
@@ -27,6 +27,27 @@
 
 namespace keymaster {
 
+namespace {
+
+class HmacCleanup {
+  public:
+    explicit HmacCleanup(HMAC_CTX* ctx) : ctx_(ctx) {}
+    ~HmacCleanup() { HMAC_CTX_cleanup(ctx_); }
+
+  private:
+    HMAC_CTX* ctx_;
+};
+
+}  // anonymous namespace
+
+HmacSha256::HmacSha256() : initialized_(false) {
+    HMAC_CTX_init(&ctx_);
+}
+
+HmacSha256::~HmacSha256() {
+    HMAC_CTX_cleanup(&ctx_);
+}
+
 size_t HmacSha256::DigestLength() const {
     return SHA256_DIGEST_LENGTH;
 }
@@ -39,12 +60,8 @@ bool HmacSha256::Init(const uint8_t* key, size_t key_len) {
     if (!key)
         return false;
 
-    key_len_ = key_len;
-    key_.reset(dup_buffer(key, key_len));
-    if (!key_.get()) {
-        return false;
-    }
-    return true;
+    initialized_ = HMAC_Init_ex(&ctx_, key, key_len, EVP_sha256(), nullptr /* engine */);
+    return initialized_;
 }
 
 bool HmacSha256::Sign(const Buffer& data, uint8_t* out_digest, size_t digest_len) const {
@@ -53,18 +70,44 @@ bool HmacSha256::Sign(const Buffer& data, uint8_t* out_digest, size_t digest_len
 
 bool HmacSha256::Sign(const uint8_t* data, size_t data_len, uint8_t* out_digest,
                       size_t digest_len) const {
+    keymaster_blob_t data_chunk = {data, data_len};
+    return Sign(&data_chunk, 1 /* num_chunks */, out_digest, digest_len);
+}
+
+bool HmacSha256::Sign(const keymaster_blob_t* data_chunks, size_t num_chunks,
+                      uint8_t* out_digest, size_t digest_len) const {
     assert(digest_len);
 
+    if (!initialized_)
+        return false;
+
+    // Start from a copy of the keyed state, so the key schedule isn't recomputed per message.
+    HMAC_CTX ctx;
+    HMAC_CTX_init(&ctx);
+    HmacCleanup cleanup(&ctx);
+    if (!HMAC_CTX_copy_ex(&ctx, &ctx_))
+        return false;
+
+    for (size_t i = 0; i < num_chunks; ++i) {
+        if (data_chunks[i].data_length == 0)
+            continue;
+        if (!HMAC_Update(&ctx, data_chunks[i].data, data_chunks[i].data_length))
+            return false;
+    }
+
     uint8_t tmp[SHA256_DIGEST_LENGTH];
     uint8_t* digest = tmp;
     if (digest_len >= SHA256_DIGEST_LENGTH)
         digest = out_digest;
 
-    if (nullptr == ::HMAC(EVP_sha256(), key_.get(), key_len_, data, data_len, digest, nullptr)) {
+    unsigned int out_len;
+    if (!HMAC_Final(&ctx, digest, &out_len))
         return false;
-    }
-    if (digest_len < SHA256_DIGEST_LENGTH)
+
+    if (digest_len < SHA256_DIGEST_LENGTH) {
         memcpy(out_digest, tmp, digest_len);
+        memset_s(tmp, 0, sizeof(tmp));
+    }
 
     return true;
 }
@@ -24,6 +24,7 @@
 #include <keymaster/km_openssl/hmac_key.h>
 #include <keymaster/km_openssl/openssl_err.h>
 #include <keymaster/km_openssl/openssl_utils.h>
+#include <keymaster/km_openssl/symmetric_key.h>
 
 #if defined(OPENSSL_IS_BORINGSSL)
 #include <openssl/mem.h>
@@ -131,7 +132,12 @@ HmacOperation::HmacOperation(Key&& key, keymaster_purpose_t purpose, keymaster_d
         }
     }
 
+    // HMAC keys are SymmetricKeys.  If this one shares keyed contexts, copying one saves hashing
+    // the key.
+    KeyedContextTemplates* templates = static_cast<SymmetricKey&>(key).context_templates();
     KeymasterKeyBlob blob = key.key_material_move();
+    const HMAC_CTX* keyed_ctx = templates ? templates->HmacContext(md, blob) : nullptr;
+    if (keyed_ctx && HMAC_CTX_copy(&ctx_, keyed_ctx)) return;
     HMAC_Init_ex(&ctx_, blob.key_material, blob.key_material_size, md, nullptr /* engine */);
 }
 
@@ -191,4 +197,12 @@ keymaster_error_t HmacOperation::Finish(const AuthorizationSet& additional_param
     }
 }
 
+keymaster_error_t HmacOperation::Restart() {
+    // With no key or digest, HMAC_Init_ex reuses the ones already in the context.
+    if (!HMAC_Init_ex(&ctx_, nullptr /* key */, 0 /* key_len */, nullptr /* md */,
+                      nullptr /* engine */))
+        return TranslateLastOpenSslError();
+    return error_;
+}
+
 }  // namespace keymaster
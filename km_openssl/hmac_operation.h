@@ -37,6 +37,7 @@ class HmacOperation : public Operation {
     virtual keymaster_error_t Finish(const AuthorizationSet& additional_params, const Buffer& input,
                                      const Buffer& signature, AuthorizationSet* output_params,
                                      Buffer* output);
+    virtual keymaster_error_t Restart();
 
     keymaster_error_t error() { return error_; }
 
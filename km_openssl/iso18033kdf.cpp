@@ -26,6 +26,39 @@ inline size_t min(size_t a, size_t b) {
     return (a < b) ? a : b;
 }
 
+Iso18033Kdf::Iso18033Kdf(uint32_t start_counter) : start_counter_(start_counter) {
+    EVP_MD_CTX_init(&secret_ctx_);
+}
+
+Iso18033Kdf::~Iso18033Kdf() {
+    EVP_MD_CTX_cleanup(&secret_ctx_);
+}
+
+bool Iso18033Kdf::Init(keymaster_digest_t digest_type, const uint8_t* secret, size_t secret_len) {
+    if (!Kdf::Init(digest_type, secret, secret_len, nullptr /* salt */, 0 /* salt_len */))
+        return false;
+    is_initialized_ = false;
+
+    const EVP_MD* md;
+    switch (digest_type_) {
+    case KM_DIGEST_SHA1:
+        md = EVP_sha1();
+        break;
+    case KM_DIGEST_SHA_2_256:
+        md = EVP_sha256();
+        break;
+    default:
+        return false;
+    }
+
+    if (!EVP_DigestInit_ex(&secret_ctx_, md, nullptr /* default digest */) ||
+        !EVP_DigestUpdate(&secret_ctx_, secret_key_.get(), secret_key_len_))
+        return false;
+
+    is_initialized_ = true;
+    return true;
+}
+
 bool Iso18033Kdf::GenerateKey(const uint8_t* info, size_t info_len, uint8_t* output,
                               size_t output_len) {
     if (!is_initialized_ || output == nullptr) return false;
@@ -38,24 +71,13 @@ bool Iso18033Kdf::GenerateKey(const uint8_t* info, size_t info_len, uint8_t* out
     EVP_MD_CTX_init(&ctx);
 
     size_t num_blocks = (output_len + digest_size_ - 1) / digest_size_;
-    UniquePtr<uint8_t[]> counter(new (std::nothrow) uint8_t[4]);
-    UniquePtr<uint8_t[]> digest_result(new (std::nothrow) uint8_t[digest_size_]);
-    if (!counter.get() || !digest_result.get()) return false;
+    uint8_t counter[4];
+    uint8_t digest_result[EVP_MAX_MD_SIZE];
+    Eraser digest_eraser(digest_result);
     for (size_t block = 0; block < num_blocks; block++) {
-        switch (digest_type_) {
-        case KM_DIGEST_SHA1:
-            if (!EVP_DigestInit_ex(&ctx, EVP_sha1(), nullptr /* default digest */)) return false;
-            break;
-        case KM_DIGEST_SHA_2_256:
-            if (!EVP_DigestInit_ex(&ctx, EVP_sha256(), nullptr /* default digest */)) return false;
-            break;
-        default:
-            return false;
-        }
-
-        if (!EVP_DigestUpdate(&ctx, secret_key_.get(), secret_key_len_) ||
-            !Uint32ToBigEndianByteArray(block + start_counter_, counter.get()) ||
-            !EVP_DigestUpdate(&ctx, counter.get(), 4))
+        if (!EVP_MD_CTX_copy_ex(&ctx, &secret_ctx_) ||
+            !Uint32ToBigEndianByteArray(block + start_counter_, counter) ||
+            !EVP_DigestUpdate(&ctx, counter, sizeof(counter)))
             return false;
 
         if (info != nullptr && info_len > 0) {
@@ -64,13 +86,13 @@ bool Iso18033Kdf::GenerateKey(const uint8_t* info, size_t info_len, uint8_t* out
 
         /* OpenSSL does not accept size_t parameter. */
         uint32_t uint32_digest_size_ = digest_size_;
-        if (!EVP_DigestFinal_ex(&ctx, digest_result.get(), &uint32_digest_size_) ||
+        if (!EVP_DigestFinal_ex(&ctx, digest_result, &uint32_digest_size_) ||
             uint32_digest_size_ != digest_size_)
             return false;
 
         size_t block_start = digest_size_ * block;
         size_t block_length = min(digest_size_, output_len - block_start);
-        memcpy(output + block_start, digest_result.get(), block_length);
+        memcpy(output + block_start, digest_result, block_length);
     }
     return true;
 }
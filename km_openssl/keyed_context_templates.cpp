@@ -0,0 +1,107 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <keymaster/km_openssl/keyed_context_templates.h>
+
+#include <keymaster/new>
+
+namespace keymaster {
+
+KeyedContextTemplates* KeyedContextTemplates::New() {
+    return new (std::nothrow) KeyedContextTemplates;
+}
+
+KeyedContextTemplates::~KeyedContextTemplates() {
+    for (size_t i = 0; i < kCipherSlots; ++i)
+        if (cipher_ctxs_[i]) EVP_CIPHER_CTX_free(cipher_ctxs_[i]);
+    delete hmac_;
+}
+
+void KeyedContextTemplates::AddRef() {
+    __atomic_add_fetch(&ref_count_, 1, __ATOMIC_RELAXED);
+}
+
+void KeyedContextTemplates::Release() {
+    if (__atomic_sub_fetch(&ref_count_, 1, __ATOMIC_ACQ_REL) == 0) delete this;
+}
+
+int KeyedContextTemplates::CipherSlot(keymaster_block_mode_t block_mode, bool encrypt) {
+    int mode_index;
+    switch (block_mode) {
+    case KM_MODE_ECB:
+        mode_index = 0;
+        break;
+    case KM_MODE_CBC:
+        mode_index = 1;
+        break;
+    case KM_MODE_CTR:
+        mode_index = 2;
+        break;
+    case KM_MODE_GCM:
+        mode_index = 3;
+        break;
+    default:
+        return -1;
+    }
+    return mode_index * 2 + (encrypt ? 1 : 0);
+}
+
+const EVP_CIPHER_CTX* KeyedContextTemplates::CipherContext(const EVP_CIPHER* cipher,
+                                                           keymaster_block_mode_t block_mode,
+                                                           bool encrypt,
+                                                           const KeymasterKeyBlob& key) {
+    int slot = CipherSlot(block_mode, encrypt);
+    if (slot < 0) return nullptr;
+
+    EVP_CIPHER_CTX* ctx = __atomic_load_n(&cipher_ctxs_[slot], __ATOMIC_ACQUIRE);
+    if (ctx) return ctx;
+
+    ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) return nullptr;
+    if (!EVP_CipherInit_ex(ctx, cipher, nullptr /* engine */, key.key_material, nullptr /* iv */,
+                           encrypt ? 1 : 0)) {
+        EVP_CIPHER_CTX_free(ctx);
+        return nullptr;
+    }
+
+    // If another thread got there first, use its context.
+    EVP_CIPHER_CTX* installed = nullptr;
+    if (!__atomic_compare_exchange_n(&cipher_ctxs_[slot], &installed, ctx, false /* weak */,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        EVP_CIPHER_CTX_free(ctx);
+        return installed;
+    }
+    return ctx;
+}
+
+const HMAC_CTX* KeyedContextTemplates::HmacContext(const EVP_MD* md, const KeymasterKeyBlob& key) {
+    HmacTemplate* hmac = __atomic_load_n(&hmac_, __ATOMIC_ACQUIRE);
+    if (!hmac) {
+        UniquePtr<HmacTemplate> new_hmac(new (std::nothrow) HmacTemplate(md));
+        if (!new_hmac ||
+            !HMAC_Init_ex(&new_hmac->ctx, key.key_material, key.key_material_size, md,
+                          nullptr /* engine */))
+            return nullptr;
+
+        // If another thread got there first, use its context.
+        if (__atomic_compare_exchange_n(&hmac_, &hmac, new_hmac.get(), false /* weak */,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            hmac = new_hmac.release();
+    }
+    return hmac->md == md ? &hmac->ctx : nullptr;
+}
+
+}  // namespace keymaster
@@ -36,27 +36,14 @@ NistCurveKeyExchange::NistCurveKeyExchange(EC_KEY* private_key, keymaster_error_
 
 /* static */
 NistCurveKeyExchange* NistCurveKeyExchange::GenerateKeyExchange(keymaster_ec_curve_t curve) {
-    int curve_name;
-    switch (curve) {
-    case KM_EC_CURVE_P_224:
-        curve_name = NID_secp224r1;
-        break;
-    case KM_EC_CURVE_P_256:
-        curve_name = NID_X9_62_prime256v1;
-        break;
-    case KM_EC_CURVE_P_384:
-        curve_name = NID_secp384r1;
-        break;
-    case KM_EC_CURVE_P_521:
-        curve_name = NID_secp521r1;
-        break;
-    default:
+    const EC_GROUP* group = ec_get_shared_group(curve);
+    if (!group) {
         LOG_E("Not a NIST curve: %d", curve);
         return nullptr;
     }
 
-    UniquePtr<EC_KEY, EC_KEY_Delete> key(EC_KEY_new_by_curve_name(curve_name));
-    if (!key.get() || !EC_KEY_generate_key(key.get())) {
+    UniquePtr<EC_KEY, EC_KEY_Delete> key(EC_KEY_new());
+    if (!key.get() || !EC_KEY_set_group(key.get(), group) || !EC_KEY_generate_key(key.get())) {
         return nullptr;
     }
     keymaster_error_t error;
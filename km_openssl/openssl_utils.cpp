@@ -19,7 +19,13 @@
 #include <openssl/rand.h>
 #include <keymaster/android_keymaster_utils.h>
 
+#if defined(OPENSSL_IS_BORINGSSL)
+#include <openssl/bytestring.h>
+#include <openssl/mem.h>
+#endif
+
 #include <keymaster/km_openssl/openssl_err.h>
+#include <keymaster/random_source.h>
 
 namespace keymaster {
 
@@ -63,6 +69,50 @@ EC_GROUP* ec_get_group(keymaster_ec_curve_t curve) {
     }
 }
 
+static int ec_curve_to_nid(keymaster_ec_curve_t curve) {
+    switch (curve) {
+    case KM_EC_CURVE_P_224:
+        return NID_secp224r1;
+    case KM_EC_CURVE_P_256:
+        return NID_X9_62_prime256v1;
+    case KM_EC_CURVE_P_384:
+        return NID_secp384r1;
+    case KM_EC_CURVE_P_521:
+        return NID_secp521r1;
+    default:
+        return NID_undef;
+    }
+}
+
+static EC_GROUP* create_precomputed_group(int nid) {
+    UniquePtr<EC_GROUP, EC_GROUP_Delete> group(EC_GROUP_new_by_curve_name(nid));
+    if (!group.get())
+        return nullptr;
+
+#if !defined(OPENSSL_IS_BORINGSSL)
+    // BoringSSL's built-in groups already carry fixed-base tables; OpenSSL computes them on
+    // request.
+    EC_GROUP_set_point_conversion_form(group.get(), POINT_CONVERSION_UNCOMPRESSED);
+    EC_GROUP_set_asn1_flag(group.get(), OPENSSL_EC_NAMED_CURVE);
+    if (!EC_GROUP_precompute_mult(group.get(), nullptr /* ctx */))
+        return nullptr;
+#endif
+
+    return group.release();
+}
+
+// One slot per NIST curve, indexed by keymaster_ec_curve_t.
+static EC_GROUP* shared_ec_groups[KM_EC_CURVE_P_521 + 1];
+
+const EC_GROUP* ec_get_shared_group(keymaster_ec_curve_t curve) {
+    int nid = ec_curve_to_nid(curve);
+    if (nid == NID_undef)
+        return nullptr;
+
+    return publish_once<EC_GROUP, EC_GROUP_Delete>(
+        &shared_ec_groups[curve], [nid] { return create_precomputed_group(nid); });
+}
+
 static int convert_to_evp(keymaster_algorithm_t algorithm) {
     switch (algorithm) {
     case KM_ALGORITHM_RSA:
@@ -89,7 +139,9 @@ keymaster_error_t convert_pkcs8_blob_to_evp(const uint8_t* key_data, size_t key_
     if (!pkey->get())
         return TranslateLastOpenSslError(true /* log_message */);
 
-    if (EVP_PKEY_type((*pkey)->type) != convert_to_evp(expected_algorithm)) {
+    int evp_key_type = EVP_PKEY_type((*pkey)->type);
+    if (evp_key_type != convert_to_evp(expected_algorithm) &&
+        !(expected_algorithm == KM_ALGORITHM_EC && is_curve25519_evp_type(evp_key_type))) {
         LOG_E("EVP key algorithm was %d, not the expected %d", EVP_PKEY_type((*pkey)->type),
               convert_to_evp(expected_algorithm));
         return KM_ERROR_INVALID_KEY_BLOB;
@@ -110,6 +162,26 @@ keymaster_error_t KeyMaterialToEvpKey(keymaster_key_format_t key_format,
 }
 
 keymaster_error_t EvpKeyToKeyMaterial(const EVP_PKEY* pkey, KeymasterKeyBlob* key_blob) {
+#if defined(OPENSSL_IS_BORINGSSL)
+    // BoringSSL's i2d_PrivateKey only knows the legacy RSA and EC formats, so Curve25519 keys are
+    // stored as PKCS#8, which is what OpenSSL's writes for them anyway.
+    if (is_curve25519_evp_type(EVP_PKEY_id(pkey))) {
+        CBB cbb;
+        uint8_t* der;
+        size_t der_length;
+        if (!CBB_init(&cbb, 0 /* initial_capacity */) || !EVP_marshal_private_key(&cbb, pkey) ||
+            !CBB_finish(&cbb, &der, &der_length)) {
+            CBB_cleanup(&cbb);
+            return TranslateLastOpenSslError();
+        }
+        bool allocated = key_blob->Reset(der_length);
+        if (allocated)
+            memcpy(key_blob->writable_data(), der, der_length);
+        OPENSSL_free(der);
+        return allocated ? KM_ERROR_OK : KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    }
+#endif
+
     int key_data_size = i2d_PrivateKey(pkey, nullptr /* key_data*/);
     if (key_data_size <= 0)
         return TranslateLastOpenSslError();
@@ -134,10 +206,20 @@ size_t ec_group_size_bits(EC_KEY* ec_key) {
     return BN_num_bits(order.get());
 }
 
+static const RandomSource* generate_random_source = nullptr;
+
 keymaster_error_t GenerateRandom(uint8_t* buf, size_t length) {
+    const RandomSource* random_source =
+        __atomic_load_n(&generate_random_source, __ATOMIC_ACQUIRE);
+    if (random_source)
+        return random_source->GenerateRandom(buf, length);
     if (RAND_bytes(buf, length) != 1)
         return KM_ERROR_UNKNOWN_ERROR;
     return KM_ERROR_OK;
 }
 
+void SetGenerateRandomSource(const RandomSource* random_source) {
+    __atomic_store_n(&generate_random_source, random_source, __ATOMIC_RELEASE);
+}
+
 }  // namespace keymaster
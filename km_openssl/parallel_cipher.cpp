@@ -0,0 +1,385 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "parallel_cipher.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <keymaster/new>
+
+#include <keymaster/keymaster_context.h>
+#include <keymaster/km_openssl/openssl_err.h>
+
+namespace keymaster {
+
+static const size_t kBlockSize = 16;
+
+// Runs, and the hashes of runs, are kept below this so their lengths fit the ints EVP takes.
+static const size_t kMaxRunLength = 1 << 30;
+
+// Shorter stretches of whole blocks are cheaper to hash in software than with a new EVP context.
+static const size_t kMinEvpHashLength = 256;
+
+// GCM allows at most 2^32 - 2 blocks of data per nonce.
+static const uint64_t kMaxGcmDataLength = (1ULL << 36) - 32;
+
+inline size_t min(size_t a, size_t b) {
+    return (a < b) ? a : b;
+}
+
+GhashBlock GhashBlock::Load(const uint8_t* bytes) {
+    GhashBlock block;
+    for (size_t i = 0; i < 8; ++i) {
+        block.hi = (block.hi << 8) | bytes[i];
+        block.lo = (block.lo << 8) | bytes[i + 8];
+    }
+    return block;
+}
+
+void GhashBlock::Store(uint8_t* bytes) const {
+    for (size_t i = 0; i < 8; ++i) {
+        bytes[i] = static_cast<uint8_t>(hi >> (56 - 8 * i));
+        bytes[i + 8] = static_cast<uint8_t>(lo >> (56 - 8 * i));
+    }
+}
+
+/*
+ * Multiplication in GF(2^128) as GCM defines it (NIST SP 800-38D, algorithm 1), one bit at a time
+ * and without branching on the operands.  Only used a handful of times per Update.
+ */
+static GhashBlock Multiply(const GhashBlock& x, const GhashBlock& y) {
+    GhashBlock z;
+    GhashBlock v = y;
+    for (size_t i = 0; i < 128; ++i) {
+        uint64_t bit = (i < 64 ? x.hi >> (63 - i) : x.lo >> (127 - i)) & 1;
+        uint64_t mask = 0 - bit;
+        z.hi ^= v.hi & mask;
+        z.lo ^= v.lo & mask;
+
+        uint64_t reduce = 0 - (v.lo & 1);
+        v.lo = (v.lo >> 1) | (v.hi << 63);
+        v.hi = (v.hi >> 1) ^ (0xE100000000000000ULL & reduce);
+    }
+    return z;
+}
+
+static GhashBlock Power(const GhashBlock& x, uint64_t exponent) {
+    GhashBlock result(0x8000000000000000ULL, 0);  // One.
+    GhashBlock square = x;
+    for (; exponent; exponent >>= 1) {
+        if (exponent & 1)
+            result = Multiply(result, square);
+        square = Multiply(square, square);
+    }
+    return result;
+}
+
+keymaster_error_t GcmHasher::Init(const EVP_CIPHER* gcm_cipher, const EVP_CIPHER* ecb_cipher,
+                                  const KeymasterKeyBlob& key, const uint8_t* nonce) {
+    gcm_cipher_ = gcm_cipher;
+    key_ = &key;
+    memcpy(nonce_, nonce, sizeof(nonce_));
+
+    uint8_t blocks[2 * kBlockSize] = {};
+    memcpy(blocks + kBlockSize, nonce_, sizeof(nonce_));
+    blocks[2 * kBlockSize - 1] = 1;
+
+    EVP_CIPHER_CTX ctx;
+    EVP_CIPHER_CTX_init(&ctx);
+    int output_written;
+    bool ok = EVP_EncryptInit_ex(&ctx, ecb_cipher, nullptr /* engine */, key.key_material,
+                                 nullptr /* iv */) &&
+              EVP_CIPHER_CTX_set_padding(&ctx, 0 /* disable padding */) &&
+              EVP_EncryptUpdate(&ctx, blocks, &output_written, blocks, sizeof(blocks));
+    EVP_CIPHER_CTX_cleanup(&ctx);
+    if (!ok) return TranslateLastOpenSslError();
+
+    h_ = GhashBlock::Load(blocks);
+    h_squared_ = Multiply(h_, h_);
+    ek_j0_ = GhashBlock::Load(blocks + kBlockSize);
+    memset_s(blocks, 0, sizeof(blocks));
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t GcmHasher::AddAad(const uint8_t* aad, size_t length) {
+    keymaster_error_t error = Add(aad, length);
+    if (error != KM_ERROR_OK) return error;
+    PadToBlock();
+    aad_length_ = length;
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t GcmHasher::AddCiphertext(const uint8_t* ciphertext, size_t length) {
+    ciphertext_length_ += length;
+    return Add(ciphertext, length);
+}
+
+keymaster_error_t GcmHasher::HashBlocks(const uint8_t* ciphertext, size_t length,
+                                        GhashBlock* hash) const {
+    assert(length % kBlockSize == 0 && length <= kMaxRunLength);
+
+    // A GCM tag over associated data X alone is E_K(J0) + GHASH(X || lengths), and
+    // GHASH(X || lengths) = GHASH(X) * H + lengths * H.
+    EVP_CIPHER_CTX ctx;
+    EVP_CIPHER_CTX_init(&ctx);
+    uint8_t tag[kTagSize];
+    int output_written;
+    bool ok = EVP_EncryptInit_ex(&ctx, gcm_cipher_, nullptr /* engine */, key_->key_material,
+                                 nonce_) &&
+              EVP_EncryptUpdate(&ctx, nullptr /* out */, &output_written, ciphertext, length) &&
+              EVP_EncryptFinal_ex(&ctx, tag, &output_written) &&
+              EVP_CIPHER_CTX_ctrl(&ctx, EVP_CTRL_GCM_GET_TAG, kTagSize, tag);
+    EVP_CIPHER_CTX_cleanup(&ctx);
+    if (!ok) return TranslateLastOpenSslError();
+
+    *hash = GhashBlock::Load(tag);
+    *hash ^= ek_j0_;
+    *hash ^= Multiply(GhashBlock(static_cast<uint64_t>(length) * 8, 0), h_);
+    return KM_ERROR_OK;
+}
+
+void GcmHasher::AppendCiphertextHash(const GhashBlock& hash, size_t length) {
+    assert(pending_length_ == 0);
+    ciphertext_length_ += length;
+    AppendHash(hash, length / kBlockSize);
+}
+
+void GcmHasher::Tag(uint8_t* tag) {
+    PadToBlock();
+    GhashBlock lengths(aad_length_ * 8, ciphertext_length_ * 8);
+    GhashBlock result = hash_;
+    result ^= Multiply(lengths, h_);
+    result ^= ek_j0_;
+    result.Store(tag);
+}
+
+keymaster_error_t GcmHasher::Add(const uint8_t* data, size_t length) {
+    if (pending_length_ > 0) {
+        size_t to_copy = min(kBlockSize - pending_length_, length);
+        memcpy(pending_ + pending_length_, data, to_copy);
+        pending_length_ += to_copy;
+        data += to_copy;
+        length -= to_copy;
+        if (pending_length_ < kBlockSize) return KM_ERROR_OK;
+        AbsorbBlock(pending_);
+        pending_length_ = 0;
+    }
+
+    while (length >= kMinEvpHashLength) {
+        size_t to_hash = min(length - length % kBlockSize, kMaxRunLength);
+        GhashBlock hash;
+        keymaster_error_t error = HashBlocks(data, to_hash, &hash);
+        if (error != KM_ERROR_OK) return error;
+        AppendHash(hash, to_hash / kBlockSize);
+        data += to_hash;
+        length -= to_hash;
+    }
+    for (; length >= kBlockSize; data += kBlockSize, length -= kBlockSize)
+        AbsorbBlock(data);
+
+    memcpy(pending_, data, length);
+    pending_length_ = length;
+    return KM_ERROR_OK;
+}
+
+void GcmHasher::AbsorbBlock(const uint8_t* block) {
+    // The hash of one block B, times H, is B * H^2.
+    AppendHash(Multiply(GhashBlock::Load(block), h_squared_), 1);
+}
+
+void GcmHasher::AppendHash(const GhashBlock& hash, size_t blocks) {
+    hash_ = Multiply(hash_, blocks == 1 ? h_ : Power(h_, blocks));
+    hash_ ^= hash;
+}
+
+void GcmHasher::PadToBlock() {
+    if (pending_length_ == 0) return;
+    memset(pending_ + pending_length_, 0, kBlockSize - pending_length_);
+    AbsorbBlock(pending_);
+    pending_length_ = 0;
+}
+
+struct ParallelCtr::Run {
+    const ParallelCtr* ctr;
+    const uint8_t* input;
+    uint8_t* output;
+    size_t length;
+    uint8_t counter[kBlockSize];
+    const GcmHasher* hasher;
+    bool hash_output;
+    GhashBlock hash;
+    keymaster_error_t error;
+};
+
+bool ParallelCtr::Worthwhile(const KeymasterContext* task_context, size_t length) {
+    return task_context && task_context->max_concurrent_tasks() > 1 &&
+           length >= 2 * kMinRunLength;
+}
+
+void ParallelCtr::Init(const EVP_CIPHER* cipher, const KeymasterKeyBlob& key,
+                       const uint8_t* initial_counter) {
+    cipher_ = cipher;
+    key_ = &key;
+    memcpy(initial_counter_, initial_counter, sizeof(initial_counter_));
+}
+
+static keymaster_error_t CryptSerially(EVP_CIPHER_CTX* ctx, const uint8_t* input, size_t length,
+                                       uint8_t* output, GcmHasher* hasher, bool hash_output) {
+    for (size_t done = 0; done < length;) {
+        int to_crypt = min(length - done, kMaxRunLength);
+        int output_written;
+        if (!EVP_CipherUpdate(ctx, output + done, &output_written, input + done, to_crypt))
+            return TranslateLastOpenSslError();
+        if (output_written != to_crypt) return KM_ERROR_UNKNOWN_ERROR;
+        done += to_crypt;
+    }
+    if (!hasher) return KM_ERROR_OK;
+    return hasher->AddCiphertext(hash_output ? output : input, length);
+}
+
+keymaster_error_t ParallelCtr::Crypt(EVP_CIPHER_CTX* ctx, uint64_t position, const uint8_t* input,
+                                     size_t length, uint8_t* output,
+                                     const KeymasterContext* task_context, GcmHasher* hasher,
+                                     bool hash_output) const {
+    if (!Worthwhile(task_context, length))
+        return CryptSerially(ctx, input, length, output, hasher, hash_output);
+
+    // Finish the current block through |ctx|, so the runs start on block boundaries.
+    size_t head = min((kBlockSize - position % kBlockSize) % kBlockSize, length);
+    keymaster_error_t error = CryptSerially(ctx, input, head, output, hasher, hash_output);
+    if (error != KM_ERROR_OK) return error;
+    position += head;
+    input += head;
+    output += head;
+    length -= head;
+
+    size_t middle = length - length % kBlockSize;
+    error = CryptRuns(ctx, position, input, middle, output, *task_context, hasher, hash_output);
+    if (error != KM_ERROR_OK) return error;
+
+    return CryptSerially(ctx, input + middle, length - middle, output + middle, hasher,
+                         hash_output);
+}
+
+keymaster_error_t ParallelCtr::CryptRuns(EVP_CIPHER_CTX* ctx, uint64_t position,
+                                         const uint8_t* input, size_t length, uint8_t* output,
+                                         const KeymasterContext& task_context, GcmHasher* hasher,
+                                         bool hash_output) const {
+    size_t blocks = length / kBlockSize;
+    size_t num_runs = min(task_context.max_concurrent_tasks(), length / kMinRunLength);
+    if (num_runs < (length + kMaxRunLength - 1) / kMaxRunLength)
+        num_runs = (length + kMaxRunLength - 1) / kMaxRunLength;
+    if (num_runs < 2)
+        return CryptSerially(ctx, input, length, output, hasher, hash_output);
+
+    UniquePtr<Run[]> runs(new (std::nothrow) Run[num_runs]);
+    if (!runs) return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    size_t offset = 0;
+    for (size_t i = 0; i < num_runs; ++i) {
+        Run& run = runs[i];
+        run.ctr = this;
+        run.input = input + offset;
+        run.output = output + offset;
+        run.length = (blocks / num_runs + (i < blocks % num_runs ? 1 : 0)) * kBlockSize;
+        CounterAt(position + offset, run.counter);
+        run.hasher = hasher;
+        run.hash_output = hash_output;
+        run.error = KM_ERROR_UNKNOWN_ERROR;
+        offset += run.length;
+    }
+    assert(offset == length);
+
+    task_context.RunTasks(num_runs, CryptRun, runs.get());
+
+    for (size_t i = 0; i < num_runs; ++i) {
+        if (runs[i].error != KM_ERROR_OK) return runs[i].error;
+        if (hasher) hasher->AppendCiphertextHash(runs[i].hash, runs[i].length);
+    }
+
+    // Move |ctx| past the data the runs processed.
+    uint8_t counter[kBlockSize];
+    CounterAt(position + length, counter);
+    if (!EVP_CipherInit_ex(ctx, nullptr /* cipher */, nullptr /* engine */, nullptr /* key */,
+                           counter, -1 /* keep direction */))
+        return TranslateLastOpenSslError();
+    return KM_ERROR_OK;
+}
+
+void ParallelCtr::CryptRun(void* context, size_t index) {
+    Run& run = reinterpret_cast<Run*>(context)[index];
+    const ParallelCtr& ctr = *run.ctr;
+
+    EVP_CIPHER_CTX ctx;
+    EVP_CIPHER_CTX_init(&ctx);
+    int output_written;
+    if (EVP_EncryptInit_ex(&ctx, ctr.cipher_, nullptr /* engine */, ctr.key_->key_material,
+                           run.counter) &&
+        EVP_EncryptUpdate(&ctx, run.output, &output_written, run.input, run.length)) {
+        run.error = KM_ERROR_OK;
+        if (run.hasher)
+            run.error = run.hasher->HashBlocks(run.hash_output ? run.output : run.input,
+                                               run.length, &run.hash);
+    } else {
+        run.error = TranslateLastOpenSslError();
+    }
+    EVP_CIPHER_CTX_cleanup(&ctx);
+}
+
+// The counter is a 128-bit big-endian number, incremented once per block.
+void ParallelCtr::CounterAt(uint64_t position, uint8_t* counter) const {
+    uint64_t add = position / kBlockSize;
+    unsigned carry = 0;
+    for (int i = kBlockSize - 1; i >= 0; --i) {
+        unsigned sum = initial_counter_[i] + static_cast<unsigned>(add & 0xFF) + carry;
+        counter[i] = static_cast<uint8_t>(sum);
+        carry = sum >> 8;
+        add >>= 8;
+    }
+}
+
+keymaster_error_t ParallelGcm::Init(const EVP_CIPHER* gcm_cipher, const EVP_CIPHER* ecb_cipher,
+                                    const EVP_CIPHER* ctr_cipher, const KeymasterKeyBlob& key,
+                                    const uint8_t* nonce, const uint8_t* aad, size_t aad_length) {
+    keymaster_error_t error = hasher_.Init(gcm_cipher, ecb_cipher, key, nonce);
+    if (error != KM_ERROR_OK) return error;
+    error = hasher_.AddAad(aad, aad_length);
+    if (error != KM_ERROR_OK) return error;
+
+    // With a 12-byte nonce, J0 is nonce || 0^31 || 1, and data starts at the counter after J0.
+    // GCM increments only the low 32 bits of the counter, but they can't wrap within
+    // kMaxGcmDataLength, so a full 128-bit CTR keystream is the same.
+    uint8_t initial_counter[kBlockSize] = {};
+    memcpy(initial_counter, nonce, 12);
+    initial_counter[kBlockSize - 1] = 2;
+    ctr_.Init(ctr_cipher, key, initial_counter);
+    if (!EVP_EncryptInit_ex(&ctr_ctx_, ctr_cipher, nullptr /* engine */, key.key_material,
+                            initial_counter))
+        return TranslateLastOpenSslError();
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t ParallelGcm::Crypt(const uint8_t* input, size_t length, uint8_t* output,
+                                     const KeymasterContext* task_context, bool encrypt) {
+    if (length > kMaxGcmDataLength - position_) return KM_ERROR_INVALID_INPUT_LENGTH;
+    keymaster_error_t error = ctr_.Crypt(&ctr_ctx_, position_, input, length, output,
+                                         task_context, &hasher_, encrypt /* hash_output */);
+    if (error != KM_ERROR_OK) return error;
+    position_ += length;
+    return KM_ERROR_OK;
+}
+
+}  // namespace keymaster
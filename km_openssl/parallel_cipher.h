@@ -0,0 +1,202 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_PARALLEL_CIPHER_H_
+#define SYSTEM_KEYMASTER_PARALLEL_CIPHER_H_
+
+#include <stdint.h>
+
+#include <openssl/evp.h>
+
+#include <hardware/keymaster_defs.h>
+
+#include <keymaster/android_keymaster_utils.h>
+
+namespace keymaster {
+
+class KeymasterContext;
+
+/**
+ * An element of GF(2^128) in GCM's representation: the big-endian halves of a 16-byte block.
+ */
+struct GhashBlock {
+    GhashBlock() : hi(0), lo(0) {}
+    GhashBlock(uint64_t high, uint64_t low) : hi(high), lo(low) {}
+
+    static GhashBlock Load(const uint8_t* bytes);
+    void Store(uint8_t* bytes) const;
+
+    GhashBlock& operator^=(const GhashBlock& other) {
+        hi ^= other.hi;
+        lo ^= other.lo;
+        return *this;
+    }
+
+    uint64_t hi;
+    uint64_t lo;
+};
+
+/**
+ * GcmHasher computes the GCM tag for data encrypted outside of an EVP GCM context, since the
+ * context keeps its GHASH state to itself.
+ *
+ * Block-aligned runs of ciphertext are hashed by a throwaway EVP GCM context each, given the run as
+ * associated data, so the library's accelerated GHASH does the work.  Runs can be hashed
+ * independently, in parallel, and combined afterwards in order, because
+ * GHASH(X || Y) = GHASH(X) * H^n + GHASH(Y) where n is the number of blocks in Y.  A tag over
+ * associated data alone yields GHASH(X) * H, so this class keeps every hash multiplied by H once
+ * more than the usual definition, which avoids needing H^-1.  Partial blocks are hashed in software.
+ */
+class GcmHasher {
+  public:
+    static const size_t kTagSize = 16;
+
+    /**
+     * |gcm_cipher| and |ecb_cipher| are AES in GCM and ECB modes for |key|'s size.  |nonce| is the
+     * operation's 12-byte nonce.  |key| must outlive the GcmHasher.
+     */
+    keymaster_error_t Init(const EVP_CIPHER* gcm_cipher, const EVP_CIPHER* ecb_cipher,
+                           const KeymasterKeyBlob& key, const uint8_t* nonce);
+
+    /**
+     * Hashes all of the associated data.  Must be called once, before any ciphertext is added.
+     */
+    keymaster_error_t AddAad(const uint8_t* aad, size_t length);
+
+    keymaster_error_t AddCiphertext(const uint8_t* ciphertext, size_t length);
+
+    /**
+     * Hashes |length| bytes of ciphertext, a whole number of blocks, for AppendCiphertextHash.
+     * Doesn't change the hasher, so several threads may call it at once.
+     */
+    keymaster_error_t HashBlocks(const uint8_t* ciphertext, size_t length, GhashBlock* hash) const;
+
+    /**
+     * Adds ciphertext hashed by HashBlocks.  The ciphertext added so far must be a whole number of
+     * blocks.
+     */
+    void AppendCiphertextHash(const GhashBlock& hash, size_t length);
+
+    /**
+     * Writes the kTagSize-byte tag over everything added to |tag|.  No more may be added.
+     */
+    void Tag(uint8_t* tag);
+
+  private:
+    keymaster_error_t Add(const uint8_t* data, size_t length);
+    void AbsorbBlock(const uint8_t* block);
+    void AppendHash(const GhashBlock& hash, size_t blocks);
+    void PadToBlock();
+
+    const EVP_CIPHER* gcm_cipher_ = nullptr;
+    const KeymasterKeyBlob* key_ = nullptr;
+    uint8_t nonce_[12];
+    GhashBlock h_;         // E_K(0^128), the hash key.
+    GhashBlock h_squared_;
+    GhashBlock ek_j0_;     // E_K(nonce || 0^31 || 1), which masks the tag.
+    GhashBlock hash_;      // Of every whole block added so far, times H.
+    uint8_t pending_[16];  // A partial block not yet in hash_.
+    size_t pending_length_ = 0;
+    uint64_t aad_length_ = 0;
+    uint64_t ciphertext_length_ = 0;
+};
+
+/**
+ * ParallelCtr runs a CTR keystream over data that arrives in pieces, producing the same output
+ * whether or not it splits the work.  Small pieces go through the caller's context.  Large ones
+ * are cut at block boundaries into one run per task that KeymasterContext::RunTasks can run at
+ * once, and each run is processed with its own context, set to the counter for its position.
+ */
+class ParallelCtr {
+  public:
+    // Runs are at least this long, so each task's setup is well amortized.
+    static const size_t kMinRunLength = 64 * 1024;
+
+    /**
+     * Returns true if |length| bytes are enough to be worth splitting across |task_context|'s
+     * tasks.  |task_context| may be null.
+     */
+    static bool Worthwhile(const KeymasterContext* task_context, size_t length);
+
+    /**
+     * |cipher| is CTR mode for |key|'s size and |initial_counter| the 16-byte counter for the
+     * first block of the stream.  |key| must outlive the ParallelCtr.
+     */
+    void Init(const EVP_CIPHER* cipher, const KeymasterKeyBlob& key,
+              const uint8_t* initial_counter);
+
+    /**
+     * Encrypts or decrypts, which are the same thing in CTR mode, |length| bytes from |input| to
+     * |output|, starting |position| bytes into the stream.  |ctx| must be keyed for the stream and
+     * positioned at |position|, and is left positioned at the end of the data.  If |hasher| is
+     * non-null the ciphertext is added to it: |output| if |hash_output| is true, otherwise
+     * |input|.
+     */
+    keymaster_error_t Crypt(EVP_CIPHER_CTX* ctx, uint64_t position, const uint8_t* input,
+                            size_t length, uint8_t* output, const KeymasterContext* task_context,
+                            GcmHasher* hasher, bool hash_output) const;
+
+  private:
+    struct Run;
+    static void CryptRun(void* context, size_t index);
+
+    keymaster_error_t CryptRuns(EVP_CIPHER_CTX* ctx, uint64_t position, const uint8_t* input,
+                                size_t length, uint8_t* output, const KeymasterContext& task_context,
+                                GcmHasher* hasher, bool hash_output) const;
+    void CounterAt(uint64_t position, uint8_t* counter) const;
+
+    const EVP_CIPHER* cipher_ = nullptr;
+    const KeymasterKeyBlob* key_ = nullptr;
+    uint8_t initial_counter_[16];
+};
+
+/**
+ * ParallelGcm takes over a GCM operation whose EVP context has had all of the associated data but
+ * none of the data, and carries it on with a ParallelCtr for the keystream and a GcmHasher for the
+ * tag.  The output and tag are the same as the EVP context's would have been.
+ */
+class ParallelGcm {
+  public:
+    ParallelGcm() { EVP_CIPHER_CTX_init(&ctr_ctx_); }
+    ~ParallelGcm() { EVP_CIPHER_CTX_cleanup(&ctr_ctx_); }
+
+    ParallelGcm(const ParallelGcm&) = delete;
+    void operator=(const ParallelGcm&) = delete;
+
+    /**
+     * |gcm_cipher|, |ecb_cipher| and |ctr_cipher| are AES in those modes for |key|'s size.
+     * |nonce| is the operation's 12-byte nonce and |aad| all of its associated data.  |key| must
+     * outlive the ParallelGcm.
+     */
+    keymaster_error_t Init(const EVP_CIPHER* gcm_cipher, const EVP_CIPHER* ecb_cipher,
+                           const EVP_CIPHER* ctr_cipher, const KeymasterKeyBlob& key,
+                           const uint8_t* nonce, const uint8_t* aad, size_t aad_length);
+
+    keymaster_error_t Crypt(const uint8_t* input, size_t length, uint8_t* output,
+                            const KeymasterContext* task_context, bool encrypt);
+
+    void Tag(uint8_t* tag) { hasher_.Tag(tag); }
+
+  private:
+    EVP_CIPHER_CTX ctr_ctx_;
+    ParallelCtr ctr_;
+    GcmHasher hasher_;
+    uint64_t position_ = 0;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_PARALLEL_CIPHER_H_
@@ -28,8 +28,8 @@ bool RsaKey::EvpToInternal(const EVP_PKEY* pkey) {
     return rsa_key_.get() != nullptr;
 }
 
-bool RsaKey::InternalToEvp(EVP_PKEY* pkey) const {
-    return EVP_PKEY_set1_RSA(pkey, rsa_key_.get()) == 1;
+bool RsaKey::CopyInternalToEvp(EVP_PKEY* pkey) const {
+    return rsa_key_.get() && EVP_PKEY_set1_RSA(pkey, rsa_key_.get()) == 1;
 }
 
 bool RsaKey::SupportedMode(keymaster_purpose_t purpose, keymaster_padding_t padding) {
@@ -35,16 +35,24 @@ const size_t kPssOverhead = 2;
 const size_t kPkcs1UndigestedSignaturePaddingOverhead = 11;
 
 /* static */
-EVP_PKEY* RsaOperationFactory::GetRsaKey(Key&& key, keymaster_error_t* error) {
+EVP_PKEY* RsaOperationFactory::GetRsaKey(Key&& key, bool public_only, keymaster_error_t* error) {
     const RsaKey& rsa_key = static_cast<RsaKey&>(key);
-    if (!rsa_key.key()) {
-        *error = KM_ERROR_UNKNOWN_ERROR;
+    // key() decodes the private components, so only check it when they're needed anyway.
+    if (!public_only && !rsa_key.key()) {
+        *error = KM_ERROR_INVALID_KEY_BLOB;
         return nullptr;
     }
 
     UniquePtr<EVP_PKEY, EVP_PKEY_Delete> pkey(EVP_PKEY_new());
-    if (!rsa_key.InternalToEvp(pkey.get())) {
-        *error = KM_ERROR_UNKNOWN_ERROR;
+    if (!pkey.get()) {
+        *error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
+        return nullptr;
+    }
+
+    bool converted = public_only ? rsa_key.PublicKeyToEvp(pkey.get())
+                                 : rsa_key.InternalToEvp(pkey.get());
+    if (!converted) {
+        *error = KM_ERROR_INVALID_KEY_BLOB;
         return nullptr;
     }
     return pkey.release();
@@ -71,7 +79,9 @@ RsaOperation* RsaOperationFactory::CreateRsaOperation(Key&& key,
     keymaster_digest_t digest = KM_DIGEST_NONE;
     if (require_digest && !GetAndValidateDigest(begin_params, key, &digest, error)) return nullptr;
 
-    UniquePtr<EVP_PKEY, EVP_PKEY_Delete> rsa(GetRsaKey(move(key), error));
+    // Verification and encryption only need the public key.
+    bool public_only = purpose() == KM_PURPOSE_VERIFY || purpose() == KM_PURPOSE_ENCRYPT;
+    UniquePtr<EVP_PKEY, EVP_PKEY_Delete> rsa(GetRsaKey(move(key), public_only, error));
     if (!rsa.get()) return nullptr;
 
     RsaOperation* op = InstantiateOperation(key.hw_enforced_move(), key.sw_enforced_move(), digest,
@@ -235,6 +245,14 @@ RsaDigestingOperation::~RsaDigestingOperation() {
     EVP_MD_CTX_cleanup(&digest_ctx_);
 }
 
+keymaster_error_t RsaDigestingOperation::Restart() {
+    // Begin() sets the digest context up again from scratch.
+    EVP_MD_CTX_cleanup(&digest_ctx_);
+    EVP_MD_CTX_init(&digest_ctx_);
+    data_.Clear();
+    return KM_ERROR_OK;
+}
+
 int RsaDigestingOperation::GetOpensslPadding(keymaster_error_t* error) {
     *error = KM_ERROR_OK;
     switch (padding_) {
@@ -514,10 +532,6 @@ int RsaCryptOperation::GetOpensslPadding(keymaster_error_t* error) {
     }
 }
 
-struct EVP_PKEY_CTX_Delete {
-    void operator()(EVP_PKEY_CTX* p) { EVP_PKEY_CTX_free(p); }
-};
-
 keymaster_error_t RsaEncryptOperation::Finish(const AuthorizationSet& additional_params,
                                               const Buffer& input, const Buffer& /* signature */,
                                               AuthorizationSet* /* output_params */,
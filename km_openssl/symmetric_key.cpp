@@ -108,6 +108,22 @@ SymmetricKey::SymmetricKey(KeymasterKeyBlob&& key_material,
     key_material_ = move(key_material);
 }
 
-SymmetricKey::~SymmetricKey() {}
+SymmetricKey::~SymmetricKey() {
+    if (context_templates_) context_templates_->Release();
+}
+
+void SymmetricKey::ShareOperationState(Key* source) {
+    // Keys from the same factory are the same type.
+    if (!source || source == this || source->key_factory() != key_factory()) return;
+    SymmetricKey* source_key = static_cast<SymmetricKey*>(source);
+
+    if (!source_key->context_templates_)
+        source_key->context_templates_ = KeyedContextTemplates::New();
+    if (!source_key->context_templates_) return;
+
+    source_key->context_templates_->AddRef();
+    if (context_templates_) context_templates_->Release();
+    context_templates_ = source_key->context_templates_;
+}
 
 }  // namespace keymaster
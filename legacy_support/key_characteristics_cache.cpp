@@ -0,0 +1,141 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <keymaster/legacy_support/key_characteristics_cache.h>
+
+#include <openssl/sha.h>
+
+namespace keymaster {
+
+const size_t KeyCharacteristicsCache::kDefaultMaxEntries;
+
+static void hash_optional_blob(SHA256_CTX* ctx, bool present, const keymaster_blob_t& blob) {
+    // Length-prefix each field, and distinguish "absent" from "empty", so that different
+    // (APPLICATION_ID, APPLICATION_DATA) pairs can't collide by shifting bytes between them.
+    uint8_t header[1 + sizeof(uint64_t)] = {present ? uint8_t(1) : uint8_t(0)};
+    uint64_t length = present ? blob.data_length : 0;
+    for (size_t i = 0; i < sizeof(length); ++i)
+        header[1 + i] = static_cast<uint8_t>(length >> (8 * i));
+    SHA256_Update(ctx, header, sizeof(header));
+    if (present && blob.data_length)
+        SHA256_Update(ctx, blob.data, blob.data_length);
+}
+
+KeyCharacteristicsCache::KeyCharacteristicsCache(size_t max_entries) : max_entries_(max_entries) {}
+
+/* static */
+std::string KeyCharacteristicsCache::BlobDigest(const keymaster_key_blob_t& blob) {
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    SHA256(blob.key_material, blob.key_material_size, digest);
+    return std::string(reinterpret_cast<const char*>(digest), sizeof(digest));
+}
+
+/* static */
+std::string KeyCharacteristicsCache::CacheKey(const std::string& blob_digest,
+                                              const AuthorizationSet& additional_params) {
+    keymaster_blob_t app_id = {nullptr, 0};
+    keymaster_blob_t app_data = {nullptr, 0};
+    bool has_app_id = additional_params.GetTagValue(TAG_APPLICATION_ID, &app_id);
+    bool has_app_data = additional_params.GetTagValue(TAG_APPLICATION_DATA, &app_data);
+
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    hash_optional_blob(&ctx, has_app_id, app_id);
+    hash_optional_blob(&ctx, has_app_data, app_data);
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    SHA256_Final(digest, &ctx);
+
+    return blob_digest + std::string(reinterpret_cast<const char*>(digest), sizeof(digest));
+}
+
+bool KeyCharacteristicsCache::Lookup(const keymaster_key_blob_t& blob,
+                                     const AuthorizationSet& additional_params,
+                                     AuthorizationSet* hw_enforced,
+                                     AuthorizationSet* sw_enforced) {
+    if (max_entries_ == 0)
+        return false;
+
+    std::string key = CacheKey(BlobDigest(blob), additional_params);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = index_.find(key);
+    if (found == index_.end())
+        return false;
+
+    entries_.splice(entries_.begin(), entries_, found->second);
+    const Entry& entry = *found->second;
+    return hw_enforced->Reinitialize(entry.hw_enforced) &&
+           sw_enforced->Reinitialize(entry.sw_enforced);
+}
+
+void KeyCharacteristicsCache::Insert(const keymaster_key_blob_t& blob,
+                                     const AuthorizationSet& additional_params,
+                                     const AuthorizationSet& hw_enforced,
+                                     const AuthorizationSet& sw_enforced) {
+    if (max_entries_ == 0)
+        return;
+
+    std::string blob_digest = BlobDigest(blob);
+    std::string key = CacheKey(blob_digest, additional_params);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = index_.find(key);
+    if (found != index_.end()) {
+        entries_.erase(found->second);
+        index_.erase(found);
+    }
+
+    entries_.emplace_front(blob_digest, key, hw_enforced, sw_enforced);
+    const Entry& entry = entries_.front();
+    if (entry.hw_enforced.is_valid() != AuthorizationSet::OK ||
+        entry.sw_enforced.is_valid() != AuthorizationSet::OK) {
+        entries_.pop_front();
+        return;
+    }
+    index_[key] = entries_.begin();
+
+    while (entries_.size() > max_entries_) {
+        index_.erase(entries_.back().cache_key);
+        entries_.pop_back();
+    }
+}
+
+void KeyCharacteristicsCache::Invalidate(const keymaster_key_blob_t& blob) {
+    if (max_entries_ == 0)
+        return;
+
+    std::string blob_digest = BlobDigest(blob);
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto entry = entries_.begin(); entry != entries_.end();) {
+        if (entry->blob_digest == blob_digest) {
+            index_.erase(entry->cache_key);
+            entry = entries_.erase(entry);
+        } else {
+            ++entry;
+        }
+    }
+}
+
+void KeyCharacteristicsCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    index_.clear();
+    entries_.clear();
+}
+
+size_t KeyCharacteristicsCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+}  // namespace keymaster
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <keymaster/legacy_support/keymaster1_digest_table.h>
+
+#include <stdlib.h>
+
+namespace keymaster {
+
+const uint32_t Keymaster1DigestTable::kUnknownDigest;
+const size_t Keymaster1DigestTable::kAlgorithmCount;
+const size_t Keymaster1DigestTable::kPurposeCount;
+
+// The digests a device must support for every pair before no key needs software digesting.
+static const keymaster_digest_t kFullDigestList[] = {
+    KM_DIGEST_MD5,       KM_DIGEST_SHA1,      KM_DIGEST_SHA_2_224,
+    KM_DIGEST_SHA_2_256, KM_DIGEST_SHA_2_384, KM_DIGEST_SHA_2_512,
+};
+
+struct AlgorithmPurpose {
+    keymaster_algorithm_t algorithm;
+    keymaster_purpose_t purpose;
+};
+
+static const AlgorithmPurpose kDigestingPairs[] = {
+    {KM_ALGORITHM_RSA, KM_PURPOSE_SIGN},    {KM_ALGORITHM_RSA, KM_PURPOSE_VERIFY},
+    {KM_ALGORITHM_EC, KM_PURPOSE_SIGN},     {KM_ALGORITHM_EC, KM_PURPOSE_VERIFY},
+    {KM_ALGORITHM_HMAC, KM_PURPOSE_SIGN},   {KM_ALGORITHM_HMAC, KM_PURPOSE_VERIFY},
+    {KM_ALGORITHM_RSA, KM_PURPOSE_ENCRYPT}, {KM_ALGORITHM_RSA, KM_PURPOSE_DECRYPT},
+};
+
+/* static */
+bool Keymaster1DigestTable::index(keymaster_algorithm_t algorithm, keymaster_purpose_t purpose,
+                                  size_t* i) {
+    size_t algorithm_slot;
+    switch (algorithm) {
+    case KM_ALGORITHM_RSA:
+        algorithm_slot = 0;
+        break;
+    case KM_ALGORITHM_EC:
+        algorithm_slot = 1;
+        break;
+    case KM_ALGORITHM_HMAC:
+        algorithm_slot = 2;
+        break;
+    default:
+        return false;
+    }
+    if (static_cast<uint32_t>(purpose) >= kPurposeCount)
+        return false;
+    *i = algorithm_slot * kPurposeCount + purpose;
+    return true;
+}
+
+void Keymaster1DigestTable::Clear() {
+    for (auto& mask : digests_)
+        mask = 0;
+    covered_ = 0;
+    supports_all_ = false;
+}
+
+keymaster_error_t Keymaster1DigestTable::Initialize(const keymaster1_device_t* dev) {
+    Clear();
+
+    uint32_t full_digests = 0;
+    for (auto digest : kFullDigestList)
+        full_digests |= DigestBit(digest);
+
+    bool supports_all = true;
+    for (auto& pair : kDigestingPairs) {
+        keymaster_digest_t* device_digests;
+        size_t device_digests_length;
+        keymaster_error_t error = dev->get_supported_digests(
+            dev, pair.algorithm, pair.purpose, &device_digests, &device_digests_length);
+        if (error != KM_ERROR_OK) {
+            Clear();
+            return error;
+        }
+
+        uint32_t supported = 0;
+        for (size_t i = 0; i < device_digests_length; ++i)
+            if (static_cast<uint32_t>(device_digests[i]) < kUnknownDigest)
+                supported |= DigestBit(device_digests[i]);
+        free(device_digests);
+
+        size_t i;
+        index(pair.algorithm, pair.purpose, &i);
+        digests_[i] = supported;
+        covered_ |= 1U << i;
+        supports_all &= (supported & full_digests) == full_digests;
+    }
+
+    supports_all_ = supports_all;
+    return KM_ERROR_OK;
+}
+
+bool Keymaster1DigestTable::covers(keymaster_algorithm_t algorithm,
+                                   keymaster_purpose_t purpose) const {
+    size_t i;
+    return index(algorithm, purpose, &i) && (covered_ & (1U << i));
+}
+
+uint32_t Keymaster1DigestTable::digests(keymaster_algorithm_t algorithm,
+                                        keymaster_purpose_t purpose) const {
+    size_t i;
+    if (!index(algorithm, purpose, &i))
+        return 0;
+    return digests_[i];
+}
+
+bool Keymaster1DigestTable::FindUnsupported(keymaster_algorithm_t algorithm,
+                                            keymaster_purpose_t purpose,
+                                            uint32_t requested_digests,
+                                            keymaster_digest_t* unsupported) const {
+    if (!covers(algorithm, purpose))
+        return false;
+
+    uint32_t missing = requested_digests & ~digests(algorithm, purpose);
+    if (!missing)
+        return false;
+
+    uint32_t digest = 0;
+    while (!(missing & (1U << digest)))
+        ++digest;
+    *unsupported = static_cast<keymaster_digest_t>(digest);
+    return true;
+}
+
+}  // namespace keymaster
@@ -21,131 +21,17 @@
 
 #include <assert.h>
 
-#include <algorithm>
-#include <vector>
-
 namespace keymaster {
 
-template <typename T> std::vector<T> make_vector(const T* array, size_t len) {
-    return std::vector<T>(array, array + len);
-}
-
-// This helper class implements just enough of the C++ standard collection interface to be able to
-// accept push_back calls, and it does nothing but count them.  It's useful when you want to count
-// insertions but not actually store anything.  It's used in digest_set_is_full below to count the
-// size of a set intersection.
-struct PushbackCounter {
-    struct value_type {
-        // NOLINTNEXTLINE(google-explicit-constructor)
-        template <typename T> value_type(const T&) {}
-    };
-    void push_back(const value_type&) { ++count; }
-    size_t count = 0;
-};
-
-static std::vector<keymaster_digest_t> full_digest_list = {
-    KM_DIGEST_MD5,       KM_DIGEST_SHA1,      KM_DIGEST_SHA_2_224,
-    KM_DIGEST_SHA_2_256, KM_DIGEST_SHA_2_384, KM_DIGEST_SHA_2_512};
-
-template <typename Iter> static bool digest_set_is_full(Iter begin, Iter end) {
-    PushbackCounter counter;
-    std::set_intersection(begin, end, full_digest_list.begin(), full_digest_list.end(),
-                          std::back_inserter(counter));
-    return counter.count == full_digest_list.size();
-}
-
-static keymaster_error_t add_digests(const keymaster1_device_t* dev, keymaster_algorithm_t algorithm,
-                                     keymaster_purpose_t purpose,
-                                     Keymaster1LegacySupport::DigestMap* map, bool* supports_all) {
-    auto key = std::make_pair(algorithm, purpose);
-
-    keymaster_digest_t* digests;
-    size_t digests_length;
-    keymaster_error_t error =
-        dev->get_supported_digests(dev, algorithm, purpose, &digests, &digests_length);
-    if (error != KM_ERROR_OK) {
-        LOG(ERROR) << "Error " << error << " getting supported digests from keymaster1 device";
-        return error;
-    }
-    std::unique_ptr<keymaster_digest_t, Malloc_Delete> digests_deleter(digests);
-
-    auto digest_vec = make_vector(digests, digests_length);
-    *supports_all = digest_set_is_full(digest_vec.begin(), digest_vec.end());
-    (*map)[key] = std::move(digest_vec);
-    return error;
-}
-
-static keymaster_error_t map_digests(const keymaster1_device_t* dev,
-                                     Keymaster1LegacySupport::DigestMap* map,
-                                     bool* supports_all) {
-    map->clear();
-    *supports_all = true;
-
-    keymaster_algorithm_t sig_algorithms[] = {KM_ALGORITHM_RSA, KM_ALGORITHM_EC, KM_ALGORITHM_HMAC};
-    keymaster_purpose_t sig_purposes[] = {KM_PURPOSE_SIGN, KM_PURPOSE_VERIFY};
-    for (auto algorithm : sig_algorithms)
-        for (auto purpose : sig_purposes) {
-            bool alg_purpose_supports_all;
-            keymaster_error_t error =
-                add_digests(dev, algorithm, purpose, map, &alg_purpose_supports_all);
-            if (error != KM_ERROR_OK)
-                return error;
-            *supports_all &= alg_purpose_supports_all;
-        }
-
-    keymaster_algorithm_t crypt_algorithms[] = {KM_ALGORITHM_RSA};
-    keymaster_purpose_t crypt_purposes[] = {KM_PURPOSE_ENCRYPT, KM_PURPOSE_DECRYPT};
-    for (auto algorithm : crypt_algorithms)
-        for (auto purpose : crypt_purposes) {
-            bool alg_purpose_supports_all;
-            keymaster_error_t error =
-                add_digests(dev, algorithm, purpose, map, &alg_purpose_supports_all);
-            if (error != KM_ERROR_OK)
-                return error;
-            *supports_all &= alg_purpose_supports_all;
-        }
-
-    return KM_ERROR_OK;
-}
-
 Keymaster1LegacySupport::Keymaster1LegacySupport(const keymaster1_device_t* dev) {
-    map_digests(dev, &device_digests_, &supports_all_);
-}
-
-template <typename Collection, typename Value> bool contains(const Collection& c, const Value& v) {
-    return std::find(c.begin(), c.end(), v) != c.end();
-}
-
-template <typename T>
-static bool findUnsupportedDigest(keymaster_algorithm_t algorithm,
-                                  keymaster_purpose_t purpose,
-                                  keymaster_digest_t digest,
-                                  const T& params,
-                                  const Keymaster1LegacySupport::DigestMap& digest_map) {
-    auto supported_digests = digest_map.find(std::make_pair(algorithm, purpose));
-    if (supported_digests == digest_map.end())
-        // Invalid algorith/purpose pair (e.g. EC encrypt).  Let the error be handled by HW module.
-        return false;
-
-    if (digest != KM_DIGEST_NONE && !contains(supported_digests->second, digest)) {
-        LOG(WARNING) << "Digest " << digest << " requested but not supported by KM1 hal";
-        return true;
-    }
-
-    for (auto& entry : params)
-        if (entry.tag == TAG_DIGEST)
-            if (!contains(supported_digests->second, entry.enumerated)) {
-                LOG(WARNING) << "Digest " << entry.enumerated << " requested but not supported by KM1 hal";
-                return true;
-            }
-    return false;
+    keymaster_error_t error = device_digests_.Initialize(dev);
+    if (error != KM_ERROR_OK)
+        LOG(ERROR) << "Error " << error << " getting supported digests from keymaster1 device";
 }
 
-template <typename T>
-bool requiresSoftwareDigesting(keymaster_algorithm_t algorithm, keymaster_purpose_t purpose,
-                               keymaster_digest_t digest,
-                               const T& params,
-                               const Keymaster1LegacySupport::DigestMap& digest_map) {
+static bool requiresSoftwareDigesting(keymaster_algorithm_t algorithm, keymaster_purpose_t purpose,
+                                      uint32_t requested_digests,
+                                      const Keymaster1DigestTable& device_digests) {
     switch (algorithm) {
     case KM_ALGORITHM_AES:
     case KM_ALGORITHM_TRIPLE_DES:
@@ -157,13 +43,18 @@ bool requiresSoftwareDigesting(keymaster_algorithm_t algorithm, keymaster_purpos
         break;
     }
 
-    if (!findUnsupportedDigest(algorithm, purpose, digest, params, digest_map)) {
+    // Invalid algorithm/purpose pairs (e.g. EC encrypt) have no unsupported digests.  Let the
+    // error be handled by HW module.
+    keymaster_digest_t unsupported;
+    if (!device_digests.FindUnsupported(algorithm, purpose, requested_digests, &unsupported)) {
         LOG(DEBUG) << "Requested digest(s) supported for algorithm " << algorithm << " and purpose " << purpose;
         return false;
     }
 
+    LOG(WARNING) << "Digest " << unsupported << " requested but not supported by KM1 hal";
     return true;
 }
+
 bool Keymaster1LegacySupport::RequiresSoftwareDigesting(
         const AuthorizationSet& key_description) const {
 
@@ -173,15 +64,15 @@ bool Keymaster1LegacySupport::RequiresSoftwareDigesting(
         return false;
     }
 
-    if (supports_all_) return false;
+    if (device_digests_.supports_all()) return false;
 
+    uint32_t requested_digests = Keymaster1DigestTable::RequestedDigests(key_description);
     bool has_purpose = false;
     for (auto& entry : key_description)
         if (entry.tag == TAG_PURPOSE) {
             has_purpose = true;
             keymaster_purpose_t purpose = static_cast<keymaster_purpose_t>(entry.enumerated);
-            if (requiresSoftwareDigesting(algorithm, purpose, KM_DIGEST_NONE, key_description,
-                                          device_digests_))
+            if (requiresSoftwareDigesting(algorithm, purpose, requested_digests, device_digests_))
                 return true;
         }
 
@@ -197,15 +88,18 @@ bool Keymaster1LegacySupport::RequiresSoftwareDigesting(const keymaster_digest_t
         return false;
     }
 
-    if (supports_all_) return false;
+    if (device_digests_.supports_all()) return false;
+
+    uint32_t requested_digests = Keymaster1DigestTable::RequestedDigests(key_description);
+    if (digest != KM_DIGEST_NONE)
+        requested_digests |= Keymaster1DigestTable::DigestBit(digest);
 
     bool has_purpose = false;
     for (auto& entry : key_description) {
         if (entry.tag == TAG_PURPOSE) {
             has_purpose = true;
             keymaster_purpose_t purpose = static_cast<keymaster_purpose_t>(entry.enumerated);
-            if (requiresSoftwareDigesting(algorithm, purpose, digest, key_description,
-                                          device_digests_))
+            if (requiresSoftwareDigesting(algorithm, purpose, requested_digests, device_digests_))
                 return true;
         }
     }
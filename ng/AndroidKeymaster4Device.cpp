@@ -70,55 +70,60 @@ inline keymaster_tag_type_t typeFromTag(const keymaster_tag_t tag) {
     return keymaster_tag_get_type(tag);
 }
 
-class KmParamSet : public keymaster_key_param_set_t {
-  public:
-    explicit KmParamSet(const hidl_vec<KeyParameter>& keyParams) {
-        params = new keymaster_key_param_t[keyParams.size()];
-        length = keyParams.size();
-        for (size_t i = 0; i < keyParams.size(); ++i) {
-            auto tag = legacy_enum_conversion(keyParams[i].tag);
-            switch (typeFromTag(tag)) {
-            case KM_ENUM:
-            case KM_ENUM_REP:
-                params[i] = keymaster_param_enum(tag, keyParams[i].f.integer);
-                break;
-            case KM_UINT:
-            case KM_UINT_REP:
-                params[i] = keymaster_param_int(tag, keyParams[i].f.integer);
-                break;
-            case KM_ULONG:
-            case KM_ULONG_REP:
-                params[i] = keymaster_param_long(tag, keyParams[i].f.longInteger);
-                break;
-            case KM_DATE:
-                params[i] = keymaster_param_date(tag, keyParams[i].f.dateTime);
-                break;
-            case KM_BOOL:
-                if (keyParams[i].f.boolValue)
-                    params[i] = keymaster_param_bool(tag);
-                else
-                    params[i].tag = KM_TAG_INVALID;
-                break;
-            case KM_BIGNUM:
-            case KM_BYTES:
-                params[i] =
-                    keymaster_param_blob(tag, &keyParams[i].blob[0], keyParams[i].blob.size());
-                break;
-            case KM_INVALID:
-            default:
-                params[i].tag = KM_TAG_INVALID;
-                /* just skip */
-                break;
-            }
-        }
+inline keymaster_key_param_t hidlKeyParam2Km(const KeyParameter& param) {
+    auto tag = legacy_enum_conversion(param.tag);
+    switch (typeFromTag(tag)) {
+    case KM_ENUM:
+    case KM_ENUM_REP:
+        return keymaster_param_enum(tag, param.f.integer);
+    case KM_UINT:
+    case KM_UINT_REP:
+        return keymaster_param_int(tag, param.f.integer);
+    case KM_ULONG:
+    case KM_ULONG_REP:
+        return keymaster_param_long(tag, param.f.longInteger);
+    case KM_DATE:
+        return keymaster_param_date(tag, param.f.dateTime);
+    case KM_BOOL:
+        if (param.f.boolValue)
+            return keymaster_param_bool(tag);
+        break;
+    case KM_BIGNUM:
+    case KM_BYTES:
+        return keymaster_param_blob(tag, param.blob.data(), param.blob.size());
+    case KM_INVALID:
+    default:
+        /* just skip */
+        break;
     }
-    KmParamSet(KmParamSet&& other) : keymaster_key_param_set_t{other.params, other.length} {
-        other.length = 0;
-        other.params = nullptr;
+    return keymaster_key_param_t{KM_TAG_INVALID, {}};
+}
+
+/**
+ * Converts \p keyParams straight into \p set.  The first pass only sums the blob lengths, so the
+ * set allocates its element array and its blob data once each and the second pass copies every
+ * parameter into place.  There is no intermediate keymaster_key_param_t array.
+ */
+bool hidlKeyParams2AuthorizationSet(const hidl_vec<KeyParameter>& keyParams,
+                                    ::keymaster::AuthorizationSet* set) {
+    set->Clear();
+    if (keyParams.size() == 0)
+        return true;
+
+    size_t blobLength = 0;
+    for (size_t i = 0; i < keyParams.size(); ++i) {
+        auto type = typeFromTag(legacy_enum_conversion(keyParams[i].tag));
+        if (type == KM_BIGNUM || type == KM_BYTES)
+            blobLength += keyParams[i].blob.size();
     }
-    KmParamSet(const KmParamSet&) = delete;
-    ~KmParamSet() { delete[] params; }
-};
+    if (!set->reserve_elems(keyParams.size()) || !set->reserve_indirect(blobLength))
+        return false;
+
+    for (size_t i = 0; i < keyParams.size(); ++i)
+        if (!set->push_back(hidlKeyParam2Km(keyParams[i])))
+            return false;
+    return true;
+}
 
 inline hidl_vec<uint8_t> kmBlob2hidlVec(const keymaster_key_blob_t& blob) {
     hidl_vec<uint8_t> result;
@@ -158,7 +163,7 @@ static inline hidl_vec<KeyParameter> kmParamSet2Hidl(const keymaster_key_param_s
         return result;
 
     result.resize(set.length);
-    keymaster_key_param_t* params = set.params;
+    const keymaster_key_param_t* params = set.params;
     for (size_t i = 0; i < set.length; ++i) {
         auto tag = params[i].tag;
         result[i].tag = legacy_enum_conversion(tag);
@@ -188,7 +193,6 @@ static inline hidl_vec<KeyParameter> kmParamSet2Hidl(const keymaster_key_param_s
             break;
         case KM_INVALID:
         default:
-            params[i].tag = KM_TAG_INVALID;
             /* just skip */
             break;
         }
@@ -216,7 +220,12 @@ AndroidKeymaster4Device::AndroidKeymaster4Device(SecurityLevel securityLevel)
               context->SetSystemVersion(GetOsVersion(), GetOsPatchlevel());
               return context;
           }(),
-          kOperationTableSize)), securityLevel_(securityLevel) {}
+          kOperationTableSize)), securityLevel_(securityLevel) {
+    // The pure software context's factories are fixed, so the matrix can be built now.
+    keymaster_error_t error = impl_->BuildCapabilities();
+    if (error != KM_ERROR_OK)
+        ALOGE("Error %d building capability matrix", error);
+}
 
 AndroidKeymaster4Device::~AndroidKeymaster4Device() {}
 
@@ -269,7 +278,11 @@ Return<void> AndroidKeymaster4Device::verifyAuthorization(
 
     VerifyAuthorizationRequest request;
     request.challenge = challenge;
-    request.parameters_to_verify.Reinitialize(KmParamSet(parametersToVerify));
+    if (!hidlKeyParams2AuthorizationSet(parametersToVerify, &request.parameters_to_verify)) {
+        _hidl_cb(ErrorCode::MEMORY_ALLOCATION_FAILED,
+                 ::android::hardware::keymaster::V4_0::VerificationToken());
+        return Void();
+    }
     request.auth_token.challenge = authToken.challenge;
     request.auth_token.user_id = authToken.userId;
     request.auth_token.authenticator_id = authToken.authenticatorId;
@@ -307,7 +320,10 @@ Return<ErrorCode> AndroidKeymaster4Device::addRngEntropy(const hidl_vec<uint8_t>
 Return<void> AndroidKeymaster4Device::generateKey(const hidl_vec<KeyParameter>& keyParams,
                                                   generateKey_cb _hidl_cb) {
     GenerateKeyRequest request;
-    request.key_description.Reinitialize(KmParamSet(keyParams));
+    if (!hidlKeyParams2AuthorizationSet(keyParams, &request.key_description)) {
+        _hidl_cb(ErrorCode::MEMORY_ALLOCATION_FAILED, hidl_vec<uint8_t>(), KeyCharacteristics());
+        return Void();
+    }
 
     GenerateKeyResponse response;
     impl_->GenerateKey(request, &response);
@@ -348,7 +364,10 @@ Return<void> AndroidKeymaster4Device::importKey(const hidl_vec<KeyParameter>& pa
                                                 const hidl_vec<uint8_t>& keyData,
                                                 importKey_cb _hidl_cb) {
     ImportKeyRequest request;
-    request.key_description.Reinitialize(KmParamSet(params));
+    if (!hidlKeyParams2AuthorizationSet(params, &request.key_description)) {
+        _hidl_cb(ErrorCode::MEMORY_ALLOCATION_FAILED, hidl_vec<uint8_t>(), KeyCharacteristics());
+        return Void();
+    }
     request.key_format = legacy_enum_conversion(keyFormat);
     request.SetKeyMaterial(keyData.data(), keyData.size());
 
@@ -375,7 +394,10 @@ Return<void> AndroidKeymaster4Device::importWrappedKey(
     request.SetWrappedMaterial(wrappedKeyData.data(), wrappedKeyData.size());
     request.SetWrappingMaterial(wrappingKeyBlob.data(), wrappingKeyBlob.size());
     request.SetMaskingKeyMaterial(maskingKey.data(), maskingKey.size());
-    request.additional_params.Reinitialize(KmParamSet(unwrappingParams));
+    if (!hidlKeyParams2AuthorizationSet(unwrappingParams, &request.additional_params)) {
+        _hidl_cb(ErrorCode::MEMORY_ALLOCATION_FAILED, hidl_vec<uint8_t>(), KeyCharacteristics());
+        return Void();
+    }
     request.password_sid = passwordSid;
     request.biometric_sid = biometricSid;
 
@@ -419,7 +441,10 @@ Return<void> AndroidKeymaster4Device::attestKey(const hidl_vec<uint8_t>& keyToAt
                                                 attestKey_cb _hidl_cb) {
     AttestKeyRequest request;
     request.SetKeyMaterial(keyToAttest.data(), keyToAttest.size());
-    request.attest_params.Reinitialize(KmParamSet(attestParams));
+    if (!hidlKeyParams2AuthorizationSet(attestParams, &request.attest_params)) {
+        _hidl_cb(ErrorCode::MEMORY_ALLOCATION_FAILED, hidl_vec<hidl_vec<uint8_t>>());
+        return Void();
+    }
 
     AttestKeyResponse response;
     impl_->AttestKey(request, &response);
@@ -439,7 +464,10 @@ Return<void> AndroidKeymaster4Device::upgradeKey(const hidl_vec<uint8_t>& keyBlo
     // implementation never returns ErrorCode::KEY_REQUIRES_UPGRADE, so this should never be called.
     UpgradeKeyRequest request;
     request.SetKeyMaterial(keyBlobToUpgrade.data(), keyBlobToUpgrade.size());
-    request.upgrade_params.Reinitialize(KmParamSet(upgradeParams));
+    if (!hidlKeyParams2AuthorizationSet(upgradeParams, &request.upgrade_params)) {
+        _hidl_cb(ErrorCode::MEMORY_ALLOCATION_FAILED, hidl_vec<uint8_t>());
+        return Void();
+    }
 
     UpgradeKeyResponse response;
     impl_->UpgradeKey(request, &response);
@@ -484,7 +512,11 @@ Return<void> AndroidKeymaster4Device::begin(KeyPurpose purpose, const hidl_vec<u
     BeginOperationRequest request;
     request.purpose = legacy_enum_conversion(purpose);
     request.SetKeyMaterial(key.data(), key.size());
-    request.additional_params.Reinitialize(KmParamSet(inParams));
+    if (!hidlKeyParams2AuthorizationSet(inParams, &request.additional_params)) {
+        _hidl_cb(ErrorCode::MEMORY_ALLOCATION_FAILED,
+                 hidl_vec<KeyParameter>(), 0 /* operationHandle */);
+        return Void();
+    }
 
     BeginOperationResponse response;
     impl_->BeginOperation(request, &response);
@@ -507,7 +539,11 @@ Return<void> AndroidKeymaster4Device::update(uint64_t operationHandle,
     UpdateOperationRequest request;
     request.op_handle = operationHandle;
     request.input.Reinitialize(input.data(), input.size());
-    request.additional_params.Reinitialize(KmParamSet(inParams));
+    if (!hidlKeyParams2AuthorizationSet(inParams, &request.additional_params)) {
+        _hidl_cb(ErrorCode::MEMORY_ALLOCATION_FAILED,
+                 0 /* inputConsumed */, hidl_vec<KeyParameter>(), hidl_vec<uint8_t>());
+        return Void();
+    }
 
     UpdateOperationResponse response;
     impl_->UpdateOperation(request, &response);
@@ -535,7 +571,11 @@ Return<void> AndroidKeymaster4Device::finish(uint64_t operationHandle,
     request.op_handle = operationHandle;
     request.input.Reinitialize(input.data(), input.size());
     request.signature.Reinitialize(signature.data(), signature.size());
-    request.additional_params.Reinitialize(KmParamSet(inParams));
+    if (!hidlKeyParams2AuthorizationSet(inParams, &request.additional_params)) {
+        _hidl_cb(ErrorCode::MEMORY_ALLOCATION_FAILED,
+                 hidl_vec<KeyParameter>(), hidl_vec<uint8_t>());
+        return Void();
+    }
 
     FinishOperationResponse response;
     impl_->FinishOperation(request, &response);
@@ -625,6 +625,322 @@ TEST(RoundTrip, UpgradeKeyResponse) {
     }
 }
 
+TEST(RoundTrip, BatchVerifyRequest) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        BatchVerifyRequest msg(ver);
+        ASSERT_TRUE(msg.AllocateJobs(2));
+        for (size_t i = 0; i < msg.num_jobs; ++i) {
+            msg.jobs[i].SetKeyMaterial("foo", 3);
+            msg.jobs[i].additional_params.Reinitialize(params, array_length(params));
+            msg.jobs[i].message.Reinitialize("hello", 5);
+            msg.jobs[i].signature.Reinitialize("sig", 3);
+        }
+
+        UniquePtr<BatchVerifyRequest> deserialized(round_trip(ver, msg, 206));
+        ASSERT_EQ(2U, deserialized->num_jobs);
+        for (size_t i = 0; i < deserialized->num_jobs; ++i) {
+            const VerificationJob& job = deserialized->jobs[i];
+            EXPECT_EQ(3U, job.key_blob.key_material_size);
+            EXPECT_EQ(0, memcmp("foo", job.key_blob.key_material, 3));
+            EXPECT_EQ(msg.jobs[i].additional_params, job.additional_params);
+            EXPECT_EQ(5U, job.message.available_read());
+            EXPECT_EQ(0, memcmp("hello", job.message.peek_read(), 5));
+            EXPECT_EQ(3U, job.signature.available_read());
+            EXPECT_EQ(0, memcmp("sig", job.signature.peek_read(), 3));
+        }
+    }
+}
+
+TEST(RoundTrip, BatchVerifyResponse) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        BatchVerifyResponse rsp(ver);
+        rsp.error = KM_ERROR_OK;
+        ASSERT_TRUE(rsp.AllocateResults(3));
+        rsp.results[0] = KM_ERROR_OK;
+        rsp.results[1] = KM_ERROR_VERIFICATION_FAILED;
+        rsp.results[2] = KM_ERROR_INVALID_KEY_BLOB;
+
+        UniquePtr<BatchVerifyResponse> deserialized(round_trip(ver, rsp, 20));
+        EXPECT_EQ(KM_ERROR_OK, deserialized->error);
+        ASSERT_EQ(3U, deserialized->num_results);
+        EXPECT_EQ(KM_ERROR_OK, deserialized->results[0]);
+        EXPECT_EQ(KM_ERROR_VERIFICATION_FAILED, deserialized->results[1]);
+        EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB, deserialized->results[2]);
+    }
+}
+
+TEST(RoundTrip, MigrateKeyBlobsRequest) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        MigrateKeyBlobsRequest msg(ver);
+        ASSERT_TRUE(msg.AllocateJobs(2));
+        for (size_t i = 0; i < msg.num_jobs; ++i) {
+            msg.jobs[i].SetKeyMaterial("foo", 3);
+            msg.jobs[i].additional_params.Reinitialize(params, array_length(params));
+        }
+
+        UniquePtr<MigrateKeyBlobsRequest> deserialized(round_trip(ver, msg, 174));
+        ASSERT_EQ(2U, deserialized->num_jobs);
+        for (size_t i = 0; i < deserialized->num_jobs; ++i) {
+            const KeyBlobMigrationJob& job = deserialized->jobs[i];
+            EXPECT_EQ(3U, job.key_blob.key_material_size);
+            EXPECT_EQ(0, memcmp("foo", job.key_blob.key_material, 3));
+            EXPECT_EQ(msg.jobs[i].additional_params, job.additional_params);
+        }
+    }
+}
+
+TEST(RoundTrip, MigrateKeyBlobsResponse) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        MigrateKeyBlobsResponse rsp(ver);
+        rsp.error = KM_ERROR_OK;
+        ASSERT_TRUE(rsp.AllocateResults(3));
+        rsp.results[0].error = KM_ERROR_OK;
+        rsp.results[0].SetKeyMaterial("migrated", 8);
+        rsp.results[1].error = KM_ERROR_OK;
+        rsp.results[2].error = KM_ERROR_INVALID_KEY_BLOB;
+
+        UniquePtr<MigrateKeyBlobsResponse> deserialized(round_trip(ver, rsp, 40));
+        EXPECT_EQ(KM_ERROR_OK, deserialized->error);
+        ASSERT_EQ(3U, deserialized->num_results);
+        EXPECT_EQ(KM_ERROR_OK, deserialized->results[0].error);
+        EXPECT_EQ(8U, deserialized->results[0].key_blob.key_material_size);
+        EXPECT_EQ(0, memcmp("migrated", deserialized->results[0].key_blob.key_material, 8));
+        EXPECT_EQ(KM_ERROR_OK, deserialized->results[1].error);
+        EXPECT_EQ(0U, deserialized->results[1].key_blob.key_material_size);
+        EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB, deserialized->results[2].error);
+    }
+}
+
+TEST(RoundTrip, BatchUpgradeKeyRequest) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        BatchUpgradeKeyRequest msg(ver);
+        ASSERT_TRUE(msg.AllocateKeyBlobs(3));
+        for (size_t i = 0; i < msg.num_key_blobs; ++i)
+            msg.key_blobs[i] = KeymasterKeyBlob(reinterpret_cast<const uint8_t*>("foo"), 3);
+        msg.upgrade_params.Reinitialize(params, array_length(params));
+
+        UniquePtr<BatchUpgradeKeyRequest> deserialized(round_trip(ver, msg, 103));
+        ASSERT_EQ(3U, deserialized->num_key_blobs);
+        for (size_t i = 0; i < deserialized->num_key_blobs; ++i) {
+            EXPECT_EQ(3U, deserialized->key_blobs[i].key_material_size);
+            EXPECT_EQ(0, memcmp("foo", deserialized->key_blobs[i].key_material, 3));
+        }
+        EXPECT_EQ(msg.upgrade_params, deserialized->upgrade_params);
+    }
+}
+
+TEST(RoundTrip, BatchUpgradeKeyResponse) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        BatchUpgradeKeyResponse rsp(ver);
+        rsp.error = KM_ERROR_OK;
+        ASSERT_TRUE(rsp.AllocateResults(2));
+        rsp.results[0].error = KM_ERROR_OK;
+        rsp.results[0].SetKeyMaterial("upgraded", 8);
+        rsp.results[1].error = KM_ERROR_INVALID_ARGUMENT;
+
+        UniquePtr<BatchUpgradeKeyResponse> deserialized(round_trip(ver, rsp, 32));
+        EXPECT_EQ(KM_ERROR_OK, deserialized->error);
+        ASSERT_EQ(2U, deserialized->num_results);
+        EXPECT_EQ(KM_ERROR_OK, deserialized->results[0].error);
+        EXPECT_EQ(8U, deserialized->results[0].key_blob.key_material_size);
+        EXPECT_EQ(0, memcmp("upgraded", deserialized->results[0].key_blob.key_material, 8));
+        EXPECT_EQ(KM_ERROR_INVALID_ARGUMENT, deserialized->results[1].error);
+    }
+}
+
+TEST(RoundTrip, LoadKeyHandleRequest) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        LoadKeyHandleRequest msg(ver);
+        msg.SetKeyMaterial("foo", 3);
+        msg.additional_params.Reinitialize(params, array_length(params));
+
+        UniquePtr<LoadKeyHandleRequest> deserialized(round_trip(ver, msg, 85));
+        EXPECT_EQ(3U, deserialized->key_blob.key_material_size);
+        EXPECT_EQ(0, memcmp("foo", deserialized->key_blob.key_material, 3));
+        EXPECT_EQ(msg.additional_params, deserialized->additional_params);
+    }
+}
+
+TEST(RoundTrip, LoadKeyHandleResponse) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        LoadKeyHandleResponse msg(ver);
+        msg.error = KM_ERROR_OK;
+        msg.key_handle = 0xDEADBEEF12345678;
+
+        UniquePtr<LoadKeyHandleResponse> deserialized(round_trip(ver, msg, 12));
+        EXPECT_EQ(0xDEADBEEF12345678, deserialized->key_handle);
+    }
+}
+
+TEST(RoundTrip, UnloadKeyHandleRequest) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        UnloadKeyHandleRequest msg(ver);
+        msg.key_handle = 0xDEADBEEF12345678;
+
+        UniquePtr<UnloadKeyHandleRequest> deserialized(round_trip(ver, msg, 8));
+        EXPECT_EQ(0xDEADBEEF12345678, deserialized->key_handle);
+    }
+}
+
+TEST(RoundTrip, UnloadKeyHandleResponse) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        UnloadKeyHandleResponse msg(ver);
+        UniquePtr<UnloadKeyHandleResponse> deserialized(round_trip(ver, msg, 4));
+    }
+}
+
+TEST(RoundTrip, BeginOperationWithKeyHandleRequest) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        BeginOperationWithKeyHandleRequest msg(ver);
+        msg.purpose = KM_PURPOSE_SIGN;
+        msg.key_handle = 0xDEADBEEF12345678;
+        msg.additional_params.Reinitialize(params, array_length(params));
+
+        UniquePtr<BeginOperationWithKeyHandleRequest> deserialized(round_trip(ver, msg, 90));
+        EXPECT_EQ(KM_PURPOSE_SIGN, deserialized->purpose);
+        EXPECT_EQ(0xDEADBEEF12345678, deserialized->key_handle);
+        EXPECT_EQ(msg.additional_params, deserialized->additional_params);
+    }
+}
+
+TEST(RoundTrip, ExportKeyWithKeyHandleRequest) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        ExportKeyWithKeyHandleRequest msg(ver);
+        msg.key_handle = 0xDEADBEEF12345678;
+        msg.key_format = KM_KEY_FORMAT_X509;
+
+        UniquePtr<ExportKeyWithKeyHandleRequest> deserialized(round_trip(ver, msg, 12));
+        EXPECT_EQ(0xDEADBEEF12345678, deserialized->key_handle);
+        EXPECT_EQ(KM_KEY_FORMAT_X509, deserialized->key_format);
+    }
+}
+
+TEST(RoundTrip, AttestKeyWithKeyHandleRequest) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        AttestKeyWithKeyHandleRequest msg(ver);
+        msg.key_handle = 0xDEADBEEF12345678;
+        msg.attest_params.Reinitialize(params, array_length(params));
+
+        UniquePtr<AttestKeyWithKeyHandleRequest> deserialized(round_trip(ver, msg, 86));
+        EXPECT_EQ(0xDEADBEEF12345678, deserialized->key_handle);
+        EXPECT_EQ(msg.attest_params, deserialized->attest_params);
+    }
+}
+
+TEST(RoundTrip, FinishAndRestartOperationRequest) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        FinishAndRestartOperationRequest msg(ver);
+        msg.op_handle = 0xDEADBEEF;
+        msg.input.Reinitialize("foo", 3);
+        msg.signature.Reinitialize("bar", 3);
+        msg.restart_params.Reinitialize(params, array_length(params));
+
+        UniquePtr<FinishAndRestartOperationRequest> deserialized(round_trip(ver, msg, 112));
+        EXPECT_EQ(0xDEADBEEF, deserialized->op_handle);
+        EXPECT_EQ(3U, deserialized->input.available_read());
+        EXPECT_EQ(0, memcmp(deserialized->input.peek_read(), "foo", 3));
+        EXPECT_EQ(3U, deserialized->signature.available_read());
+        EXPECT_EQ(0, memcmp(deserialized->signature.peek_read(), "bar", 3));
+        EXPECT_EQ(msg.restart_params, deserialized->restart_params);
+    }
+}
+
+TEST(RoundTrip, FinishAndRestartOperationResponse) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        FinishAndRestartOperationResponse msg(ver);
+        msg.error = KM_ERROR_OK;
+        msg.output.Reinitialize("foo", 3);
+        msg.restart_error = KM_ERROR_KEY_MAX_OPS_EXCEEDED;
+        msg.op_handle = 0xDEADBEEF;
+
+        UniquePtr<FinishAndRestartOperationResponse> deserialized(round_trip(ver, msg, 47));
+        EXPECT_EQ(3U, deserialized->output.available_read());
+        EXPECT_EQ(0, memcmp(deserialized->output.peek_read(), "foo", 3));
+        EXPECT_EQ(KM_ERROR_KEY_MAX_OPS_EXCEEDED, deserialized->restart_error);
+        EXPECT_EQ(0xDEADBEEF, deserialized->op_handle);
+    }
+}
+
+// RSA signing with PSS and SHA-256 only, importing PKCS#8 and exporting X.509.
+static const uint32_t capability_values[] = {
+    1, KM_ALGORITHM_RSA,  // algorithms
+    1,                    // entry_count
+    KM_ALGORITHM_RSA, 1, KM_KEY_FORMAT_PKCS8, 1, KM_KEY_FORMAT_X509,
+    1,  // purpose_count
+    KM_PURPOSE_SIGN, 0, 1, KM_PAD_RSA_PSS, 1, KM_DIGEST_SHA_2_256,
+};
+
+TEST(RoundTrip, GetCapabilitiesResponse) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        GetCapabilitiesResponse msg(ver);
+        msg.error = KM_ERROR_OK;
+        ASSERT_TRUE(
+            msg.capabilities.Reinitialize(capability_values, array_length(capability_values)));
+
+        UniquePtr<GetCapabilitiesResponse> deserialized(round_trip(ver, msg, 68));
+        const KeymasterCapabilities& capabilities = deserialized->capabilities;
+        CapabilityList list;
+        EXPECT_EQ(KM_ERROR_OK, capabilities.SupportedAlgorithms(&list));
+        EXPECT_EQ(1U, list.count);
+        EXPECT_TRUE(list.Contains(KM_ALGORITHM_RSA));
+        EXPECT_EQ(KM_ERROR_OK, capabilities.SupportedExportFormats(KM_ALGORITHM_RSA, &list));
+        EXPECT_EQ(1U, list.count);
+        EXPECT_TRUE(list.Contains(KM_KEY_FORMAT_X509));
+        EXPECT_EQ(KM_ERROR_OK,
+                  capabilities.SupportedBlockModes(KM_ALGORITHM_RSA, KM_PURPOSE_SIGN, &list));
+        EXPECT_EQ(0U, list.count);
+        EXPECT_EQ(KM_ERROR_OK,
+                  capabilities.SupportedDigests(KM_ALGORITHM_RSA, KM_PURPOSE_SIGN, &list));
+        EXPECT_EQ(1U, list.count);
+        EXPECT_TRUE(list.Contains(KM_DIGEST_SHA_2_256));
+        EXPECT_FALSE(list.Contains(KM_DIGEST_NONE));
+        EXPECT_EQ(KM_ERROR_UNSUPPORTED_PURPOSE,
+                  capabilities.SupportedDigests(KM_ALGORITHM_RSA, KM_PURPOSE_ENCRYPT, &list));
+        EXPECT_EQ(KM_ERROR_UNSUPPORTED_ALGORITHM,
+                  capabilities.SupportedDigests(KM_ALGORITHM_HMAC, KM_PURPOSE_SIGN, &list));
+    }
+}
+
+TEST(RoundTrip, GetCapabilitiesResponseShared) {
+    KeymasterCapabilities matrix;
+    ASSERT_TRUE(matrix.Reinitialize(capability_values, array_length(capability_values)));
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        GetCapabilitiesResponse msg(ver);
+        msg.error = KM_ERROR_OK;
+        msg.shared_capabilities = &matrix;
+
+        UniquePtr<GetCapabilitiesResponse> deserialized(round_trip(ver, msg, 68));
+        EXPECT_EQ(nullptr, deserialized->shared_capabilities);
+        const KeymasterCapabilities& capabilities = deserialized->capabilities;
+        ASSERT_EQ(matrix.values_length(), capabilities.values_length());
+        EXPECT_EQ(0, memcmp(matrix.values(), capabilities.values(),
+                            matrix.values_length() * sizeof(uint32_t)));
+    }
+}
+
+TEST(KeymasterCapabilities, Malformed) {
+    KeymasterCapabilities capabilities;
+    ASSERT_TRUE(capabilities.Reinitialize(capability_values, array_length(capability_values)));
+
+    // Truncated.
+    EXPECT_FALSE(
+        capabilities.Reinitialize(capability_values, array_length(capability_values) - 1));
+    EXPECT_TRUE(capabilities.empty());
+    CapabilityList list;
+    EXPECT_EQ(KM_ERROR_UNKNOWN_ERROR, capabilities.SupportedAlgorithms(&list));
+
+    // Trailing values.
+    uint32_t values[sizeof(capability_values) / sizeof(*capability_values) + 1];
+    memcpy(values, capability_values, sizeof(capability_values));
+    values[array_length(capability_values)] = 0;
+    EXPECT_FALSE(capabilities.Reinitialize(values, array_length(values)));
+
+    // A list that runs off the end.
+    memcpy(values, capability_values, sizeof(capability_values));
+    values[4] = 0xFFFFFFFF;
+    EXPECT_FALSE(capabilities.Reinitialize(values, array_length(capability_values)));
+}
+
 uint8_t msgbuf[] = {
     220, 88,  183, 255, 71,  1,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
     0,   173, 0,   0,   0,   228, 174, 98,  187, 191, 135, 253, 200, 51,  230, 114, 247, 151, 109,
@@ -699,6 +1015,22 @@ GARBAGE_TEST(AddEntropyRequest);
 GARBAGE_TEST(AddEntropyResponse);
 GARBAGE_TEST(BeginOperationRequest);
 GARBAGE_TEST(BeginOperationResponse);
+GARBAGE_TEST(BatchVerifyRequest);
+GARBAGE_TEST(BatchVerifyResponse);
+GARBAGE_TEST(MigrateKeyBlobsRequest);
+GARBAGE_TEST(MigrateKeyBlobsResponse);
+GARBAGE_TEST(BatchUpgradeKeyRequest);
+GARBAGE_TEST(BatchUpgradeKeyResponse);
+GARBAGE_TEST(FinishAndRestartOperationRequest);
+GARBAGE_TEST(FinishAndRestartOperationResponse);
+GARBAGE_TEST(GetCapabilitiesResponse);
+GARBAGE_TEST(LoadKeyHandleRequest);
+GARBAGE_TEST(LoadKeyHandleResponse);
+GARBAGE_TEST(UnloadKeyHandleRequest);
+GARBAGE_TEST(UnloadKeyHandleResponse);
+GARBAGE_TEST(BeginOperationWithKeyHandleRequest);
+GARBAGE_TEST(ExportKeyWithKeyHandleRequest);
+GARBAGE_TEST(AttestKeyWithKeyHandleRequest);
 GARBAGE_TEST(DeleteAllKeysRequest);
 GARBAGE_TEST(DeleteAllKeysResponse);
 GARBAGE_TEST(DeleteKeyRequest);
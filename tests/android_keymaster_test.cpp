@@ -19,7 +19,10 @@
 #include <string>
 #include <vector>
 
+#include <openssl/ec.h>
+#include <openssl/ec_key.h>
 #include <openssl/evp.h>
+#include <openssl/rsa.h>
 #include <openssl/x509.h>
 
 #include <hardware/keymaster0.h>
@@ -28,7 +31,14 @@
 #include <keymaster/attestation_record.h>
 #include <keymaster/contexts/pure_soft_keymaster_context.h>
 #include <keymaster/contexts/soft_keymaster_context.h>
+#include <keymaster/contexts/thread_pool.h>
+#include <keymaster/key_blob_utils/integrity_assured_key_blob.h>
+#include <keymaster/key_blob_utils/software_keyblobs.h>
 #include <keymaster/key_factory.h>
+#include <keymaster/km_openssl/aes_key.h>
+#include <keymaster/km_openssl/asymmetric_key.h>
+#include <keymaster/km_openssl/curve25519_operation.h>
+#include <keymaster/km_openssl/ec_key.h>
 #include <keymaster/km_openssl/hmac_key.h>
 #include <keymaster/km_openssl/openssl_utils.h>
 #include <keymaster/km_openssl/soft_keymaster_enforcement.h>
@@ -451,6 +461,200 @@ TEST_P(GetKeyCharacteristics, SimpleRsa) {
         EXPECT_EQ(1, GetParam()->keymaster0_calls());
 }
 
+TEST(ParseKeyBlobAuthorizationsTest, MatchesParseKeyBlob) {
+    TestKeymasterContext context;
+    ASSERT_EQ(KM_ERROR_OK, context.SetSystemVersion(kOsVersion, kOsPatchLevel));
+
+    AuthorizationSet descriptions[] = {
+        AuthorizationSetBuilder().RsaSigningKey(256, 3).Digest(KM_DIGEST_NONE).build(),
+        AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_SHA_2_256).build(),
+        AuthorizationSetBuilder().AesEncryptionKey(128).build(),
+    };
+    const AuthorizationSet client_params(
+        AuthorizationSetBuilder().Authorization(TAG_APPLICATION_ID, "clientid", 8));
+
+    for (auto& description : descriptions) {
+        description.push_back(TAG_APPLICATION_ID, "clientid", 8);
+        keymaster_algorithm_t algorithm;
+        ASSERT_TRUE(description.GetTagValue(TAG_ALGORITHM, &algorithm));
+
+        KeymasterKeyBlob blob;
+        AuthorizationSet hw_enforced, sw_enforced;
+        ASSERT_EQ(KM_ERROR_OK, context.GetKeyFactory(algorithm)->GenerateKey(
+                                   description, &blob, &hw_enforced, &sw_enforced));
+
+        UniquePtr<Key> key;
+        ASSERT_EQ(KM_ERROR_OK, context.ParseKeyBlob(blob, client_params, &key));
+
+        AuthorizationSet parsed_hw_enforced, parsed_sw_enforced;
+        ASSERT_EQ(KM_ERROR_OK, context.ParseKeyBlobAuthorizations(
+                                   blob, client_params, &parsed_hw_enforced, &parsed_sw_enforced));
+        EXPECT_EQ(key->hw_enforced(), parsed_hw_enforced);
+        EXPECT_EQ(key->sw_enforced(), parsed_sw_enforced);
+
+        // The shortcut must be no less strict about the blob than the full parse.
+        EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB,
+                  context.ParseKeyBlobAuthorizations(blob, AuthorizationSet(), &parsed_hw_enforced,
+                                                     &parsed_sw_enforced));
+        blob.writable_data()[blob.key_material_size / 2] ^= 0x01;
+        EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB,
+                  context.ParseKeyBlobAuthorizations(blob, client_params, &parsed_hw_enforced,
+                                                     &parsed_sw_enforced));
+    }
+}
+
+static string PublicKeyInfo(const AsymmetricKey& key, bool public_only) {
+    EVP_PKEY_Ptr pkey(EVP_PKEY_new());
+    if (!(public_only ? key.PublicKeyToEvp(pkey.get()) : key.InternalToEvp(pkey.get())))
+        return "";
+    int len = i2d_PUBKEY(pkey.get(), nullptr);
+    if (len <= 0)
+        return "";
+    string spki(len, '\0');
+    uint8_t* p = reinterpret_cast<uint8_t*>(&spki[0]);
+    i2d_PUBKEY(pkey.get(), &p);
+    return spki;
+}
+
+static bool EvpHasPrivateKey(EVP_PKEY* pkey) {
+    switch (EVP_PKEY_type(pkey->type)) {
+    case EVP_PKEY_RSA: {
+        RSA_Ptr rsa(EVP_PKEY_get1_RSA(pkey));
+        return rsa.get() && rsa->d;
+    }
+    case EVP_PKEY_EC: {
+        EC_KEY_Ptr ec_key(EVP_PKEY_get1_EC_KEY(pkey));
+        return ec_key.get() && EC_KEY_get0_private_key(ec_key.get());
+    }
+    }
+    return false;
+}
+
+static bool HasPrivateKey(const AsymmetricKey& key) {
+    EVP_PKEY_Ptr pkey(EVP_PKEY_new());
+    return key.InternalToEvp(pkey.get()) && EvpHasPrivateKey(pkey.get());
+}
+
+TEST(AsymmetricKeyLoadTest, PublicOnlyDecodeMatchesFullDecode) {
+    TestKeymasterContext context;
+    ASSERT_EQ(KM_ERROR_OK, context.SetSystemVersion(kOsVersion, kOsPatchLevel));
+
+    AuthorizationSet descriptions[] = {
+        AuthorizationSetBuilder().RsaSigningKey(512, 3).Digest(KM_DIGEST_NONE).build(),
+        AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_SHA_2_256).build(),
+        AuthorizationSetBuilder().EcdsaSigningKey(521).Digest(KM_DIGEST_SHA_2_256).build(),
+    };
+
+    for (auto& description : descriptions) {
+        keymaster_algorithm_t algorithm;
+        ASSERT_TRUE(description.GetTagValue(TAG_ALGORITHM, &algorithm));
+
+        KeymasterKeyBlob blob;
+        AuthorizationSet hw_enforced, sw_enforced;
+        ASSERT_EQ(KM_ERROR_OK, context.GetKeyFactory(algorithm)->GenerateKey(
+                                   description, &blob, &hw_enforced, &sw_enforced));
+
+        UniquePtr<Key> eager_key, lazy_key;
+        ASSERT_EQ(KM_ERROR_OK, context.ParseKeyBlob(blob, AuthorizationSet(), &eager_key));
+        ASSERT_EQ(KM_ERROR_OK, context.ParseKeyBlob(blob, AuthorizationSet(), &lazy_key));
+        const AsymmetricKey& eager = static_cast<const AsymmetricKey&>(*eager_key);
+        const AsymmetricKey& lazy = static_cast<const AsymmetricKey&>(*lazy_key);
+
+        string expected = PublicKeyInfo(eager, false /* public_only */);
+        ASSERT_FALSE(expected.empty());
+        EXPECT_EQ(expected, PublicKeyInfo(lazy, true /* public_only */));
+
+        UniquePtr<uint8_t[]> exported;
+        size_t exported_size;
+        ASSERT_EQ(KM_ERROR_OK, lazy.formatted_key_material(KM_KEY_FORMAT_X509, &exported,
+                                                           &exported_size));
+        EXPECT_EQ(expected, string(reinterpret_cast<char*>(exported.get()), exported_size));
+
+        // A private operation after a public-only decode must still get the whole key.
+        EXPECT_TRUE(HasPrivateKey(lazy));
+        EXPECT_EQ(expected, PublicKeyInfo(lazy, false /* public_only */));
+    }
+}
+
+TEST(AsymmetricKeyLoadTest, EcKeyWithoutEmbeddedPublicKey) {
+    TestKeymasterContext context;
+
+    // ECPrivateKey's public key field is optional; without it the public key has to be computed
+    // from the private scalar, so the public-only decode falls back to a full one.
+    EC_KEY_Ptr ec_key(EC_KEY_new_by_curve_name(NID_X9_62_prime256v1));
+    ASSERT_TRUE(ec_key.get() != nullptr);
+    ASSERT_EQ(1, EC_KEY_generate_key(ec_key.get()));
+    EC_KEY_set_enc_flags(ec_key.get(), EC_PKEY_NO_PUBKEY);
+    EVP_PKEY_Ptr pkey(EVP_PKEY_new());
+    ASSERT_EQ(1, EVP_PKEY_set1_EC_KEY(pkey.get(), ec_key.get()));
+
+    int key_material_len = i2d_PrivateKey(pkey.get(), nullptr);
+    ASSERT_GT(key_material_len, 0);
+    KeymasterKeyBlob key_material(key_material_len);
+    uint8_t* p = key_material.writable_data();
+    ASSERT_EQ(key_material_len, i2d_PrivateKey(pkey.get(), &p));
+
+    int spki_len = i2d_PUBKEY(pkey.get(), nullptr);
+    ASSERT_GT(spki_len, 0);
+    string expected(spki_len, '\0');
+    p = reinterpret_cast<uint8_t*>(&expected[0]);
+    i2d_PUBKEY(pkey.get(), &p);
+
+    UniquePtr<Key> key;
+    ASSERT_EQ(KM_ERROR_OK,
+              context.GetKeyFactory(KM_ALGORITHM_EC)
+                  ->LoadKey(move(key_material), AuthorizationSet(), AuthorizationSet(),
+                            AuthorizationSet(), &key));
+    const AsymmetricKey& asym_key = static_cast<const AsymmetricKey&>(*key);
+    EXPECT_EQ(expected, PublicKeyInfo(asym_key, true /* public_only */));
+    EXPECT_TRUE(HasPrivateKey(asym_key));
+}
+
+#if defined(OPENSSL_IS_BORINGSSL)
+TEST(AsymmetricKeyLoadTest, PublicOnlyDecodeSkipsPrivateComponents) {
+    TestKeymasterContext context;
+    ASSERT_EQ(KM_ERROR_OK, context.SetSystemVersion(kOsVersion, kOsPatchLevel));
+
+    AuthorizationSet descriptions[] = {
+        AuthorizationSetBuilder().RsaSigningKey(512, 3).Digest(KM_DIGEST_NONE).build(),
+        AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_SHA_2_256).build(),
+    };
+
+    for (auto& description : descriptions) {
+        keymaster_algorithm_t algorithm;
+        ASSERT_TRUE(description.GetTagValue(TAG_ALGORITHM, &algorithm));
+
+        KeymasterKeyBlob blob;
+        AuthorizationSet hw_enforced, sw_enforced;
+        ASSERT_EQ(KM_ERROR_OK, context.GetKeyFactory(algorithm)->GenerateKey(
+                                   description, &blob, &hw_enforced, &sw_enforced));
+
+        // The key material the factories write must take the public-only path, not fall back.
+        UniquePtr<Key> key;
+        ASSERT_EQ(KM_ERROR_OK, context.ParseKeyBlob(blob, AuthorizationSet(), &key));
+        const AsymmetricKey& asym_key = static_cast<const AsymmetricKey&>(*key);
+        EVP_PKEY_Ptr pkey(EVP_PKEY_new());
+        ASSERT_TRUE(asym_key.PublicKeyToEvp(pkey.get()));
+        EXPECT_FALSE(EvpHasPrivateKey(pkey.get()));
+        EXPECT_TRUE(HasPrivateKey(asym_key));
+    }
+}
+#endif  // OPENSSL_IS_BORINGSSL
+
+TEST(AsymmetricKeyLoadTest, CorruptKeyMaterialRejectedAtLoad) {
+    TestKeymasterContext context;
+
+    static const uint8_t kGarbage[] = {0x30, 0x03, 0x02, 0x01, 0x00, 0xde, 0xad};
+    for (auto algorithm : {KM_ALGORITHM_RSA, KM_ALGORITHM_EC}) {
+        UniquePtr<Key> key;
+        EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB,
+                  context.GetKeyFactory(algorithm)->LoadKey(KeymasterKeyBlob(kGarbage),
+                                                            AuthorizationSet(), AuthorizationSet(),
+                                                            AuthorizationSet(), &key));
+        EXPECT_TRUE(key.get() == nullptr);
+    }
+}
+
 typedef Keymaster2Test SigningOperationsTest;
 INSTANTIATE_TEST_CASE_P(AndroidKeymasterTest, SigningOperationsTest, test_params);
 
@@ -2059,6 +2263,384 @@ TEST_F(ImportWrappedKeyTest, WrongPurpose) {
     EXPECT_EQ(response.error, KM_ERROR_INCOMPATIBLE_PURPOSE);
 }
 
+class BatchVerifyTest : public testing::Test {
+  public:
+    BatchVerifyTest() : keymaster_(new TestKeymasterContext, 16) {}
+
+  protected:
+    void SetUp() override {
+        ConfigureRequest configReq;
+        configReq.os_version = kOsVersion;
+        configReq.os_patchlevel = kOsPatchLevel;
+        ConfigureResponse configRsp;
+        keymaster_.Configure(configReq, &configRsp);
+        EXPECT_EQ(KM_ERROR_OK, configRsp.error);
+    }
+
+    KeymasterKeyBlob GenerateKey(const AuthorizationSetBuilder& builder) {
+        GenerateKeyRequest req;
+        req.key_description = builder.build();
+        req.key_description.push_back(TAG_NO_AUTH_REQUIRED);
+        GenerateKeyResponse rsp;
+        keymaster_.GenerateKey(req, &rsp);
+        EXPECT_EQ(KM_ERROR_OK, rsp.error);
+        return KeymasterKeyBlob(rsp.key_blob);
+    }
+
+    string Sign(const KeymasterKeyBlob& key, const AuthorizationSet& params,
+                const string& message) {
+        BeginOperationRequest begin_req;
+        begin_req.purpose = KM_PURPOSE_SIGN;
+        begin_req.SetKeyMaterial(key);
+        begin_req.additional_params = params;
+        BeginOperationResponse begin_rsp;
+        keymaster_.BeginOperation(begin_req, &begin_rsp);
+        EXPECT_EQ(KM_ERROR_OK, begin_rsp.error);
+
+        FinishOperationRequest finish_req;
+        finish_req.op_handle = begin_rsp.op_handle;
+        finish_req.input.Reinitialize(message.data(), message.size());
+        FinishOperationResponse finish_rsp;
+        keymaster_.FinishOperation(finish_req, &finish_rsp);
+        EXPECT_EQ(KM_ERROR_OK, finish_rsp.error);
+        return string(reinterpret_cast<const char*>(finish_rsp.output.peek_read()),
+                      finish_rsp.output.available_read());
+    }
+
+    void SetJob(VerificationJob* job, const KeymasterKeyBlob& key, const AuthorizationSet& params,
+                const string& message, const string& signature) {
+        job->SetKeyMaterial(key);
+        job->additional_params = params;
+        job->message.Reinitialize(message.data(), message.size());
+        job->signature.Reinitialize(signature.data(), signature.size());
+    }
+
+    AndroidKeymaster keymaster_;
+};
+
+TEST_F(BatchVerifyTest, PerItemResults) {
+    KeymasterKeyBlob rsa_key = GenerateKey(AuthorizationSetBuilder()
+                                               .RsaSigningKey(1024, 65537)
+                                               .Digest(KM_DIGEST_SHA_2_256)
+                                               .Padding(KM_PAD_RSA_PKCS1_1_5_SIGN));
+    KeymasterKeyBlob ec_key =
+        GenerateKey(AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_SHA_2_256));
+    KeymasterKeyBlob aes_key =
+        GenerateKey(AuthorizationSetBuilder().AesEncryptionKey(128).EcbMode().Padding(KM_PAD_NONE));
+    AuthorizationSet rsa_params(AuthorizationSetBuilder()
+                                    .Digest(KM_DIGEST_SHA_2_256)
+                                    .Padding(KM_PAD_RSA_PKCS1_1_5_SIGN));
+    AuthorizationSet ec_params(AuthorizationSetBuilder().Digest(KM_DIGEST_SHA_2_256));
+
+    string message = "12345678901234567890123456789012";
+    string rsa_signature = Sign(rsa_key, rsa_params, message);
+    string ec_signature = Sign(ec_key, ec_params, message);
+    string corrupt_ec_signature = ec_signature;
+    ++corrupt_ec_signature[corrupt_ec_signature.size() / 2];
+    KeymasterKeyBlob corrupt_rsa_key(rsa_key);
+    ++corrupt_rsa_key.writable_data()[corrupt_rsa_key.key_material_size / 2];
+
+    BatchVerifyRequest request;
+    ASSERT_TRUE(request.AllocateJobs(6));
+    SetJob(&request.jobs[0], rsa_key, rsa_params, message, rsa_signature);
+    SetJob(&request.jobs[1], ec_key, ec_params, message, ec_signature);
+    SetJob(&request.jobs[2], ec_key, ec_params, message, corrupt_ec_signature);
+    SetJob(&request.jobs[3], rsa_key, rsa_params, "Not the signed message", rsa_signature);
+    SetJob(&request.jobs[4], corrupt_rsa_key, rsa_params, message, rsa_signature);
+    SetJob(&request.jobs[5], aes_key, AuthorizationSet(), message, rsa_signature);
+
+    BatchVerifyResponse response;
+    keymaster_.BatchVerify(request, &response);
+    ASSERT_EQ(KM_ERROR_OK, response.error);
+    ASSERT_EQ(6U, response.num_results);
+    EXPECT_EQ(KM_ERROR_OK, response.results[0]);
+    EXPECT_EQ(KM_ERROR_OK, response.results[1]);
+    EXPECT_EQ(KM_ERROR_VERIFICATION_FAILED, response.results[2]);
+    EXPECT_EQ(KM_ERROR_VERIFICATION_FAILED, response.results[3]);
+    EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB, response.results[4]);
+    EXPECT_EQ(KM_ERROR_UNSUPPORTED_PURPOSE, response.results[5]);
+}
+
+TEST_F(BatchVerifyTest, ManyJobs) {
+    // Enough jobs that the context's thread pool, if it has one, gets several per thread.
+    const size_t kNumJobs = 64;
+    KeymasterKeyBlob ec_key =
+        GenerateKey(AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_SHA_2_256));
+    AuthorizationSet ec_params(AuthorizationSetBuilder().Digest(KM_DIGEST_SHA_2_256));
+
+    BatchVerifyRequest request;
+    ASSERT_TRUE(request.AllocateJobs(kNumJobs));
+    for (size_t i = 0; i < kNumJobs; ++i) {
+        string message = "message " + std::to_string(i);
+        string signature = Sign(ec_key, ec_params, message);
+        // Every third job gets someone else's signature.
+        if (i % 3 == 2)
+            message += " (tampered)";
+        SetJob(&request.jobs[i], ec_key, ec_params, message, signature);
+    }
+
+    BatchVerifyResponse response;
+    keymaster_.BatchVerify(request, &response);
+    ASSERT_EQ(KM_ERROR_OK, response.error);
+    ASSERT_EQ(kNumJobs, response.num_results);
+    for (size_t i = 0; i < kNumJobs; ++i) {
+        EXPECT_EQ(i % 3 == 2 ? KM_ERROR_VERIFICATION_FAILED : KM_ERROR_OK, response.results[i])
+            << "Job " << i;
+    }
+}
+
+TEST_F(BatchVerifyTest, EmptyBatch) {
+    BatchVerifyRequest request;
+    BatchVerifyResponse response;
+    keymaster_.BatchVerify(request, &response);
+    EXPECT_EQ(KM_ERROR_OK, response.error);
+    EXPECT_EQ(0U, response.num_results);
+}
+
+class MigrateKeyBlobsTest : public testing::Test {
+  public:
+    MigrateKeyBlobsTest() : keymaster_(new TestKeymasterContext, 16) {}
+
+  protected:
+    static KeymasterKeyBlob ReadBlob(const string& file_name) {
+        string data = read_file(file_name);
+        EXPECT_FALSE(data.empty()) << "Missing fixture " << file_name;
+        return KeymasterKeyBlob(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+    }
+
+    void ExpectSameKey(const KeymasterKeyBlob& original, const KeymasterKeyBlob& migrated) {
+        UniquePtr<Key> original_key, migrated_key;
+        ASSERT_EQ(KM_ERROR_OK, context_.ParseKeyBlob(original, AuthorizationSet(), &original_key));
+        ASSERT_EQ(KM_ERROR_OK, context_.ParseKeyBlob(migrated, AuthorizationSet(), &migrated_key));
+        EXPECT_EQ(original_key->hw_enforced(), migrated_key->hw_enforced());
+        EXPECT_EQ(original_key->sw_enforced(), migrated_key->sw_enforced());
+        const KeymasterKeyBlob& original_material = original_key->key_material();
+        const KeymasterKeyBlob& migrated_material = migrated_key->key_material();
+        ASSERT_EQ(original_material.key_material_size, migrated_material.key_material_size);
+        EXPECT_EQ(0, memcmp(original_material.key_material, migrated_material.key_material,
+                            original_material.key_material_size));
+    }
+
+    AndroidKeymaster keymaster_;
+    TestKeymasterContext context_;  // For checking the results.
+};
+
+TEST_F(MigrateKeyBlobsTest, LegacySoftwareBlobs) {
+    const char* const kLegacyBlobs[] = {
+        "km0_sw_rsa_512.blob",
+        "km1_sw_rsa_512.blob",
+        "km1_sw_rsa_512_unversioned.blob",
+        "km1_sw_ecdsa_256.blob",
+    };
+    const size_t kNumLegacyBlobs = array_length(kLegacyBlobs);
+
+    MigrateKeyBlobsRequest request;
+    ASSERT_TRUE(request.AllocateJobs(kNumLegacyBlobs + 1));
+    for (size_t i = 0; i < kNumLegacyBlobs; ++i)
+        request.jobs[i].SetKeyMaterial(ReadBlob(kLegacyBlobs[i]));
+    const uint8_t garbage[] = "Not a key blob at all";
+    request.jobs[kNumLegacyBlobs].SetKeyMaterial(garbage, sizeof(garbage));
+
+    MigrateKeyBlobsResponse response;
+    keymaster_.MigrateKeyBlobs(request, &response);
+    ASSERT_EQ(KM_ERROR_OK, response.error);
+    ASSERT_EQ(kNumLegacyBlobs + 1, response.num_results);
+    for (size_t i = 0; i < kNumLegacyBlobs; ++i) {
+        SCOPED_TRACE(kLegacyBlobs[i]);
+        const KeyBlobResult& result = response.results[i];
+        ASSERT_EQ(KM_ERROR_OK, result.error);
+        ASSERT_GT(result.key_blob.key_material_size, 0U);
+        EXPECT_EQ(static_cast<uint32_t>(SOFTWARE_BLOB_INTEGRITY_ASSURED),
+                  ClassifySoftwareKeyBlob(result.key_blob));
+        ExpectSameKey(request.jobs[i].key_blob, result.key_blob);
+    }
+    EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB, response.results[kNumLegacyBlobs].error);
+}
+
+TEST_F(MigrateKeyBlobsTest, CurrentBlobsAreLeftAlone) {
+    MigrateKeyBlobsRequest request;
+    ASSERT_TRUE(request.AllocateJobs(1));
+    request.jobs[0].SetKeyMaterial(ReadBlob("km1_sw_ecdsa_256.blob"));
+    MigrateKeyBlobsResponse response;
+    keymaster_.MigrateKeyBlobs(request, &response);
+    ASSERT_EQ(KM_ERROR_OK, response.error);
+    ASSERT_EQ(KM_ERROR_OK, response.results[0].error);
+
+    // Migrating the migrated blob again is a no-op.
+    request.jobs[0].SetKeyMaterial(response.results[0].key_blob);
+    MigrateKeyBlobsResponse second_response;
+    keymaster_.MigrateKeyBlobs(request, &second_response);
+    ASSERT_EQ(KM_ERROR_OK, second_response.error);
+    ASSERT_EQ(1U, second_response.num_results);
+    EXPECT_EQ(KM_ERROR_OK, second_response.results[0].error);
+    EXPECT_EQ(0U, second_response.results[0].key_blob.key_material_size);
+}
+
+TEST_F(MigrateKeyBlobsTest, V0BlobsAreCompacted) {
+    UniquePtr<Key> key;
+    ASSERT_EQ(KM_ERROR_OK,
+              context_.ParseKeyBlob(ReadBlob("km1_sw_ecdsa_256.blob"), AuthorizationSet(), &key));
+    AuthorizationSet hidden;
+    ASSERT_EQ(KM_ERROR_OK,
+              BuildHiddenAuthorizations(AuthorizationSet(), &hidden, softwareRootOfTrust));
+    KeymasterKeyBlob v0_blob;
+    ASSERT_EQ(KM_ERROR_OK, SerializeIntegrityAssuredBlob(key->key_material(), hidden,
+                                                         key->hw_enforced(), key->sw_enforced(),
+                                                         &v0_blob, INTEGRITY_ASSURED_BLOB_V0));
+
+    MigrateKeyBlobsRequest request;
+    ASSERT_TRUE(request.AllocateJobs(1));
+    request.jobs[0].SetKeyMaterial(v0_blob);
+    MigrateKeyBlobsResponse response;
+    keymaster_.MigrateKeyBlobs(request, &response);
+    ASSERT_EQ(KM_ERROR_OK, response.error);
+    ASSERT_EQ(KM_ERROR_OK, response.results[0].error);
+    const KeymasterKeyBlob& migrated = response.results[0].key_blob;
+    ASSERT_GT(migrated.key_material_size, 0U);
+    EXPECT_EQ(INTEGRITY_ASSURED_BLOB_COMPACT, migrated.key_material[0]);
+    EXPECT_LT(migrated.key_material_size, v0_blob.key_material_size);
+    ExpectSameKey(v0_blob, migrated);
+}
+
+TEST_F(MigrateKeyBlobsTest, WrongApplicationId) {
+    MigrateKeyBlobsRequest request;
+    ASSERT_TRUE(request.AllocateJobs(1));
+    request.jobs[0].SetKeyMaterial(ReadBlob("km1_sw_rsa_512.blob"));
+    request.jobs[0].additional_params.push_back(TAG_APPLICATION_ID, "wrong", 5);
+    MigrateKeyBlobsResponse response;
+    keymaster_.MigrateKeyBlobs(request, &response);
+    ASSERT_EQ(KM_ERROR_OK, response.error);
+    ASSERT_EQ(1U, response.num_results);
+    EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB, response.results[0].error);
+}
+
+TEST_F(MigrateKeyBlobsTest, ManyJobs) {
+    // Enough jobs that the context's thread pool, if it has one, gets several per thread.
+    const size_t kNumJobs = 64;
+    KeymasterKeyBlob legacy_blob = ReadBlob("km1_sw_rsa_512.blob");
+    MigrateKeyBlobsRequest request;
+    ASSERT_TRUE(request.AllocateJobs(kNumJobs));
+    for (size_t i = 0; i < kNumJobs; ++i)
+        request.jobs[i].SetKeyMaterial(legacy_blob);
+
+    MigrateKeyBlobsResponse response;
+    keymaster_.MigrateKeyBlobs(request, &response);
+    ASSERT_EQ(KM_ERROR_OK, response.error);
+    ASSERT_EQ(kNumJobs, response.num_results);
+    for (size_t i = 0; i < kNumJobs; ++i) {
+        ASSERT_EQ(KM_ERROR_OK, response.results[i].error) << "Job " << i;
+        ExpectSameKey(legacy_blob, response.results[i].key_blob);
+    }
+}
+
+class BatchUpgradeKeyTest : public testing::Test {
+  public:
+    BatchUpgradeKeyTest() : keymaster_(new TestKeymasterContext, 16) {}
+
+  protected:
+    void Configure(uint32_t os_patchlevel) {
+        ConfigureRequest configReq;
+        configReq.os_version = kOsVersion;
+        configReq.os_patchlevel = os_patchlevel;
+        ConfigureResponse configRsp;
+        keymaster_.Configure(configReq, &configRsp);
+        EXPECT_EQ(KM_ERROR_OK, configRsp.error);
+    }
+
+    KeymasterKeyBlob GenerateKey(const AuthorizationSetBuilder& builder) {
+        GenerateKeyRequest req;
+        req.key_description = builder.build();
+        GenerateKeyResponse rsp;
+        keymaster_.GenerateKey(req, &rsp);
+        EXPECT_EQ(KM_ERROR_OK, rsp.error);
+        return KeymasterKeyBlob(rsp.key_blob);
+    }
+
+    uint32_t KeyPatchlevel(const KeymasterKeyBlob& key) {
+        GetKeyCharacteristicsRequest req;
+        req.SetKeyMaterial(key);
+        GetKeyCharacteristicsResponse rsp;
+        keymaster_.GetKeyCharacteristics(req, &rsp);
+        EXPECT_EQ(KM_ERROR_OK, rsp.error);
+        uint32_t patchlevel = 0;
+        EXPECT_TRUE(rsp.enforced.GetTagValue(TAG_OS_PATCHLEVEL, &patchlevel) ||
+                    rsp.unenforced.GetTagValue(TAG_OS_PATCHLEVEL, &patchlevel));
+        return patchlevel;
+    }
+
+    AndroidKeymaster keymaster_;
+};
+
+TEST_F(BatchUpgradeKeyTest, PerItemResults) {
+    Configure(kOsPatchLevel);
+    KeymasterKeyBlob aes_key =
+        GenerateKey(AuthorizationSetBuilder().AesEncryptionKey(128).EcbMode().Padding(KM_PAD_NONE));
+    KeymasterKeyBlob ec_key =
+        GenerateKey(AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_SHA_2_256));
+    KeymasterKeyBlob corrupt_aes_key(aes_key);
+    ++corrupt_aes_key.writable_data()[corrupt_aes_key.key_material_size / 2];
+
+    Configure(kOsPatchLevel + 1);
+    KeymasterKeyBlob current_key =
+        GenerateKey(AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_SHA_2_256));
+    Configure(kOsPatchLevel + 2);
+    KeymasterKeyBlob future_key =
+        GenerateKey(AuthorizationSetBuilder().AesEncryptionKey(128).EcbMode().Padding(KM_PAD_NONE));
+    Configure(kOsPatchLevel + 1);
+
+    BatchUpgradeKeyRequest request;
+    ASSERT_TRUE(request.AllocateKeyBlobs(5));
+    request.key_blobs[0] = aes_key;
+    request.key_blobs[1] = ec_key;
+    request.key_blobs[2] = corrupt_aes_key;
+    request.key_blobs[3] = current_key;
+    request.key_blobs[4] = future_key;
+
+    BatchUpgradeKeyResponse response;
+    keymaster_.BatchUpgradeKey(request, &response);
+    ASSERT_EQ(KM_ERROR_OK, response.error);
+    ASSERT_EQ(5U, response.num_results);
+    ASSERT_EQ(KM_ERROR_OK, response.results[0].error);
+    EXPECT_EQ(kOsPatchLevel + 1, KeyPatchlevel(response.results[0].key_blob));
+    ASSERT_EQ(KM_ERROR_OK, response.results[1].error);
+    EXPECT_EQ(kOsPatchLevel + 1, KeyPatchlevel(response.results[1].key_blob));
+    EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB, response.results[2].error);
+    EXPECT_EQ(KM_ERROR_OK, response.results[3].error);
+    EXPECT_EQ(0U, response.results[3].key_blob.key_material_size);
+    EXPECT_EQ(KM_ERROR_INVALID_ARGUMENT, response.results[4].error);
+}
+
+TEST_F(BatchUpgradeKeyTest, MatchesUpgradeKey) {
+    // Enough blobs that the context's thread pool, if it has one, gets several per thread.
+    const size_t kNumBlobs = 64;
+    Configure(kOsPatchLevel);
+    BatchUpgradeKeyRequest request;
+    ASSERT_TRUE(request.AllocateKeyBlobs(kNumBlobs));
+    for (size_t i = 0; i < kNumBlobs; ++i)
+        request.key_blobs[i] = GenerateKey(
+            AuthorizationSetBuilder().AesEncryptionKey(128).EcbMode().Padding(KM_PAD_NONE));
+    Configure(kOsPatchLevel + 1);
+
+    BatchUpgradeKeyResponse response;
+    keymaster_.BatchUpgradeKey(request, &response);
+    ASSERT_EQ(KM_ERROR_OK, response.error);
+    ASSERT_EQ(kNumBlobs, response.num_results);
+    for (size_t i = 0; i < kNumBlobs; ++i) {
+        UpgradeKeyRequest upgrade_req;
+        upgrade_req.SetKeyMaterial(request.key_blobs[i]);
+        UpgradeKeyResponse upgrade_rsp;
+        keymaster_.UpgradeKey(upgrade_req, &upgrade_rsp);
+        ASSERT_EQ(KM_ERROR_OK, upgrade_rsp.error);
+
+        // Software blobs are deterministic, so the batch must produce exactly the same bytes.
+        const KeyBlobResult& result = response.results[i];
+        ASSERT_EQ(KM_ERROR_OK, result.error) << "Blob " << i;
+        ASSERT_EQ(upgrade_rsp.upgraded_key.key_material_size, result.key_blob.key_material_size);
+        EXPECT_EQ(0, memcmp(upgrade_rsp.upgraded_key.key_material, result.key_blob.key_material,
+                            result.key_blob.key_material_size));
+    }
+}
+
 typedef Keymaster2Test EncryptionOperationsTest;
 INSTANTIATE_TEST_CASE_P(AndroidKeymasterTest, EncryptionOperationsTest, test_params);
 
@@ -3376,6 +3958,185 @@ TEST_P(EncryptionOperationsTest, AesGcmCorruptTag) {
     EXPECT_EQ(0, GetParam()->keymaster0_calls());
 }
 
+#if defined(OPENSSL_IS_BORINGSSL)
+
+// The AEAD test vector from RFC 8439 section 2.8.2.
+TEST_P(EncryptionOperationsTest, AesChaCha20Poly1305TestVector) {
+    string key = hex2str("808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f");
+    string nonce = hex2str("070000004041424344454647");
+    string aad = hex2str("50515253c0c1c2c3c4c5c6c7");
+    string message = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip "
+                     "for the future, sunscreen would be it.";
+    string expected = hex2str("d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+                              "3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+                              "92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+                              "3ff4def08e4b7a9de576d26586cec64b6116"
+                              "1ae10b594f09e26a7e902ecbd0600691");
+    ASSERT_EQ(KM_ERROR_OK, ImportKey(AuthorizationSetBuilder()
+                                         .AesEncryptionKey(256)
+                                         .Authorization(TAG_BLOCK_MODE, KM_MODE_CHACHA20_POLY1305)
+                                         .Authorization(TAG_PADDING, KM_PAD_NONE)
+                                         .Authorization(TAG_CALLER_NONCE),
+                                     KM_KEY_FORMAT_RAW, key));
+
+    AuthorizationSet begin_params(client_params());
+    begin_params.push_back(TAG_BLOCK_MODE, KM_MODE_CHACHA20_POLY1305);
+    begin_params.push_back(TAG_PADDING, KM_PAD_NONE);
+    begin_params.push_back(TAG_NONCE, nonce.data(), nonce.size());
+    AuthorizationSet update_params;
+    update_params.push_back(TAG_ASSOCIATED_DATA, aad.data(), aad.size());
+
+    // In one piece.
+    string ciphertext =
+        ProcessMessage(KM_PURPOSE_ENCRYPT, message, begin_params, update_params, nullptr);
+    EXPECT_EQ(expected, ciphertext);
+
+    // In pieces that don't line up with ChaCha20's 64-byte blocks.
+    EXPECT_EQ(KM_ERROR_OK, BeginOperation(KM_PURPOSE_ENCRYPT, begin_params));
+    AuthorizationSet update_out_params;
+    size_t input_consumed;
+    ciphertext.clear();
+    EXPECT_EQ(KM_ERROR_OK, UpdateOperation(update_params, message.substr(0, 7),
+                                           &update_out_params, &ciphertext, &input_consumed));
+    for (size_t i = 7; i < message.size(); i += 61)
+        EXPECT_EQ(KM_ERROR_OK,
+                  UpdateOperation(message.substr(i, 61), &ciphertext, &input_consumed));
+    EXPECT_EQ(KM_ERROR_OK, FinishOperation(&ciphertext));
+    EXPECT_EQ(expected, ciphertext);
+
+    EXPECT_EQ(KM_ERROR_OK, BeginOperation(KM_PURPOSE_DECRYPT, begin_params));
+    string plaintext;
+    EXPECT_EQ(KM_ERROR_OK, UpdateOperation(update_params, ciphertext.substr(0, 5),
+                                           &update_out_params, &plaintext, &input_consumed));
+    for (size_t i = 5; i < ciphertext.size(); i += 29)
+        EXPECT_EQ(KM_ERROR_OK,
+                  UpdateOperation(ciphertext.substr(i, 29), &plaintext, &input_consumed));
+    EXPECT_EQ(KM_ERROR_OK, FinishOperation(&plaintext));
+    EXPECT_EQ(message, plaintext);
+
+    EXPECT_EQ(0, GetParam()->keymaster0_calls());
+}
+
+TEST_P(EncryptionOperationsTest, AesChaCha20Poly1305AadNoData) {
+    ASSERT_EQ(KM_ERROR_OK, GenerateKey(AuthorizationSetBuilder()
+                                           .AesEncryptionKey(256)
+                                           .Authorization(TAG_BLOCK_MODE, KM_MODE_CHACHA20_POLY1305)
+                                           .Authorization(TAG_PADDING, KM_PAD_NONE)));
+    string aad = "123456789012345678";
+    AuthorizationSet begin_params(client_params());
+    begin_params.push_back(TAG_BLOCK_MODE, KM_MODE_CHACHA20_POLY1305);
+    begin_params.push_back(TAG_PADDING, KM_PAD_NONE);
+    AuthorizationSet update_params;
+    update_params.push_back(TAG_ASSOCIATED_DATA, aad.data(), aad.size());
+
+    AuthorizationSet begin_out_params;
+    string tag = ProcessMessage(KM_PURPOSE_ENCRYPT, "", begin_params, update_params,
+                                &begin_out_params);
+    EXPECT_EQ(16U, tag.size());
+
+    // The associated data is all that the tag covers, so it must match.
+    begin_params.push_back(begin_out_params);
+    EXPECT_EQ("", ProcessMessage(KM_PURPOSE_DECRYPT, tag, begin_params, update_params));
+
+    AuthorizationSet bad_update_params;
+    bad_update_params.push_back(TAG_ASSOCIATED_DATA, "123456789012345679", 18);
+    EXPECT_EQ(KM_ERROR_OK, BeginOperation(KM_PURPOSE_DECRYPT, begin_params));
+    AuthorizationSet update_out_params;
+    string plaintext;
+    size_t input_consumed;
+    EXPECT_EQ(KM_ERROR_OK, UpdateOperation(bad_update_params, tag, &update_out_params, &plaintext,
+                                           &input_consumed));
+    EXPECT_EQ(KM_ERROR_VERIFICATION_FAILED, FinishOperation(&plaintext));
+
+    EXPECT_EQ(0, GetParam()->keymaster0_calls());
+}
+
+TEST_P(EncryptionOperationsTest, AesChaCha20Poly1305CorruptTag) {
+    ASSERT_EQ(KM_ERROR_OK, GenerateKey(AuthorizationSetBuilder()
+                                           .AesEncryptionKey(256)
+                                           .Authorization(TAG_BLOCK_MODE, KM_MODE_CHACHA20_POLY1305)
+                                           .Authorization(TAG_PADDING, KM_PAD_NONE)));
+    string message = "123456789012345678901234567890123456";
+    AuthorizationSet begin_params(client_params());
+    begin_params.push_back(TAG_BLOCK_MODE, KM_MODE_CHACHA20_POLY1305);
+    begin_params.push_back(TAG_PADDING, KM_PAD_NONE);
+
+    AuthorizationSet begin_out_params;
+    string ciphertext = ProcessMessage(KM_PURPOSE_ENCRYPT, message, begin_params,
+                                       AuthorizationSet(), &begin_out_params);
+    EXPECT_EQ(message.size() + 16, ciphertext.size());
+
+    // Corrupt tag
+    (*ciphertext.rbegin())++;
+
+    begin_params.push_back(begin_out_params);
+    EXPECT_EQ(KM_ERROR_OK, BeginOperation(KM_PURPOSE_DECRYPT, begin_params));
+    string plaintext;
+    size_t input_consumed;
+    EXPECT_EQ(KM_ERROR_OK, UpdateOperation(ciphertext, &plaintext, &input_consumed));
+    EXPECT_EQ(KM_ERROR_VERIFICATION_FAILED, FinishOperation(&plaintext));
+
+    EXPECT_EQ(0, GetParam()->keymaster0_calls());
+}
+
+TEST_P(EncryptionOperationsTest, AesChaCha20Poly1305BadParams) {
+    // ChaCha20 keys are 256 bits.
+    EXPECT_EQ(KM_ERROR_UNSUPPORTED_KEY_SIZE,
+              GenerateKey(AuthorizationSetBuilder()
+                              .AesEncryptionKey(128)
+                              .Authorization(TAG_BLOCK_MODE, KM_MODE_CHACHA20_POLY1305)
+                              .Authorization(TAG_PADDING, KM_PAD_NONE)));
+
+    // The key material can't double as an AES key.
+    EXPECT_EQ(KM_ERROR_INCOMPATIBLE_BLOCK_MODE,
+              GenerateKey(AuthorizationSetBuilder()
+                              .AesEncryptionKey(256)
+                              .Authorization(TAG_BLOCK_MODE, KM_MODE_CHACHA20_POLY1305)
+                              .Authorization(TAG_BLOCK_MODE, KM_MODE_CTR)
+                              .Authorization(TAG_PADDING, KM_PAD_NONE)));
+    EXPECT_EQ(KM_ERROR_INCOMPATIBLE_BLOCK_MODE,
+              ImportKey(AuthorizationSetBuilder()
+                            .AesEncryptionKey(256)
+                            .Authorization(TAG_BLOCK_MODE, KM_MODE_ECB)
+                            .Authorization(TAG_BLOCK_MODE, KM_MODE_CHACHA20_POLY1305)
+                            .Authorization(TAG_PADDING, KM_PAD_NONE),
+                        KM_KEY_FORMAT_RAW, string(32, 'k')));
+
+    ASSERT_EQ(KM_ERROR_OK, GenerateKey(AuthorizationSetBuilder()
+                                           .AesEncryptionKey(256)
+                                           .Authorization(TAG_BLOCK_MODE, KM_MODE_CHACHA20_POLY1305)
+                                           .Authorization(TAG_PADDING, KM_PAD_NONE)
+                                           .Authorization(TAG_CALLER_NONCE)));
+
+    // Poly1305 tags can't be truncated.
+    AuthorizationSet begin_params(client_params());
+    begin_params.push_back(TAG_BLOCK_MODE, KM_MODE_CHACHA20_POLY1305);
+    begin_params.push_back(TAG_PADDING, KM_PAD_NONE);
+    begin_params.push_back(TAG_MAC_LENGTH, 96);
+    EXPECT_EQ(KM_ERROR_UNSUPPORTED_MAC_LENGTH, BeginOperation(KM_PURPOSE_ENCRYPT, begin_params));
+
+    // The nonce is 12 bytes.
+    begin_params.Reinitialize(client_params());
+    begin_params.push_back(TAG_BLOCK_MODE, KM_MODE_CHACHA20_POLY1305);
+    begin_params.push_back(TAG_PADDING, KM_PAD_NONE);
+    begin_params.push_back(TAG_NONCE, "0123456789abcdef", 16);
+    EXPECT_EQ(KM_ERROR_INVALID_NONCE, BeginOperation(KM_PURPOSE_ENCRYPT, begin_params));
+
+    EXPECT_EQ(0, GetParam()->keymaster0_calls());
+}
+
+#else  // OPENSSL_IS_BORINGSSL
+
+TEST_P(EncryptionOperationsTest, AesChaCha20Poly1305Unsupported) {
+    EXPECT_EQ(KM_ERROR_UNSUPPORTED_BLOCK_MODE,
+              GenerateKey(AuthorizationSetBuilder()
+                              .AesEncryptionKey(256)
+                              .Authorization(TAG_BLOCK_MODE, KM_MODE_CHACHA20_POLY1305)
+                              .Authorization(TAG_PADDING, KM_PAD_NONE)));
+}
+
+#endif  // OPENSSL_IS_BORINGSSL
+
 TEST_P(EncryptionOperationsTest, TripleDesEcbRoundTripSuccess) {
     auto auths = AuthorizationSetBuilder()
                      .TripleDesEncryptionKey(112)
@@ -4480,5 +5241,1226 @@ TEST_F(HmacKeySharingTest, ComputeSharedHmacCorruptSeed) {
     }
 }
 
+class KeyHandleTest : public testing::Test {
+  public:
+    KeyHandleTest()
+        : context_(new TestKeymasterContext), keymaster_(context_, 16, 2 /* key handles */) {
+        Configure(kOsPatchLevel);
+    }
+
+  protected:
+    void Configure(uint32_t os_patchlevel) {
+        ConfigureRequest req;
+        req.os_version = kOsVersion;
+        req.os_patchlevel = os_patchlevel;
+        ConfigureResponse rsp;
+        keymaster_.Configure(req, &rsp);
+        EXPECT_EQ(KM_ERROR_OK, rsp.error);
+    }
+
+    KeymasterKeyBlob GenerateKey(const AuthorizationSetBuilder& builder) {
+        GenerateKeyRequest req;
+        req.key_description = builder.build();
+        GenerateKeyResponse rsp;
+        keymaster_.GenerateKey(req, &rsp);
+        EXPECT_EQ(KM_ERROR_OK, rsp.error);
+        return KeymasterKeyBlob(rsp.key_blob);
+    }
+
+    KeymasterKeyBlob GenerateHmacKey() {
+        return GenerateKey(AuthorizationSetBuilder()
+                               .HmacKey(128)
+                               .Digest(KM_DIGEST_SHA_2_256)
+                               .Authorization(TAG_MIN_MAC_LENGTH, 256));
+    }
+
+    keymaster_error_t
+    LoadKeyHandle(const KeymasterKeyBlob& key_blob, uint64_t* key_handle,
+                  const AuthorizationSet& additional_params = AuthorizationSet()) {
+        LoadKeyHandleRequest req;
+        req.SetKeyMaterial(key_blob);
+        req.additional_params = additional_params;
+        LoadKeyHandleResponse rsp;
+        keymaster_.LoadKeyHandle(req, &rsp);
+        *key_handle = rsp.key_handle;
+        return rsp.error;
+    }
+
+    keymaster_error_t UnloadKeyHandle(uint64_t key_handle) {
+        UnloadKeyHandleRequest req;
+        req.key_handle = key_handle;
+        UnloadKeyHandleResponse rsp;
+        keymaster_.UnloadKeyHandle(req, &rsp);
+        return rsp.error;
+    }
+
+    static AuthorizationSet MacParams() {
+        return AuthorizationSetBuilder()
+            .Digest(KM_DIGEST_SHA_2_256)
+            .Authorization(TAG_MAC_LENGTH, 256)
+            .build();
+    }
+
+    // Finishes the operation |begin| started, MACing a fixed message.
+    keymaster_error_t FinishMac(const BeginOperationResponse& begin, string* mac) {
+        if (begin.error != KM_ERROR_OK)
+            return begin.error;
+        FinishOperationRequest req;
+        req.op_handle = begin.op_handle;
+        req.input.Reinitialize("Hello, handles", 14);
+        FinishOperationResponse rsp;
+        keymaster_.FinishOperation(req, &rsp);
+        if (rsp.error == KM_ERROR_OK)
+            mac->assign(reinterpret_cast<const char*>(rsp.output.peek_read()),
+                        rsp.output.available_read());
+        return rsp.error;
+    }
+
+    keymaster_error_t MacWithBlob(const KeymasterKeyBlob& key_blob, string* mac) {
+        BeginOperationRequest req;
+        req.purpose = KM_PURPOSE_SIGN;
+        req.SetKeyMaterial(key_blob);
+        req.additional_params = MacParams();
+        BeginOperationResponse rsp;
+        keymaster_.BeginOperation(req, &rsp);
+        return FinishMac(rsp, mac);
+    }
+
+    keymaster_error_t MacWithHandle(uint64_t key_handle, string* mac) {
+        BeginOperationWithKeyHandleRequest req;
+        req.purpose = KM_PURPOSE_SIGN;
+        req.key_handle = key_handle;
+        req.additional_params = MacParams();
+        BeginOperationResponse rsp;
+        keymaster_.BeginOperationWithKeyHandle(req, &rsp);
+        return FinishMac(rsp, mac);
+    }
+
+    keymaster_error_t EcdsaSignWithHandle(uint64_t key_handle, string* signature) {
+        BeginOperationWithKeyHandleRequest req;
+        req.purpose = KM_PURPOSE_SIGN;
+        req.key_handle = key_handle;
+        req.additional_params = AuthorizationSetBuilder().Digest(KM_DIGEST_SHA_2_256).build();
+        BeginOperationResponse begin;
+        keymaster_.BeginOperationWithKeyHandle(req, &begin);
+        return FinishMac(begin, signature);
+    }
+
+    keymaster_error_t EcdsaVerifyWithBlob(const KeymasterKeyBlob& key_blob,
+                                          const string& signature) {
+        BeginOperationRequest begin_req;
+        begin_req.purpose = KM_PURPOSE_VERIFY;
+        begin_req.SetKeyMaterial(key_blob);
+        begin_req.additional_params = AuthorizationSetBuilder().Digest(KM_DIGEST_SHA_2_256).build();
+        BeginOperationResponse begin;
+        keymaster_.BeginOperation(begin_req, &begin);
+        if (begin.error != KM_ERROR_OK)
+            return begin.error;
+
+        FinishOperationRequest req;
+        req.op_handle = begin.op_handle;
+        req.input.Reinitialize("Hello, handles", 14);
+        req.signature.Reinitialize(signature.data(), signature.size());
+        FinishOperationResponse rsp;
+        keymaster_.FinishOperation(req, &rsp);
+        return rsp.error;
+    }
+
+    // Parses |key_blob| twice and shares the first key's operation state with the second, the way
+    // KeyHandleTable does, returning the second key's precomputed EVP_PKEY.
+    EVP_PKEY* SharedPrecomputedPkey(const KeymasterKeyBlob& key_blob, UniquePtr<Key>* stored,
+                                    UniquePtr<Key>* rebuilt) {
+        EXPECT_EQ(KM_ERROR_OK, context_->ParseKeyBlob(key_blob, AuthorizationSet(), stored));
+        EXPECT_EQ(KM_ERROR_OK, context_->ParseKeyBlob(key_blob, AuthorizationSet(), rebuilt));
+        if (!stored->get() || !rebuilt->get())
+            return nullptr;
+        (*rebuilt)->ShareOperationState(stored->get());
+        return static_cast<EcKey&>(**rebuilt).precomputed_pkey();
+    }
+
+    // Encrypts or decrypts |input| in one step with the key in |key_blob|, or with |key_handle| if
+    // |key_blob| is null, using a fixed nonce so that results can be compared.
+    keymaster_error_t AesCrypt(keymaster_purpose_t purpose, const KeymasterKeyBlob* key_blob,
+                               uint64_t key_handle, keymaster_block_mode_t block_mode,
+                               const string& input, string* output) {
+        AuthorizationSetBuilder params;
+        params.BlockMode(block_mode).Padding(KM_PAD_NONE);
+        if (block_mode == KM_MODE_GCM)
+            params.Authorization(TAG_NONCE, "0123456789ab", 12).Authorization(TAG_MAC_LENGTH, 128);
+        else if (block_mode != KM_MODE_ECB)
+            params.Authorization(TAG_NONCE, "0123456789abcdef", 16);
+
+        BeginOperationResponse begin;
+        if (key_blob) {
+            BeginOperationRequest req;
+            req.purpose = purpose;
+            req.SetKeyMaterial(*key_blob);
+            req.additional_params = params.build();
+            keymaster_.BeginOperation(req, &begin);
+        } else {
+            BeginOperationWithKeyHandleRequest req;
+            req.purpose = purpose;
+            req.key_handle = key_handle;
+            req.additional_params = params.build();
+            keymaster_.BeginOperationWithKeyHandle(req, &begin);
+        }
+        if (begin.error != KM_ERROR_OK)
+            return begin.error;
+
+        FinishOperationRequest req;
+        req.op_handle = begin.op_handle;
+        req.input.Reinitialize(input.data(), input.size());
+        FinishOperationResponse rsp;
+        keymaster_.FinishOperation(req, &rsp);
+        if (rsp.error == KM_ERROR_OK)
+            output->assign(reinterpret_cast<const char*>(rsp.output.peek_read()),
+                           rsp.output.available_read());
+        return rsp.error;
+    }
+
+    TestKeymasterContext* context_;  // Owned by keymaster_.
+    AndroidKeymaster keymaster_;
+};
+
+TEST_F(KeyHandleTest, BeginMatchesBlob) {
+    KeymasterKeyBlob key_blob = GenerateHmacKey();
+    uint64_t key_handle;
+    ASSERT_EQ(KM_ERROR_OK, LoadKeyHandle(key_blob, &key_handle));
+    EXPECT_NE(0U, key_handle);
+
+    string blob_mac, handle_mac;
+    ASSERT_EQ(KM_ERROR_OK, MacWithBlob(key_blob, &blob_mac));
+    ASSERT_EQ(KM_ERROR_OK, MacWithHandle(key_handle, &handle_mac));
+    EXPECT_EQ(32U, handle_mac.size());
+    EXPECT_EQ(blob_mac, handle_mac);
+
+    // A handle can be used any number of times.
+    ASSERT_EQ(KM_ERROR_OK, MacWithHandle(key_handle, &handle_mac));
+    EXPECT_EQ(blob_mac, handle_mac);
+}
+
+TEST_F(KeyHandleTest, EnforcesKeyPolicy) {
+    // Handles carry the enforcement policy compiled when they were loaded, so operations begun with
+    // one must be authorized exactly as ones begun with the blob, each time.
+    KeymasterKeyBlob key_blob = GenerateKey(AuthorizationSetBuilder()
+                                                .HmacKey(128)
+                                                .Digest(KM_DIGEST_SHA_2_256)
+                                                .Authorization(TAG_MIN_MAC_LENGTH, 256)
+                                                .Authorization(TAG_USER_SECURE_ID, 7)
+                                                .Authorization(TAG_USER_SECURE_ID, 8)
+                                                .Authorization(TAG_USER_AUTH_TYPE, HW_AUTH_PASSWORD)
+                                                .Authorization(TAG_AUTH_TIMEOUT, 300));
+    uint64_t key_handle;
+    ASSERT_EQ(KM_ERROR_OK, LoadKeyHandle(key_blob, &key_handle));
+
+    string mac;
+    keymaster_error_t blob_error = MacWithBlob(key_blob, &mac);
+    EXPECT_NE(KM_ERROR_OK, blob_error);
+    for (int i = 0; i < 2; ++i)
+        EXPECT_EQ(blob_error, MacWithHandle(key_handle, &mac));
+}
+
+TEST_F(KeyHandleTest, AesMatchesBlob) {
+    KeymasterKeyBlob key_blob = GenerateKey(AuthorizationSetBuilder()
+                                                .AesEncryptionKey(128)
+                                                .BlockMode(KM_MODE_ECB)
+                                                .BlockMode(KM_MODE_CBC)
+                                                .BlockMode(KM_MODE_CTR)
+                                                .BlockMode(KM_MODE_GCM)
+                                                .Padding(KM_PAD_NONE)
+                                                .Authorization(TAG_CALLER_NONCE)
+                                                .Authorization(TAG_MIN_MAC_LENGTH, 128));
+    uint64_t key_handle;
+    ASSERT_EQ(KM_ERROR_OK, LoadKeyHandle(key_blob, &key_handle));
+
+    // Operations on a handle start from contexts keyed once for the handle, per mode and
+    // direction.  Use each one twice, so the second use copies a context the first one made.
+    const string message = "0123456789abcdef0123456789abcdef";
+    for (keymaster_block_mode_t mode : {KM_MODE_ECB, KM_MODE_CBC, KM_MODE_CTR, KM_MODE_GCM}) {
+        string blob_ciphertext;
+        ASSERT_EQ(KM_ERROR_OK,
+                  AesCrypt(KM_PURPOSE_ENCRYPT, &key_blob, 0, mode, message, &blob_ciphertext));
+        for (int i = 0; i < 2; ++i) {
+            string ciphertext, plaintext;
+            ASSERT_EQ(KM_ERROR_OK,
+                      AesCrypt(KM_PURPOSE_ENCRYPT, nullptr, key_handle, mode, message, &ciphertext));
+            EXPECT_EQ(blob_ciphertext, ciphertext) << "Mode " << mode;
+            ASSERT_EQ(KM_ERROR_OK, AesCrypt(KM_PURPOSE_DECRYPT, nullptr, key_handle, mode,
+                                            ciphertext, &plaintext));
+            EXPECT_EQ(message, plaintext) << "Mode " << mode;
+        }
+    }
+
+    // A bad tag must still fail with a copied GCM context.
+    string ciphertext, plaintext;
+    ASSERT_EQ(KM_ERROR_OK,
+              AesCrypt(KM_PURPOSE_ENCRYPT, nullptr, key_handle, KM_MODE_GCM, message, &ciphertext));
+    ciphertext[ciphertext.size() - 1] ^= 1;
+    EXPECT_EQ(KM_ERROR_VERIFICATION_FAILED, AesCrypt(KM_PURPOSE_DECRYPT, nullptr, key_handle,
+                                                     KM_MODE_GCM, ciphertext, &plaintext));
+}
+
+TEST_F(KeyHandleTest, ExportAndAttest) {
+    KeymasterKeyBlob key_blob =
+        GenerateKey(AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_SHA_2_256));
+    uint64_t key_handle;
+    ASSERT_EQ(KM_ERROR_OK, LoadKeyHandle(key_blob, &key_handle));
+
+    ExportKeyRequest export_req;
+    export_req.SetKeyMaterial(key_blob);
+    export_req.key_format = KM_KEY_FORMAT_X509;
+    ExportKeyResponse blob_export;
+    keymaster_.ExportKey(export_req, &blob_export);
+    ASSERT_EQ(KM_ERROR_OK, blob_export.error);
+
+    ExportKeyWithKeyHandleRequest handle_export_req;
+    handle_export_req.key_handle = key_handle;
+    handle_export_req.key_format = KM_KEY_FORMAT_X509;
+    ExportKeyResponse handle_export;
+    keymaster_.ExportKeyWithKeyHandle(handle_export_req, &handle_export);
+    ASSERT_EQ(KM_ERROR_OK, handle_export.error);
+    ASSERT_EQ(blob_export.key_data_length, handle_export.key_data_length);
+    EXPECT_EQ(0, memcmp(blob_export.key_data, handle_export.key_data,
+                        handle_export.key_data_length));
+
+    AttestKeyWithKeyHandleRequest attest_req;
+    attest_req.key_handle = key_handle;
+    attest_req.attest_params.push_back(TAG_ATTESTATION_CHALLENGE, "challenge", 9);
+    attest_req.attest_params.push_back(TAG_ATTESTATION_APPLICATION_ID, "attest_app_id", 13);
+    AttestKeyResponse attest_rsp;
+    keymaster_.AttestKeyWithKeyHandle(attest_req, &attest_rsp);
+    ASSERT_EQ(KM_ERROR_OK, attest_rsp.error);
+    EXPECT_GT(attest_rsp.certificate_chain.entry_count, 0U);
+}
+
+TEST_F(KeyHandleTest, EcdsaPrecomputedSigning) {
+    context_->set_precompute_ec_signing(true);
+    KeymasterKeyBlob key_blob =
+        GenerateKey(AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_SHA_2_256));
+
+    // Keys rebuilt from a handle's key share the EVP_PKEY precomputed in it.
+    UniquePtr<Key> stored, rebuilt;
+    EVP_PKEY* shared = SharedPrecomputedPkey(key_blob, &stored, &rebuilt);
+    ASSERT_TRUE(shared != nullptr);
+    EXPECT_EQ(static_cast<EcKey&>(*stored).precomputed_pkey(), shared);
+
+    // Signatures made from the precomputed state must verify with the blob.
+    uint64_t key_handle;
+    ASSERT_EQ(KM_ERROR_OK, LoadKeyHandle(key_blob, &key_handle));
+    for (int i = 0; i < 2; ++i) {
+        string signature;
+        ASSERT_EQ(KM_ERROR_OK, EcdsaSignWithHandle(key_handle, &signature));
+        EXPECT_EQ(KM_ERROR_OK, EcdsaVerifyWithBlob(key_blob, signature));
+    }
+}
+
+TEST_F(KeyHandleTest, EcdsaPrecomputationIsOptIn) {
+    KeymasterKeyBlob key_blob =
+        GenerateKey(AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_SHA_2_256));
+    UniquePtr<Key> stored, rebuilt;
+    EXPECT_TRUE(SharedPrecomputedPkey(key_blob, &stored, &rebuilt) == nullptr);
+    EXPECT_TRUE(static_cast<EcKey&>(*stored).precomputed_pkey() == nullptr);
+}
+
+TEST_F(KeyHandleTest, BoundToApplication) {
+    AuthorizationSet app_params =
+        AuthorizationSetBuilder().Authorization(TAG_APPLICATION_ID, "app_id", 6).build();
+    KeymasterKeyBlob key_blob = GenerateKey(AuthorizationSetBuilder()
+                                                .HmacKey(128)
+                                                .Digest(KM_DIGEST_SHA_2_256)
+                                                .Authorization(TAG_MIN_MAC_LENGTH, 256)
+                                                .Authorization(TAG_APPLICATION_ID, "app_id", 6));
+
+    uint64_t key_handle;
+    EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB, LoadKeyHandle(key_blob, &key_handle));
+    EXPECT_EQ(0U, key_handle);
+
+    // Once loaded with the right application ID, the handle doesn't need it again.
+    ASSERT_EQ(KM_ERROR_OK, LoadKeyHandle(key_blob, &key_handle, app_params));
+    string mac;
+    EXPECT_EQ(KM_ERROR_OK, MacWithHandle(key_handle, &mac));
+}
+
+TEST_F(KeyHandleTest, Unload) {
+    uint64_t key_handle;
+    ASSERT_EQ(KM_ERROR_OK, LoadKeyHandle(GenerateHmacKey(), &key_handle));
+    EXPECT_EQ(KM_ERROR_OK, UnloadKeyHandle(key_handle));
+    EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB, UnloadKeyHandle(key_handle));
+    EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB, UnloadKeyHandle(0));
+
+    string mac;
+    EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB, MacWithHandle(key_handle, &mac));
+}
+
+TEST_F(KeyHandleTest, EvictsLeastRecentlyUsed) {
+    uint64_t first, second, third;
+    ASSERT_EQ(KM_ERROR_OK, LoadKeyHandle(GenerateHmacKey(), &first));
+    ASSERT_EQ(KM_ERROR_OK, LoadKeyHandle(GenerateHmacKey(), &second));
+
+    // Using the first key makes the second the eviction candidate.
+    string mac;
+    ASSERT_EQ(KM_ERROR_OK, MacWithHandle(first, &mac));
+    ASSERT_EQ(KM_ERROR_OK, LoadKeyHandle(GenerateHmacKey(), &third));
+
+    EXPECT_EQ(KM_ERROR_OK, MacWithHandle(first, &mac));
+    EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB, MacWithHandle(second, &mac));
+    EXPECT_EQ(KM_ERROR_OK, MacWithHandle(third, &mac));
+}
+
+TEST_F(KeyHandleTest, DeletedKeys) {
+    KeymasterKeyBlob key_blob = GenerateHmacKey();
+    uint64_t key_handle;
+    ASSERT_EQ(KM_ERROR_OK, LoadKeyHandle(key_blob, &key_handle));
+    DeleteKeyRequest delete_req;
+    delete_req.SetKeyMaterial(key_blob);
+    DeleteKeyResponse delete_rsp;
+    keymaster_.DeleteKey(delete_req, &delete_rsp);
+    string mac;
+    EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB, MacWithHandle(key_handle, &mac));
+
+    ASSERT_EQ(KM_ERROR_OK, LoadKeyHandle(GenerateHmacKey(), &key_handle));
+    DeleteAllKeysResponse delete_all_rsp;
+    keymaster_.DeleteAllKeys(DeleteAllKeysRequest(), &delete_all_rsp);
+    EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB, MacWithHandle(key_handle, &mac));
+}
+
+TEST_F(KeyHandleTest, SystemUpdate) {
+    uint64_t key_handle;
+    ASSERT_EQ(KM_ERROR_OK, LoadKeyHandle(GenerateHmacKey(), &key_handle));
+    Configure(kOsPatchLevel + 1);
+    string mac;
+    EXPECT_EQ(KM_ERROR_KEY_REQUIRES_UPGRADE, MacWithHandle(key_handle, &mac));
+}
+
+class RestartOperationTest : public testing::Test {
+  public:
+    RestartOperationTest() : keymaster_(new TestKeymasterContext, 16) {
+        ConfigureRequest req;
+        req.os_version = kOsVersion;
+        req.os_patchlevel = kOsPatchLevel;
+        ConfigureResponse rsp;
+        keymaster_.Configure(req, &rsp);
+        EXPECT_EQ(KM_ERROR_OK, rsp.error);
+    }
+
+  protected:
+    KeymasterKeyBlob GenerateKey(const AuthorizationSetBuilder& builder) {
+        GenerateKeyRequest req;
+        req.key_description = builder.build();
+        GenerateKeyResponse rsp;
+        keymaster_.GenerateKey(req, &rsp);
+        EXPECT_EQ(KM_ERROR_OK, rsp.error);
+        return KeymasterKeyBlob(rsp.key_blob);
+    }
+
+    keymaster_error_t Begin(keymaster_purpose_t purpose, const KeymasterKeyBlob& key_blob,
+                            const AuthorizationSet& params, BeginOperationResponse* rsp) {
+        BeginOperationRequest req;
+        req.purpose = purpose;
+        req.SetKeyMaterial(key_blob);
+        req.additional_params = params;
+        keymaster_.BeginOperation(req, rsp);
+        return rsp->error;
+    }
+
+    // Runs |message| through a fresh operation, for comparison with a restarted one.
+    string ProcessMessage(keymaster_purpose_t purpose, const KeymasterKeyBlob& key_blob,
+                          const AuthorizationSet& params, const string& message) {
+        BeginOperationResponse begin;
+        EXPECT_EQ(KM_ERROR_OK, Begin(purpose, key_blob, params, &begin));
+        FinishOperationRequest req;
+        req.op_handle = begin.op_handle;
+        req.input.Reinitialize(message.data(), message.size());
+        FinishOperationResponse rsp;
+        keymaster_.FinishOperation(req, &rsp);
+        EXPECT_EQ(KM_ERROR_OK, rsp.error);
+        return string(reinterpret_cast<const char*>(rsp.output.peek_read()),
+                      rsp.output.available_read());
+    }
+
+    void FinishAndRestart(keymaster_operation_handle_t op_handle, const string& message,
+                          const AuthorizationSet& restart_params,
+                          FinishAndRestartOperationResponse* rsp) {
+        FinishAndRestartOperationRequest req;
+        req.op_handle = op_handle;
+        req.input.Reinitialize(message.data(), message.size());
+        req.restart_params = restart_params;
+        keymaster_.FinishAndRestartOperation(req, rsp);
+    }
+
+    static string output(const FinishAndRestartOperationResponse& rsp) {
+        return string(reinterpret_cast<const char*>(rsp.output.peek_read()),
+                      rsp.output.available_read());
+    }
+
+    AndroidKeymaster keymaster_;
+};
+
+TEST_F(RestartOperationTest, Hmac) {
+    KeymasterKeyBlob key_blob = GenerateKey(AuthorizationSetBuilder()
+                                                .HmacKey(128)
+                                                .Digest(KM_DIGEST_SHA_2_256)
+                                                .Authorization(TAG_MIN_MAC_LENGTH, 256));
+    AuthorizationSet params(AuthorizationSetBuilder()
+                                .Digest(KM_DIGEST_SHA_2_256)
+                                .Authorization(TAG_MAC_LENGTH, 256));
+    BeginOperationResponse begin;
+    ASSERT_EQ(KM_ERROR_OK, Begin(KM_PURPOSE_SIGN, key_blob, params, &begin));
+
+    keymaster_operation_handle_t op_handle = begin.op_handle;
+    for (const string& message : {"first message", "second", ""}) {
+        FinishAndRestartOperationResponse rsp;
+        FinishAndRestart(op_handle, message, params, &rsp);
+        ASSERT_EQ(KM_ERROR_OK, rsp.error);
+        ASSERT_EQ(KM_ERROR_OK, rsp.restart_error);
+        EXPECT_EQ(ProcessMessage(KM_PURPOSE_SIGN, key_blob, params, message), output(rsp));
+
+        // The restarted operation has a new handle, and the old one is gone.
+        EXPECT_NE(op_handle, rsp.op_handle);
+        EXPECT_FALSE(keymaster_.has_operation(op_handle));
+        EXPECT_TRUE(keymaster_.has_operation(rsp.op_handle));
+        op_handle = rsp.op_handle;
+    }
+}
+
+TEST_F(RestartOperationTest, RsaSign) {
+    KeymasterKeyBlob key_blob = GenerateKey(AuthorizationSetBuilder()
+                                                .RsaSigningKey(1024, 65537)
+                                                .Digest(KM_DIGEST_SHA_2_256)
+                                                .Padding(KM_PAD_RSA_PKCS1_1_5_SIGN));
+    AuthorizationSet params(AuthorizationSetBuilder()
+                                .Digest(KM_DIGEST_SHA_2_256)
+                                .Padding(KM_PAD_RSA_PKCS1_1_5_SIGN));
+    BeginOperationResponse begin;
+    ASSERT_EQ(KM_ERROR_OK, Begin(KM_PURPOSE_SIGN, key_blob, params, &begin));
+
+    // PKCS#1 v1.5 signatures are deterministic, so a restarted operation must match a fresh one.
+    keymaster_operation_handle_t op_handle = begin.op_handle;
+    for (const string& message : {"first message", "second"}) {
+        FinishAndRestartOperationResponse rsp;
+        FinishAndRestart(op_handle, message, params, &rsp);
+        ASSERT_EQ(KM_ERROR_OK, rsp.error);
+        ASSERT_EQ(KM_ERROR_OK, rsp.restart_error);
+        EXPECT_EQ(ProcessMessage(KM_PURPOSE_SIGN, key_blob, params, message), output(rsp));
+        op_handle = rsp.op_handle;
+    }
+}
+
+TEST_F(RestartOperationTest, AesGcmGetsNewNonce) {
+    KeymasterKeyBlob key_blob = GenerateKey(AuthorizationSetBuilder()
+                                                .AesEncryptionKey(128)
+                                                .Authorization(TAG_BLOCK_MODE, KM_MODE_GCM)
+                                                .Authorization(TAG_PADDING, KM_PAD_NONE)
+                                                .Authorization(TAG_MIN_MAC_LENGTH, 128));
+    AuthorizationSet params(AuthorizationSetBuilder()
+                                .Authorization(TAG_BLOCK_MODE, KM_MODE_GCM)
+                                .Authorization(TAG_PADDING, KM_PAD_NONE)
+                                .Authorization(TAG_MAC_LENGTH, 128));
+    BeginOperationResponse begin;
+    ASSERT_EQ(KM_ERROR_OK, Begin(KM_PURPOSE_ENCRYPT, key_blob, params, &begin));
+
+    keymaster_operation_handle_t op_handle = begin.op_handle;
+    AuthorizationSet nonce_params = begin.output_params;
+    for (const string& message : {"first message", "second"}) {
+        FinishAndRestartOperationResponse rsp;
+        FinishAndRestart(op_handle, message, params, &rsp);
+        ASSERT_EQ(KM_ERROR_OK, rsp.error);
+        ASSERT_EQ(KM_ERROR_OK, rsp.restart_error);
+
+        keymaster_blob_t nonce, new_nonce;
+        ASSERT_TRUE(nonce_params.GetTagValue(TAG_NONCE, &nonce));
+        ASSERT_TRUE(rsp.restart_output_params.GetTagValue(TAG_NONCE, &new_nonce));
+        ASSERT_EQ(nonce.data_length, new_nonce.data_length);
+        EXPECT_NE(0, memcmp(nonce.data, new_nonce.data, nonce.data_length));
+
+        AuthorizationSet decrypt_params(params);
+        decrypt_params.push_back(TAG_NONCE, nonce.data, nonce.data_length);
+        EXPECT_EQ(message, ProcessMessage(KM_PURPOSE_DECRYPT, key_blob, decrypt_params,
+                                          output(rsp)));
+
+        op_handle = rsp.op_handle;
+        nonce_params = rsp.restart_output_params;
+    }
+}
+
+TEST_F(RestartOperationTest, MaxUsesPerBoot) {
+    KeymasterKeyBlob key_blob = GenerateKey(AuthorizationSetBuilder()
+                                                .HmacKey(128)
+                                                .Digest(KM_DIGEST_SHA_2_256)
+                                                .Authorization(TAG_MIN_MAC_LENGTH, 256)
+                                                .Authorization(TAG_MAX_USES_PER_BOOT, 2));
+    AuthorizationSet params(AuthorizationSetBuilder()
+                                .Digest(KM_DIGEST_SHA_2_256)
+                                .Authorization(TAG_MAC_LENGTH, 256));
+    BeginOperationResponse begin;
+    ASSERT_EQ(KM_ERROR_OK, Begin(KM_PURPOSE_SIGN, key_blob, params, &begin));
+
+    // Restarting counts as a use.
+    FinishAndRestartOperationResponse rsp;
+    FinishAndRestart(begin.op_handle, "first", params, &rsp);
+    ASSERT_EQ(KM_ERROR_OK, rsp.error);
+    ASSERT_EQ(KM_ERROR_OK, rsp.restart_error);
+
+    keymaster_operation_handle_t op_handle = rsp.op_handle;
+    FinishAndRestart(op_handle, "second", params, &rsp);
+    EXPECT_EQ(KM_ERROR_OK, rsp.error);
+    EXPECT_EQ(32U, rsp.output.available_read());
+    EXPECT_EQ(KM_ERROR_KEY_MAX_OPS_EXCEEDED, rsp.restart_error);
+    EXPECT_EQ(0U, rsp.op_handle);
+    EXPECT_FALSE(keymaster_.has_operation(op_handle));
+}
+
+TEST_F(RestartOperationTest, Unsupported) {
+    KeymasterKeyBlob key_blob =
+        GenerateKey(AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_SHA_2_256));
+    AuthorizationSet params(AuthorizationSetBuilder().Digest(KM_DIGEST_SHA_2_256));
+    BeginOperationResponse begin;
+    ASSERT_EQ(KM_ERROR_OK, Begin(KM_PURPOSE_SIGN, key_blob, params, &begin));
+
+    // The operation is still finished, just not restarted.
+    FinishAndRestartOperationResponse rsp;
+    FinishAndRestart(begin.op_handle, "message", params, &rsp);
+    EXPECT_EQ(KM_ERROR_OK, rsp.error);
+    EXPECT_GT(rsp.output.available_read(), 0U);
+    EXPECT_EQ(KM_ERROR_UNIMPLEMENTED, rsp.restart_error);
+    EXPECT_EQ(0U, rsp.op_handle);
+    EXPECT_FALSE(keymaster_.has_operation(begin.op_handle));
+}
+
+/**
+ * TestKeymasterContext with a fixed number of concurrent tasks, so that operations take the same
+ * path whatever the machine running the test.
+ */
+class FixedConcurrencyKeymasterContext : public TestKeymasterContext {
+  public:
+    explicit FixedConcurrencyKeymasterContext(size_t max_concurrent_tasks)
+        : max_concurrent_tasks_(max_concurrent_tasks),
+          thread_pool_(max_concurrent_tasks > 1 ? max_concurrent_tasks - 1 : 1) {}
+
+    void RunTasks(size_t num_tasks, void (*task)(void* task_context, size_t index),
+                  void* task_context) const override {
+        thread_pool_.Run(num_tasks, task, task_context);
+    }
+    size_t max_concurrent_tasks() const override { return max_concurrent_tasks_; }
+
+  private:
+    const size_t max_concurrent_tasks_;
+    mutable ThreadPool thread_pool_;
+};
+
+/**
+ * Compares large AES CTR and GCM operations split across threads with the same operations done
+ * serially.
+ */
+class ParallelCipherTest : public testing::Test {
+  public:
+    ParallelCipherTest()
+        : serial_(new FixedConcurrencyKeymasterContext(1), 16),
+          parallel_(new FixedConcurrencyKeymasterContext(4), 16) {
+        Configure(&serial_);
+        Configure(&parallel_);
+
+        GenerateKeyRequest req;
+        req.key_description = AuthorizationSetBuilder()
+                                  .AesEncryptionKey(256)
+                                  .BlockMode(KM_MODE_CTR)
+                                  .BlockMode(KM_MODE_GCM)
+                                  .Padding(KM_PAD_NONE)
+                                  .Authorization(TAG_CALLER_NONCE)
+                                  .Authorization(TAG_MIN_MAC_LENGTH, 128)
+                                  .build();
+        GenerateKeyResponse rsp;
+        serial_.GenerateKey(req, &rsp);
+        EXPECT_EQ(KM_ERROR_OK, rsp.error);
+        key_blob_ = KeymasterKeyBlob(rsp.key_blob);
+
+        // Long enough to be split, and not a whole number of blocks.
+        message_.resize(3 * 1024 * 1024 + 37);
+        for (size_t i = 0; i < message_.size(); ++i)
+            message_[i] = static_cast<char>(i * 7 + (i >> 12));
+    }
+
+  protected:
+    static void Configure(AndroidKeymaster* keymaster) {
+        ConfigureRequest req;
+        req.os_version = kOsVersion;
+        req.os_patchlevel = kOsPatchLevel;
+        ConfigureResponse rsp;
+        keymaster->Configure(req, &rsp);
+        EXPECT_EQ(KM_ERROR_OK, rsp.error);
+    }
+
+    // Runs |input| through one operation, passing the first |update_lengths| bytes in separate
+    // Updates and the rest to Finish.  GCM operations get |aad| with the first Update.
+    keymaster_error_t Crypt(AndroidKeymaster* keymaster, keymaster_purpose_t purpose,
+                            keymaster_block_mode_t block_mode, const string& aad,
+                            const vector<size_t>& update_lengths, const string& input,
+                            string* output) {
+        AuthorizationSetBuilder params;
+        params.BlockMode(block_mode).Padding(KM_PAD_NONE);
+        if (block_mode == KM_MODE_GCM)
+            params.Authorization(TAG_NONCE, "0123456789ab", 12).Authorization(TAG_MAC_LENGTH, 128);
+        else
+            params.Authorization(TAG_NONCE, "0123456789abcde\xff", 16);
+
+        BeginOperationRequest begin_req;
+        begin_req.purpose = purpose;
+        begin_req.SetKeyMaterial(key_blob_);
+        begin_req.additional_params = params.build();
+        BeginOperationResponse begin_rsp;
+        keymaster->BeginOperation(begin_req, &begin_rsp);
+        if (begin_rsp.error != KM_ERROR_OK)
+            return begin_rsp.error;
+
+        output->clear();
+        size_t consumed = 0;
+        bool first = true;
+        for (size_t length : update_lengths) {
+            UpdateOperationRequest req;
+            req.op_handle = begin_rsp.op_handle;
+            req.input.Reinitialize(input.data() + consumed, length);
+            if (first && block_mode == KM_MODE_GCM)
+                req.additional_params.push_back(TAG_ASSOCIATED_DATA, aad.data(), aad.size());
+            first = false;
+            UpdateOperationResponse rsp;
+            keymaster->UpdateOperation(req, &rsp);
+            if (rsp.error != KM_ERROR_OK)
+                return rsp.error;
+            EXPECT_EQ(length, rsp.input_consumed);
+            consumed += length;
+            output->append(reinterpret_cast<const char*>(rsp.output.peek_read()),
+                           rsp.output.available_read());
+        }
+
+        FinishOperationRequest req;
+        req.op_handle = begin_rsp.op_handle;
+        req.input.Reinitialize(input.data() + consumed, input.size() - consumed);
+        if (first && block_mode == KM_MODE_GCM)
+            req.additional_params.push_back(TAG_ASSOCIATED_DATA, aad.data(), aad.size());
+        FinishOperationResponse rsp;
+        keymaster->FinishOperation(req, &rsp);
+        if (rsp.error == KM_ERROR_OK)
+            output->append(reinterpret_cast<const char*>(rsp.output.peek_read()),
+                           rsp.output.available_read());
+        return rsp.error;
+    }
+
+    // Ways of feeding message_ to an operation: all at once, after a short Update that leaves the
+    // stream unaligned, and with large Updates on either side of a short one.
+    static vector<vector<size_t>> Splits() {
+        return {{}, {3}, {3, 1024 * 1024 + 5}, {1024 * 1024 + 11, 5, 1024 * 1024}};
+    }
+
+    AndroidKeymaster serial_;
+    AndroidKeymaster parallel_;
+    KeymasterKeyBlob key_blob_;
+    string message_;
+};
+
+TEST_F(ParallelCipherTest, CtrMatchesSerial) {
+    string expected;
+    ASSERT_EQ(KM_ERROR_OK,
+              Crypt(&serial_, KM_PURPOSE_ENCRYPT, KM_MODE_CTR, "", {}, message_, &expected));
+    ASSERT_EQ(message_.size(), expected.size());
+
+    for (const vector<size_t>& split : Splits()) {
+        string ciphertext, plaintext;
+        ASSERT_EQ(KM_ERROR_OK, Crypt(&parallel_, KM_PURPOSE_ENCRYPT, KM_MODE_CTR, "", split,
+                                     message_, &ciphertext));
+        EXPECT_TRUE(expected == ciphertext) << "Split of " << split.size();
+        ASSERT_EQ(KM_ERROR_OK, Crypt(&parallel_, KM_PURPOSE_DECRYPT, KM_MODE_CTR, "", split,
+                                     ciphertext, &plaintext));
+        EXPECT_TRUE(message_ == plaintext) << "Split of " << split.size();
+    }
+}
+
+TEST_F(ParallelCipherTest, GcmMatchesSerial) {
+    // Not a whole number of blocks either.
+    const string aad = "associated data, 33 bytes long..";
+    for (const vector<size_t>& split : Splits()) {
+        string expected, ciphertext, plaintext;
+        ASSERT_EQ(KM_ERROR_OK, Crypt(&serial_, KM_PURPOSE_ENCRYPT, KM_MODE_GCM, aad, split,
+                                     message_, &expected));
+        ASSERT_EQ(message_.size() + 16, expected.size());
+        ASSERT_EQ(KM_ERROR_OK, Crypt(&parallel_, KM_PURPOSE_ENCRYPT, KM_MODE_GCM, aad, split,
+                                     message_, &ciphertext));
+        EXPECT_TRUE(expected == ciphertext) << "Split of " << split.size();
+        ASSERT_EQ(KM_ERROR_OK, Crypt(&parallel_, KM_PURPOSE_DECRYPT, KM_MODE_GCM, aad, split,
+                                     ciphertext, &plaintext));
+        EXPECT_TRUE(message_ == plaintext) << "Split of " << split.size();
+    }
+
+    // No associated data at all.
+    string expected, ciphertext;
+    ASSERT_EQ(KM_ERROR_OK,
+              Crypt(&serial_, KM_PURPOSE_ENCRYPT, KM_MODE_GCM, "", {}, message_, &expected));
+    ASSERT_EQ(KM_ERROR_OK,
+              Crypt(&parallel_, KM_PURPOSE_ENCRYPT, KM_MODE_GCM, "", {}, message_, &ciphertext));
+    EXPECT_TRUE(expected == ciphertext);
+}
+
+TEST_F(ParallelCipherTest, GcmVerificationFailure) {
+    const string aad = "associated data";
+    string ciphertext, plaintext;
+    ASSERT_EQ(KM_ERROR_OK,
+              Crypt(&parallel_, KM_PURPOSE_ENCRYPT, KM_MODE_GCM, aad, {}, message_, &ciphertext));
+
+    // A changed tag, ciphertext block or associated data must all be caught.
+    string bad_tag = ciphertext;
+    bad_tag[bad_tag.size() - 1] ^= 1;
+    EXPECT_EQ(KM_ERROR_VERIFICATION_FAILED,
+              Crypt(&parallel_, KM_PURPOSE_DECRYPT, KM_MODE_GCM, aad, {}, bad_tag, &plaintext));
+    string bad_data = ciphertext;
+    bad_data[message_.size() / 2] ^= 0x80;
+    EXPECT_EQ(KM_ERROR_VERIFICATION_FAILED,
+              Crypt(&parallel_, KM_PURPOSE_DECRYPT, KM_MODE_GCM, aad, {}, bad_data, &plaintext));
+    EXPECT_EQ(KM_ERROR_VERIFICATION_FAILED,
+              Crypt(&parallel_, KM_PURPOSE_DECRYPT, KM_MODE_GCM, "associated dat4", {},
+                    ciphertext, &plaintext));
+}
+
+class Curve25519Test : public testing::Test {
+  public:
+    Curve25519Test() : keymaster_(new TestKeymasterContext, 16) {
+        ConfigureRequest req;
+        req.os_version = kOsVersion;
+        req.os_patchlevel = kOsPatchLevel;
+        ConfigureResponse rsp;
+        keymaster_.Configure(req, &rsp);
+        EXPECT_EQ(KM_ERROR_OK, rsp.error);
+    }
+
+  protected:
+    keymaster_error_t GenerateKey(const AuthorizationSetBuilder& builder,
+                                  KeymasterKeyBlob* key_blob) {
+        GenerateKeyRequest req;
+        req.key_description = builder.build();
+        GenerateKeyResponse rsp;
+        keymaster_.GenerateKey(req, &rsp);
+        if (rsp.error == KM_ERROR_OK) {
+            *key_blob = KeymasterKeyBlob(rsp.key_blob);
+            hw_enforced_ = rsp.enforced;
+            sw_enforced_ = rsp.unenforced;
+        }
+        return rsp.error;
+    }
+
+    keymaster_error_t ImportKey(const AuthorizationSetBuilder& builder, EVP_PKEY* pkey,
+                                KeymasterKeyBlob* key_blob) {
+        KeymasterKeyBlob pkcs8;
+        keymaster_error_t error = EvpKeyToKeyMaterial(pkey, &pkcs8);
+        if (error != KM_ERROR_OK)
+            return error;
+        ImportKeyRequest req;
+        req.key_description = builder.build();
+        req.key_format = KM_KEY_FORMAT_PKCS8;
+        req.SetKeyMaterial(pkcs8.key_material, pkcs8.key_material_size);
+        ImportKeyResponse rsp;
+        keymaster_.ImportKey(req, &rsp);
+        if (rsp.error == KM_ERROR_OK) {
+            *key_blob = KeymasterKeyBlob(rsp.key_blob);
+            hw_enforced_ = rsp.enforced;
+            sw_enforced_ = rsp.unenforced;
+        }
+        return rsp.error;
+    }
+
+    // Runs a whole operation, with |input| passed to Update and |signature| to Finish.
+    keymaster_error_t Process(const KeymasterKeyBlob& key_blob, keymaster_purpose_t purpose,
+                              const string& input, const string& signature, string* output) {
+        BeginOperationRequest begin_req;
+        begin_req.purpose = purpose;
+        begin_req.SetKeyMaterial(key_blob);
+        BeginOperationResponse begin_rsp;
+        keymaster_.BeginOperation(begin_req, &begin_rsp);
+        if (begin_rsp.error != KM_ERROR_OK)
+            return begin_rsp.error;
+
+        UpdateOperationRequest update_req;
+        update_req.op_handle = begin_rsp.op_handle;
+        update_req.input.Reinitialize(input.data(), input.size());
+        UpdateOperationResponse update_rsp;
+        keymaster_.UpdateOperation(update_req, &update_rsp);
+        if (update_rsp.error != KM_ERROR_OK)
+            return update_rsp.error;
+
+        FinishOperationRequest finish_req;
+        finish_req.op_handle = begin_rsp.op_handle;
+        finish_req.signature.Reinitialize(signature.data(), signature.size());
+        FinishOperationResponse finish_rsp;
+        keymaster_.FinishOperation(finish_req, &finish_rsp);
+        if (finish_rsp.error == KM_ERROR_OK && output)
+            output->assign(reinterpret_cast<const char*>(finish_rsp.output.peek_read()),
+                           finish_rsp.output.available_read());
+        return finish_rsp.error;
+    }
+
+    EVP_PKEY* ExportKey(const KeymasterKeyBlob& key_blob) {
+        ExportKeyRequest req;
+        req.SetKeyMaterial(key_blob);
+        req.key_format = KM_KEY_FORMAT_X509;
+        ExportKeyResponse rsp;
+        keymaster_.ExportKey(req, &rsp);
+        EXPECT_EQ(KM_ERROR_OK, rsp.error);
+        if (rsp.error != KM_ERROR_OK)
+            return nullptr;
+        const uint8_t* p = rsp.key_data;
+        return d2i_PUBKEY(nullptr, &p, rsp.key_data_length);
+    }
+
+    static EVP_PKEY* NewKey(int evp_key_type) {
+        EVP_PKEY_CTX_Ptr ctx(EVP_PKEY_CTX_new_id(evp_key_type, nullptr /* engine */));
+        EVP_PKEY* pkey = nullptr;
+        if (!ctx.get() || EVP_PKEY_keygen_init(ctx.get()) != 1 ||
+            EVP_PKEY_keygen(ctx.get(), &pkey) != 1)
+            return nullptr;
+        return pkey;
+    }
+
+    static string PublicKeyInfo(EVP_PKEY* pkey) {
+        uint8_t* der = nullptr;
+        int der_length = i2d_PUBKEY(pkey, &der);
+        string result(reinterpret_cast<char*>(der), der_length > 0 ? der_length : 0);
+        OPENSSL_free(der);
+        return result;
+    }
+
+    static bool OpenSslVerify(EVP_PKEY* pkey, const string& message, const string& signature) {
+        EVP_MD_CTX ctx;
+        EVP_MD_CTX_init(&ctx);
+        EvpMdCtxCleaner ctx_cleaner(&ctx);
+        return EVP_DigestVerifyInit(&ctx, nullptr /* pctx */, nullptr /* type */,
+                                    nullptr /* engine */, pkey) == 1 &&
+               EVP_DigestVerify(&ctx, reinterpret_cast<const uint8_t*>(signature.data()),
+                                signature.size(), reinterpret_cast<const uint8_t*>(message.data()),
+                                message.size()) == 1;
+    }
+
+    AuthProxy characteristics() const { return AuthProxy(hw_enforced_, sw_enforced_); }
+
+    AndroidKeymaster keymaster_;
+    AuthorizationSet hw_enforced_;
+    AuthorizationSet sw_enforced_;
+};
+
+TEST_F(Curve25519Test, Ed25519SignVerify) {
+    KeymasterKeyBlob key_blob;
+    ASSERT_EQ(KM_ERROR_OK, GenerateKey(AuthorizationSetBuilder().Ed25519SigningKey(), &key_blob));
+    EXPECT_TRUE(characteristics().Contains(TAG_EC_CURVE, KM_EC_CURVE_CURVE_25519));
+    EXPECT_TRUE(characteristics().Contains(TAG_KEY_SIZE, 256));
+
+    const string message = "The quick brown fox jumps over the lazy dog";
+    string signature;
+    ASSERT_EQ(KM_ERROR_OK, Process(key_blob, KM_PURPOSE_SIGN, message, "", &signature));
+    EXPECT_EQ(64U, signature.size());
+    EXPECT_EQ(KM_ERROR_OK, Process(key_blob, KM_PURPOSE_VERIFY, message, signature, nullptr));
+
+    // Ed25519 signatures are deterministic.
+    string signature2;
+    ASSERT_EQ(KM_ERROR_OK, Process(key_blob, KM_PURPOSE_SIGN, message, "", &signature2));
+    EXPECT_TRUE(signature == signature2);
+
+    string bad_signature = signature;
+    bad_signature[10] ^= 1;
+    EXPECT_EQ(KM_ERROR_VERIFICATION_FAILED,
+              Process(key_blob, KM_PURPOSE_VERIFY, message, bad_signature, nullptr));
+    EXPECT_EQ(KM_ERROR_VERIFICATION_FAILED,
+              Process(key_blob, KM_PURPOSE_VERIFY, message + "!", signature, nullptr));
+
+    // The exported public key must verify the signature outside keymaster.
+    EVP_PKEY_Ptr public_key(ExportKey(key_blob));
+    ASSERT_TRUE(public_key.get() != nullptr);
+    EXPECT_EQ(EVP_PKEY_ED25519, EVP_PKEY_id(public_key.get()));
+    EXPECT_TRUE(OpenSslVerify(public_key.get(), message, signature));
+}
+
+TEST_F(Curve25519Test, Ed25519MessageTooLong) {
+    KeymasterKeyBlob key_blob;
+    ASSERT_EQ(KM_ERROR_OK, GenerateKey(AuthorizationSetBuilder().Ed25519SigningKey(), &key_blob));
+    string message(Curve25519Operation::kMaxMessageSize + 1, 'a');
+    EXPECT_EQ(KM_ERROR_INVALID_INPUT_LENGTH,
+              Process(key_blob, KM_PURPOSE_SIGN, message, "", nullptr));
+}
+
+TEST_F(Curve25519Test, Ed25519Import) {
+    EVP_PKEY_Ptr pkey(NewKey(EVP_PKEY_ED25519));
+    ASSERT_TRUE(pkey.get() != nullptr);
+    KeymasterKeyBlob key_blob;
+    ASSERT_EQ(KM_ERROR_OK,
+              ImportKey(AuthorizationSetBuilder()
+                            .Authorization(TAG_ALGORITHM, KM_ALGORITHM_EC)
+                            .Digest(KM_DIGEST_NONE)
+                            .SigningKey(),
+                        pkey.get(), &key_blob));
+    EXPECT_TRUE(characteristics().Contains(TAG_EC_CURVE, KM_EC_CURVE_CURVE_25519));
+    EXPECT_TRUE(characteristics().Contains(TAG_KEY_SIZE, 256));
+
+    const string message = "imported";
+    string signature;
+    ASSERT_EQ(KM_ERROR_OK, Process(key_blob, KM_PURPOSE_SIGN, message, "", &signature));
+    EXPECT_TRUE(OpenSslVerify(pkey.get(), message, signature));
+
+    // An Ed25519 key can't be imported for key agreement, or as a NIST curve key.
+    EXPECT_EQ(KM_ERROR_INCOMPATIBLE_PURPOSE,
+              ImportKey(AuthorizationSetBuilder()
+                            .Authorization(TAG_ALGORITHM, KM_ALGORITHM_EC)
+                            .Authorization(TAG_PURPOSE, KM_PURPOSE_AGREE_KEY),
+                        pkey.get(), &key_blob));
+    EXPECT_EQ(KM_ERROR_IMPORT_PARAMETER_MISMATCH,
+              ImportKey(AuthorizationSetBuilder()
+                            .Authorization(TAG_ALGORITHM, KM_ALGORITHM_EC)
+                            .Authorization(TAG_EC_CURVE, KM_EC_CURVE_P_256)
+                            .Digest(KM_DIGEST_NONE)
+                            .SigningKey(),
+                        pkey.get(), &key_blob));
+}
+
+TEST_F(Curve25519Test, X25519Agreement) {
+    KeymasterKeyBlob key_blob;
+    ASSERT_EQ(KM_ERROR_OK, GenerateKey(AuthorizationSetBuilder().X25519AgreementKey(), &key_blob));
+    EVP_PKEY_Ptr public_key(ExportKey(key_blob));
+    ASSERT_TRUE(public_key.get() != nullptr);
+    EXPECT_EQ(EVP_PKEY_X25519, EVP_PKEY_id(public_key.get()));
+
+    EVP_PKEY_Ptr peer_key(NewKey(EVP_PKEY_X25519));
+    ASSERT_TRUE(peer_key.get() != nullptr);
+    string secret;
+    ASSERT_EQ(KM_ERROR_OK, Process(key_blob, KM_PURPOSE_AGREE_KEY, PublicKeyInfo(peer_key.get()),
+                                   "", &secret));
+    ASSERT_EQ(32U, secret.size());
+
+    // The peer must arrive at the same secret.
+    EVP_PKEY_CTX_Ptr ctx(EVP_PKEY_CTX_new(peer_key.get(), nullptr /* engine */));
+    uint8_t peer_secret[32];
+    size_t peer_secret_length = sizeof(peer_secret);
+    ASSERT_TRUE(ctx.get() != nullptr);
+    ASSERT_EQ(1, EVP_PKEY_derive_init(ctx.get()));
+    ASSERT_EQ(1, EVP_PKEY_derive_set_peer(ctx.get(), public_key.get()));
+    ASSERT_EQ(1, EVP_PKEY_derive(ctx.get(), peer_secret, &peer_secret_length));
+    ASSERT_EQ(secret.size(), peer_secret_length);
+    EXPECT_EQ(0, memcmp(secret.data(), peer_secret, peer_secret_length));
+
+    // The peer key must be an X25519 SubjectPublicKeyInfo, with nothing after it.
+    EVP_PKEY_Ptr ed25519_key(NewKey(EVP_PKEY_ED25519));
+    EXPECT_EQ(KM_ERROR_INVALID_ARGUMENT,
+              Process(key_blob, KM_PURPOSE_AGREE_KEY, PublicKeyInfo(ed25519_key.get()), "",
+                      &secret));
+    EXPECT_EQ(KM_ERROR_INVALID_ARGUMENT,
+              Process(key_blob, KM_PURPOSE_AGREE_KEY, PublicKeyInfo(peer_key.get()) + "x", "",
+                      &secret));
+}
+
+TEST_F(Curve25519Test, PurposeMismatch) {
+    KeymasterKeyBlob key_blob;
+    EXPECT_EQ(KM_ERROR_INCOMPATIBLE_PURPOSE,
+              GenerateKey(AuthorizationSetBuilder().Ed25519SigningKey().Authorization(
+                              TAG_PURPOSE, KM_PURPOSE_AGREE_KEY),
+                          &key_blob));
+
+    ASSERT_EQ(KM_ERROR_OK, GenerateKey(AuthorizationSetBuilder().Ed25519SigningKey(), &key_blob));
+    EXPECT_EQ(KM_ERROR_INCOMPATIBLE_PURPOSE,
+              Process(key_blob, KM_PURPOSE_AGREE_KEY, "", "", nullptr));
+
+    ASSERT_EQ(KM_ERROR_OK, GenerateKey(AuthorizationSetBuilder().X25519AgreementKey(), &key_blob));
+    EXPECT_EQ(KM_ERROR_INCOMPATIBLE_PURPOSE, Process(key_blob, KM_PURPOSE_SIGN, "", "", nullptr));
+
+    // NIST curve keys don't do key agreement.
+    ASSERT_EQ(KM_ERROR_OK,
+              GenerateKey(AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_NONE),
+                          &key_blob));
+    EXPECT_EQ(KM_ERROR_UNSUPPORTED_PURPOSE,
+              Process(key_blob, KM_PURPOSE_AGREE_KEY, "", "", nullptr));
+}
+
+TEST_F(Curve25519Test, Attestation) {
+    const struct {
+        AuthorizationSetBuilder description;
+        int evp_key_type;
+    } kKeys[] = {
+        {AuthorizationSetBuilder().Ed25519SigningKey(), EVP_PKEY_ED25519},
+        {AuthorizationSetBuilder().X25519AgreementKey(), EVP_PKEY_X25519},
+    };
+    for (const auto& key : kKeys) {
+        KeymasterKeyBlob key_blob;
+        ASSERT_EQ(KM_ERROR_OK, GenerateKey(key.description, &key_blob));
+
+        AttestKeyRequest req;
+        req.SetKeyMaterial(key_blob);
+        req.attest_params.push_back(TAG_ATTESTATION_CHALLENGE, "challenge", 9);
+        req.attest_params.push_back(TAG_ATTESTATION_APPLICATION_ID, "attest_app_id", 13);
+        AttestKeyResponse rsp;
+        keymaster_.AttestKey(req, &rsp);
+        ASSERT_EQ(KM_ERROR_OK, rsp.error);
+        ASSERT_GT(rsp.certificate_chain.entry_count, 0U);
+
+        const uint8_t* p = rsp.certificate_chain.entries[0].data;
+        X509_Ptr cert(d2i_X509(nullptr, &p, rsp.certificate_chain.entries[0].data_length));
+        ASSERT_TRUE(cert.get() != nullptr);
+        EVP_PKEY_Ptr cert_key(X509_get_pubkey(cert.get()));
+        ASSERT_TRUE(cert_key.get() != nullptr);
+        EXPECT_EQ(key.evp_key_type, EVP_PKEY_id(cert_key.get()));
+    }
+}
+
+class CapabilitiesTest : public testing::Test {
+  protected:
+    CapabilitiesTest() : keymaster_(new TestKeymasterContext, 16) {}
+
+    void SetUp() override {
+        ASSERT_EQ(KM_ERROR_OK, keymaster_.BuildCapabilities());
+        GetCapabilitiesResponse rsp;
+        keymaster_.GetCapabilities(GetCapabilitiesRequest(), &rsp);
+        ASSERT_EQ(KM_ERROR_OK, rsp.error);
+        ASSERT_TRUE(capabilities_.Reinitialize(rsp.matrix()));
+    }
+
+    template <typename T>
+    void ExpectSame(const SupportedResponse<T>& expected, keymaster_error_t error,
+                    const CapabilityList& list) {
+        EXPECT_EQ(expected.error, error);
+        if (expected.error != KM_ERROR_OK || error != KM_ERROR_OK)
+            return;
+        ASSERT_EQ(expected.results_length, list.count);
+        for (size_t i = 0; i < list.count; ++i)
+            EXPECT_EQ(static_cast<uint32_t>(expected.results[i]), list.values[i]);
+    }
+
+    template <typename Request, typename Response>
+    void CheckByAlgorithm(void (AndroidKeymaster::*query)(const Request&, Response*),
+                          keymaster_error_t (KeymasterCapabilities::*lookup)(
+                              keymaster_algorithm_t, CapabilityList*) const,
+                          keymaster_algorithm_t algorithm) {
+        Request req;
+        req.algorithm = algorithm;
+        Response rsp;
+        (keymaster_.*query)(req, &rsp);
+        CapabilityList list;
+        ExpectSame(rsp, (capabilities_.*lookup)(algorithm, &list), list);
+    }
+
+    template <typename Request, typename Response>
+    void CheckByPurpose(void (AndroidKeymaster::*query)(const Request&, Response*),
+                        keymaster_error_t (KeymasterCapabilities::*lookup)(
+                            keymaster_algorithm_t, keymaster_purpose_t, CapabilityList*) const,
+                        keymaster_algorithm_t algorithm, keymaster_purpose_t purpose) {
+        Request req;
+        req.algorithm = algorithm;
+        req.purpose = purpose;
+        Response rsp;
+        (keymaster_.*query)(req, &rsp);
+        CapabilityList list;
+        ExpectSame(rsp, (capabilities_.*lookup)(algorithm, purpose, &list), list);
+    }
+
+    AndroidKeymaster keymaster_;
+    KeymasterCapabilities capabilities_;
+};
+
+TEST_F(CapabilitiesTest, MatchesSupportedQueries) {
+    SupportedAlgorithmsResponse algorithms;
+    keymaster_.SupportedAlgorithms(SupportedAlgorithmsRequest(), &algorithms);
+    CapabilityList list;
+    ExpectSame(algorithms, capabilities_.SupportedAlgorithms(&list), list);
+
+    // Includes Triple DES, which the context has a factory for but doesn't list, and an algorithm
+    // that doesn't exist.
+    const keymaster_algorithm_t kAlgorithms[] = {
+        KM_ALGORITHM_RSA,        KM_ALGORITHM_EC,   KM_ALGORITHM_AES,
+        KM_ALGORITHM_TRIPLE_DES, KM_ALGORITHM_HMAC, static_cast<keymaster_algorithm_t>(2),
+    };
+    const keymaster_purpose_t kPurposes[] = {
+        KM_PURPOSE_ENCRYPT, KM_PURPOSE_DECRYPT,    KM_PURPOSE_SIGN,
+        KM_PURPOSE_VERIFY,  KM_PURPOSE_DERIVE_KEY, KM_PURPOSE_WRAP,
+    };
+    for (auto algorithm : kAlgorithms) {
+        CheckByAlgorithm(&AndroidKeymaster::SupportedImportFormats,
+                         &KeymasterCapabilities::SupportedImportFormats, algorithm);
+        CheckByAlgorithm(&AndroidKeymaster::SupportedExportFormats,
+                         &KeymasterCapabilities::SupportedExportFormats, algorithm);
+        for (auto purpose : kPurposes) {
+            CheckByPurpose(&AndroidKeymaster::SupportedBlockModes,
+                           &KeymasterCapabilities::SupportedBlockModes, algorithm, purpose);
+            CheckByPurpose(&AndroidKeymaster::SupportedPaddingModes,
+                           &KeymasterCapabilities::SupportedPaddingModes, algorithm, purpose);
+            CheckByPurpose(&AndroidKeymaster::SupportedDigests,
+                           &KeymasterCapabilities::SupportedDigests, algorithm, purpose);
+        }
+    }
+}
+
+TEST_F(CapabilitiesTest, OnlyHalBlockModes) {
+    SupportedBlockModesRequest req;
+    req.algorithm = KM_ALGORITHM_AES;
+    req.purpose = KM_PURPOSE_ENCRYPT;
+    SupportedBlockModesResponse rsp;
+    keymaster_.SupportedBlockModes(req, &rsp);
+    ASSERT_EQ(KM_ERROR_OK, rsp.error);
+    EXPECT_EQ(4U, rsp.results_length);
+    for (size_t i = 0; i < rsp.results_length; ++i)
+        EXPECT_NE(KM_MODE_CHACHA20_POLY1305, rsp.results[i]);
+
+    CapabilityList list;
+    ASSERT_EQ(KM_ERROR_OK,
+              capabilities_.SupportedBlockModes(KM_ALGORITHM_AES, KM_PURPOSE_ENCRYPT, &list));
+    EXPECT_EQ(4U, list.count);
+    for (size_t i = 0; i < list.count; ++i)
+        EXPECT_NE(static_cast<uint32_t>(KM_MODE_CHACHA20_POLY1305), list.values[i]);
+}
+
+TEST_F(CapabilitiesTest, OnlyHalPurposes) {
+    // X25519 keys support KM_PURPOSE_AGREE_KEY, but it isn't a HAL purpose.
+    CapabilityList list;
+    EXPECT_EQ(KM_ERROR_OK, capabilities_.SupportedDigests(KM_ALGORITHM_EC, KM_PURPOSE_SIGN, &list));
+    EXPECT_EQ(KM_ERROR_UNSUPPORTED_PURPOSE,
+              capabilities_.SupportedDigests(KM_ALGORITHM_EC, KM_PURPOSE_AGREE_KEY, &list));
+}
+
+TEST_F(CapabilitiesTest, ResponsesShareMatrix) {
+    GetCapabilitiesResponse first, second;
+    keymaster_.GetCapabilities(GetCapabilitiesRequest(), &first);
+    keymaster_.GetCapabilities(GetCapabilitiesRequest(), &second);
+    ASSERT_EQ(KM_ERROR_OK, first.error);
+    ASSERT_EQ(KM_ERROR_OK, second.error);
+    EXPECT_EQ(&keymaster_.capabilities(), &first.matrix());
+    EXPECT_EQ(&keymaster_.capabilities(), &second.matrix());
+    EXPECT_TRUE(first.capabilities.empty());
+}
+
+TEST(CapabilitiesNotBuiltTest, Unimplemented) {
+    AndroidKeymaster keymaster(new TestKeymasterContext, 16);
+    GetCapabilitiesResponse rsp;
+    keymaster.GetCapabilities(GetCapabilitiesRequest(), &rsp);
+    EXPECT_EQ(KM_ERROR_UNIMPLEMENTED, rsp.error);
+    EXPECT_TRUE(keymaster.capabilities().empty());
+}
+
+TEST(SoftKeymasterDeviceCapabilitiesTest, GetSupported) {
+    SoftKeymasterDevice* device = new SoftKeymasterDevice(new TestKeymasterContext);
+    keymaster1_device_t* km1_device = device->keymaster_device();
+
+    keymaster_digest_t* digests;
+    size_t digests_length;
+    ASSERT_EQ(KM_ERROR_OK, km1_device->get_supported_digests(km1_device, KM_ALGORITHM_EC,
+                                                             KM_PURPOSE_SIGN, &digests,
+                                                             &digests_length));
+    bool has_sha256 = false;
+    for (size_t i = 0; i < digests_length; ++i)
+        has_sha256 = has_sha256 || digests[i] == KM_DIGEST_SHA_2_256;
+    EXPECT_TRUE(has_sha256);
+    free(digests);
+
+    keymaster_block_mode_t* modes;
+    size_t modes_length;
+    EXPECT_EQ(KM_ERROR_UNSUPPORTED_PURPOSE,
+              km1_device->get_supported_block_modes(km1_device, KM_ALGORITHM_AES,
+                                                    KM_PURPOSE_SIGN, &modes, &modes_length));
+    EXPECT_EQ(KM_ERROR_UNSUPPORTED_ALGORITHM,
+              km1_device->get_supported_block_modes(km1_device,
+                                                    static_cast<keymaster_algorithm_t>(2),
+                                                    KM_PURPOSE_ENCRYPT, &modes, &modes_length));
+
+    km1_device->common.close(device->hw_device());
+}
+
 }  // namespace test
 }  // namespace keymaster
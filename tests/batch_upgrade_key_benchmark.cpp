@@ -0,0 +1,154 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <keymaster/android_keymaster.h>
+#include <keymaster/android_keymaster_messages.h>
+#include <keymaster/android_keymaster_utils.h>
+#include <keymaster/authorization_set.h>
+#include <keymaster/contexts/pure_soft_keymaster_context.h>
+
+#include "keymaster_benchmark_utils.h"
+
+namespace keymaster {
+namespace test {
+
+static const uint32_t kOsVersion = 80000;
+static const uint32_t kOldPatchlevel = 201801;
+static const uint32_t kNewPatchlevel = 201802;
+
+// Roughly the key population of a busy device on its first boot after an OTA.
+static const size_t kNumBlobs = 10000;
+
+/**
+ * Times upgrading kNumBlobs key blobs after a patch level bump, one UpgradeKey call per blob the
+ * way keystore does it today, and as a single BatchUpgradeKey.
+ */
+class BatchUpgradeKeyBenchmark : public testing::Test {
+  protected:
+    BatchUpgradeKeyBenchmark() : keymaster_(new PureSoftKeymasterContext, 16) {}
+
+    void SetUp() override {
+        Configure(kOldPatchlevel);
+
+        // A mix of key types, repeated to fill the batch.  Only the blob format matters to the
+        // upgrade, not whether the keys are distinct.
+        const AuthorizationSet key_descriptions[] = {
+            AuthorizationSet(
+                AuthorizationSetBuilder().AesEncryptionKey(128).EcbMode().Padding(KM_PAD_NONE)),
+            AuthorizationSet(AuthorizationSetBuilder()
+                                 .HmacKey(256)
+                                 .Digest(KM_DIGEST_SHA_2_256)
+                                 .Authorization(TAG_MIN_MAC_LENGTH, 256)),
+            AuthorizationSet(
+                AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_SHA_2_256)),
+            AuthorizationSet(AuthorizationSetBuilder()
+                                 .RsaSigningKey(2048, 65537)
+                                 .Digest(KM_DIGEST_SHA_2_256)
+                                 .Padding(KM_PAD_RSA_PKCS1_1_5_SIGN)),
+        };
+        std::vector<KeymasterKeyBlob> keys;
+        for (const AuthorizationSet& key_description : key_descriptions) {
+            GenerateKeyRequest req;
+            req.key_description = key_description;
+            GenerateKeyResponse rsp;
+            keymaster_.GenerateKey(req, &rsp);
+            ASSERT_EQ(KM_ERROR_OK, rsp.error);
+            keys.push_back(KeymasterKeyBlob(rsp.key_blob));
+        }
+
+        ASSERT_TRUE(request_.AllocateKeyBlobs(kNumBlobs));
+        for (size_t i = 0; i < kNumBlobs; ++i)
+            request_.key_blobs[i] = keys[i % keys.size()];
+
+        Configure(kNewPatchlevel);
+    }
+
+    void Configure(uint32_t os_patchlevel) {
+        ConfigureRequest req;
+        req.os_version = kOsVersion;
+        req.os_patchlevel = os_patchlevel;
+        ConfigureResponse rsp;
+        keymaster_.Configure(req, &rsp);
+        ASSERT_EQ(KM_ERROR_OK, rsp.error);
+    }
+
+    bool UpgradeOneByOne(KeymasterKeyBlob* upgraded) {
+        for (size_t i = 0; i < kNumBlobs; ++i) {
+            UpgradeKeyRequest req;
+            req.SetKeyMaterial(request_.key_blobs[i]);
+            UpgradeKeyResponse rsp;
+            keymaster_.UpgradeKey(req, &rsp);
+            if (rsp.error != KM_ERROR_OK)
+                return false;
+            upgraded[i] = KeymasterKeyBlob(rsp.upgraded_key);
+        }
+        return true;
+    }
+
+    bool UpgradeBatch(BatchUpgradeKeyResponse* response) {
+        keymaster_.BatchUpgradeKey(request_, response);
+        if (response->error != KM_ERROR_OK || response->num_results != kNumBlobs)
+            return false;
+        for (size_t i = 0; i < kNumBlobs; ++i)
+            if (response->results[i].error != KM_ERROR_OK)
+                return false;
+        return true;
+    }
+
+    AndroidKeymaster keymaster_;
+    BatchUpgradeKeyRequest request_;
+};
+
+// Each pass upgrades all of the blobs, which takes long enough to time on its own.
+template <typename Op> static double MeasureBlobsPerSecond(Op op) {
+    typedef std::chrono::steady_clock clock;
+    const auto start = clock::now();
+    if (!op())
+        return 0;
+    return kNumBlobs / std::chrono::duration<double>(clock::now() - start).count();
+}
+
+TEST_F(BatchUpgradeKeyBenchmark, Upgrade) {
+    UniquePtr<KeymasterKeyBlob[]> serial_blobs(new KeymasterKeyBlob[kNumBlobs]);
+    double serial_rate =
+        MeasureBlobsPerSecond([&]() { return UpgradeOneByOne(serial_blobs.get()); });
+    BatchUpgradeKeyResponse response;
+    double batch_rate = MeasureBlobsPerSecond([&]() { return UpgradeBatch(&response); });
+    EXPECT_GT(serial_rate, 0);
+    EXPECT_GT(batch_rate, 0);
+    ReportRate((std::to_string(kNumBlobs) + " blobs, UpgradeKey each").c_str(), serial_rate);
+    ReportRate((std::to_string(kNumBlobs) + " blobs, BatchUpgradeKey").c_str(), batch_rate);
+
+    // Software blobs are deterministic, so both ways must produce the same bytes.
+    ASSERT_EQ(kNumBlobs, response.num_results);
+    for (size_t i = 0; i < kNumBlobs; ++i) {
+        const KeymasterKeyBlob& batch_blob = response.results[i].key_blob;
+        ASSERT_EQ(serial_blobs[i].key_material_size, batch_blob.key_material_size);
+        ASSERT_EQ(0, memcmp(serial_blobs[i].key_material, batch_blob.key_material,
+                            batch_blob.key_material_size));
+    }
+}
+
+}  // namespace test
+}  // namespace keymaster
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <keymaster/android_keymaster.h>
+#include <keymaster/android_keymaster_messages.h>
+#include <keymaster/android_keymaster_utils.h>
+#include <keymaster/authorization_set.h>
+#include <keymaster/contexts/pure_soft_keymaster_context.h>
+#include <keymaster/km_openssl/aes_key.h>
+
+#include "keymaster_benchmark_utils.h"
+
+namespace keymaster {
+namespace test {
+
+struct AeadScenario {
+    keymaster_block_mode_t block_mode;
+    size_t message_size;
+};
+
+/**
+ * Compares encrypting and decrypting with AES-256-GCM and ChaCha20-Poly1305, through
+ * AndroidKeymaster.  Messages stay below the size at which GCM is split across threads.
+ */
+class ChaCha20Poly1305Benchmark : public testing::TestWithParam<AeadScenario> {
+  protected:
+    ChaCha20Poly1305Benchmark() : keymaster_(new PureSoftKeymasterContext, 16) {}
+
+    void SetUp() override {
+        ConfigureRequest configure_req;
+        configure_req.os_version = 80000;
+        configure_req.os_patchlevel = 201801;
+        ConfigureResponse configure_rsp;
+        keymaster_.Configure(configure_req, &configure_rsp);
+        ASSERT_EQ(KM_ERROR_OK, configure_rsp.error);
+
+        AuthorizationSetBuilder key_description;
+        key_description.AesEncryptionKey(256)
+            .BlockMode(GetParam().block_mode)
+            .Padding(KM_PAD_NONE)
+            .Authorization(TAG_CALLER_NONCE);
+        if (GetParam().block_mode == KM_MODE_GCM)
+            key_description.Authorization(TAG_MIN_MAC_LENGTH, 128);
+        GenerateKeyRequest req;
+        req.key_description = key_description.build();
+        GenerateKeyResponse rsp;
+        keymaster_.GenerateKey(req, &rsp);
+        ASSERT_EQ(KM_ERROR_OK, rsp.error);
+        key_blob_ = KeymasterKeyBlob(rsp.key_blob);
+
+        message_.Reinitialize(GetParam().message_size);
+        memset(message_.peek_write(), 'x', GetParam().message_size);
+        message_.advance_write(GetParam().message_size);
+        ASSERT_TRUE(Crypt(KM_PURPOSE_ENCRYPT, message_, &ciphertext_));
+    }
+
+    bool Crypt(keymaster_purpose_t purpose, const Buffer& input, Buffer* output) {
+        AuthorizationSetBuilder params;
+        params.BlockMode(GetParam().block_mode)
+            .Padding(KM_PAD_NONE)
+            .Authorization(TAG_NONCE, "0123456789ab", 12)
+            .Authorization(TAG_MAC_LENGTH, 128);
+
+        BeginOperationRequest begin_req;
+        begin_req.purpose = purpose;
+        begin_req.SetKeyMaterial(key_blob_);
+        begin_req.additional_params = params.build();
+        BeginOperationResponse begin_rsp;
+        keymaster_.BeginOperation(begin_req, &begin_rsp);
+        if (begin_rsp.error != KM_ERROR_OK)
+            return false;
+
+        FinishOperationRequest req;
+        req.op_handle = begin_rsp.op_handle;
+        req.input.Reinitialize(input);
+        req.additional_params.push_back(TAG_ASSOCIATED_DATA, "associated data", 15);
+        FinishOperationResponse rsp;
+        keymaster_.FinishOperation(req, &rsp);
+        if (rsp.error != KM_ERROR_OK)
+            return false;
+        return output->Reinitialize(rsp.output);
+    }
+
+    std::string Name(const char* direction) const {
+        return std::string(GetParam().block_mode == KM_MODE_GCM ? "AES-256-GCM "
+                                                                : "ChaCha20-Poly1305 ") +
+               direction + " " + std::to_string(GetParam().message_size / 1024) + " KiB";
+    }
+
+    AndroidKeymaster keymaster_;
+    KeymasterKeyBlob key_blob_;
+    Buffer message_;
+    Buffer ciphertext_;
+};
+
+TEST_P(ChaCha20Poly1305Benchmark, Encrypt) {
+    Buffer output;
+    double rate =
+        MeasureOpsPerSecond([&]() { return Crypt(KM_PURPOSE_ENCRYPT, message_, &output); });
+    EXPECT_GT(rate, 0);
+    ReportRate(Name("encrypt").c_str(), rate, GetParam().message_size);
+}
+
+TEST_P(ChaCha20Poly1305Benchmark, Decrypt) {
+    Buffer output;
+    double rate =
+        MeasureOpsPerSecond([&]() { return Crypt(KM_PURPOSE_DECRYPT, ciphertext_, &output); });
+    EXPECT_GT(rate, 0);
+    ReportRate(Name("decrypt").c_str(), rate, GetParam().message_size);
+}
+
+static const AeadScenario kScenarios[] = {
+    {KM_MODE_GCM, 1024},
+    {KM_MODE_GCM, 16 * 1024},
+    {KM_MODE_GCM, 64 * 1024},
+#if defined(OPENSSL_IS_BORINGSSL)
+    {KM_MODE_CHACHA20_POLY1305, 1024},
+    {KM_MODE_CHACHA20_POLY1305, 16 * 1024},
+    {KM_MODE_CHACHA20_POLY1305, 64 * 1024},
+#endif
+};
+
+INSTANTIATE_TEST_CASE_P(ModesAndSizes, ChaCha20Poly1305Benchmark, testing::ValuesIn(kScenarios));
+
+}  // namespace test
+}  // namespace keymaster
@@ -99,5 +99,22 @@ TEST(CkdfTest, Ckdf) {
     }
 }
 
+TEST(CkdfTest, ReusedKey) {
+    for (auto& test : kCkdfTests) {
+        auto label = hex2blob(test.label);
+        auto context = hex2blob(test.context);
+        auto expected = hex2blob(test.output);
+
+        Ckdf kdf;
+        ASSERT_EQ(KM_ERROR_OK, kdf.Init(hex2key(test.key)));
+        for (int i = 0; i < 3; ++i) {
+            KeymasterKeyBlob output;
+            output.Reset(expected.data_length);
+            ASSERT_EQ(KM_ERROR_OK, kdf.GenerateKey(label, &context, 1, &output));
+            EXPECT_TRUE(std::equal(output.begin(), output.end(), expected.begin()));
+        }
+    }
+}
+
 }  // namespace test
 }  // namespace keymaster
@@ -0,0 +1,150 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <keymaster/km_openssl/drbg_random_source.h>
+#include <keymaster/km_openssl/openssl_utils.h>
+
+namespace keymaster {
+namespace test {
+
+static bool all_zero(const uint8_t* buf, size_t length) {
+    for (size_t i = 0; i < length; ++i)
+        if (buf[i])
+            return false;
+    return true;
+}
+
+TEST(DrbgRandomSourceTest, SmallDraws) {
+    DrbgRandomSource random_source;
+    uint8_t first[16], second[16];
+    ASSERT_EQ(KM_ERROR_OK, random_source.GenerateRandom(first, sizeof(first)));
+    ASSERT_EQ(KM_ERROR_OK, random_source.GenerateRandom(second, sizeof(second)));
+    EXPECT_FALSE(all_zero(first, sizeof(first)));
+    EXPECT_NE(0, memcmp(first, second, sizeof(first)));
+}
+
+TEST(DrbgRandomSourceTest, DrawsSpanningRefills) {
+    DrbgRandomSource random_source;
+    // An odd size, so draws straddle the buffer boundary.
+    const size_t kDrawSize = 13;
+    const size_t kNumDraws = 3 * DrbgRandomSource::kBufferSize / kDrawSize;
+    uint8_t previous[kDrawSize] = {};
+    for (size_t i = 0; i < kNumDraws; ++i) {
+        uint8_t draw[kDrawSize];
+        ASSERT_EQ(KM_ERROR_OK, random_source.GenerateRandom(draw, sizeof(draw)));
+        EXPECT_NE(0, memcmp(previous, draw, sizeof(draw)));
+        memcpy(previous, draw, sizeof(draw));
+    }
+}
+
+TEST(DrbgRandomSourceTest, LargeDraws) {
+    DrbgRandomSource random_source;
+    const size_t kDrawSize = 4 * DrbgRandomSource::kBufferSize;
+    uint8_t first[kDrawSize], second[kDrawSize];
+    ASSERT_EQ(KM_ERROR_OK, random_source.GenerateRandom(first, sizeof(first)));
+    ASSERT_EQ(KM_ERROR_OK, random_source.GenerateRandom(second, sizeof(second)));
+    // Each half of a large draw must be fresh output, too.
+    EXPECT_NE(0, memcmp(first, first + kDrawSize / 2, kDrawSize / 2));
+    EXPECT_NE(0, memcmp(first, second, sizeof(first)));
+    EXPECT_FALSE(all_zero(second + kDrawSize - 16, 16));
+}
+
+TEST(DrbgRandomSourceTest, ThreadsHaveSeparateGenerators) {
+    uint8_t main_thread[32], other_thread[32];
+    DrbgRandomSource random_source;
+    ASSERT_EQ(KM_ERROR_OK, random_source.GenerateRandom(main_thread, sizeof(main_thread)));
+    keymaster_error_t error = KM_ERROR_UNKNOWN_ERROR;
+    std::thread thread([&] {
+        error = random_source.GenerateRandom(other_thread, sizeof(other_thread));
+    });
+    thread.join();
+    ASSERT_EQ(KM_ERROR_OK, error);
+    EXPECT_NE(0, memcmp(main_thread, other_thread, sizeof(main_thread)));
+}
+
+TEST(DrbgRandomSourceTest, AddEntropy) {
+    DrbgRandomSource random_source;
+    uint8_t before[16], after[16];
+    ASSERT_EQ(KM_ERROR_OK, random_source.GenerateRandom(before, sizeof(before)));
+    const uint8_t entropy[] = "some caller-supplied entropy";
+    DrbgRandomSource::AddEntropy(entropy, sizeof(entropy));
+    ASSERT_EQ(KM_ERROR_OK, random_source.GenerateRandom(after, sizeof(after)));
+    EXPECT_NE(0, memcmp(before, after, sizeof(before)));
+}
+
+TEST(DrbgRandomSourceTest, ForkedChildReseeds) {
+    DrbgRandomSource random_source;
+    uint8_t buf[16];
+    // Make sure this thread's generator is seeded and has buffered output before forking.
+    ASSERT_EQ(KM_ERROR_OK, random_source.GenerateRandom(buf, sizeof(buf)));
+
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+        uint8_t child[32];
+        bool ok = random_source.GenerateRandom(child, sizeof(child)) == KM_ERROR_OK &&
+                  write(fds[1], child, sizeof(child)) == static_cast<ssize_t>(sizeof(child));
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+
+    uint8_t parent[32], child[32];
+    ASSERT_EQ(KM_ERROR_OK, random_source.GenerateRandom(parent, sizeof(parent)));
+    EXPECT_EQ(static_cast<ssize_t>(sizeof(child)), read(fds[0], child, sizeof(child)));
+    close(fds[0]);
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(0, WEXITSTATUS(status));
+    EXPECT_NE(0, memcmp(parent, child, sizeof(parent)));
+}
+
+class FixedRandomSource : public RandomSource {
+  public:
+    keymaster_error_t GenerateRandom(uint8_t* buffer, size_t length) const override {
+        memset(buffer, 0xA5, length);
+        return KM_ERROR_OK;
+    }
+};
+
+TEST(DrbgRandomSourceTest, GenerateRandomSource) {
+    FixedRandomSource fixed;
+    SetGenerateRandomSource(&fixed);
+    uint8_t buf[8];
+    ASSERT_EQ(KM_ERROR_OK, GenerateRandom(buf, sizeof(buf)));
+    EXPECT_EQ(0xA5, buf[0]);
+    EXPECT_EQ(0xA5, buf[7]);
+
+    DrbgRandomSource::InstallForGenerateRandom();
+    ASSERT_EQ(KM_ERROR_OK, GenerateRandom(buf, sizeof(buf)));
+    EXPECT_NE(0, memcmp(buf, "\xA5\xA5\xA5\xA5\xA5\xA5\xA5\xA5", sizeof(buf)));
+
+    SetGenerateRandomSource(nullptr);
+    ASSERT_EQ(KM_ERROR_OK, GenerateRandom(buf, sizeof(buf)));
+}
+
+}  // namespace test
+}  // namespace keymaster
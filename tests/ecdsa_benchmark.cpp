@@ -0,0 +1,239 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+
+#include <keymaster/android_keymaster.h>
+#include <keymaster/android_keymaster_messages.h>
+#include <keymaster/contexts/pure_soft_keymaster_context.h>
+#include <keymaster/km_openssl/curve25519_key.h>
+#include <keymaster/km_openssl/curve25519_operation.h>
+#include <keymaster/km_openssl/ec_key.h>
+#include <keymaster/km_openssl/ecdsa_operation.h>
+#include <keymaster/km_openssl/openssl_utils.h>
+
+#include "keymaster_benchmark_utils.h"
+
+namespace keymaster {
+namespace test {
+
+static const keymaster_ec_curve_t kEcCurves[] = {KM_EC_CURVE_P_224, KM_EC_CURVE_P_256,
+                                                 KM_EC_CURVE_P_384, KM_EC_CURVE_P_521};
+
+static const char kMessage[] = "The quick brown fox jumps over the lazy dog";
+
+class EcdsaBenchmark : public testing::TestWithParam<keymaster_ec_curve_t> {
+  protected:
+    void SetUp() override {
+        EC_KEY_Ptr ec_key(EC_KEY_new());
+        ASSERT_TRUE(ec_key.get() != nullptr);
+        ASSERT_EQ(1, EC_KEY_set_group(ec_key.get(), ec_get_shared_group(GetParam())));
+        ASSERT_EQ(1, EC_KEY_generate_key(ec_key.get()));
+
+        EVP_PKEY_Ptr pkey(EVP_PKEY_new());
+        ASSERT_EQ(1, EVP_PKEY_set1_EC_KEY(pkey.get(), ec_key.get()));
+        key_.reset(new EcKey(AuthorizationSet(), AuthorizationSet(), nullptr /* factory */));
+        ASSERT_TRUE(key_->EvpToInternal(pkey.get()));
+    }
+
+    // Mirrors what EcdsaOperationFactory::CreateOperation does for each Begin of a key that isn't
+    // held by a handle.
+    EVP_PKEY* OperationPkey() const {
+        EVP_PKEY* pkey = EVP_PKEY_new();
+        if (pkey && !key_->InternalToEvp(pkey)) {
+            EVP_PKEY_free(pkey);
+            return nullptr;
+        }
+        return pkey;
+    }
+
+    bool Sign(Buffer* signature) const {
+        EcdsaSignOperation op(AuthorizationSet(), AuthorizationSet(), KM_DIGEST_SHA_2_256,
+                              OperationPkey());
+        AuthorizationSet out_params;
+        return op.Begin(AuthorizationSet(), &out_params) == KM_ERROR_OK &&
+               op.Finish(AuthorizationSet(), Buffer(kMessage, sizeof(kMessage)), Buffer(),
+                         &out_params, signature) == KM_ERROR_OK;
+    }
+
+    bool Verify(const Buffer& signature) const {
+        EcdsaVerifyOperation op(AuthorizationSet(), AuthorizationSet(), KM_DIGEST_SHA_2_256,
+                                OperationPkey());
+        AuthorizationSet out_params;
+        Buffer output;
+        return op.Begin(AuthorizationSet(), &out_params) == KM_ERROR_OK &&
+               op.Finish(AuthorizationSet(), Buffer(kMessage, sizeof(kMessage)), signature,
+                         &out_params, &output) == KM_ERROR_OK;
+    }
+
+    std::string Name(const char* what) const {
+        return std::string("ECDSA P-") + std::to_string(ec_curve_bits()) + " " + what;
+    }
+
+    uint32_t ec_curve_bits() const {
+        size_t bits = 0;
+        ec_get_group_size(EC_KEY_get0_group(key_->key()), &bits);
+        return bits;
+    }
+
+    UniquePtr<EcKey> key_;
+};
+
+TEST_P(EcdsaBenchmark, Sign) {
+    Buffer signature;
+    double rate = MeasureOpsPerSecond([&]() { return Sign(&signature); });
+    EXPECT_GT(rate, 0);
+    ReportRate(Name("sign").c_str(), rate);
+}
+
+TEST_P(EcdsaBenchmark, Verify) {
+    Buffer signature;
+    ASSERT_TRUE(Sign(&signature));
+    double rate = MeasureOpsPerSecond([&]() { return Verify(signature); });
+    EXPECT_GT(rate, 0);
+    ReportRate(Name("verify").c_str(), rate);
+}
+
+INSTANTIATE_TEST_CASE_P(PerCurve, EcdsaBenchmark, testing::ValuesIn(kEcCurves));
+
+/**
+ * Times signing through a key handle, the way a long-lived signing key is used, with and without
+ * the context's EC signing precomputation.
+ */
+class EcdsaKeyHandleBenchmark : public testing::TestWithParam<bool> {
+  protected:
+    EcdsaKeyHandleBenchmark() : context_(new PureSoftKeymasterContext), keymaster_(context_, 16) {}
+
+    void SetUp() override {
+        context_->set_precompute_ec_signing(GetParam());
+
+        ConfigureRequest configure_req;
+        configure_req.os_version = 80000;
+        configure_req.os_patchlevel = 201801;
+        ConfigureResponse configure_rsp;
+        keymaster_.Configure(configure_req, &configure_rsp);
+        ASSERT_EQ(KM_ERROR_OK, configure_rsp.error);
+
+        GenerateKeyRequest generate_req;
+        generate_req.key_description =
+            AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_SHA_2_256).build();
+        GenerateKeyResponse generate_rsp;
+        keymaster_.GenerateKey(generate_req, &generate_rsp);
+        ASSERT_EQ(KM_ERROR_OK, generate_rsp.error);
+
+        LoadKeyHandleRequest load_req;
+        load_req.SetKeyMaterial(generate_rsp.key_blob);
+        LoadKeyHandleResponse load_rsp;
+        keymaster_.LoadKeyHandle(load_req, &load_rsp);
+        ASSERT_EQ(KM_ERROR_OK, load_rsp.error);
+        key_handle_ = load_rsp.key_handle;
+    }
+
+    bool Sign() {
+        BeginOperationWithKeyHandleRequest begin_req;
+        begin_req.purpose = KM_PURPOSE_SIGN;
+        begin_req.key_handle = key_handle_;
+        begin_req.additional_params =
+            AuthorizationSetBuilder().Digest(KM_DIGEST_SHA_2_256).build();
+        BeginOperationResponse begin_rsp;
+        keymaster_.BeginOperationWithKeyHandle(begin_req, &begin_rsp);
+        if (begin_rsp.error != KM_ERROR_OK)
+            return false;
+
+        FinishOperationRequest finish_req;
+        finish_req.op_handle = begin_rsp.op_handle;
+        finish_req.input.Reinitialize(kMessage, sizeof(kMessage));
+        FinishOperationResponse finish_rsp;
+        keymaster_.FinishOperation(finish_req, &finish_rsp);
+        return finish_rsp.error == KM_ERROR_OK;
+    }
+
+    PureSoftKeymasterContext* context_;  // Owned by keymaster_.
+    AndroidKeymaster keymaster_;
+    uint64_t key_handle_ = 0;
+};
+
+TEST_P(EcdsaKeyHandleBenchmark, Sign) {
+    double rate = MeasureOpsPerSecond([&]() { return Sign(); });
+    EXPECT_GT(rate, 0);
+    ReportRate(GetParam() ? "ECDSA P-256 sign by handle, precomputed"
+                          : "ECDSA P-256 sign by handle",
+               rate);
+}
+
+INSTANTIATE_TEST_CASE_P(Precompute, EcdsaKeyHandleBenchmark, testing::Bool());
+
+/**
+ * The same signing and verification as EcdsaBenchmark, with an Ed25519 key, for comparison with
+ * the ECDSA P-256 rates.
+ */
+class Ed25519Benchmark : public testing::Test {
+  protected:
+    void SetUp() override {
+        EVP_PKEY_CTX_Ptr ctx(EVP_PKEY_CTX_new_id(EVP_PKEY_ED25519, nullptr /* engine */));
+        ASSERT_TRUE(ctx.get() != nullptr);
+        ASSERT_EQ(1, EVP_PKEY_keygen_init(ctx.get()));
+        EVP_PKEY* raw_pkey = nullptr;
+        ASSERT_EQ(1, EVP_PKEY_keygen(ctx.get(), &raw_pkey));
+        EVP_PKEY_Ptr pkey(raw_pkey);
+
+        key_.reset(new Curve25519Key(AuthorizationSet(), AuthorizationSet(),
+                                     nullptr /* factory */));
+        ASSERT_TRUE(key_->EvpToInternal(pkey.get()));
+    }
+
+    bool Sign(Buffer* signature) const {
+        Ed25519SignOperation op(AuthorizationSet(), AuthorizationSet(), key_->evp_key());
+        AuthorizationSet out_params;
+        return op.Begin(AuthorizationSet(), &out_params) == KM_ERROR_OK &&
+               op.Finish(AuthorizationSet(), Buffer(kMessage, sizeof(kMessage)), Buffer(),
+                         &out_params, signature) == KM_ERROR_OK;
+    }
+
+    bool Verify(const Buffer& signature) const {
+        Ed25519VerifyOperation op(AuthorizationSet(), AuthorizationSet(), key_->NewPublicEvpKey());
+        AuthorizationSet out_params;
+        Buffer output;
+        return op.Begin(AuthorizationSet(), &out_params) == KM_ERROR_OK &&
+               op.Finish(AuthorizationSet(), Buffer(kMessage, sizeof(kMessage)), signature,
+                         &out_params, &output) == KM_ERROR_OK;
+    }
+
+    UniquePtr<Curve25519Key> key_;
+};
+
+TEST_F(Ed25519Benchmark, Sign) {
+    Buffer signature;
+    double rate = MeasureOpsPerSecond([&]() { return Sign(&signature); });
+    EXPECT_GT(rate, 0);
+    ReportRate("Ed25519 sign", rate);
+}
+
+TEST_F(Ed25519Benchmark, Verify) {
+    Buffer signature;
+    ASSERT_TRUE(Sign(&signature));
+    double rate = MeasureOpsPerSecond([&]() { return Verify(signature); });
+    EXPECT_GT(rate, 0);
+    ReportRate("Ed25519 verify", rate);
+}
+
+}  // namespace test
+}  // namespace keymaster
@@ -16,12 +16,16 @@
 
 #include <keymaster/km_openssl/ecies_kem.h>
 
+#include <chrono>
+#include <thread>
+
 #include <gtest/gtest.h>
 #include <openssl/evp.h>
 
 #include <hardware/keymaster_defs.h>
 
 #include <keymaster/android_keymaster_utils.h>
+#include <keymaster/km_openssl/ec_ephemeral_key_pool.h>
 #include <keymaster/km_openssl/nist_curve_key_exchange.h>
 
 #include "android_keymaster_test_utils.h"
@@ -70,5 +74,79 @@ TEST(EciesKem, TestConsistency) {
     }
 }
 
+TEST(EciesKem, EphemeralKeyPool) {
+    static const uint32_t kKeyLen = 32;
+    EcEphemeralKeyPool pool(4 /* keys_per_curve */);
+    for (auto& curve : kEcCurves) {
+        AuthorizationSet kem_description(AuthorizationSetBuilder()
+                                             .Authorization(TAG_EC_CURVE, curve)
+                                             .Authorization(TAG_KDF, KM_KDF_RFC5869_SHA256)
+                                             .Authorization(TAG_KEY_SIZE, kKeyLen));
+        keymaster_error_t error;
+        EciesKem kem(kem_description, &pool, &error);
+        ASSERT_EQ(KM_ERROR_OK, error);
+
+        UniquePtr<NistCurveKeyExchange> recipient(NistCurveKeyExchange::GenerateKeyExchange(curve));
+        ASSERT_TRUE(recipient.get() != nullptr);
+        Buffer peer_public_value;
+        ASSERT_TRUE(recipient->public_value(&peer_public_value));
+        UniquePtr<EC_KEY, EC_KEY_Delete> recipient_key(recipient->private_key());
+
+        // Run enough encapsulations to drain the pool at least once; every one must use a
+        // distinct ephemeral key and decapsulate to the same clear key.
+        Buffer previous_encrypted_key;
+        for (int i = 0; i < 10; ++i) {
+            Buffer clear_key;
+            Buffer encrypted_key;
+            ASSERT_TRUE(kem.Encrypt(peer_public_value, &clear_key, &encrypted_key));
+            ASSERT_EQ(kKeyLen, clear_key.available_read());
+            EXPECT_FALSE(encrypted_key.available_read() ==
+                             previous_encrypted_key.available_read() &&
+                         memcmp(encrypted_key.peek_read(), previous_encrypted_key.peek_read(),
+                                encrypted_key.available_read()) == 0);
+
+            EciesKem decrypt_kem(kem_description, &error);
+            ASSERT_EQ(KM_ERROR_OK, error);
+            Buffer decrypted_clear_key;
+            ASSERT_TRUE(decrypt_kem.Decrypt(EC_KEY_dup(recipient_key.get()), encrypted_key,
+                                            &decrypted_clear_key));
+            ASSERT_EQ(kKeyLen, decrypted_clear_key.available_read());
+            EXPECT_EQ(0, memcmp(clear_key.peek_read(), decrypted_clear_key.peek_read(), kKeyLen));
+
+            previous_encrypted_key.Reinitialize(encrypted_key.peek_read(),
+                                                encrypted_key.available_read());
+        }
+
+        // The background thread tops the curve back up to the cap.
+        for (int i = 0; i < 1000 && pool.available(curve) < 4U; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        EXPECT_EQ(4U, pool.available(curve));
+    }
+}
+
+TEST(EciesKem, EphemeralKeyPoolStock) {
+    static const size_t kKeysPerCurve = 4;
+    EcEphemeralKeyPool pool(kKeysPerCurve, false /* background_refill */);
+    for (auto& curve : kEcCurves) {
+        EXPECT_EQ(0U, pool.available(curve));
+        ASSERT_TRUE(pool.Refill(curve));
+        EXPECT_EQ(kKeysPerCurve, pool.available(curve));
+
+        for (size_t taken = 1; taken <= kKeysPerCurve; ++taken) {
+            UniquePtr<NistCurveKeyExchange> key(pool.TakeKeyExchange(curve));
+            ASSERT_TRUE(key.get() != nullptr);
+            EXPECT_EQ(kKeysPerCurve - taken, pool.available(curve));
+        }
+
+        // An empty pool still hands out keys, generated inline.
+        UniquePtr<NistCurveKeyExchange> key(pool.TakeKeyExchange(curve));
+        ASSERT_TRUE(key.get() != nullptr);
+        EXPECT_EQ(0U, pool.available(curve));
+
+        ASSERT_TRUE(pool.Refill(curve));
+        EXPECT_EQ(kKeysPerCurve, pool.available(curve));
+    }
+}
+
 }  // namespace test
 }  // namespace keymaster
@@ -74,5 +74,37 @@ TEST(HkdfTest, Hkdf) {
     }
 }
 
+TEST(HkdfTest, RepeatedExpand) {
+    // A single instance must produce the same output as a fresh instance per call, regardless of
+    // the order of the |info| values it is asked to expand.
+    const string key = hex2str(kHkdfTests[0].key_hex);
+    const string salt = hex2str(kHkdfTests[0].salt_hex);
+    const char* infos[] = {"", "f0f1f2f3f4f5f6f7f8f9", "0a0b0c", ""};
+
+    Rfc5869Sha256Kdf reused;
+    ASSERT_TRUE(reused.Init(reinterpret_cast<const uint8_t*>(key.data()), key.size(),
+                            reinterpret_cast<const uint8_t*>(salt.data()), salt.size()));
+    for (auto info_hex : infos) {
+        const string info = hex2str(info_hex);
+        uint8_t reused_output[80];
+        uint8_t fresh_output[80];
+        ASSERT_TRUE(reused.GenerateKey(reinterpret_cast<const uint8_t*>(info.data()), info.size(),
+                                       reused_output, sizeof(reused_output)));
+
+        Rfc5869Sha256Kdf fresh;
+        ASSERT_TRUE(fresh.Init(reinterpret_cast<const uint8_t*>(key.data()), key.size(),
+                               reinterpret_cast<const uint8_t*>(salt.data()), salt.size()));
+        ASSERT_TRUE(fresh.GenerateKey(reinterpret_cast<const uint8_t*>(info.data()), info.size(),
+                                      fresh_output, sizeof(fresh_output)));
+        EXPECT_EQ(0, memcmp(reused_output, fresh_output, sizeof(fresh_output)));
+    }
+}
+
+TEST(HkdfTest, Uninitialized) {
+    Rfc5869Sha256Kdf hkdf;
+    uint8_t output[32];
+    EXPECT_FALSE(hkdf.GenerateKey(nullptr, 0, output, sizeof(output)));
+}
+
 }  // namespace test
 }  // namespace keymaster
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <keymaster/km_openssl/ckdf.h>
+#include <keymaster/km_openssl/hkdf.h>
+#include <keymaster/km_openssl/kdf2.h>
+
+#include "keymaster_benchmark_utils.h"
+
+namespace keymaster {
+namespace test {
+
+static const uint8_t kSecret[32] = {0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b,
+                                    0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b};
+static const uint8_t kSalt[13] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+static const uint8_t kInfo[10] = {0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9};
+
+// Long enough that HKDF needs two Expand blocks.
+static const size_t kOutputSize = 48;
+
+TEST(KdfBenchmark, HkdfInitAndExpand) {
+    uint8_t output[kOutputSize];
+    double rate = MeasureOpsPerSecond([&]() {
+        Rfc5869Sha256Kdf hkdf;
+        return hkdf.Init(kSecret, sizeof(kSecret), kSalt, sizeof(kSalt)) &&
+               hkdf.GenerateKey(kInfo, sizeof(kInfo), output, sizeof(output));
+    });
+    EXPECT_GT(rate, 0);
+    ReportRate("HKDF-SHA256 extract+expand", rate, sizeof(output));
+}
+
+TEST(KdfBenchmark, HkdfExpandOnly) {
+    Rfc5869Sha256Kdf hkdf;
+    ASSERT_TRUE(hkdf.Init(kSecret, sizeof(kSecret), kSalt, sizeof(kSalt)));
+    uint8_t output[kOutputSize];
+    uint8_t info[sizeof(kInfo)];
+    memcpy(info, kInfo, sizeof(info));
+    double rate = MeasureOpsPerSecond([&]() {
+        ++info[0];  // A different context each time.
+        return hkdf.GenerateKey(info, sizeof(info), output, sizeof(output));
+    });
+    EXPECT_GT(rate, 0);
+    ReportRate("HKDF-SHA256 expand (reused PRK)", rate, sizeof(output));
+}
+
+TEST(KdfBenchmark, Kdf2Sha256) {
+    Kdf2 kdf;
+    ASSERT_TRUE(kdf.Init(KM_DIGEST_SHA_2_256, kSecret, sizeof(kSecret)));
+    uint8_t output[kOutputSize];
+    double rate = MeasureOpsPerSecond(
+        [&]() { return kdf.GenerateKey(kInfo, sizeof(kInfo), output, sizeof(output)); });
+    EXPECT_GT(rate, 0);
+    ReportRate("KDF2-SHA256", rate, sizeof(output));
+}
+
+TEST(KdfBenchmark, CkdfOneShot) {
+    KeymasterKeyBlob key(kSecret, sizeof(kSecret));
+    KeymasterBlob label(kSalt, sizeof(kSalt));
+    keymaster_blob_t context = {kInfo, sizeof(kInfo)};
+    KeymasterKeyBlob output(kOutputSize);
+    double rate = MeasureOpsPerSecond(
+        [&]() { return ckdf(key, label, context, &output) == KM_ERROR_OK; });
+    EXPECT_GT(rate, 0);
+    ReportRate("CKDF-AES256 one-shot", rate, kOutputSize);
+}
+
+TEST(KdfBenchmark, CkdfReusedKey) {
+    Ckdf kdf;
+    ASSERT_EQ(KM_ERROR_OK, kdf.Init(KeymasterKeyBlob(kSecret, sizeof(kSecret))));
+    KeymasterBlob label(kSalt, sizeof(kSalt));
+    keymaster_blob_t context = {kInfo, sizeof(kInfo)};
+    KeymasterKeyBlob output(kOutputSize);
+    double rate = MeasureOpsPerSecond(
+        [&]() { return kdf.GenerateKey(label, &context, 1, &output) == KM_ERROR_OK; });
+    EXPECT_GT(rate, 0);
+    ReportRate("CKDF-AES256 (reused key)", rate, kOutputSize);
+}
+
+}  // namespace test
+}  // namespace keymaster
@@ -0,0 +1,191 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <openssl/rand.h>
+
+#include <keymaster/android_keymaster_utils.h>
+#include <keymaster/authorization_set.h>
+#include <keymaster/contexts/pure_soft_keymaster_context.h>
+#include <keymaster/key_blob_utils/integrity_assured_key_blob.h>
+#include <keymaster/key_blob_utils/software_keyblobs.h>
+
+#include "keymaster_benchmark_utils.h"
+
+namespace keymaster {
+namespace test {
+
+struct BlobFixture {
+    const char* name;
+    const char* file_name;  // nullptr means random bytes.
+};
+
+static std::string read_file(const std::string& file_name) {
+    std::ifstream file_stream(file_name, std::ios::binary);
+    std::istreambuf_iterator<char> file_begin(file_stream);
+    std::istreambuf_iterator<char> file_end;
+    return std::string(file_begin, file_end);
+}
+
+/**
+ * Compares the context's classified blob parsing with trying every software format in turn, the
+ * way it used to be done.
+ */
+class KeyBlobParseBenchmark : public testing::TestWithParam<BlobFixture> {
+  protected:
+    void SetUp() override {
+        if (GetParam().file_name) {
+            std::string data = read_file(GetParam().file_name);
+            ASSERT_FALSE(data.empty()) << "Missing fixture " << GetParam().file_name;
+            blob_ = KeymasterKeyBlob(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+        } else {
+            blob_ = KeymasterKeyBlob(333);
+            ASSERT_EQ(1, RAND_bytes(blob_.writable_data(), blob_.key_material_size));
+        }
+        ASSERT_EQ(KM_ERROR_OK,
+                  BuildHiddenAuthorizations(AuthorizationSet(), &hidden_, softwareRootOfTrust));
+    }
+
+    keymaster_error_t TrialParse() const {
+        KeymasterKeyBlob key_material;
+        AuthorizationSet hw_enforced, sw_enforced;
+        keymaster_error_t error = DeserializeIntegrityAssuredBlob(blob_, hidden_, &key_material,
+                                                                  &hw_enforced, &sw_enforced);
+        if (error != KM_ERROR_INVALID_KEY_BLOB)
+            return error;
+        error = ParseOcbAuthEncryptedBlob(blob_, hidden_, &key_material, &hw_enforced,
+                                          &sw_enforced);
+        if (error != KM_ERROR_INVALID_KEY_BLOB)
+            return error;
+        return ParseOldSoftkeymasterBlob(blob_, &key_material, &hw_enforced, &sw_enforced);
+    }
+
+    keymaster_error_t ClassifiedParse() const {
+        AuthorizationSet hw_enforced, sw_enforced;
+        return context_.ParseKeyBlobAuthorizations(blob_, AuthorizationSet(), &hw_enforced,
+                                                   &sw_enforced);
+    }
+
+    PureSoftKeymasterContext context_;
+    KeymasterKeyBlob blob_;
+    AuthorizationSet hidden_;
+};
+
+TEST_P(KeyBlobParseBenchmark, Parse) {
+    const keymaster_error_t expected = TrialParse();
+    ASSERT_EQ(expected, ClassifiedParse());
+
+    double trial_rate = MeasureOpsPerSecond([&]() { return TrialParse() == expected; });
+    double classified_rate = MeasureOpsPerSecond([&]() { return ClassifiedParse() == expected; });
+    EXPECT_GT(trial_rate, 0);
+    EXPECT_GT(classified_rate, 0);
+    ReportRate((std::string(GetParam().name) + ", try every format").c_str(), trial_rate);
+    ReportRate((std::string(GetParam().name) + ", classified").c_str(), classified_rate);
+}
+
+static const BlobFixture kFixtures[] = {
+    {"km0 software RSA 512", "km0_sw_rsa_512.blob"},
+    {"km1 software RSA 512", "km1_sw_rsa_512.blob"},
+    {"km1 software RSA 512, unversioned", "km1_sw_rsa_512_unversioned.blob"},
+    {"km1 software ECDSA 256", "km1_sw_ecdsa_256.blob"},
+    {"random bytes", nullptr},
+};
+
+INSTANTIATE_TEST_CASE_P(Fixtures, KeyBlobParseBenchmark, testing::ValuesIn(kFixtures));
+
+struct BlobLayout {
+    const char* name;
+    IntegrityAssuredBlobVersion version;
+};
+
+/**
+ * Compares the size and parse rate of the integrity-assured blob layouts, for a P-256 signing key
+ * with the authorizations GenerateKey gives it.
+ */
+class IntegrityAssuredLayoutBenchmark : public testing::TestWithParam<BlobLayout> {
+  protected:
+    void SetUp() override {
+        // About the size of a PKCS#8-encoded P-256 private key.
+        KeymasterKeyBlob key_material(138);
+        ASSERT_EQ(1, RAND_bytes(key_material.writable_data(), key_material.key_material_size));
+
+        AuthorizationSet hw_enforced(AuthorizationSetBuilder()
+                                         .EcdsaSigningKey(256)
+                                         .Digest(KM_DIGEST_SHA_2_256)
+                                         .Authorization(TAG_USER_SECURE_ID, 0x1234567890ABCDEFULL)
+                                         .Authorization(TAG_USER_AUTH_TYPE, HW_AUTH_FINGERPRINT)
+                                         .Authorization(TAG_AUTH_TIMEOUT, 300)
+                                         .Authorization(TAG_ORIGIN, KM_ORIGIN_GENERATED)
+                                         .Authorization(TAG_OS_VERSION, 80000)
+                                         .Authorization(TAG_OS_PATCHLEVEL, 201801));
+        AuthorizationSet sw_enforced(
+            AuthorizationSetBuilder().Authorization(TAG_CREATION_DATETIME, 1500000000000ULL));
+
+        ASSERT_EQ(KM_ERROR_OK,
+                  BuildHiddenAuthorizations(AuthorizationSet(), &hidden_, softwareRootOfTrust));
+        ASSERT_EQ(KM_ERROR_OK,
+                  SerializeIntegrityAssuredBlob(key_material, hidden_, hw_enforced, sw_enforced,
+                                                &blob_, GetParam().version));
+    }
+
+    bool Parse() const {
+        KeymasterKeyBlob key_material;
+        AuthorizationSet hw_enforced, sw_enforced;
+        return DeserializeIntegrityAssuredBlob(blob_, hidden_, &key_material, &hw_enforced,
+                                               &sw_enforced) == KM_ERROR_OK;
+    }
+
+    bool ParseNoHmacCheck() const {
+        KeymasterKeyBlob key_material;
+        AuthorizationSet hw_enforced, sw_enforced;
+        return DeserializeIntegrityAssuredBlob_NoHmacCheck(blob_, &key_material, &hw_enforced,
+                                                           &sw_enforced) == KM_ERROR_OK;
+    }
+
+    KeymasterKeyBlob blob_;
+    AuthorizationSet hidden_;
+};
+
+TEST_P(IntegrityAssuredLayoutBenchmark, Parse) {
+    printf("[ BENCHMARK] %-48s %12zu bytes\n", (std::string(GetParam().name) + " blob").c_str(),
+           blob_.key_material_size);
+    RecordProperty((std::string(GetParam().name) + " bytes").c_str(),
+                   static_cast<int>(blob_.key_material_size));
+
+    double rate = MeasureOpsPerSecond([&]() { return Parse(); });
+    double no_hmac_rate = MeasureOpsPerSecond([&]() { return ParseNoHmacCheck(); });
+    EXPECT_GT(rate, 0);
+    EXPECT_GT(no_hmac_rate, 0);
+    ReportRate((std::string(GetParam().name) + " parse").c_str(), rate);
+    ReportRate((std::string(GetParam().name) + " parse, no HMAC").c_str(), no_hmac_rate);
+}
+
+static const BlobLayout kLayouts[] = {
+    {"integrity-assured V0", INTEGRITY_ASSURED_BLOB_V0},
+    {"integrity-assured compact", INTEGRITY_ASSURED_BLOB_COMPACT},
+};
+
+INSTANTIATE_TEST_CASE_P(Layouts, IntegrityAssuredLayoutBenchmark, testing::ValuesIn(kLayouts));
+
+}  // namespace test
+}  // namespace keymaster
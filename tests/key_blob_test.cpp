@@ -15,10 +15,13 @@
  */
 
 #include <algorithm>
+#include <string>
 
 #include <gtest/gtest.h>
 
 #include <openssl/engine.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
 #include <openssl/rand.h>
 
 #include <keymaster/authorization_set.h>
@@ -288,6 +291,166 @@ TEST_F(KeyBlobTest, WrongAppId) {
                             nonce_, tag_, &decrypted_plaintext_));
 }
 
+TEST_F(KeyBlobTest, IntegrityAssuredRoundTrip) {
+    KeymasterKeyBlob blob;
+    ASSERT_EQ(KM_ERROR_OK, SerializeIntegrityAssuredBlob(key_material_, hidden_, hw_enforced_,
+                                                         sw_enforced_, &blob));
+
+    // The trailing HMAC is the first eight bytes of HMAC-SHA256 over the rest of the blob followed
+    // by the serialized hidden set, keyed with the fixed blob key.
+    static const char kHmacKey[] = "IntegrityAssuredBlob0";
+    const size_t kHmacSize = 8;
+    std::string hmac_input(reinterpret_cast<const char*>(blob.begin()),
+                           blob.key_material_size - kHmacSize);
+    std::string hidden_bytes(hidden_.SerializedSize(), '\0');
+    uint8_t* hidden_start = reinterpret_cast<uint8_t*>(&hidden_bytes[0]);
+    hidden_.Serialize(hidden_start, hidden_start + hidden_bytes.size());
+    hmac_input += hidden_bytes;
+    uint8_t expected_hmac[EVP_MAX_MD_SIZE];
+    unsigned expected_hmac_len;
+    ASSERT_TRUE(HMAC(EVP_sha256(), kHmacKey, sizeof(kHmacKey),
+                     reinterpret_cast<const uint8_t*>(hmac_input.data()), hmac_input.size(),
+                     expected_hmac, &expected_hmac_len));
+    EXPECT_EQ(0, memcmp(expected_hmac, blob.end() - kHmacSize, kHmacSize));
+
+    KeymasterKeyBlob key_material;
+    AuthorizationSet hw_enforced, sw_enforced;
+    ASSERT_EQ(KM_ERROR_OK, DeserializeIntegrityAssuredBlob(blob, hidden_, &key_material,
+                                                           &hw_enforced, &sw_enforced));
+    EXPECT_EQ(hw_enforced_, hw_enforced);
+    EXPECT_EQ(sw_enforced_, sw_enforced);
+    ASSERT_EQ(key_material_.key_material_size, key_material.key_material_size);
+    EXPECT_EQ(0, memcmp(key_material_.begin(), key_material.begin(),
+                        key_material.key_material_size));
+
+    AuthorizationSet wrong_hidden(hidden_);
+    wrong_hidden.push_back(TAG_APPLICATION_DATA, "data", 4);
+    EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB, DeserializeIntegrityAssuredBlob(
+                                             blob, wrong_hidden, &key_material, &hw_enforced,
+                                             &sw_enforced));
+
+    // Hidden sets too large for the stack buffer take the same path through the HMAC.
+    std::string long_app_data(1024, 'x');
+    AuthorizationSet long_hidden(hidden_);
+    long_hidden.push_back(TAG_APPLICATION_DATA, long_app_data.data(), long_app_data.size());
+    ASSERT_EQ(KM_ERROR_OK, SerializeIntegrityAssuredBlob(key_material_, long_hidden, hw_enforced_,
+                                                         sw_enforced_, &blob));
+    EXPECT_EQ(KM_ERROR_OK, DeserializeIntegrityAssuredBlob(blob, long_hidden, &key_material,
+                                                           &hw_enforced, &sw_enforced));
+    EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB, DeserializeIntegrityAssuredBlob(
+                                             blob, hidden_, &key_material, &hw_enforced,
+                                             &sw_enforced));
+}
+
+TEST_F(KeyBlobTest, IntegrityAssuredCompactValues) {
+    // Every value type, with extreme values and tags out of order.
+    const uint8_t bignum[] = {0x01, 0x00, 0x01};
+    std::string long_bytes(300, 'y');
+    hw_enforced_.push_back(TAG_USER_SECURE_ID, UINT64_MAX);
+    hw_enforced_.push_back(TAG_USER_SECURE_ID, 0);
+    hw_enforced_.push_back(TAG_MAX_USES_PER_BOOT, UINT32_MAX);
+    hw_enforced_.push_back(TAG_RSA_PUBLIC_EXPONENT, UINT64_MAX);
+    hw_enforced_.push_back(TAG_PURPOSE, KM_PURPOSE_VERIFY);
+    hw_enforced_.push_back(TAG_PURPOSE, KM_PURPOSE_SIGN);
+    hw_enforced_.push_back(
+        keymaster_param_blob(static_cast<keymaster_tag_t>(KM_BIGNUM | 1000), bignum, 3));
+    hw_enforced_.push_back(TAG_APPLICATION_DATA, long_bytes.data(), long_bytes.size());
+    hw_enforced_.push_back(TAG_APPLICATION_DATA, "", 0);
+    sw_enforced_.push_back(TAG_USAGE_EXPIRE_DATETIME, UINT64_MAX);
+    sw_enforced_.push_back(TAG_ALGORITHM, KM_ALGORITHM_EC);
+
+    KeymasterKeyBlob blob;
+    ASSERT_EQ(KM_ERROR_OK, SerializeIntegrityAssuredBlob(key_material_, hidden_, hw_enforced_,
+                                                         sw_enforced_, &blob));
+    EXPECT_EQ(INTEGRITY_ASSURED_BLOB_COMPACT, blob.key_material[0]);
+    EXPECT_TRUE(LooksLikeIntegrityAssuredBlob(blob));
+
+    KeymasterKeyBlob key_material;
+    AuthorizationSet hw_enforced, sw_enforced;
+    ASSERT_EQ(KM_ERROR_OK, DeserializeIntegrityAssuredBlob(blob, hidden_, &key_material,
+                                                           &hw_enforced, &sw_enforced));
+    EXPECT_EQ(hw_enforced_, hw_enforced);
+    EXPECT_EQ(sw_enforced_, sw_enforced);
+    ASSERT_EQ(key_material_.key_material_size, key_material.key_material_size);
+    EXPECT_EQ(0, memcmp(key_material_.begin(), key_material.begin(),
+                        key_material.key_material_size));
+
+    // Empty sets and key material too.
+    ASSERT_EQ(KM_ERROR_OK, SerializeIntegrityAssuredBlob(KeymasterKeyBlob(), hidden_,
+                                                         AuthorizationSet(), AuthorizationSet(),
+                                                         &blob));
+    ASSERT_EQ(KM_ERROR_OK, DeserializeIntegrityAssuredBlob(blob, hidden_, &key_material,
+                                                           &hw_enforced, &sw_enforced));
+    EXPECT_EQ(0U, key_material.key_material_size);
+    EXPECT_EQ(0U, hw_enforced.size());
+    EXPECT_EQ(0U, sw_enforced.size());
+}
+
+TEST_F(KeyBlobTest, IntegrityAssuredV0) {
+    KeymasterKeyBlob v0_blob, compact_blob;
+    ASSERT_EQ(KM_ERROR_OK,
+              SerializeIntegrityAssuredBlob(key_material_, hidden_, hw_enforced_, sw_enforced_,
+                                            &v0_blob, INTEGRITY_ASSURED_BLOB_V0));
+    ASSERT_EQ(KM_ERROR_OK, SerializeIntegrityAssuredBlob(key_material_, hidden_, hw_enforced_,
+                                                         sw_enforced_, &compact_blob));
+    EXPECT_EQ(INTEGRITY_ASSURED_BLOB_V0, v0_blob.key_material[0]);
+    EXPECT_LT(compact_blob.key_material_size, v0_blob.key_material_size);
+
+    // Blobs written before the compact layout existed still parse.
+    EXPECT_TRUE(LooksLikeIntegrityAssuredBlob(v0_blob));
+    KeymasterKeyBlob key_material;
+    AuthorizationSet hw_enforced, sw_enforced;
+    ASSERT_EQ(KM_ERROR_OK, DeserializeIntegrityAssuredBlob(v0_blob, hidden_, &key_material,
+                                                           &hw_enforced, &sw_enforced));
+    EXPECT_EQ(hw_enforced_, hw_enforced);
+    EXPECT_EQ(sw_enforced_, sw_enforced);
+    ASSERT_EQ(key_material_.key_material_size, key_material.key_material_size);
+    EXPECT_EQ(0, memcmp(key_material_.begin(), key_material.begin(),
+                        key_material.key_material_size));
+
+    // The version byte is covered by the HMAC.
+    v0_blob.writable_data()[0] = INTEGRITY_ASSURED_BLOB_COMPACT;
+    EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB, DeserializeIntegrityAssuredBlob(
+                                             v0_blob, hidden_, &key_material, &hw_enforced,
+                                             &sw_enforced));
+}
+
+TEST_F(KeyBlobTest, StructuralChecks) {
+    ASSERT_EQ(KM_ERROR_OK, Encrypt());
+    ASSERT_EQ(KM_ERROR_OK, Serialize());
+    EXPECT_TRUE(LooksLikeAuthEncryptedBlob(serialized_blob_));
+
+    KeymasterKeyBlob integrity_assured_blob;
+    ASSERT_EQ(KM_ERROR_OK, SerializeIntegrityAssuredBlob(key_material_, hidden_, hw_enforced_,
+                                                         sw_enforced_, &integrity_assured_blob));
+    EXPECT_TRUE(LooksLikeIntegrityAssuredBlob(integrity_assured_blob));
+    EXPECT_FALSE(LooksLikeAuthEncryptedBlob(integrity_assured_blob));
+    EXPECT_FALSE(LooksLikeIntegrityAssuredBlob(serialized_blob_));
+
+    // Truncating either blob breaks its length fields.
+    KeymasterKeyBlob truncated(serialized_blob_.key_material,
+                               serialized_blob_.key_material_size - 1);
+    EXPECT_FALSE(LooksLikeAuthEncryptedBlob(truncated));
+    truncated = KeymasterKeyBlob(integrity_assured_blob.key_material,
+                                 integrity_assured_blob.key_material_size - 1);
+    EXPECT_FALSE(LooksLikeIntegrityAssuredBlob(truncated));
+
+    // The compact layout has no outer length field, so a trailing byte must be caught too.
+    KeymasterKeyBlob extended(integrity_assured_blob.key_material_size + 1);
+    memcpy(extended.writable_data(), integrity_assured_blob.key_material,
+           integrity_assured_blob.key_material_size);
+    extended.writable_data()[integrity_assured_blob.key_material_size] = 0;
+    EXPECT_FALSE(LooksLikeIntegrityAssuredBlob(extended));
+
+    KeymasterKeyBlob v0_blob;
+    ASSERT_EQ(KM_ERROR_OK,
+              SerializeIntegrityAssuredBlob(key_material_, hidden_, hw_enforced_, sw_enforced_,
+                                            &v0_blob, INTEGRITY_ASSURED_BLOB_V0));
+    EXPECT_TRUE(LooksLikeIntegrityAssuredBlob(v0_blob));
+    truncated = KeymasterKeyBlob(v0_blob.key_material, v0_blob.key_material_size - 1);
+    EXPECT_FALSE(LooksLikeIntegrityAssuredBlob(truncated));
+}
+
 // This test is especially useful when compiled for 32-bit mode and run under valgrind.
 TEST_F(KeyBlobTest, FuzzTest) {
     time_t now = time(NULL);
@@ -315,6 +478,9 @@ TEST_F(KeyBlobTest, FuzzTest) {
         keymaster_error_t error = DeserializeAuthEncryptedBlob(
             key_blob, &ciphertext_, &hw_enforced_, &sw_enforced_, &nonce_, &tag_);
         if (error == KM_ERROR_OK) {
+            // The structural check must never rule out a blob that deserializes.
+            EXPECT_TRUE(LooksLikeAuthEncryptedBlob(key_blob));
+
             // It's possible to deserialize successfully.  Decryption should always fail.
             ++deserialize_auth_encrypted_success;
             error = OcbDecryptKey(hw_enforced_, sw_enforced_, hidden_, master_key_, ciphertext_,
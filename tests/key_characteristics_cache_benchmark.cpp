@@ -0,0 +1,168 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <hardware/keymaster2.h>
+
+#include <keymaster/android_keymaster_utils.h>
+#include <keymaster/contexts/keymaster2_passthrough_context.h>
+#include <keymaster/key.h>
+
+#include "keymaster_benchmark_utils.h"
+
+namespace keymaster {
+namespace test {
+
+/**
+ * Just enough of a keymaster2 device to answer get_key_characteristics and delete_key.
+ * get_key_characteristics takes at least |latency_us|, the way a round trip into a TEE does, and
+ * describes every blob as a P-256 signing key.
+ */
+class FakeKeymaster2Device {
+  public:
+    explicit FakeKeymaster2Device(uint32_t latency_us) : latency_us_(latency_us) {
+        memset(&device_, 0, sizeof(device_));
+        device_.common.tag = HARDWARE_DEVICE_TAG;
+        device_.common.version = 1;
+        device_.common.close = close_device;
+        device_.context = this;
+        device_.get_key_characteristics = get_key_characteristics;
+        device_.delete_key = delete_key;
+    }
+
+    keymaster2_device_t* device() { return &device_; }
+    size_t characteristics_calls() const { return characteristics_calls_; }
+
+  private:
+    static FakeKeymaster2Device* self(const keymaster2_device_t* dev) {
+        return reinterpret_cast<FakeKeymaster2Device*>(dev->context);
+    }
+
+    static int close_device(hw_device_t* dev) {
+        delete self(reinterpret_cast<keymaster2_device_t*>(dev));
+        return 0;
+    }
+
+    static keymaster_error_t get_key_characteristics(const keymaster2_device_t* dev,
+                                                     const keymaster_key_blob_t* /* key_blob */,
+                                                     const keymaster_blob_t* /* client_id */,
+                                                     const keymaster_blob_t* /* app_data */,
+                                                     keymaster_key_characteristics_t* chars) {
+        ++self(dev)->characteristics_calls_;
+        std::this_thread::sleep_for(std::chrono::microseconds(self(dev)->latency_us_));
+
+        // The caller releases these with keymaster_free_characteristics, so they must come from
+        // malloc.
+        const keymaster_key_param_t hw_params[] = {
+            keymaster_param_enum(KM_TAG_ALGORITHM, KM_ALGORITHM_EC),
+            keymaster_param_int(KM_TAG_KEY_SIZE, 256),
+            keymaster_param_enum(KM_TAG_PURPOSE, KM_PURPOSE_SIGN),
+            keymaster_param_enum(KM_TAG_DIGEST, KM_DIGEST_SHA_2_256),
+            keymaster_param_bool(KM_TAG_NO_AUTH_REQUIRED),
+            keymaster_param_enum(KM_TAG_ORIGIN, KM_ORIGIN_GENERATED),
+            keymaster_param_int(KM_TAG_OS_VERSION, 80000),
+            keymaster_param_int(KM_TAG_OS_PATCHLEVEL, 201801),
+        };
+        const keymaster_key_param_t sw_params[] = {
+            keymaster_param_date(KM_TAG_CREATION_DATETIME, 1500000000000),
+        };
+        chars->hw_enforced.params = Copy(hw_params, array_length(hw_params));
+        chars->hw_enforced.length = array_length(hw_params);
+        chars->sw_enforced.params = Copy(sw_params, array_length(sw_params));
+        chars->sw_enforced.length = array_length(sw_params);
+        return KM_ERROR_OK;
+    }
+
+    static keymaster_error_t delete_key(const keymaster2_device_t* /* dev */,
+                                        const keymaster_key_blob_t* /* key */) {
+        return KM_ERROR_OK;
+    }
+
+    static keymaster_key_param_t* Copy(const keymaster_key_param_t* params, size_t count) {
+        void* copy = malloc(count * sizeof(*params));
+        memcpy(copy, params, count * sizeof(*params));
+        return reinterpret_cast<keymaster_key_param_t*>(copy);
+    }
+
+    keymaster2_device_t device_;
+    const uint32_t latency_us_;
+    std::atomic<size_t> characteristics_calls_{0};
+};
+
+static const uint32_t kDeviceLatencyUs = 200;
+
+class KeyCharacteristicsCacheBenchmark : public testing::TestWithParam<size_t> {
+  protected:
+    void SetUp() override {
+        device_ = new FakeKeymaster2Device(kDeviceLatencyUs);
+        // The context's engine takes ownership of the device.
+        context_.reset(new Keymaster2PassthroughContext(device_->device(), GetParam()));
+
+        const uint8_t blob_data[] = "opaque hardware key blob";
+        blob_ = KeymasterKeyBlob(blob_data, sizeof(blob_data));
+        params_ = AuthorizationSetBuilder()
+                      .Authorization(TAG_APPLICATION_ID, "app_id", 6)
+                      .Authorization(TAG_APPLICATION_DATA, "app_data", 8)
+                      .build();
+    }
+
+    bool Parse() const {
+        UniquePtr<Key> key;
+        return context_->ParseKeyBlob(blob_, params_, &key) == KM_ERROR_OK;
+    }
+
+    std::string Name() const {
+        if (GetParam())
+            return "km2 ParseKeyBlob, " + std::to_string(kDeviceLatencyUs) + "us device, cache";
+        return "km2 ParseKeyBlob, " + std::to_string(kDeviceLatencyUs) + "us device, no cache";
+    }
+
+    FakeKeymaster2Device* device_;
+    UniquePtr<Keymaster2PassthroughContext> context_;
+    KeymasterKeyBlob blob_;
+    AuthorizationSet params_;
+};
+
+TEST_P(KeyCharacteristicsCacheBenchmark, ParseKeyBlob) {
+    double rate = MeasureOpsPerSecond([&]() { return Parse(); });
+    EXPECT_GT(rate, 0);
+    ReportRate(Name().c_str(), rate);
+
+    // With the cache on, only the first parse should have reached the device.
+    if (GetParam())
+        EXPECT_EQ(1U, device_->characteristics_calls());
+
+    // Deleting the key must force the next parse back to the device.
+    size_t calls_before_delete = device_->characteristics_calls();
+    context_->DeleteKey(blob_);
+    ASSERT_TRUE(Parse());
+    EXPECT_EQ(calls_before_delete + 1, device_->characteristics_calls());
+}
+
+INSTANTIATE_TEST_CASE_P(CacheSize, KeyCharacteristicsCacheBenchmark,
+                        testing::Values(0, KeyCharacteristicsCache::kDefaultMaxEntries));
+
+}  // namespace test
+}  // namespace keymaster
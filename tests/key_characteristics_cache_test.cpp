@@ -0,0 +1,122 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <keymaster/android_keymaster_utils.h>
+#include <keymaster/legacy_support/key_characteristics_cache.h>
+
+#include "android_keymaster_test_utils.h"
+
+namespace keymaster {
+namespace test {
+
+class KeyCharacteristicsCacheTest : public testing::Test {
+  protected:
+    KeyCharacteristicsCacheTest()
+        : hw_enforced_(AuthorizationSetBuilder()
+                           .Authorization(TAG_ALGORITHM, KM_ALGORITHM_EC)
+                           .Authorization(TAG_KEY_SIZE, 256)
+                           .Authorization(TAG_PURPOSE, KM_PURPOSE_SIGN)),
+          sw_enforced_(AuthorizationSetBuilder().Authorization(TAG_CREATION_DATETIME, 10)) {}
+
+    static KeymasterKeyBlob MakeBlob(uint8_t fill) {
+        KeymasterKeyBlob blob(32);
+        memset(blob.writable_data(), fill, blob.key_material_size);
+        return blob;
+    }
+
+    static AuthorizationSet AppId(const char* app_id) {
+        return AuthorizationSetBuilder()
+            .Authorization(TAG_APPLICATION_ID, app_id, strlen(app_id))
+            .build();
+    }
+
+    AuthorizationSet hw_enforced_;
+    AuthorizationSet sw_enforced_;
+};
+
+TEST_F(KeyCharacteristicsCacheTest, MissThenHit) {
+    KeyCharacteristicsCache cache;
+    KeymasterKeyBlob blob = MakeBlob(1);
+    AuthorizationSet hw, sw;
+    EXPECT_FALSE(cache.Lookup(blob, AuthorizationSet(), &hw, &sw));
+
+    cache.Insert(blob, AuthorizationSet(), hw_enforced_, sw_enforced_);
+    ASSERT_TRUE(cache.Lookup(blob, AuthorizationSet(), &hw, &sw));
+    EXPECT_EQ(hw_enforced_, hw);
+    EXPECT_EQ(sw_enforced_, sw);
+    EXPECT_EQ(1U, cache.size());
+}
+
+TEST_F(KeyCharacteristicsCacheTest, KeyedByApplicationBinding) {
+    KeyCharacteristicsCache cache;
+    KeymasterKeyBlob blob = MakeBlob(1);
+    cache.Insert(blob, AppId("app"), hw_enforced_, sw_enforced_);
+
+    AuthorizationSet hw, sw;
+    EXPECT_TRUE(cache.Lookup(blob, AppId("app"), &hw, &sw));
+    EXPECT_FALSE(cache.Lookup(blob, AppId("other"), &hw, &sw));
+    EXPECT_FALSE(cache.Lookup(blob, AuthorizationSet(), &hw, &sw));
+    EXPECT_FALSE(cache.Lookup(MakeBlob(2), AppId("app"), &hw, &sw));
+
+    // An empty APPLICATION_ID is not the same as none at all.
+    EXPECT_FALSE(cache.Lookup(blob, AppId(""), &hw, &sw));
+}
+
+TEST_F(KeyCharacteristicsCacheTest, EvictsLeastRecentlyUsed) {
+    KeyCharacteristicsCache cache(2);
+    cache.Insert(MakeBlob(1), AuthorizationSet(), hw_enforced_, sw_enforced_);
+    cache.Insert(MakeBlob(2), AuthorizationSet(), hw_enforced_, sw_enforced_);
+
+    AuthorizationSet hw, sw;
+    EXPECT_TRUE(cache.Lookup(MakeBlob(1), AuthorizationSet(), &hw, &sw));
+    cache.Insert(MakeBlob(3), AuthorizationSet(), hw_enforced_, sw_enforced_);
+
+    EXPECT_EQ(2U, cache.size());
+    EXPECT_TRUE(cache.Lookup(MakeBlob(1), AuthorizationSet(), &hw, &sw));
+    EXPECT_FALSE(cache.Lookup(MakeBlob(2), AuthorizationSet(), &hw, &sw));
+    EXPECT_TRUE(cache.Lookup(MakeBlob(3), AuthorizationSet(), &hw, &sw));
+}
+
+TEST_F(KeyCharacteristicsCacheTest, InvalidateDropsAllBindings) {
+    KeyCharacteristicsCache cache;
+    KeymasterKeyBlob blob = MakeBlob(1);
+    cache.Insert(blob, AuthorizationSet(), hw_enforced_, sw_enforced_);
+    cache.Insert(blob, AppId("app"), hw_enforced_, sw_enforced_);
+    cache.Insert(MakeBlob(2), AuthorizationSet(), hw_enforced_, sw_enforced_);
+
+    cache.Invalidate(blob);
+    AuthorizationSet hw, sw;
+    EXPECT_FALSE(cache.Lookup(blob, AuthorizationSet(), &hw, &sw));
+    EXPECT_FALSE(cache.Lookup(blob, AppId("app"), &hw, &sw));
+    EXPECT_TRUE(cache.Lookup(MakeBlob(2), AuthorizationSet(), &hw, &sw));
+
+    cache.Clear();
+    EXPECT_EQ(0U, cache.size());
+}
+
+TEST_F(KeyCharacteristicsCacheTest, ZeroSizeCachesNothing) {
+    KeyCharacteristicsCache cache(0);
+    KeymasterKeyBlob blob = MakeBlob(1);
+    cache.Insert(blob, AuthorizationSet(), hw_enforced_, sw_enforced_);
+    AuthorizationSet hw, sw;
+    EXPECT_FALSE(cache.Lookup(blob, AuthorizationSet(), &hw, &sw));
+    EXPECT_EQ(0U, cache.size());
+}
+
+}  // namespace test
+}  // namespace keymaster
@@ -0,0 +1,237 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <openssl/x509.h>
+
+#include <keymaster/android_keymaster_utils.h>
+#include <keymaster/km_openssl/openssl_utils.h>
+#include <keymaster/legacy_support/keymaster0_engine.h>
+
+#include "keymaster_benchmark_utils.h"
+
+namespace keymaster {
+namespace test {
+
+/**
+ * A software keymaster0 device that behaves like a slow secure element: every signing call takes
+ * at least |latency_us|, and at most |max_concurrent| calls are serviced at once.  Key blobs are
+ * just PKCS#8-encoded EC private keys.  Only EC keys are supported.
+ */
+class FakeKeymaster0Device {
+  public:
+    FakeKeymaster0Device(uint32_t latency_us, size_t max_concurrent)
+        : latency_us_(latency_us), max_concurrent_(max_concurrent) {
+        memset(&device_, 0, sizeof(device_));
+        device_.common.tag = HARDWARE_DEVICE_TAG;
+        device_.common.version = 1;
+        device_.common.close = close_device;
+        device_.client_version = 1;
+        device_.flags = KEYMASTER_SUPPORTS_EC;
+        device_.context = this;
+        device_.generate_keypair = generate_keypair;
+        device_.get_keypair_public = get_keypair_public;
+        device_.sign_data = sign_data;
+    }
+
+    const keymaster0_device_t* device() { return &device_; }
+
+  private:
+    static FakeKeymaster0Device* self(const keymaster0_device_t* dev) {
+        return reinterpret_cast<FakeKeymaster0Device*>(dev->context);
+    }
+
+    static int close_device(hw_device_t* dev) {
+        delete self(reinterpret_cast<keymaster0_device_t*>(dev));
+        return 0;
+    }
+
+    static EVP_PKEY* ParseBlob(const uint8_t* key_blob, size_t key_blob_length) {
+        return d2i_AutoPrivateKey(nullptr, &key_blob, key_blob_length);
+    }
+
+    static int generate_keypair(const keymaster0_device_t* /* dev */,
+                                const keymaster_keypair_t key_type, const void* key_params,
+                                uint8_t** key_blob, size_t* key_blob_length) {
+        if (key_type != TYPE_EC)
+            return -1;
+        const keymaster_ec_keygen_params_t* params =
+            reinterpret_cast<const keymaster_ec_keygen_params_t*>(key_params);
+        if (params->field_size != 256)
+            return -1;
+
+        EC_KEY_Ptr ec_key(EC_KEY_new_by_curve_name(NID_X9_62_prime256v1));
+        EVP_PKEY_Ptr pkey(EVP_PKEY_new());
+        if (!ec_key.get() || !pkey.get() || !EC_KEY_generate_key(ec_key.get()) ||
+            !EVP_PKEY_set1_EC_KEY(pkey.get(), ec_key.get()))
+            return -1;
+        return Encode(i2d_PrivateKey, pkey.get(), key_blob, key_blob_length);
+    }
+
+    static int get_keypair_public(const keymaster0_device_t* /* dev */, const uint8_t* key_blob,
+                                  const size_t key_blob_length, uint8_t** x509_data,
+                                  size_t* x509_data_length) {
+        EVP_PKEY_Ptr pkey(ParseBlob(key_blob, key_blob_length));
+        if (!pkey.get())
+            return -1;
+        return Encode(i2d_PUBKEY, pkey.get(), x509_data, x509_data_length);
+    }
+
+    static int sign_data(const keymaster0_device_t* dev, const void* /* signing_params */,
+                         const uint8_t* key_blob, const size_t key_blob_length,
+                         const uint8_t* data, const size_t data_length, uint8_t** signed_data,
+                         size_t* signed_data_length) {
+        EVP_PKEY_Ptr pkey(ParseBlob(key_blob, key_blob_length));
+        if (!pkey.get())
+            return -1;
+        EC_KEY_Ptr ec_key(EVP_PKEY_get1_EC_KEY(pkey.get()));
+        if (!ec_key.get())
+            return -1;
+
+        self(dev)->EnterDevice();
+        std::this_thread::sleep_for(std::chrono::microseconds(self(dev)->latency_us_));
+        *signed_data = reinterpret_cast<uint8_t*>(malloc(ECDSA_size(ec_key.get())));
+        unsigned int sig_len = 0;
+        int result = -1;
+        if (*signed_data &&
+            ECDSA_sign(0 /* type */, data, data_length, *signed_data, &sig_len, ec_key.get())) {
+            *signed_data_length = sig_len;
+            result = 0;
+        }
+        self(dev)->LeaveDevice();
+        return result;
+    }
+
+    template <typename Encoder>
+    static int Encode(Encoder encoder, EVP_PKEY* pkey, uint8_t** data, size_t* data_length) {
+        int len = encoder(pkey, nullptr);
+        if (len <= 0)
+            return -1;
+        *data = reinterpret_cast<uint8_t*>(malloc(len));
+        if (!*data)
+            return -1;
+        uint8_t* p = *data;
+        encoder(pkey, &p);
+        *data_length = len;
+        return 0;
+    }
+
+    void EnterDevice() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        slot_free_.wait(lock, [this] { return in_device_ < max_concurrent_; });
+        ++in_device_;
+    }
+
+    void LeaveDevice() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --in_device_;
+        }
+        slot_free_.notify_one();
+    }
+
+    keymaster0_device_t device_;
+    const uint32_t latency_us_;
+    const size_t max_concurrent_;
+    std::mutex mutex_;
+    std::condition_variable slot_free_;
+    size_t in_device_ = 0;
+};
+
+static const uint32_t kDeviceLatencyUs = 500;
+static const size_t kDeviceMaxConcurrent = 4;
+static const char kMessage[] = "The quick brown fox jumps over the lazy dog";
+
+class Keymaster0EngineBenchmark : public testing::TestWithParam<size_t> {
+  protected:
+    void SetUp() override {
+        FakeKeymaster0Device* device =
+            new FakeKeymaster0Device(kDeviceLatencyUs, kDeviceMaxConcurrent);
+        engine_.reset(new Keymaster0Engine(device->device()));
+        ASSERT_TRUE(engine_->supports_ec());
+        ASSERT_TRUE(engine_->GenerateEcKey(256, &blob_));
+
+        EVP_PKEY_Ptr pkey(engine_->GetKeymaster0PublicKey(blob_));
+        ASSERT_TRUE(pkey.get() != nullptr);
+        public_key_.reset(EVP_PKEY_get1_EC_KEY(pkey.get()));
+        ASSERT_TRUE(public_key_.get() != nullptr);
+
+        SHA256(reinterpret_cast<const uint8_t*>(kMessage), sizeof(kMessage), digest_);
+    }
+
+    void TearDown() override { engine_.reset(); }
+
+    bool Sign(EC_KEY* key, std::vector<uint8_t>* sig) const {
+        sig->resize(ECDSA_size(key));
+        unsigned int sig_len = 0;
+        if (ECDSA_sign(0 /* type */, digest_, sizeof(digest_), sig->data(), &sig_len, key) != 1)
+            return false;
+        sig->resize(sig_len);
+        return true;
+    }
+
+    std::string Name() const {
+        return "keymaster0 ECDSA P-256 sign, " + std::to_string(GetParam()) + " callers";
+    }
+
+    UniquePtr<Keymaster0Engine> engine_;
+    KeymasterKeyBlob blob_;
+    EC_KEY_Ptr public_key_;
+    uint8_t digest_[SHA256_DIGEST_LENGTH];
+};
+
+TEST_P(Keymaster0EngineBenchmark, Sign) {
+    const size_t callers = GetParam();
+
+    // Each caller gets its own engine-backed key, as separate keystore operations would.
+    std::vector<EC_KEY_Ptr> keys(callers);
+    for (auto& key : keys) {
+        key.reset(engine_->BlobToEcKey(blob_));
+        ASSERT_TRUE(key.get() != nullptr);
+    }
+
+    // Make sure the signatures coming back through the engine are real before timing anything.
+    std::vector<uint8_t> sig;
+    ASSERT_TRUE(Sign(keys[0].get(), &sig));
+    EXPECT_EQ(1, ECDSA_verify(0 /* type */, digest_, sizeof(digest_), sig.data(), sig.size(),
+                              public_key_.get()));
+
+    std::vector<std::vector<uint8_t>> caller_sigs(callers);
+    double rate = MeasureParallelOpsPerSecond(
+        callers, [&](size_t caller) { return Sign(keys[caller].get(), &caller_sigs[caller]); });
+    EXPECT_GT(rate, 0);
+    ReportRate(Name().c_str(), rate);
+}
+
+INSTANTIATE_TEST_CASE_P(Callers, Keymaster0EngineBenchmark, testing::Values(1, 4, 8));
+
+}  // namespace test
+}  // namespace keymaster
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include <keymaster/android_keymaster_utils.h>
+#include <keymaster/authorization_set.h>
+#include <keymaster/legacy_support/keymaster1_digest_table.h>
+
+namespace keymaster {
+namespace test {
+
+/**
+ * Just enough of a keymaster1 device to answer get_supported_digests: RSA gets every digest, EC
+ * gets SHA-256 only and HMAC gets SHA-256 and SHA-512, unless |all_digests| is set, and
+ * |fail_algorithm| gets an error.
+ */
+class FakeKeymaster1Device {
+  public:
+    FakeKeymaster1Device() {
+        memset(&device_, 0, sizeof(device_));
+        device_.context = this;
+        device_.get_supported_digests = get_supported_digests;
+    }
+
+    const keymaster1_device_t* device() const { return &device_; }
+    void set_all_digests(bool all_digests) { all_digests_ = all_digests; }
+    void set_fail_algorithm(keymaster_algorithm_t algorithm) { fail_algorithm_ = algorithm; }
+    size_t calls() const { return calls_; }
+
+  private:
+    static keymaster_error_t get_supported_digests(const keymaster1_device_t* dev,
+                                                   keymaster_algorithm_t algorithm,
+                                                   keymaster_purpose_t /* purpose */,
+                                                   keymaster_digest_t** digests,
+                                                   size_t* digests_length) {
+        FakeKeymaster1Device* self = reinterpret_cast<FakeKeymaster1Device*>(dev->context);
+        ++self->calls_;
+        if (algorithm == self->fail_algorithm_)
+            return KM_ERROR_UNKNOWN_ERROR;
+
+        static const keymaster_digest_t rsa_digests[] = {
+            KM_DIGEST_SHA_2_512, KM_DIGEST_NONE,      KM_DIGEST_MD5,       KM_DIGEST_SHA1,
+            KM_DIGEST_SHA_2_224, KM_DIGEST_SHA_2_256, KM_DIGEST_SHA_2_384,
+        };
+        static const keymaster_digest_t ec_digests[] = {KM_DIGEST_SHA_2_256};
+        static const keymaster_digest_t hmac_digests[] = {KM_DIGEST_SHA_2_512, KM_DIGEST_SHA_2_256};
+
+        if (self->all_digests_)
+            return Copy(rsa_digests, array_length(rsa_digests), digests, digests_length);
+        switch (algorithm) {
+        case KM_ALGORITHM_RSA:
+            return Copy(rsa_digests, array_length(rsa_digests), digests, digests_length);
+        case KM_ALGORITHM_EC:
+            return Copy(ec_digests, array_length(ec_digests), digests, digests_length);
+        case KM_ALGORITHM_HMAC:
+            return Copy(hmac_digests, array_length(hmac_digests), digests, digests_length);
+        default:
+            return KM_ERROR_UNSUPPORTED_ALGORITHM;
+        }
+    }
+
+    // The caller frees the list, so it must come from malloc.
+    static keymaster_error_t Copy(const keymaster_digest_t* src, size_t count,
+                                  keymaster_digest_t** digests, size_t* digests_length) {
+        *digests = reinterpret_cast<keymaster_digest_t*>(malloc(count * sizeof(*src)));
+        if (!*digests)
+            return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+        memcpy(*digests, src, count * sizeof(*src));
+        *digests_length = count;
+        return KM_ERROR_OK;
+    }
+
+    keymaster1_device_t device_;
+    bool all_digests_ = false;
+    keymaster_algorithm_t fail_algorithm_ = KM_ALGORITHM_AES;
+    size_t calls_ = 0;
+};
+
+static uint32_t Bit(keymaster_digest_t digest) {
+    return Keymaster1DigestTable::DigestBit(digest);
+}
+
+TEST(Keymaster1DigestTableTest, Initialize) {
+    FakeKeymaster1Device device;
+    Keymaster1DigestTable table;
+    ASSERT_EQ(KM_ERROR_OK, table.Initialize(device.device()));
+    EXPECT_EQ(8U, device.calls());
+
+    EXPECT_TRUE(table.covers(KM_ALGORITHM_RSA, KM_PURPOSE_SIGN));
+    EXPECT_TRUE(table.covers(KM_ALGORITHM_RSA, KM_PURPOSE_DECRYPT));
+    EXPECT_TRUE(table.covers(KM_ALGORITHM_EC, KM_PURPOSE_VERIFY));
+    EXPECT_TRUE(table.covers(KM_ALGORITHM_HMAC, KM_PURPOSE_SIGN));
+    EXPECT_FALSE(table.covers(KM_ALGORITHM_EC, KM_PURPOSE_ENCRYPT));
+    EXPECT_FALSE(table.covers(KM_ALGORITHM_AES, KM_PURPOSE_ENCRYPT));
+    EXPECT_FALSE(table.covers(KM_ALGORITHM_RSA, KM_PURPOSE_DERIVE_KEY));
+
+    EXPECT_EQ(Bit(KM_DIGEST_SHA_2_256), table.digests(KM_ALGORITHM_EC, KM_PURPOSE_SIGN));
+    EXPECT_EQ(Bit(KM_DIGEST_SHA_2_256) | Bit(KM_DIGEST_SHA_2_512),
+              table.digests(KM_ALGORITHM_HMAC, KM_PURPOSE_VERIFY));
+
+    // EC and HMAC are missing digests.
+    EXPECT_FALSE(table.supports_all());
+}
+
+TEST(Keymaster1DigestTableTest, InitializeError) {
+    FakeKeymaster1Device device;
+    device.set_fail_algorithm(KM_ALGORITHM_HMAC);
+    Keymaster1DigestTable table;
+    EXPECT_EQ(KM_ERROR_UNKNOWN_ERROR, table.Initialize(device.device()));
+    EXPECT_FALSE(table.covers(KM_ALGORITHM_RSA, KM_PURPOSE_SIGN));
+    EXPECT_FALSE(table.supports_all());
+}
+
+TEST(Keymaster1DigestTableTest, FindUnsupported) {
+    FakeKeymaster1Device device;
+    Keymaster1DigestTable table;
+    ASSERT_EQ(KM_ERROR_OK, table.Initialize(device.device()));
+
+    AuthorizationSet params(AuthorizationSetBuilder()
+                                .Digest(KM_DIGEST_SHA_2_256)
+                                .Digest(KM_DIGEST_SHA1)
+                                .Digest(KM_DIGEST_SHA_2_512));
+    uint32_t requested = Keymaster1DigestTable::RequestedDigests(params);
+    EXPECT_EQ(Bit(KM_DIGEST_SHA1) | Bit(KM_DIGEST_SHA_2_256) | Bit(KM_DIGEST_SHA_2_512), requested);
+
+    keymaster_digest_t unsupported = KM_DIGEST_NONE;
+    EXPECT_FALSE(table.FindUnsupported(KM_ALGORITHM_RSA, KM_PURPOSE_SIGN, requested, &unsupported));
+    ASSERT_TRUE(table.FindUnsupported(KM_ALGORITHM_EC, KM_PURPOSE_SIGN, requested, &unsupported));
+    EXPECT_EQ(KM_DIGEST_SHA1, unsupported);
+    ASSERT_TRUE(table.FindUnsupported(KM_ALGORITHM_HMAC, KM_PURPOSE_SIGN, requested, &unsupported));
+    EXPECT_EQ(KM_DIGEST_SHA1, unsupported);
+
+    // Pairs the device wasn't asked about are left to the device.
+    EXPECT_FALSE(
+        table.FindUnsupported(KM_ALGORITHM_EC, KM_PURPOSE_ENCRYPT, requested, &unsupported));
+
+    // Digests the table has no bit for are never supported.
+    uint32_t unknown = Keymaster1DigestTable::DigestBit(1000);
+    EXPECT_TRUE(table.FindUnsupported(KM_ALGORITHM_RSA, KM_PURPOSE_SIGN, unknown, &unsupported));
+}
+
+TEST(Keymaster1DigestTableTest, SupportsAll) {
+    FakeKeymaster1Device device;
+    device.set_all_digests(true);
+    Keymaster1DigestTable table;
+    ASSERT_EQ(KM_ERROR_OK, table.Initialize(device.device()));
+    EXPECT_TRUE(table.supports_all());
+
+    table.Clear();
+    EXPECT_FALSE(table.supports_all());
+    EXPECT_FALSE(table.covers(KM_ALGORITHM_RSA, KM_PURPOSE_SIGN));
+}
+
+}  // namespace test
+}  // namespace keymaster
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_KEYMASTER_BENCHMARK_UTILS_H_
+#define SYSTEM_KEYMASTER_KEYMASTER_BENCHMARK_UTILS_H_
+
+/*
+ * Minimal timing helpers for the *_benchmark gtest binaries.  Not used in production code.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace keymaster {
+namespace test {
+
+/**
+ * Runs |op| repeatedly, for at least |min_duration_ms| milliseconds, and returns the observed rate
+ * in operations per second.  |op| returns false to signal failure, in which case the run stops and
+ * 0 is returned.
+ */
+template <typename Op> double MeasureOpsPerSecond(Op op, uint64_t min_duration_ms = 500) {
+    typedef std::chrono::steady_clock clock;
+    const auto start = clock::now();
+    const auto deadline = start + std::chrono::milliseconds(min_duration_ms);
+    uint64_t ops = 0;
+    auto now = start;
+    do {
+        // Check the clock in batches, so cheap operations aren't dominated by clock reads.
+        for (int i = 0; i < 16; ++i, ++ops)
+            if (!op()) return 0;
+        now = clock::now();
+    } while (now < deadline);
+    return ops / std::chrono::duration<double>(now - start).count();
+}
+
+/**
+ * Runs MeasureOpsPerSecond on |num_threads| threads at once and returns the combined rate, or 0 if
+ * any thread saw a failure.  |op| is called as op(thread_index), so threads can keep separate state.
+ */
+template <typename Op>
+double MeasureParallelOpsPerSecond(size_t num_threads, Op op, uint64_t min_duration_ms = 500) {
+    std::vector<double> rates(num_threads);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; ++t) {
+        threads.emplace_back([&rates, &op, t, min_duration_ms] {
+            rates[t] = MeasureOpsPerSecond([&op, t] { return op(t); }, min_duration_ms);
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    double total = 0;
+    for (double rate : rates) {
+        if (rate == 0) return 0;
+        total += rate;
+    }
+    return total;
+}
+
+/**
+ * Prints |ops_per_sec| in a greppable form and records it as a gtest property, so that it shows up
+ * in XML output.  If |bytes_per_op| is non-zero, the throughput in MB/s is reported as well.
+ */
+inline void ReportRate(const char* name, double ops_per_sec, size_t bytes_per_op = 0) {
+    if (bytes_per_op) {
+        double mb_per_sec = ops_per_sec * bytes_per_op / (1024 * 1024);
+        printf("[ BENCHMARK] %-48s %12.0f ops/s %10.1f MB/s\n", name, ops_per_sec, mb_per_sec);
+    } else {
+        printf("[ BENCHMARK] %-48s %12.0f ops/s\n", name, ops_per_sec);
+    }
+    ::testing::Test::RecordProperty(name, static_cast<int>(ops_per_sec));
+}
+
+}  // namespace test
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_KEYMASTER_BENCHMARK_UTILS_H_
@@ -925,5 +925,304 @@ TEST_F(KeymasterBaseTest, TestCreateKeyId) {
     EXPECT_NE(0U, key_id);
 }
 
+/**
+ * Checks the compiled-policy overloads of AuthorizeOperation against the AuthProxy ones.  Each
+ * path gets its own enforcement object, so that the rate-limit and use-count tables of both see
+ * the same history.
+ */
+class CompiledPolicyTest : public KeymasterBaseTest {
+  protected:
+    CompiledPolicyTest() {
+        memset(&token, 0, sizeof(token));
+        token.version = HW_AUTH_TOKEN_VERSION;
+        token.challenge = 99;
+        token.user_id = 9;
+        token.authenticator_id = 10;
+        token.authenticator_type = hton(static_cast<uint32_t>(HW_AUTH_PASSWORD));
+        token.timestamp = hton(static_cast<uint64_t>(kmen.current_time()));
+
+        token_params.push_back(TAG_AUTH_TOKEN, &token, sizeof(token));
+        nonce_params.push_back(TAG_NONCE, "nonce", 5);
+        nonce_params.push_back(TAG_AUTH_TOKEN, &token, sizeof(token));
+    }
+
+    keymaster_error_t Authorize(const AuthorizationSet& auth_set, keymaster_purpose_t purpose,
+                                const AuthorizationSet& op_params,
+                                keymaster_operation_handle_t op_handle, bool is_begin_operation) {
+        AuthProxy auths(auth_set, empty);
+        KeyEnforcementPolicy policy;
+        EXPECT_EQ(KM_ERROR_OK, KeymasterEnforcement::CompileKeyPolicy(auths, &policy));
+
+        keymaster_error_t expected = kmen.AuthorizeOperation(purpose, key_id, auths, op_params,
+                                                             op_handle, is_begin_operation);
+        keymaster_error_t error = compiled_kmen.AuthorizeOperation(
+            purpose, key_id, policy, op_params, op_handle, is_begin_operation);
+        EXPECT_EQ(expected, error) << "purpose " << purpose << ", op_handle " << op_handle
+                                   << (is_begin_operation ? ", begin" : ", update/finish");
+        return error;
+    }
+
+    // Runs every purpose, with and without a token and a nonce, at begin and afterwards.
+    void ExpectSameResults(const AuthorizationSet& auth_set) {
+        const keymaster_purpose_t purposes[] = {
+            KM_PURPOSE_ENCRYPT,    KM_PURPOSE_DECRYPT, KM_PURPOSE_SIGN,       KM_PURPOSE_VERIFY,
+            KM_PURPOSE_DERIVE_KEY, KM_PURPOSE_WRAP,    KM_PURPOSE_AGREE_KEY,
+        };
+        const AuthorizationSet* op_params[] = {&empty, &token_params, &nonce_params};
+        const keymaster_operation_handle_t op_handles[] = {0, token.challenge, 100};
+
+        for (auto purpose : purposes)
+            for (auto params : op_params)
+                for (auto op_handle : op_handles) {
+                    Authorize(auth_set, purpose, *params, op_handle, true /* begin */);
+                    Authorize(auth_set, purpose, *params, op_handle, false /* begin */);
+                }
+    }
+
+    TestKeymasterEnforcement compiled_kmen;
+    hw_auth_token_t token;
+    AuthorizationSet token_params;
+    AuthorizationSet nonce_params;
+};
+
+TEST_F(CompiledPolicyTest, NoAuthRequired) {
+    ExpectSameResults(AuthorizationSetBuilder()
+                          .Authorization(TAG_ALGORITHM, KM_ALGORITHM_AES)
+                          .Authorization(TAG_PURPOSE, KM_PURPOSE_ENCRYPT)
+                          .Authorization(TAG_PURPOSE, KM_PURPOSE_DECRYPT)
+                          .Authorization(TAG_NO_AUTH_REQUIRED)
+                          .build());
+    ExpectSameResults(AuthorizationSetBuilder()
+                          .Authorization(TAG_ALGORITHM, KM_ALGORITHM_EC)
+                          .Authorization(TAG_PURPOSE, KM_PURPOSE_SIGN)
+                          .Authorization(TAG_PURPOSE, KM_PURPOSE_VERIFY)
+                          .Authorization(TAG_PURPOSE, KM_PURPOSE_AGREE_KEY)
+                          .Authorization(TAG_NO_AUTH_REQUIRED)
+                          .build());
+}
+
+TEST_F(CompiledPolicyTest, LegacyKeyWithoutAuthTags) {
+    AuthorizationSet auth_set(AuthorizationSetBuilder()
+                                  .Authorization(TAG_ALGORITHM, KM_ALGORITHM_RSA)
+                                  .Authorization(TAG_PURPOSE, KM_PURPOSE_DECRYPT)
+                                  .Authorization(TAG_PADDING_OLD, KM_PAD_RSA_OAEP)
+                                  .Authorization(TAG_DIGEST_OLD, KM_DIGEST_SHA_2_256));
+    ExpectSameResults(auth_set);
+}
+
+TEST_F(CompiledPolicyTest, ValidityDates) {
+    const keymaster_tag_t date_tags[] = {
+        KM_TAG_ACTIVE_DATETIME, KM_TAG_ORIGINATION_EXPIRE_DATETIME, KM_TAG_USAGE_EXPIRE_DATETIME,
+    };
+    for (auto tag : date_tags) {
+        AuthorizationSet auth_set(AuthorizationSetBuilder()
+                                      .Authorization(TAG_ALGORITHM, KM_ALGORITHM_RSA)
+                                      .Authorization(TAG_PURPOSE, KM_PURPOSE_SIGN)
+                                      .Authorization(TAG_PURPOSE, KM_PURPOSE_DECRYPT)
+                                      .Authorization(TAG_NO_AUTH_REQUIRED));
+        AuthorizationSet past(auth_set), future(auth_set), both(auth_set);
+        past.push_back(keymaster_param_date(tag, past_time));
+        future.push_back(keymaster_param_date(tag, future_time));
+        both.push_back(keymaster_param_date(tag, past_time));
+        both.push_back(keymaster_param_date(tag, future_time));
+        ExpectSameResults(past);
+        ExpectSameResults(future);
+        ExpectSameResults(both);
+    }
+}
+
+TEST_F(CompiledPolicyTest, RateLimit) {
+    AuthorizationSet auth_set(AuthorizationSetBuilder()
+                                  .Authorization(TAG_ALGORITHM, KM_ALGORITHM_AES)
+                                  .Authorization(TAG_PURPOSE, KM_PURPOSE_ENCRYPT)
+                                  .Authorization(TAG_NO_AUTH_REQUIRED)
+                                  .Authorization(TAG_MIN_SECONDS_BETWEEN_OPS, 10));
+    EXPECT_EQ(KM_ERROR_OK, Authorize(auth_set, KM_PURPOSE_ENCRYPT, empty, 0, true /* begin */));
+    EXPECT_EQ(KM_ERROR_KEY_RATE_LIMIT_EXCEEDED,
+              Authorize(auth_set, KM_PURPOSE_ENCRYPT, empty, 0, true /* begin */));
+    kmen.tick(10);
+    compiled_kmen.tick(10);
+    EXPECT_EQ(KM_ERROR_OK, Authorize(auth_set, KM_PURPOSE_ENCRYPT, empty, 0, true /* begin */));
+    ExpectSameResults(auth_set);
+}
+
+TEST_F(CompiledPolicyTest, MaxUsesPerBoot) {
+    AuthorizationSet auth_set(AuthorizationSetBuilder()
+                                  .Authorization(TAG_ALGORITHM, KM_ALGORITHM_AES)
+                                  .Authorization(TAG_PURPOSE, KM_PURPOSE_ENCRYPT)
+                                  .Authorization(TAG_NO_AUTH_REQUIRED)
+                                  .Authorization(TAG_MAX_USES_PER_BOOT, 3)
+                                  .Authorization(TAG_MAX_USES_PER_BOOT, 2));
+    EXPECT_EQ(KM_ERROR_OK, Authorize(auth_set, KM_PURPOSE_ENCRYPT, empty, 0, true /* begin */));
+    EXPECT_EQ(KM_ERROR_OK, Authorize(auth_set, KM_PURPOSE_ENCRYPT, empty, 0, true /* begin */));
+    EXPECT_EQ(KM_ERROR_KEY_MAX_OPS_EXCEEDED,
+              Authorize(auth_set, KM_PURPOSE_ENCRYPT, empty, 0, true /* begin */));
+    ExpectSameResults(auth_set);
+}
+
+TEST_F(CompiledPolicyTest, AuthPerOp) {
+    AuthorizationSet auth_set(AuthorizationSetBuilder()
+                                  .Authorization(TAG_ALGORITHM, KM_ALGORITHM_HMAC)
+                                  .Authorization(TAG_PURPOSE, KM_PURPOSE_SIGN)
+                                  .Authorization(TAG_USER_SECURE_ID, 8)
+                                  .Authorization(TAG_USER_SECURE_ID, token.user_id)
+                                  .Authorization(TAG_USER_AUTH_TYPE, HW_AUTH_PASSWORD));
+    EXPECT_EQ(KM_ERROR_OK,
+              Authorize(auth_set, KM_PURPOSE_SIGN, token_params, token.challenge, false));
+    EXPECT_EQ(KM_ERROR_KEY_USER_NOT_AUTHENTICATED,
+              Authorize(auth_set, KM_PURPOSE_SIGN, token_params, 100, false));
+    ExpectSameResults(auth_set);
+
+    // The authenticator ID matches as well as the user ID.
+    ExpectSameResults(AuthorizationSetBuilder()
+                          .Authorization(TAG_ALGORITHM, KM_ALGORITHM_HMAC)
+                          .Authorization(TAG_PURPOSE, KM_PURPOSE_SIGN)
+                          .Authorization(TAG_USER_SECURE_ID, token.authenticator_id)
+                          .Authorization(TAG_USER_AUTH_TYPE, HW_AUTH_PASSWORD)
+                          .build());
+
+    // Wrong authenticator type, and none at all.
+    ExpectSameResults(AuthorizationSetBuilder()
+                          .Authorization(TAG_ALGORITHM, KM_ALGORITHM_HMAC)
+                          .Authorization(TAG_PURPOSE, KM_PURPOSE_SIGN)
+                          .Authorization(TAG_USER_SECURE_ID, token.user_id)
+                          .Authorization(TAG_USER_AUTH_TYPE, HW_AUTH_FINGERPRINT)
+                          .build());
+    ExpectSameResults(AuthorizationSetBuilder()
+                          .Authorization(TAG_ALGORITHM, KM_ALGORITHM_HMAC)
+                          .Authorization(TAG_PURPOSE, KM_PURPOSE_SIGN)
+                          .Authorization(TAG_USER_SECURE_ID, token.user_id)
+                          .build());
+
+    kmen.set_report_token_valid(false);
+    compiled_kmen.set_report_token_valid(false);
+    ExpectSameResults(auth_set);
+}
+
+TEST_F(CompiledPolicyTest, TimedAuth) {
+    AuthorizationSet auth_set(AuthorizationSetBuilder()
+                                  .Authorization(TAG_ALGORITHM, KM_ALGORITHM_AES)
+                                  .Authorization(TAG_PURPOSE, KM_PURPOSE_ENCRYPT)
+                                  .Authorization(TAG_PURPOSE, KM_PURPOSE_DECRYPT)
+                                  .Authorization(TAG_USER_SECURE_ID, token.user_id)
+                                  .Authorization(TAG_AUTH_TIMEOUT, 1)
+                                  .Authorization(TAG_USER_AUTH_TYPE, HW_AUTH_ANY));
+    EXPECT_EQ(KM_ERROR_OK, Authorize(auth_set, KM_PURPOSE_DECRYPT, token_params, 0, true));
+    ExpectSameResults(auth_set);
+
+    kmen.tick(2);
+    compiled_kmen.tick(2);
+    EXPECT_EQ(KM_ERROR_KEY_USER_NOT_AUTHENTICATED,
+              Authorize(auth_set, KM_PURPOSE_DECRYPT, token_params, 0, true));
+    ExpectSameResults(auth_set);
+}
+
+TEST_F(CompiledPolicyTest, CallerNonce) {
+    AuthorizationSet auth_set(AuthorizationSetBuilder()
+                                  .Authorization(TAG_ALGORITHM, KM_ALGORITHM_AES)
+                                  .Authorization(TAG_PURPOSE, KM_PURPOSE_ENCRYPT)
+                                  .Authorization(TAG_PURPOSE, KM_PURPOSE_DECRYPT)
+                                  .Authorization(TAG_NO_AUTH_REQUIRED));
+    EXPECT_EQ(KM_ERROR_CALLER_NONCE_PROHIBITED,
+              Authorize(auth_set, KM_PURPOSE_ENCRYPT, nonce_params, 0, true));
+    ExpectSameResults(auth_set);
+
+    auth_set.push_back(TAG_CALLER_NONCE);
+    EXPECT_EQ(KM_ERROR_OK, Authorize(auth_set, KM_PURPOSE_ENCRYPT, nonce_params, 0, true));
+    ExpectSameResults(auth_set);
+}
+
+TEST_F(CompiledPolicyTest, TrustedConfirmation) {
+    ExpectSameResults(AuthorizationSetBuilder()
+                          .Authorization(TAG_ALGORITHM, KM_ALGORITHM_EC)
+                          .Authorization(TAG_PURPOSE, KM_PURPOSE_SIGN)
+                          .Authorization(TAG_NO_AUTH_REQUIRED)
+                          .Authorization(TAG_TRUSTED_CONFIRMATION_REQUIRED)
+                          .build());
+}
+
+TEST_F(CompiledPolicyTest, InvalidKeyBlob) {
+    // Authentication both required and not.
+    ExpectSameResults(AuthorizationSetBuilder()
+                          .Authorization(TAG_ALGORITHM, KM_ALGORITHM_AES)
+                          .Authorization(TAG_PURPOSE, KM_PURPOSE_ENCRYPT)
+                          .Authorization(TAG_USER_SECURE_ID, token.user_id)
+                          .Authorization(TAG_USER_AUTH_TYPE, HW_AUTH_PASSWORD)
+                          .Authorization(TAG_NO_AUTH_REQUIRED)
+                          .build());
+
+    // Tags that never belong in a key's authorizations.
+    ExpectSameResults(AuthorizationSetBuilder()
+                          .Authorization(TAG_ALGORITHM, KM_ALGORITHM_AES)
+                          .Authorization(TAG_PURPOSE, KM_PURPOSE_ENCRYPT)
+                          .Authorization(TAG_NO_AUTH_REQUIRED)
+                          .Authorization(TAG_APPLICATION_DATA, "data", 4)
+                          .build());
+    ExpectSameResults(AuthorizationSetBuilder()
+                          .Authorization(TAG_ALGORITHM, KM_ALGORITHM_EC)
+                          .Authorization(TAG_PURPOSE, KM_PURPOSE_SIGN)
+                          .Authorization(TAG_NO_AUTH_REQUIRED)
+                          .Authorization(TAG_BOOTLOADER_ONLY)
+                          .build());
+}
+
+TEST_F(CompiledPolicyTest, SeveralFailures) {
+    // With more than one reason to refuse the operation the two paths may give different errors,
+    // but both must refuse it.
+    AuthorizationSet auth_set(AuthorizationSetBuilder()
+                                  .Authorization(TAG_ALGORITHM, KM_ALGORITHM_AES)
+                                  .Authorization(TAG_PURPOSE, KM_PURPOSE_ENCRYPT)
+                                  .Authorization(TAG_NO_AUTH_REQUIRED)
+                                  .Authorization(TAG_ORIGINATION_EXPIRE_DATETIME, past_time)
+                                  .Authorization(TAG_BOOTLOADER_ONLY));
+    KeyEnforcementPolicy policy;
+    ASSERT_EQ(KM_ERROR_OK,
+              KeymasterEnforcement::CompileKeyPolicy(AuthProxy(auth_set, empty), &policy));
+    EXPECT_EQ(KM_ERROR_KEY_EXPIRED,
+              kmen.AuthorizeOperation(KM_PURPOSE_ENCRYPT, key_id, AuthProxy(auth_set, empty)));
+    EXPECT_EQ(KM_ERROR_INVALID_KEY_BLOB,
+              compiled_kmen.AuthorizeOperation(KM_PURPOSE_ENCRYPT, key_id, policy, empty,
+                                               0 /* op_handle */, true /* is_begin_operation */));
+}
+
+TEST_F(CompiledPolicyTest, Compile) {
+    AuthorizationSet auth_set(AuthorizationSetBuilder()
+                                  .Authorization(TAG_ALGORITHM, KM_ALGORITHM_RSA)
+                                  .Authorization(TAG_PURPOSE, KM_PURPOSE_SIGN)
+                                  .Authorization(TAG_PURPOSE, KM_PURPOSE_DECRYPT)
+                                  .Authorization(TAG_USER_SECURE_ID, 1)
+                                  .Authorization(TAG_USER_SECURE_ID, 2)
+                                  .Authorization(TAG_USER_AUTH_TYPE, HW_AUTH_FINGERPRINT)
+                                  .Authorization(TAG_AUTH_TIMEOUT, 300)
+                                  .Authorization(TAG_MAX_USES_PER_BOOT, 5)
+                                  .Authorization(TAG_MAX_USES_PER_BOOT, 3));
+    KeyEnforcementPolicy policy;
+    ASSERT_EQ(KM_ERROR_OK,
+              KeymasterEnforcement::CompileKeyPolicy(AuthProxy(auth_set, empty), &policy));
+    EXPECT_TRUE(policy.public_key);
+    EXPECT_TRUE(policy.allows_purpose(KM_PURPOSE_SIGN));
+    EXPECT_TRUE(policy.allows_purpose(KM_PURPOSE_DECRYPT));
+    EXPECT_FALSE(policy.allows_purpose(KM_PURPOSE_ENCRYPT));
+    EXPECT_FALSE(policy.invalid);
+    ASSERT_EQ(2U, policy.user_secure_id_count);
+    EXPECT_EQ(1U, policy.user_secure_ids[0]);
+    EXPECT_EQ(2U, policy.user_secure_ids[1]);
+    EXPECT_TRUE(policy.has_user_auth_type);
+    EXPECT_EQ(static_cast<uint32_t>(HW_AUTH_FINGERPRINT), policy.user_auth_type);
+    EXPECT_TRUE(policy.has_auth_timeout);
+    EXPECT_EQ(300U, policy.auth_timeout);
+    EXPECT_TRUE(policy.has_max_uses_per_boot);
+    EXPECT_EQ(3U, policy.max_uses_per_boot);
+    EXPECT_FALSE(policy.has_min_seconds_between_ops);
+    EXPECT_FALSE(policy.no_auth_required);
+
+    // Compiling again starts over.
+    ASSERT_EQ(KM_ERROR_OK,
+              KeymasterEnforcement::CompileKeyPolicy(AuthProxy(empty, empty), &policy));
+    EXPECT_EQ(0U, policy.purposes);
+    EXPECT_EQ(0U, policy.user_secure_id_count);
+    EXPECT_FALSE(policy.has_max_uses_per_boot);
+}
+
 }; /* namespace test */
 }; /* namespace keymaster */
@@ -127,6 +127,27 @@ TEST(NistCurveKeyExchange, TestInfinity) {
     }
 }
 
+/**
+ * Test that shared groups are created once per curve and match the groups OpenSSL creates.
+ */
+TEST(NistCurveKeyExchange, SharedGroups) {
+    for (auto& curve : kEcCurves) {
+        const EC_GROUP* shared = ec_get_shared_group(curve);
+        ASSERT_TRUE(shared != nullptr);
+        EXPECT_EQ(shared, ec_get_shared_group(curve));
+
+        UniquePtr<EC_GROUP, EC_GROUP_Delete> fresh(ec_get_group(curve));
+        EXPECT_EQ(0, EC_GROUP_cmp(shared, fresh.get(), nullptr /* ctx */));
+
+        UniquePtr<NistCurveKeyExchange> key_exchange(
+            NistCurveKeyExchange::GenerateKeyExchange(curve));
+        ASSERT_TRUE(key_exchange.get() != nullptr);
+        UniquePtr<EC_KEY, EC_KEY_Delete> key(key_exchange->private_key());
+        EXPECT_EQ(0, EC_GROUP_cmp(shared, EC_KEY_get0_group(key.get()), nullptr /* ctx */));
+    }
+    EXPECT_TRUE(ec_get_shared_group(static_cast<keymaster_ec_curve_t>(-1)) == nullptr);
+}
+
 /* Test vectors for P-256, downloaded from NIST. */
 struct NistCurveTest {
     const keymaster_ec_curve_t curve;
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <keymaster/android_keymaster.h>
+#include <keymaster/android_keymaster_messages.h>
+#include <keymaster/android_keymaster_utils.h>
+#include <keymaster/authorization_set.h>
+#include <keymaster/contexts/pure_soft_keymaster_context.h>
+#include <keymaster/contexts/thread_pool.h>
+
+#include "keymaster_benchmark_utils.h"
+
+namespace keymaster {
+namespace test {
+
+static const size_t kMessageSize = 16 * 1024 * 1024;
+
+/**
+ * PureSoftKeymasterContext with a fixed number of concurrent tasks, rather than one per hardware
+ * thread.
+ */
+class FixedConcurrencyContext : public PureSoftKeymasterContext {
+  public:
+    explicit FixedConcurrencyContext(size_t max_concurrent_tasks)
+        : max_concurrent_tasks_(max_concurrent_tasks),
+          thread_pool_(max_concurrent_tasks > 1 ? max_concurrent_tasks - 1 : 1) {}
+
+    void RunTasks(size_t num_tasks, void (*task)(void* task_context, size_t index),
+                  void* task_context) const override {
+        thread_pool_.Run(num_tasks, task, task_context);
+    }
+    size_t max_concurrent_tasks() const override { return max_concurrent_tasks_; }
+
+  private:
+    const size_t max_concurrent_tasks_;
+    mutable ThreadPool thread_pool_;
+};
+
+struct CipherScenario {
+    keymaster_block_mode_t block_mode;
+    size_t max_concurrent_tasks;  // 0 means one per hardware thread.
+};
+
+/**
+ * Times encrypting a kMessageSize message with AES-256 in one Finish, split across up to
+ * |max_concurrent_tasks| threads.
+ */
+class ParallelCipherBenchmark : public testing::TestWithParam<CipherScenario> {
+  protected:
+    void SetUp() override {
+        concurrency_ = GetParam().max_concurrent_tasks;
+        if (!concurrency_)
+            concurrency_ = std::max(1U, std::thread::hardware_concurrency());
+        keymaster_.reset(new AndroidKeymaster(new FixedConcurrencyContext(concurrency_), 16));
+
+        ConfigureRequest configure_req;
+        configure_req.os_version = 80000;
+        configure_req.os_patchlevel = 201801;
+        ConfigureResponse configure_rsp;
+        keymaster_->Configure(configure_req, &configure_rsp);
+        ASSERT_EQ(KM_ERROR_OK, configure_rsp.error);
+
+        GenerateKeyRequest req;
+        req.key_description = AuthorizationSetBuilder()
+                                  .AesEncryptionKey(256)
+                                  .BlockMode(GetParam().block_mode)
+                                  .Padding(KM_PAD_NONE)
+                                  .Authorization(TAG_CALLER_NONCE)
+                                  .Authorization(TAG_MIN_MAC_LENGTH, 128)
+                                  .build();
+        GenerateKeyResponse rsp;
+        keymaster_->GenerateKey(req, &rsp);
+        ASSERT_EQ(KM_ERROR_OK, rsp.error);
+        key_blob_ = KeymasterKeyBlob(rsp.key_blob);
+
+        message_.Reinitialize(kMessageSize);
+        memset(message_.peek_write(), 'x', kMessageSize);
+        message_.advance_write(kMessageSize);
+    }
+
+    bool Encrypt() {
+        AuthorizationSetBuilder params;
+        params.BlockMode(GetParam().block_mode).Padding(KM_PAD_NONE);
+        if (GetParam().block_mode == KM_MODE_GCM)
+            params.Authorization(TAG_NONCE, "0123456789ab", 12).Authorization(TAG_MAC_LENGTH, 128);
+        else
+            params.Authorization(TAG_NONCE, "0123456789abcdef", 16);
+
+        BeginOperationRequest begin_req;
+        begin_req.purpose = KM_PURPOSE_ENCRYPT;
+        begin_req.SetKeyMaterial(key_blob_);
+        begin_req.additional_params = params.build();
+        BeginOperationResponse begin_rsp;
+        keymaster_->BeginOperation(begin_req, &begin_rsp);
+        if (begin_rsp.error != KM_ERROR_OK)
+            return false;
+
+        FinishOperationRequest req;
+        req.op_handle = begin_rsp.op_handle;
+        req.input.Reinitialize(message_);
+        FinishOperationResponse rsp;
+        keymaster_->FinishOperation(req, &rsp);
+        return rsp.error == KM_ERROR_OK && rsp.output.available_read() >= kMessageSize;
+    }
+
+    std::string Name() const {
+        return std::string(GetParam().block_mode == KM_MODE_GCM ? "AES-256-GCM" : "AES-256-CTR") +
+               " encrypt 16 MiB, " + std::to_string(concurrency_) + " threads";
+    }
+
+    size_t concurrency_;
+    UniquePtr<AndroidKeymaster> keymaster_;
+    KeymasterKeyBlob key_blob_;
+    Buffer message_;
+};
+
+TEST_P(ParallelCipherBenchmark, Encrypt) {
+    double rate = MeasureOpsPerSecond([&]() { return Encrypt(); });
+    EXPECT_GT(rate, 0);
+    ReportRate(Name().c_str(), rate, kMessageSize);
+}
+
+static const CipherScenario kScenarios[] = {
+    {KM_MODE_CTR, 1}, {KM_MODE_CTR, 2}, {KM_MODE_CTR, 4}, {KM_MODE_CTR, 0},
+    {KM_MODE_GCM, 1}, {KM_MODE_GCM, 2}, {KM_MODE_GCM, 4}, {KM_MODE_GCM, 0},
+};
+
+INSTANTIATE_TEST_CASE_P(ModesAndThreads, ParallelCipherBenchmark, testing::ValuesIn(kScenarios));
+
+}  // namespace test
+}  // namespace keymaster
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <keymaster/km_openssl/drbg_random_source.h>
+#include <keymaster/km_openssl/software_random_source.h>
+
+#include "keymaster_benchmark_utils.h"
+
+namespace keymaster {
+namespace test {
+
+struct RandomDraw {
+    const char* name;
+    size_t length;
+    size_t threads;
+};
+
+/**
+ * Compares drawing the small amounts of randomness keymaster needs from RAND_bytes directly and
+ * from the buffered per-thread DRBG.
+ */
+class RandomSourceBenchmark : public testing::TestWithParam<RandomDraw> {
+  protected:
+    double Measure(const RandomSource& random_source) const {
+        const size_t length = GetParam().length;
+        return MeasureParallelOpsPerSecond(GetParam().threads, [&](size_t /* thread */) {
+            uint8_t buf[64];
+            return random_source.GenerateRandom(buf, length) == KM_ERROR_OK;
+        });
+    }
+
+    std::string Name(const char* source) const {
+        return std::string(GetParam().name) + ", " + std::to_string(GetParam().threads) +
+               " threads, " + source;
+    }
+};
+
+TEST_P(RandomSourceBenchmark, GenerateRandom) {
+    SoftwareRandomSource rand_bytes;
+    DrbgRandomSource drbg;
+    double rand_bytes_rate = Measure(rand_bytes);
+    double drbg_rate = Measure(drbg);
+    EXPECT_GT(rand_bytes_rate, 0);
+    EXPECT_GT(drbg_rate, 0);
+    ReportRate(Name("RAND_bytes").c_str(), rand_bytes_rate, GetParam().length);
+    ReportRate(Name("DRBG").c_str(), drbg_rate, GetParam().length);
+}
+
+static const RandomDraw kDraws[] = {
+    {"operation handle", 8, 1},  {"operation handle", 8, 8}, {"GCM nonce", 12, 1},
+    {"CBC/CTR IV", 16, 1},       {"CBC/CTR IV", 16, 8},      {"AES-256 key", 32, 1},
+};
+
+INSTANTIATE_TEST_CASE_P(Draws, RandomSourceBenchmark, testing::ValuesIn(kDraws));
+
+}  // namespace test
+}  // namespace keymaster